@@ -0,0 +1,271 @@
+#include "band_io.h"
+#include "histogram.h"
+#include "image_io.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+namespace {
+
+const size_t kNetpbmHeaderLimit = 4096;
+
+// Unpadded bytes of `rows` rows over all channels.
+size_t planeBytes(int width, int rows, int channels) {
+    return static_cast<size_t>(width) * rows * channels;
+}
+
+// Skips whitespace and '#' comments, then reads a decimal number.
+bool readNetpbmNumber(const unsigned char*& p, const unsigned char* end, int& value) {
+    while (p < end) {
+        if (*p == '#') {
+            while (p < end && *p != '\n') ++p;
+        } else if (std::isspace(*p)) {
+            ++p;
+        } else {
+            break;
+        }
+    }
+    if (p == end || !std::isdigit(*p)) return false;
+
+    long number = 0;
+    while (p < end && std::isdigit(*p)) {
+        number = number * 10 + (*p++ - '0');
+        if (number > (1 << 30)) return false;
+    }
+    value = static_cast<int>(number);
+    return true;
+}
+
+}
+
+RleBandSource::RleBandSource() : chunkHeight(0), chunkFirst(0), chunkRows(0) {}
+
+bool RleBandSource::open(const std::string& filename) {
+    path = filename;
+    chunkFirst = chunkRows = 0;
+    if (!decoder.open(path)) return false;
+
+    width = decoder.getWidth();
+    height = decoder.getHeight();
+    channels = decoder.getChannels();
+    chunkHeight = decoder.bandRows();
+    return true;
+}
+
+bool RleBandSource::read(PlanarImage& dst, int dstRow, int rows) {
+    if (dst.getWidth() != width || dst.getChannels() != channels || dstRow < 0 || dstRow + rows > dst.getHeight()) {
+        return false;
+    }
+
+    while (rows > 0) {
+        if (chunkRows > 0) {
+            int n = std::min(rows, chunkRows);
+            for (int c = 0; c < channels; ++c) {
+                for (int i = 0; i < n; ++i) std::memcpy(dst.row(c, dstRow + i), chunk.row(c, chunkFirst + i), width);
+            }
+            chunkFirst += n;
+            chunkRows -= n;
+            dstRow += n;
+            rows -= n;
+            continue;
+        }
+
+        int band = decoder.bandRows();
+        if (band <= 0) return false;
+        if (rows >= band) {
+            // Whole chunks are decoded straight into the destination.
+            if (!decoder.readBand(dst, dstRow)) return false;
+            dstRow += band;
+            rows -= band;
+        } else {
+            try {
+                chunk.allocate(width, band, channels);
+            }
+            catch (const std::bad_alloc&) {
+                return false;
+            }
+            if (!decoder.readBand(chunk, 0)) return false;
+            chunkFirst = 0;
+            chunkRows = band;
+        }
+    }
+    return true;
+}
+
+bool RleBandSource::rewind() {
+    std::string reopen = path;
+    return open(reopen);
+}
+
+size_t RleBandSource::bufferBytes() const {
+    // Stream buffer, one payload and the partial-chunk band.
+    return kRleStreamBufferSize + 2 * planeBytes(width, chunkHeight, channels);
+}
+
+NetpbmBandSource::NetpbmBandSource() : dataOffset(0), samples(3) {}
+
+bool NetpbmBandSource::open(const std::string& path) {
+    if (!reader.open(path)) return false;
+
+    unsigned char header[kNetpbmHeaderLimit];
+    size_t size = reader.readSome(header, sizeof(header));
+    const unsigned char* p = header;
+    const unsigned char* end = header + size;
+    if (size < 2 || p[0] != 'P' || (p[1] != '5' && p[1] != '6')) return false;
+    samples = p[1] == '6' ? 3 : 1;
+    p += 2;
+
+    int maxValue;
+    if (!readNetpbmNumber(p, end, width) || !readNetpbmNumber(p, end, height) ||
+        !readNetpbmNumber(p, end, maxValue)) {
+        return false;
+    }
+    // Exactly one whitespace byte separates the header from the raster.
+    if (width <= 0 || height <= 0 || maxValue != 255 || p == end || !std::isspace(*p)) return false;
+    channels = 3;
+    dataOffset = static_cast<uint64_t>(p + 1 - header);
+    row.resize(static_cast<size_t>(width) * samples);
+    return reader.seek(dataOffset);
+}
+
+bool NetpbmBandSource::read(PlanarImage& dst, int dstRow, int rows) {
+    if (dst.getWidth() != width || dst.getChannels() < 3 || dstRow < 0 || dstRow + rows > dst.getHeight()) {
+        return false;
+    }
+
+    for (int y = dstRow; y < dstRow + rows; ++y) {
+        if (!reader.read(row.data(), row.size())) return false;
+        unsigned char* r = dst.row(0, y);
+        unsigned char* g = dst.row(1, y);
+        unsigned char* b = dst.row(2, y);
+        if (samples == 1) {
+            std::memcpy(r, row.data(), width);
+            std::memcpy(g, row.data(), width);
+            std::memcpy(b, row.data(), width);
+        } else {
+            const unsigned char* src = row.data();
+            for (int x = 0; x < width; ++x) {
+                r[x] = src[3 * x];
+                g[x] = src[3 * x + 1];
+                b[x] = src[3 * x + 2];
+            }
+        }
+    }
+    return true;
+}
+
+bool NetpbmBandSource::rewind() {
+    return reader.seek(dataOffset);
+}
+
+size_t NetpbmBandSource::bufferBytes() const {
+    return kRleStreamBufferSize + row.size();
+}
+
+RleBandSink::RleBandSink() : chunkBytes(0) {}
+
+bool RleBandSink::open(const std::string& path, int width, int height, int channels, int rowsPerChunk) {
+    chunkBytes = planeBytes(width, std::min(height, rowsPerChunk), channels);
+    return encoder.open(path, width, height, channels, rowsPerChunk);
+}
+
+bool RleBandSink::write(const PlanarImage& src, int srcRow, int rows) {
+    return encoder.writeRows(src, srcRow, rows);
+}
+
+bool RleBandSink::close() {
+    return encoder.close();
+}
+
+size_t RleBandSink::bufferBytes() const {
+    // Stream buffer, the partial-chunk band, and scratch plus output for
+    // every chunk of a parallel batch.
+    return kRleStreamBufferSize + chunkBytes + 4 * chunkBytes * hardwareThreads();
+}
+
+NetpbmBandSink::NetpbmBandSink() : width(0), height(0), rowsWritten(0), gray(false) {}
+
+bool NetpbmBandSink::open(const std::string& path, int imageWidth, int imageHeight, bool grayOutput) {
+    width = imageWidth;
+    height = imageHeight;
+    gray = grayOutput;
+    rowsWritten = 0;
+    row.resize(static_cast<size_t>(width) * (gray ? 1 : 3));
+    if (!writer.open(path)) return false;
+
+    char header[64];
+    int size = std::snprintf(header, sizeof(header), "P%c\n%d %d\n255\n", gray ? '5' : '6', width, height);
+    return writer.write(header, size);
+}
+
+bool NetpbmBandSink::write(const PlanarImage& src, int srcRow, int rows) {
+    if (src.getWidth() != width || src.getChannels() < 3 || srcRow < 0 || srcRow + rows > src.getHeight() ||
+        rowsWritten + rows > height) {
+        return false;
+    }
+
+    for (int y = srcRow; y < srcRow + rows; ++y) {
+        const unsigned char* r = src.row(0, y);
+        const unsigned char* g = src.row(1, y);
+        const unsigned char* b = src.row(2, y);
+        if (gray) {
+            for (int x = 0; x < width; ++x) {
+                row[x] = static_cast<unsigned char>(lumaOf(r[x], g[x], b[x]));
+            }
+        } else {
+            for (int x = 0; x < width; ++x) {
+                row[3 * x] = r[x];
+                row[3 * x + 1] = g[x];
+                row[3 * x + 2] = b[x];
+            }
+        }
+        if (!writer.write(row.data(), row.size())) return false;
+    }
+    rowsWritten += rows;
+    return true;
+}
+
+bool NetpbmBandSink::close() {
+    bool complete = rowsWritten == height;
+    return writer.close() && complete;
+}
+
+size_t NetpbmBandSink::bufferBytes() const {
+    return kRleStreamBufferSize + row.size();
+}
+
+bool isBandFileSupported(const std::string& path) {
+    std::string extension = fileExtension(path);
+    return extension == ".rle" || extension == ".ppm" || extension == ".pgm";
+}
+
+std::unique_ptr<BandSource> openBandSource(const std::string& path) {
+    std::string extension = fileExtension(path);
+    if (extension == ".rle") {
+        RleBandSource* source = new RleBandSource();
+        std::unique_ptr<BandSource> owned(source);
+        if (source->open(path)) return owned;
+    } else if (extension == ".ppm" || extension == ".pgm") {
+        NetpbmBandSource* source = new NetpbmBandSource();
+        std::unique_ptr<BandSource> owned(source);
+        if (source->open(path)) return owned;
+    }
+    return nullptr;
+}
+
+std::unique_ptr<BandSink> createBandSink(const std::string& path, int width, int height, int channels) {
+    std::string extension = fileExtension(path);
+    if (extension == ".rle") {
+        RleBandSink* sink = new RleBandSink();
+        std::unique_ptr<BandSink> owned(sink);
+        if (sink->open(path, width, height, channels)) return owned;
+    } else if (extension == ".ppm" || extension == ".pgm") {
+        NetpbmBandSink* sink = new NetpbmBandSink();
+        std::unique_ptr<BandSink> owned(sink);
+        if (sink->open(path, width, height, extension == ".pgm")) return owned;
+    }
+    return nullptr;
+}
@@ -0,0 +1,117 @@
+#ifndef BAND_IO_H
+#define BAND_IO_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "planar_image.h"
+#include "rle_stream.h"
+
+// Row-band access to image files, for images too large to hold in memory.
+// Sources deliver rows top to bottom and sinks take them in the same order;
+// neither keeps more than a fixed buffer (plus one RLE chunk) of the image.
+
+class BandSource {
+public:
+    virtual ~BandSource() {}
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getChannels() const { return channels; }
+
+    // Reads the next rows into rows [dstRow, dstRow + rows) of dst, which
+    // must have the source's width and channel count.
+    virtual bool read(PlanarImage& dst, int dstRow, int rows) = 0;
+    // Starts over at the first row, for a second pass.
+    virtual bool rewind() = 0;
+    // Memory held by the source, for budgeting.
+    virtual size_t bufferBytes() const = 0;
+
+protected:
+    BandSource() : width(0), height(0), channels(0) {}
+
+    int width, height, channels;
+};
+
+class BandSink {
+public:
+    virtual ~BandSink() {}
+
+    // Appends rows [srcRow, srcRow + rows) of src.
+    virtual bool write(const PlanarImage& src, int srcRow, int rows) = 0;
+    // False if any write failed or the image is incomplete.
+    virtual bool close() = 0;
+    virtual size_t bufferBytes() const = 0;
+};
+
+// RLE files (v2 or legacy v1). Rows come chunk by chunk from RleStreamDecoder;
+// a request that ends inside a chunk leaves the rest of it buffered.
+class RleBandSource : public BandSource {
+public:
+    RleBandSource();
+    bool open(const std::string& path);
+    bool read(PlanarImage& dst, int dstRow, int rows) override;
+    bool rewind() override;
+    size_t bufferBytes() const override;
+
+private:
+    std::string path;
+    RleStreamDecoder decoder;
+    PlanarImage chunk;
+    int chunkHeight, chunkFirst, chunkRows;
+};
+
+// Binary netpbm (P6, or P5 read as RGB). The header must fit in its first 4 KiB.
+class NetpbmBandSource : public BandSource {
+public:
+    NetpbmBandSource();
+    bool open(const std::string& path);
+    bool read(PlanarImage& dst, int dstRow, int rows) override;
+    bool rewind() override;
+    size_t bufferBytes() const override;
+
+private:
+    BufferedFileReader reader;
+    uint64_t dataOffset;
+    int samples;
+    std::vector<unsigned char> row;
+};
+
+class RleBandSink : public BandSink {
+public:
+    RleBandSink();
+    bool open(const std::string& path, int width, int height, int channels,
+              int rowsPerChunk = kRleDefaultRowsPerChunk);
+    bool write(const PlanarImage& src, int srcRow, int rows) override;
+    bool close() override;
+    size_t bufferBytes() const override;
+
+private:
+    RleStreamEncoder encoder;
+    size_t chunkBytes;
+};
+
+// P6, or P5 holding the luma (gray); alpha is dropped.
+class NetpbmBandSink : public BandSink {
+public:
+    NetpbmBandSink();
+    bool open(const std::string& path, int width, int height, bool gray);
+    bool write(const PlanarImage& src, int srcRow, int rows) override;
+    bool close() override;
+    size_t bufferBytes() const override;
+
+private:
+    BufferedFileWriter writer;
+    int width, height, rowsWritten;
+    bool gray;
+    std::vector<unsigned char> row;
+};
+
+// By extension: .rle, .ppm and .pgm. Null if the format cannot be streamed
+// or the file cannot be opened.
+bool isBandFileSupported(const std::string& path);
+std::unique_ptr<BandSource> openBandSource(const std::string& path);
+std::unique_ptr<BandSink> createBandSink(const std::string& path, int width, int height, int channels);
+
+#endif // BAND_IO_H
@@ -0,0 +1,112 @@
+// Lossless codecs on real images: RLE v2 vs. the predictive codec, ratio and
+// MB/s of raw pixels for encoding and decoding. Reads any format image_io.h
+// knows; with no arguments, every image in ../image.
+#include "image_io.h"
+#include "predictive_codec.h"
+#include "rle_codec.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+double timeMs(const std::function<void()>& fn, int repeats) {
+    double best = 1e30;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+bool sameImage(const PlanarImage& a, const PlanarImage& b) {
+    if (!a.sameGeometry(b)) return false;
+    for (int c = 0; c < a.getChannels(); ++c) {
+        for (int y = 0; y < a.getHeight(); ++y) {
+            if (std::memcmp(a.row(c, y), b.row(c, y), a.getWidth()) != 0) return false;
+        }
+    }
+    return true;
+}
+
+struct Result {
+    size_t bytes;
+    double encodeMs, decodeMs;
+    bool lossless;
+};
+
+Result measure(const PlanarImage& image,
+               const std::function<std::vector<unsigned char>(const PlanarImage&)>& encode,
+               const std::function<bool(const std::vector<unsigned char>&, PlanarImage&)>& decode) {
+    Result result;
+    std::vector<unsigned char> encoded;
+    PlanarImage decoded;
+    result.encodeMs = timeMs([&]() { encoded = encode(image); }, 5);
+    result.decodeMs = timeMs([&]() { decode(encoded, decoded); }, 5);
+    result.bytes = encoded.size();
+    result.lossless = sameImage(image, decoded);
+    return result;
+}
+
+std::vector<std::string> listImages(const std::string& directory) {
+    std::vector<std::string> paths;
+    if (DIR* dir = opendir(directory.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (isImageFileSupported(name)) {
+                paths.push_back(directory + "/" + name);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> paths(argv + 1, argv + argc);
+    if (paths.empty()) paths = listImages("image");
+    if (paths.empty()) paths = listImages("../image");
+    if (paths.empty()) {
+        std::printf("usage: %s image...\n", argv[0]);
+        return 1;
+    }
+
+    std::printf("%-16s %11s | %7s %9s %9s | %7s %9s %9s\n", "", "", "RLE", "enc", "dec", "LPC", "enc", "dec");
+    std::printf("%-16s %11s | %7s %9s %9s | %7s %9s %9s\n", "image", "size", "ratio", "MB/s", "MB/s", "ratio", "MB/s", "MB/s");
+    for (const std::string& path : paths) {
+        PlanarImage image;
+        if (!readImageFile(path, image)) {
+            std::printf("%s: cannot read\n", path.c_str());
+            continue;
+        }
+
+        double raw = static_cast<double>(image.getWidth()) * image.getHeight() * image.getChannels();
+        Result rle = measure(image, [](const PlanarImage& im) { return encodeRle(im); },
+                             [](const std::vector<unsigned char>& e, PlanarImage& out) {
+                                 return decodeRle(e.data(), e.size(), out);
+                             });
+        Result lpc = measure(image, [](const PlanarImage& im) { return encodePredictive(im); },
+                             [](const std::vector<unsigned char>& e, PlanarImage& out) {
+                                 return decodePredictive(e.data(), e.size(), out);
+                             });
+
+        std::string name = path.substr(path.find_last_of('/') + 1);
+        char size[32];
+        std::snprintf(size, sizeof(size), "%dx%dx%d", image.getWidth(), image.getHeight(), image.getChannels());
+        std::printf("%-16s %11s | %7.2f %9.1f %9.1f | %7.2f %9.1f %9.1f%s\n", name.c_str(), size,
+                    raw / rle.bytes, raw / 1e3 / rle.encodeMs, raw / 1e3 / rle.decodeMs,
+                    raw / lpc.bytes, raw / 1e3 / lpc.encodeMs, raw / 1e3 / lpc.decodeMs,
+                    rle.lossless && lpc.lossless ? "" : "  MISMATCH");
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Compares brightness-only equalization paths on a synthetic photo-like image:
+// the luma-ratio rescaling used so far, fused HSV V / HLS L equalization, and
+// the unfused HSV round trip through full-image H, S, V planes.
+#include "color_kernels.h"
+#include "histogram.h"
+#include "tone_lut.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace {
+
+PlanarImage makeTestImage(int width, int height) {
+    PlanarImage image(width, height, 3);
+    unsigned seed = 12345;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            seed = seed * 1103515245u + 12345u;
+            int noise = static_cast<int>((seed >> 16) & 15) - 8;
+            int base = 40 + 120 * x / width + 60 * y / height;
+            image.row(0, y)[x] = static_cast<unsigned char>(std::max(0, std::min(255, base + noise)));
+            image.row(1, y)[x] = static_cast<unsigned char>(std::max(0, std::min(255, base / 2 + noise)));
+            image.row(2, y)[x] = static_cast<unsigned char>(std::max(0, std::min(255, 200 - base / 2 + noise)));
+        }
+    }
+    return image;
+}
+
+double timeMs(const std::function<void()>& fn, int repeats) {
+    fn();
+    double best = 1e30;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+int maxAbsDiff(const PlanarImage& a, const PlanarImage& b) {
+    int worst = 0;
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < a.getHeight(); ++y) {
+            for (int x = 0; x < a.getWidth(); ++x) {
+                worst = std::max(worst, std::abs(a.row(c, y)[x] - b.row(c, y)[x]));
+            }
+        }
+    }
+    return worst;
+}
+
+// Mean hue change in degrees over chromatic pixels, sampled every 4th row.
+double meanHueShift(const PlanarImage& before, const PlanarImage& after) {
+    int width = before.getWidth();
+    std::vector<float> h0(width), s0(width), v0(width), h1(width), s1(width), v1(width);
+    double total = 0;
+    long count = 0;
+    for (int y = 0; y < before.getHeight(); y += 4) {
+        rgbToHsvRow(before.row(0, y), before.row(1, y), before.row(2, y), h0.data(), s0.data(), v0.data(), width);
+        rgbToHsvRow(after.row(0, y), after.row(1, y), after.row(2, y), h1.data(), s1.data(), v1.data(), width);
+        for (int x = 0; x < width; ++x) {
+            if (s0[x] < 10 || s1[x] < 10) continue;
+            double d = std::fabs(h0[x] - h1[x]);
+            total += std::min(d, 360 - d);
+            ++count;
+        }
+    }
+    return count ? total / count : 0.0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int width = argc > 1 ? std::atoi(argv[1]) : 6000;
+    int height = argc > 2 ? std::atoi(argv[2]) : 4000;
+    int repeats = argc > 3 ? std::atoi(argv[3]) : 5;
+
+    PlanarImage source = makeTestImage(width, height);
+    PlanarImage luma, value, lightness, reference;
+
+    double lumaMs = timeMs([&]() {
+        TonePipeline pipeline;
+        pipeline.add(makeLumaEqualizationStage(computeLumaHistogram(source)));
+        pipeline.apply(source, luma);
+    }, repeats);
+    double valueMs = timeMs([&]() { equalizeValue(source, value); }, repeats);
+    double lightnessMs = timeMs([&]() { equalizeLightness(source, lightness); }, repeats);
+    double referenceMs = timeMs([&]() { equalizeValueReference(source, reference); }, repeats);
+
+    double mp = width * static_cast<double>(height) / 1e6;
+    std::printf("%dx%d (%.1f MP), best of %d\n", width, height, mp, repeats);
+    std::printf("%-28s %9.2f ms %8.1f MP/s  mean hue shift %.2f deg\n", "luma ratio (current)", lumaMs, mp / lumaMs * 1e3, meanHueShift(source, luma));
+    std::printf("%-28s %9.2f ms %8.1f MP/s  mean hue shift %.2f deg\n", "HSV V fused", valueMs, mp / valueMs * 1e3, meanHueShift(source, value));
+    std::printf("%-28s %9.2f ms %8.1f MP/s  mean hue shift %.2f deg\n", "HLS L fused", lightnessMs, mp / lightnessMs * 1e3, meanHueShift(source, lightness));
+    std::printf("%-28s %9.2f ms %8.1f MP/s\n", "HSV V via H/S/V planes", referenceMs, mp / referenceMs * 1e3);
+    std::printf("max |fused - reference| for HSV V: %d\n", maxAbsDiff(value, reference));
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Median filter cost against radius. The histogram-based filter should stay
+// flat as the window grows; the sort-based baseline (nth_element over the
+// window, radius <= 3 only) shows the quadratic growth it replaces.
+#include "filters.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace {
+
+PlanarImage makeTestImage(int width, int height) {
+    PlanarImage image(width, height, 3);
+    unsigned seed = 12345;
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                seed = seed * 1103515245u + 12345u;
+                int noise = static_cast<int>((seed >> 16) & 31) - 16;
+                int base = 40 + 120 * x / width + 60 * y / height + 20 * c;
+                image.row(c, y)[x] = static_cast<unsigned char>(std::max(0, std::min(255, base + noise)));
+            }
+        }
+    }
+    return image;
+}
+
+double timeMs(const std::function<void()>& fn, int repeats) {
+    fn();
+    double best = 1e30;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+void sortMedian(const PlanarImage& src, PlanarImage& dst, int radius) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    dst.allocate(width, height, src.getChannels());
+    std::vector<uint8_t> window;
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                window.clear();
+                for (int dy = -radius; dy <= radius; ++dy) {
+                    const uint8_t* in = src.row(c, borderIndex(y + dy, height, BorderMode::Clamp));
+                    for (int dx = -radius; dx <= radius; ++dx) {
+                        window.push_back(in[borderIndex(x + dx, width, BorderMode::Clamp)]);
+                    }
+                }
+                std::nth_element(window.begin(), window.begin() + window.size() / 2, window.end());
+                dst.row(c, y)[x] = window[window.size() / 2];
+            }
+        }
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    int width = argc > 1 ? std::atoi(argv[1]) : 3000;
+    int height = argc > 2 ? std::atoi(argv[2]) : 2000;
+    int repeats = argc > 3 ? std::atoi(argv[3]) : 3;
+
+    PlanarImage source = makeTestImage(width, height);
+    PlanarImage result, reference;
+
+    double mp = width * static_cast<double>(height) / 1e6;
+    std::printf("%dx%d (%.1f MP), 3 channels, best of %d\n", width, height, mp, repeats);
+    std::printf("%6s %12s %10s %12s\n", "radius", "median ms", "MP/s", "sort ms");
+    const int radii[] = {1, 2, 3, 5, 10, 20, 30, 40, 50};
+    for (int radius : radii) {
+        double ms = timeMs([&]() { medianFilter(source, result, radius, BorderMode::Clamp); }, repeats);
+        if (radius <= 3) {
+            double sortMs = timeMs([&]() { sortMedian(source, reference, radius); }, 1);
+            bool same = true;
+            for (int c = 0; c < 3 && same; ++c) {
+                for (int y = 0; y < height && same; ++y) {
+                    same = std::equal(result.row(c, y), result.row(c, y) + width, reference.row(c, y));
+                }
+            }
+            std::printf("%6d %12.2f %10.1f %12.2f%s\n", radius, ms, mp / ms * 1e3, sortMs, same ? "" : "  MISMATCH");
+        } else {
+            std::printf("%6d %12.2f %10.1f %12s\n", radius, ms, mp / ms * 1e3, "-");
+        }
+    }
+    return 0;
+}
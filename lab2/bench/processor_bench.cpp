@@ -0,0 +1,345 @@
+// Every ImageProcessor operation over a matrix of image sizes, kernel sizes
+// and thread counts, with median and 95th percentile wall time, MP/s and
+// bytes moved per pixel. A table goes to stdout, the results to a JSON file
+// with one case per line:
+//
+//   ProcessorBench [--sizes 0.3,1,4,16,50,100] [--threads 1,N] [--repeats 7]
+//                  [--ops median,gaussian] [--out processor_bench.json]
+//                  [--baseline old.json] [--tolerance 0.1]
+//
+// With --baseline, every case is compared with the same case (operation,
+// parameters, size and threads) in a file written earlier by this tool;
+// cases whose median is more than the tolerance slower are flagged and the
+// exit status is 1.
+//
+// Bytes per pixel is a model, not a measurement: the planes each operation
+// reads and writes in its passes over the image, plus the undo snapshot of
+// the result (read it, write the copy). MP/s times bytes per pixel is the
+// bandwidth an operation sustains; the copy case shows what the machine can
+// stream.
+//
+// Allocations counts the blocks the buffer pool had to allocate per timed
+// run; once the warm-up run has seen every size it should be 0.
+#include "buffer_pool.h"
+#include "image_processor.h"
+#include "parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int kChannels = 3;
+
+struct Case {
+    std::string op, params;
+    // Planes read plus planes written, without the undo snapshot.
+    int planes;
+    bool snapshot;
+    // Larger images are skipped (the sliding-window CLAHE is minutes there).
+    double maxMegapixels;
+    std::function<void(ImageProcessor&)> run;
+};
+
+struct EncodedImage {
+    std::vector<unsigned char> data;
+    int width = 0, height = 0;
+};
+
+struct Result {
+    std::string op, params;
+    int width, height, threads;
+    double medianMs, p95Ms, megapixelsPerSecond, bytesPerPixel, allocations;
+};
+
+std::vector<Case> makeCases() {
+    const int c = kChannels;
+    std::vector<Case> cases;
+    // Stands in for the memcpy the undo snapshot and every copy make.
+    std::shared_ptr<PlanarImage> copy = std::make_shared<PlanarImage>();
+    cases.push_back({"copy", "", 2 * c, false, 1e9, [copy](ImageProcessor& p) { copy->copyFrom(p.getFiltered()); }});
+    for (int k : {3, 7, 15}) {
+        cases.push_back({"lowpass", "k=" + std::to_string(k), 2 * c, true, 1e9,
+                         [k](ImageProcessor& p) { p.applyLowPassFilter(k, BorderMode::Reflect); }});
+    }
+    for (int k : {3, 7, 15}) {
+        cases.push_back({"gaussian", "k=" + std::to_string(k), 2 * c, true, 1e9,
+                         [k](ImageProcessor& p) { p.applyGaussianFilter(k, k / 6.0, BorderMode::Reflect); }});
+    }
+    for (int r : {1, 5, 20}) {
+        cases.push_back({"median", "r=" + std::to_string(r), 2 * c, true, 1e9,
+                         [r](ImageProcessor& p) { p.applyMedianFilter(r, BorderMode::Reflect); }});
+    }
+    for (int s : {4, 16}) {
+        cases.push_back({"bilateral", "s=" + std::to_string(s), 3 * c, true, 1e9,
+                         [s](ImageProcessor& p) { p.applyBilateralFilter(s, 30); }});
+    }
+    for (int k : {3, 15}) {
+        cases.push_back({"open", "k=" + std::to_string(k), 8 * c, true, 1e9,
+                         [k](ImageProcessor& p) { p.applyMorphology(MorphologyOp::Open, k, k); }});
+        cases.push_back({"open-binary", "k=" + std::to_string(k), 8 * c, true, 1e9,
+                         [k](ImageProcessor& p) { p.applyMorphology(MorphologyOp::Open, k, k, true); }});
+    }
+    cases.push_back({"edges", "", 2 * c + 2, true, 1e9, [](ImageProcessor& p) { p.applyEdgeDetection(50, 150); }});
+    const char* modes[] = {"rgb", "luma", "hsv", "hls"};
+    for (int mode = 0; mode < 4; ++mode) {
+        cases.push_back({"equalize", modes[mode], 3 * c, true, 1e9,
+                         [mode](ImageProcessor& p) { p.applyHistogramEqualization(mode); }});
+    }
+    cases.push_back({"contrast", "", 3 * c, true, 1e9, [](ImageProcessor& p) { p.applyLinearContrast(20, 230); }});
+    cases.push_back({"clahe", "tiles=8", 3 * c + 4, true, 1e9, [](ImageProcessor& p) { p.applyCLAHE(8, 2.0); }});
+    cases.push_back({"clahe-sliding", "tiles=8", 3 * c + 4, true, 4.0,
+                     [](ImageProcessor& p) { p.applyCLAHE(8, 2.0, true); }});
+    cases.push_back({"rle-encode", "", 2 * c, false, 1e9, [](ImageProcessor& p) { p.encodeRLE(); }});
+    // Decodes the processed image's own encoding (so the image stays the
+    // same), made in the untimed first run at every size.
+    std::shared_ptr<EncodedImage> encoded = std::make_shared<EncodedImage>();
+    cases.push_back({"rle-decode", "", 2 * c, false, 1e9, [encoded](ImageProcessor& p) {
+        const PlanarImage& image = p.getFiltered();
+        if (encoded->width != image.getWidth() || encoded->height != image.getHeight()) {
+            encoded->data = p.encodeRLE();
+            encoded->width = image.getWidth();
+            encoded->height = image.getHeight();
+        }
+        p.decodeRLE(encoded->data);
+    }});
+    return cases;
+}
+
+PlanarImage makeTestImage(int width, int height) {
+    PlanarImage image(width, height, kChannels);
+    unsigned seed = 12345;
+    for (int c = 0; c < kChannels; ++c) {
+        for (int y = 0; y < height; ++y) {
+            unsigned char* out = image.row(c, y);
+            for (int x = 0; x < width; ++x) {
+                seed = seed * 1103515245u + 12345u;
+                int noise = static_cast<int>((seed >> 16) & 31) - 16;
+                int base = 40 + 120 * x / width + 60 * y / height + 20 * c;
+                out[x] = static_cast<unsigned char>(std::max(0, std::min(255, base + noise)));
+            }
+        }
+    }
+    return image;
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+// Nearest-rank percentile of sorted times.
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+std::string caseKey(const std::string& op, const std::string& params, int width, int height, int threads) {
+    return op + "/" + params + "/" + std::to_string(width) + "x" + std::to_string(height) + "/" +
+           std::to_string(threads);
+}
+
+// Value of "key": in one line of our own output.
+bool findField(const std::string& line, const std::string& key, std::string& value) {
+    std::string pattern = "\"" + key + "\": ";
+    size_t at = line.find(pattern);
+    if (at == std::string::npos) return false;
+    at += pattern.size();
+    if (at < line.size() && line[at] == '"') {
+        size_t end = line.find('"', at + 1);
+        if (end == std::string::npos) return false;
+        value = line.substr(at + 1, end - at - 1);
+    } else {
+        size_t end = line.find_first_of(",}", at);
+        value = line.substr(at, end - at);
+    }
+    return true;
+}
+
+// Median milliseconds by case key from a file written by writeJson.
+bool readBaseline(const std::string& path, std::map<std::string, double>& baseline) {
+    FILE* file = std::fopen(path.c_str(), "r");
+    if (!file) return false;
+    char buffer[1024];
+    while (std::fgets(buffer, sizeof(buffer), file)) {
+        std::string line = buffer;
+        std::string op, params, width, height, threads, median;
+        if (findField(line, "op", op) && findField(line, "params", params) && findField(line, "width", width) &&
+            findField(line, "height", height) && findField(line, "threads", threads) &&
+            findField(line, "median_ms", median)) {
+            baseline[caseKey(op, params, std::atoi(width.c_str()), std::atoi(height.c_str()),
+                             std::atoi(threads.c_str()))] = std::atof(median.c_str());
+        }
+    }
+    std::fclose(file);
+    return true;
+}
+
+bool writeJson(const std::string& path, const std::vector<Result>& results, int repeats) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) return false;
+    std::fprintf(file, "{\n  \"hardware_threads\": %d,\n  \"repeats\": %d,\n  \"results\": [\n", hardwareThreads(),
+                 repeats);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::fprintf(file,
+                     "    {\"op\": \"%s\", \"params\": \"%s\", \"width\": %d, \"height\": %d, \"megapixels\": %.3f, "
+                     "\"threads\": %d, \"median_ms\": %.3f, \"p95_ms\": %.3f, \"mp_per_s\": %.2f, "
+                     "\"bytes_per_pixel\": %.0f, \"gb_per_s\": %.3f, \"pool_allocations\": %.2f}%s\n",
+                     r.op.c_str(), r.params.c_str(), r.width, r.height, r.width * static_cast<double>(r.height) / 1e6,
+                     r.threads, r.medianMs, r.p95Ms, r.megapixelsPerSecond, r.bytesPerPixel,
+                     r.megapixelsPerSecond * r.bytesPerPixel / 1e3, r.allocations, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    return std::fclose(file) == 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> sizes = {"0.3", "1", "4", "16", "50", "100"};
+    std::vector<std::string> threadCounts = {"1"};
+    if (hardwareThreads() > 1) threadCounts.push_back(std::to_string(hardwareThreads()));
+    std::vector<std::string> ops;
+    int repeats = 7;
+    std::string outPath = "processor_bench.json";
+    std::string baselinePath;
+    double tolerance = 0.1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue) {
+            sizes = split(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            threadCounts = split(argv[++i]);
+        } else if (arg == "--ops" && hasValue) {
+            ops = split(argv[++i]);
+        } else if (arg == "--repeats" && hasValue) {
+            repeats = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--out" && hasValue) {
+            outPath = argv[++i];
+        } else if (arg == "--baseline" && hasValue) {
+            baselinePath = argv[++i];
+        } else if (arg == "--tolerance" && hasValue) {
+            tolerance = std::atof(argv[++i]);
+        } else {
+            std::fprintf(stderr,
+                         "usage: %s [--sizes MP,...] [--threads N,...] [--ops name,...] [--repeats N]\n"
+                         "          [--out results.json] [--baseline old.json] [--tolerance 0.1]\n",
+                         argv[0]);
+            return 2;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baselinePath.empty() && !readBaseline(baselinePath, baseline)) {
+        std::fprintf(stderr, "cannot read baseline %s\n", baselinePath.c_str());
+        return 2;
+    }
+
+    std::vector<Case> cases = makeCases();
+    std::vector<Result> results;
+    int regressions = 0;
+
+    std::printf("%-14s %-8s %11s %3s %10s %10s %9s %5s %8s %6s %s\n", "op", "params", "size", "thr", "median ms",
+                "p95 ms", "MP/s", "B/px", "GB/s", "allocs", baseline.empty() ? "" : "vs baseline");
+    for (const std::string& size : sizes) {
+        double megapixels = std::atof(size.c_str());
+        if (megapixels <= 0) continue;
+        // 3:2, the shape of most camera frames.
+        int width = std::max(1, static_cast<int>(std::lround(std::sqrt(megapixels * 1e6 * 1.5))));
+        int height = std::max(1, static_cast<int>(std::lround(width / 1.5)));
+        ImageProcessor processor;
+        processor.setImage(makeTestImage(width, height));
+
+        for (const std::string& threadText : threadCounts) {
+            int threads = std::max(1, std::atoi(threadText.c_str()));
+            ThreadPool::instance().setActiveThreads(threads);
+            threads = ThreadPool::instance().activeThreads();
+
+            for (const Case& c : cases) {
+                if (!ops.empty() && std::find(ops.begin(), ops.end(), c.op) == ops.end()) continue;
+                if (megapixels > c.maxMegapixels) continue;
+
+                // Every run starts from the same image: the result is undone
+                // outside the timed part.
+                std::vector<double> times;
+                uint64_t allocationsBefore = 0;
+                for (int run = 0; run <= repeats; ++run) {
+                    if (run == 1) allocationsBefore = BufferPool::instance().statistics().allocations;
+                    auto start = std::chrono::steady_clock::now();
+                    c.run(processor);
+                    auto end = std::chrono::steady_clock::now();
+                    if (c.snapshot) processor.undo();
+                    // The first run warms caches and allocations up.
+                    if (run > 0) times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+                }
+                std::sort(times.begin(), times.end());
+
+                Result r;
+                r.op = c.op;
+                r.params = c.params;
+                r.width = width;
+                r.height = height;
+                r.threads = threads;
+                r.medianMs = percentile(times, 0.5);
+                r.p95Ms = percentile(times, 0.95);
+                r.megapixelsPerSecond = width * static_cast<double>(height) / 1e3 / std::max(r.medianMs, 1e-6);
+                r.bytesPerPixel = c.planes + (c.snapshot ? 2 * kChannels : 0);
+                r.allocations = static_cast<double>(BufferPool::instance().statistics().allocations -
+                                                    allocationsBefore) / std::max(repeats, 1);
+                results.push_back(r);
+
+                std::string verdict;
+                auto found = baseline.find(caseKey(r.op, r.params, width, height, threads));
+                if (found != baseline.end() && found->second > 0) {
+                    double ratio = r.medianMs / found->second;
+                    char text[64];
+                    std::snprintf(text, sizeof(text), "%+.1f%%", (ratio - 1) * 100);
+                    verdict = text;
+                    if (ratio > 1 + tolerance) {
+                        verdict += "  REGRESSION";
+                        ++regressions;
+                    }
+                } else if (!baseline.empty()) {
+                    verdict = "new";
+                }
+                std::printf("%-14s %-8s %5dx%-5d %3d %10.2f %10.2f %9.1f %5.0f %8.2f %6.2f %s\n", r.op.c_str(),
+                            r.params.c_str(), width, height, threads, r.medianMs, r.p95Ms, r.megapixelsPerSecond,
+                            r.bytesPerPixel, r.megapixelsPerSecond * r.bytesPerPixel / 1e3, r.allocations,
+                            verdict.c_str());
+                std::fflush(stdout);
+            }
+        }
+        ThreadPool::instance().setActiveThreads(0);
+    }
+
+    if (!writeJson(outPath, results, repeats)) {
+        std::fprintf(stderr, "cannot write %s\n", outPath.c_str());
+        return 2;
+    }
+    BufferPool::Statistics pool = BufferPool::instance().statistics();
+    std::printf("buffer pool: %llu requests, %.1f%% reused, %llu allocations (%.0f MiB)\n",
+                static_cast<unsigned long long>(pool.requests), pool.reuseRate() * 100,
+                static_cast<unsigned long long>(pool.allocations), pool.allocatedBytes / (1024.0 * 1024.0));
+    std::printf("wrote %zu cases to %s\n", results.size(), outPath.c_str());
+    if (!baseline.empty()) {
+        std::printf("%d regression(s) beyond %.0f%%\n", regressions, tolerance * 100);
+    }
+    return regressions > 0 ? 1 : 0;
+}
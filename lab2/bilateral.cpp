@@ -0,0 +1,230 @@
+#include "bilateral.h"
+#include "histogram.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Empty cells around the data so the 5-tap blur and the trilinear lookup
+// never need bounds checks.
+const int kPad = 2;
+const float kBlur[5] = {1 / 16.0f, 4 / 16.0f, 6 / 16.0f, 4 / 16.0f, 1 / 16.0f};
+
+// Grid of (R, G, B, weight) cells laid out as [y][x][z][4].
+struct BilateralGrid {
+    int sizeX, sizeY, sizeZ;
+    std::vector<float> cells;
+
+    BilateralGrid(int x, int y, int z)
+        : sizeX(x), sizeY(y), sizeZ(z), cells(static_cast<size_t>(x) * y * z * 4, 0.0f) {}
+
+    float* at(int y, int x, int z) {
+        return &cells[((static_cast<size_t>(y) * sizeX + x) * sizeZ + z) * 4];
+    }
+};
+
+inline int cellIndex(double position, double sigma) {
+    return static_cast<int>(std::floor(position / sigma + 0.5));
+}
+
+// One 5-tap pass of the blur along x (axis 0), y (1) or z (2). Cells
+// past the edge count as empty.
+void blurAxis(BilateralGrid& in, BilateralGrid& out, int axis) {
+    int run = in.sizeZ * 4;
+    int stride = axis == 0 ? run : in.sizeX * run;
+
+    parallelFor(0, in.sizeY, 1, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            for (int x = 0; x < in.sizeX; ++x) {
+                const float* center = in.at(y, x, 0);
+                float* result = out.at(y, x, 0);
+                if (axis == 2) {
+                    for (int z = 0; z < in.sizeZ; ++z) {
+                        for (int c = 0; c < 4; ++c) {
+                            float sum = 0;
+                            for (int t = std::max(-2, -z); t <= std::min(2, in.sizeZ - 1 - z); ++t) {
+                                sum += kBlur[t + 2] * center[(z + t) * 4 + c];
+                            }
+                            result[z * 4 + c] = sum;
+                        }
+                    }
+                    continue;
+                }
+
+                // Along x or y whole z-runs are combined, which vectorizes.
+                int position = axis == 0 ? x : y;
+                int limit = axis == 0 ? in.sizeX : in.sizeY;
+                std::fill(result, result + run, 0.0f);
+                for (int t = std::max(-2, -position); t <= std::min(2, limit - 1 - position); ++t) {
+                    const float* cell = center + t * stride;
+                    float weight = kBlur[t + 2];
+                    for (int i = 0; i < run; ++i) result[i] += weight * cell[i];
+                }
+            }
+        }
+    });
+}
+
+void copyExtraPlanes(const PlanarImage& src, PlanarImage& dst) {
+    for (int c = 3; c < src.getChannels(); ++c) {
+        std::memcpy(dst.plane(c), src.plane(c), static_cast<size_t>(src.getStride()) * src.getHeight());
+    }
+}
+
+}
+
+void bilateralFilter(const PlanarImage& src, PlanarImage& dst, double sigmaSpatial, double sigmaRange) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    int width = src.getWidth();
+    int height = src.getHeight();
+    sigmaSpatial = std::max(1.0, sigmaSpatial);
+    sigmaRange = std::max(1.0, sigmaRange);
+
+    std::vector<int> cellX(width), cellY(height), cellZ(256);
+    for (int x = 0; x < width; ++x) cellX[x] = cellIndex(x, sigmaSpatial) + kPad;
+    for (int y = 0; y < height; ++y) cellY[y] = cellIndex(y, sigmaSpatial) + kPad;
+    for (int v = 0; v < 256; ++v) cellZ[v] = cellIndex(v, sigmaRange) + kPad;
+
+    BilateralGrid grid(cellX[width - 1] + kPad + 1, cellY[height - 1] + kPad + 1, cellZ[255] + kPad + 1);
+
+    // Splat: each task owns a range of grid rows and the image rows that
+    // round into them, so no two tasks touch the same cell.
+    parallelFor(cellY[0], cellY[height - 1] + 1, 1, [&](int j0, int j1) {
+        int yBegin = static_cast<int>(std::lower_bound(cellY.begin(), cellY.end(), j0) - cellY.begin());
+        int yEnd = static_cast<int>(std::lower_bound(cellY.begin(), cellY.end(), j1) - cellY.begin());
+        for (int y = yBegin; y < yEnd; ++y) {
+            const uint8_t* r = src.row(0, y);
+            const uint8_t* g = src.row(1, y);
+            const uint8_t* b = src.row(2, y);
+            for (int x = 0; x < width; ++x) {
+                float* cell = grid.at(cellY[y], cellX[x], cellZ[lumaOf(r[x], g[x], b[x])]);
+                cell[0] += r[x];
+                cell[1] += g[x];
+                cell[2] += b[x];
+                cell[3] += 1.0f;
+            }
+        }
+    });
+
+    BilateralGrid temp(grid.sizeX, grid.sizeY, grid.sizeZ);
+    blurAxis(grid, temp, 2);
+    blurAxis(temp, grid, 0);
+    blurAxis(grid, temp, 1);
+
+    // Slice: trilinear lookup at each pixel's continuous grid position.
+    std::vector<int> x0(width);
+    std::vector<float> wx(width);
+    for (int x = 0; x < width; ++x) {
+        float f = static_cast<float>(x / sigmaSpatial) + kPad;
+        x0[x] = static_cast<int>(f);
+        wx[x] = f - x0[x];
+    }
+    int z0[256];
+    float wz[256];
+    for (int v = 0; v < 256; ++v) {
+        float f = static_cast<float>(v / sigmaRange) + kPad;
+        z0[v] = static_cast<int>(f);
+        wz[v] = f - z0[v];
+    }
+
+    if (&src != &dst) {
+        dst.allocate(width, height, src.getChannels());
+        copyExtraPlanes(src, dst);
+    }
+
+    int strideX = temp.sizeZ * 4;
+    int strideY = temp.sizeX * strideX;
+    parallelFor(0, height, std::max(1, (1 << 14) / width), [&](int yBegin, int yEnd) {
+        for (int y = yBegin; y < yEnd; ++y) {
+            float fy = static_cast<float>(y / sigmaSpatial) + kPad;
+            int y0 = static_cast<int>(fy);
+            float wy = fy - y0;
+            const uint8_t* in[3] = {src.row(0, y), src.row(1, y), src.row(2, y)};
+            uint8_t* out[3] = {dst.row(0, y), dst.row(1, y), dst.row(2, y)};
+
+            for (int x = 0; x < width; ++x) {
+                int luma = lumaOf(in[0][x], in[1][x], in[2][x]);
+                const float* base = temp.at(y0, x0[x], z0[luma]);
+                float weights[8];
+                float ax = wx[x], az = wz[luma];
+                weights[0] = (1 - wy) * (1 - ax) * (1 - az);
+                weights[1] = (1 - wy) * (1 - ax) * az;
+                weights[2] = (1 - wy) * ax * (1 - az);
+                weights[3] = (1 - wy) * ax * az;
+                weights[4] = wy * (1 - ax) * (1 - az);
+                weights[5] = wy * (1 - ax) * az;
+                weights[6] = wy * ax * (1 - az);
+                weights[7] = wy * ax * az;
+                const int offsets[8] = {0, 4, strideX, strideX + 4,
+                                        strideY, strideY + 4, strideY + strideX, strideY + strideX + 4};
+
+                float sum[4] = {0, 0, 0, 0};
+                for (int corner = 0; corner < 8; ++corner) {
+                    const float* cell = base + offsets[corner];
+                    for (int c = 0; c < 4; ++c) sum[c] += weights[corner] * cell[c];
+                }
+
+                for (int c = 0; c < 3; ++c) {
+                    float value = sum[3] > 1e-6f ? sum[c] / sum[3] : in[c][x];
+                    out[c][x] = static_cast<uint8_t>(std::max(0.0f, std::min(255.0f, value + 0.5f)));
+                }
+            }
+        }
+    });
+}
+
+void bilateralFilterReference(const PlanarImage& src, PlanarImage& dst, double sigmaSpatial, double sigmaRange) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    int width = src.getWidth();
+    int height = src.getHeight();
+    int radius = static_cast<int>(std::ceil(2 * sigmaSpatial));
+    int side = 2 * radius + 1;
+
+    std::vector<float> spatial(side * side);
+    for (int dy = -radius; dy <= radius; ++dy) {
+        for (int dx = -radius; dx <= radius; ++dx) {
+            spatial[(dy + radius) * side + dx + radius] =
+                static_cast<float>(std::exp(-(dx * dx + dy * dy) / (2 * sigmaSpatial * sigmaSpatial)));
+        }
+    }
+    float range[256];
+    for (int d = 0; d < 256; ++d) {
+        range[d] = static_cast<float>(std::exp(-(d * d) / (2 * sigmaRange * sigmaRange)));
+    }
+
+    PlanarImage luma(width, height, 1);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            luma.row(0, y)[x] = static_cast<uint8_t>(lumaOf(src.row(0, y)[x], src.row(1, y)[x], src.row(2, y)[x]));
+        }
+    }
+
+    PlanarImage result(width, height, src.getChannels());
+    copyExtraPlanes(src, result);
+    parallelFor(0, height, 1, [&](int yBegin, int yEnd) {
+        for (int y = yBegin; y < yEnd; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int center = luma.row(0, y)[x];
+                float sum[4] = {0, 0, 0, 0};
+                for (int yy = std::max(0, y - radius); yy <= std::min(height - 1, y + radius); ++yy) {
+                    const uint8_t* guide = luma.row(0, yy);
+                    const float* weightRow = &spatial[(yy - y + radius) * side];
+                    for (int xx = std::max(0, x - radius); xx <= std::min(width - 1, x + radius); ++xx) {
+                        float weight = weightRow[xx - x + radius] * range[std::abs(guide[xx] - center)];
+                        for (int c = 0; c < 3; ++c) sum[c] += weight * src.row(c, yy)[xx];
+                        sum[3] += weight;
+                    }
+                }
+                for (int c = 0; c < 3; ++c) {
+                    result.row(c, y)[x] = static_cast<uint8_t>(std::min(255.0f, sum[c] / sum[3] + 0.5f));
+                }
+            }
+        }
+    });
+    dst = std::move(result);
+}
@@ -0,0 +1,21 @@
+#ifndef BILATERAL_H
+#define BILATERAL_H
+
+#include "planar_image.h"
+
+// Edge-preserving smoothing of channels 0..2, with luma as the range guide
+// so all channels share the same weights and edges stay aligned.
+//
+// Bilateral grid (Chen, Paris & Durand 2007): pixels are splatted into a
+// 3D grid of (x / sigmaSpatial, y / sigmaSpatial, luma / sigmaRange) cells
+// holding RGB sums and a weight, the grid is blurred with a small Gaussian
+// along all three axes, and each pixel reads its result back by trilinear
+// interpolation. Cost is O(pixels) plus O(grid), independent of sigmaSpatial.
+// Splatting and slicing run in parallel row bands.
+void bilateralFilter(const PlanarImage& src, PlanarImage& dst, double sigmaSpatial, double sigmaRange);
+
+// Brute-force bilateral over a (2 * ceil(2 * sigmaSpatial) + 1)^2 window with
+// the same luma guide. O(sigmaSpatial^2) per pixel; kept for comparison.
+void bilateralFilterReference(const PlanarImage& src, PlanarImage& dst, double sigmaSpatial, double sigmaRange);
+
+#endif // BILATERAL_H
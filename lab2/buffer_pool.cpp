@@ -0,0 +1,189 @@
+#include "buffer_pool.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Per-thread caches hold scratch-sized blocks only; image planes go to the
+// shared lists, where any thread can pick them up.
+const size_t kThreadBlockMax = size_t(1) << 20;
+const size_t kThreadBlocks = 8;
+
+const size_t kDefaultIdleLimit = size_t(512) << 20;
+
+void* allocateAligned(size_t size) {
+    void* data = nullptr;
+    if (posix_memalign(&data, BufferPool::kAlignment, size) != 0) return nullptr;
+    return data;
+}
+
+void freeAll(const std::vector<void*>& blocks) {
+    for (void* data : blocks) std::free(data);
+}
+
+}
+
+struct BufferPool::ThreadCache {
+    std::vector<Block> blocks;
+
+    ~ThreadCache() {
+        BufferPool& pool = BufferPool::instance();
+        for (const Block& block : blocks) {
+            pool.threadBytes -= block.size;
+            pool.keep(block);
+        }
+    }
+};
+
+BufferPool::BufferPool()
+        : idleBytes(0), idleLimit(kDefaultIdleLimit), requests(0), reused(0), allocations(0), allocatedBytes(0),
+          threadBytes(0) {}
+
+BufferPool& BufferPool::instance() {
+    // Never destroyed: thread caches hand their blocks back at thread exit,
+    // which can come after static destructors have run.
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+BufferPool::ThreadCache& BufferPool::threadCache() {
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+size_t BufferPool::classSize(size_t bytes) {
+    if (bytes <= 512) return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+    size_t power = 512;
+    while (power <= bytes / 2) power *= 2;
+    size_t step = power / 8;
+    return (bytes + step - 1) / step * step;
+}
+
+void* BufferPool::acquire(size_t bytes) {
+    size_t size = classSize(bytes);
+    ++requests;
+
+    if (size <= kThreadBlockMax) {
+        std::vector<Block>& blocks = threadCache().blocks;
+        for (size_t i = blocks.size(); i-- > 0;) {
+            if (blocks[i].size == size) {
+                void* data = blocks[i].data;
+                blocks.erase(blocks.begin() + i);
+                threadBytes -= size;
+                ++reused;
+                return data;
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = idle.size(); i-- > 0;) {
+            if (idle[i].size == size) {
+                void* data = idle[i].data;
+                idle.erase(idle.begin() + i);
+                idleBytes -= size;
+                ++reused;
+                return data;
+            }
+        }
+    }
+
+    void* data = allocateAligned(size);
+    if (!data) {
+        // Blocks of other sizes may be what stands in the way.
+        trim();
+        data = allocateAligned(size);
+        if (!data) throw std::bad_alloc();
+    }
+    ++allocations;
+    allocatedBytes += size;
+    return data;
+}
+
+void BufferPool::release(void* data, size_t bytes) {
+    if (!data) return;
+    Block block = {data, classSize(bytes)};
+
+    if (block.size <= kThreadBlockMax) {
+        std::vector<Block>& blocks = threadCache().blocks;
+        if (blocks.size() < kThreadBlocks) {
+            blocks.push_back(block);
+            threadBytes += block.size;
+            return;
+        }
+    }
+    keep(block);
+}
+
+void BufferPool::keep(const Block& block) {
+    std::vector<void*> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(block);
+        idleBytes += block.size;
+        evictOverLimit(evicted);
+    }
+    freeAll(evicted);
+}
+
+void BufferPool::evictOverLimit(std::vector<void*>& evicted) {
+    size_t count = 0;
+    while (idleBytes > idleLimit) {
+        evicted.push_back(idle[count].data);
+        idleBytes -= idle[count].size;
+        ++count;
+    }
+    idle.erase(idle.begin(), idle.begin() + count);
+}
+
+void BufferPool::setIdleLimit(size_t bytes) {
+    std::vector<void*> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        idleLimit = bytes;
+        evictOverLimit(evicted);
+    }
+    freeAll(evicted);
+}
+
+size_t BufferPool::getIdleLimit() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idleLimit;
+}
+
+void BufferPool::trim() {
+    std::vector<void*> evicted;
+    std::vector<Block>& blocks = threadCache().blocks;
+    for (const Block& block : blocks) {
+        evicted.push_back(block.data);
+        threadBytes -= block.size;
+    }
+    blocks.clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Block& block : idle) evicted.push_back(block.data);
+        idle.clear();
+        idleBytes = 0;
+    }
+    freeAll(evicted);
+}
+
+BufferPool::Statistics BufferPool::statistics() const {
+    Statistics stats;
+    stats.requests = requests;
+    stats.reused = reused;
+    stats.allocations = allocations;
+    stats.allocatedBytes = allocatedBytes;
+    stats.threadBytes = threadBytes;
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.idleBytes = idleBytes;
+    return stats;
+}
+
+void BufferPool::resetStatistics() {
+    requests = 0;
+    reused = 0;
+    allocations = 0;
+    allocatedBytes = 0;
+}
@@ -0,0 +1,105 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// 64-byte aligned blocks for image planes and large scratch arrays. A block
+// given back is kept and handed out again for the next request of the same
+// size class, so repeated operations on one image stop allocating once each
+// size has been seen. Classes are an eighth of a power of two apart, which
+// wastes at most 12.5% and only as untouched address space. Small blocks are
+// kept per thread first, so scratch arrays inside parallel kernels do not
+// contend for the lock.
+class BufferPool {
+public:
+    static const size_t kAlignment = 64;
+
+    struct Statistics {
+        uint64_t requests;      // acquire calls
+        uint64_t reused;        // ... served from a kept block
+        uint64_t allocations;   // ... that had to allocate
+        uint64_t allocatedBytes;
+        size_t idleBytes;       // kept in the shared lists
+        size_t threadBytes;     // kept in per-thread caches
+
+        double reuseRate() const { return requests ? static_cast<double>(reused) / requests : 0.0; }
+    };
+
+    static BufferPool& instance();
+
+    // A block of at least bytes. Throws std::bad_alloc.
+    void* acquire(size_t bytes);
+    // Gives back a block from acquire; bytes is the size asked for then.
+    void release(void* block, size_t bytes);
+
+    // Kept blocks beyond the limit are freed, the longest unused first.
+    void setIdleLimit(size_t bytes);
+    size_t getIdleLimit() const;
+    // Frees the shared kept blocks and those of the calling thread's cache.
+    void trim();
+
+    Statistics statistics() const;
+    void resetStatistics();
+
+    static size_t classSize(size_t bytes);
+
+private:
+    struct Block {
+        void* data;
+        size_t size;
+    };
+    struct ThreadCache;
+
+    BufferPool();
+    static ThreadCache& threadCache();
+    void keep(const Block& block);
+    // Takes the oldest kept blocks out until the limit holds; mutex held.
+    void evictOverLimit(std::vector<void*>& evicted);
+
+    mutable std::mutex mutex;
+    std::vector<Block> idle; // least recently given back first
+    size_t idleBytes, idleLimit;
+    std::atomic<uint64_t> requests, reused, allocations, allocatedBytes;
+    std::atomic<size_t> threadBytes;
+};
+
+// Uninitialized array of a trivial type in pooled memory.
+template <typename T>
+class PooledArray {
+public:
+    PooledArray() : items(nullptr), count(0) {}
+    explicit PooledArray(size_t count)
+            : items(count ? static_cast<T*>(BufferPool::instance().acquire(count * sizeof(T))) : nullptr),
+              count(count) {}
+    PooledArray(PooledArray&& other) noexcept : items(other.items), count(other.count) {
+        other.items = nullptr;
+        other.count = 0;
+    }
+    PooledArray& operator=(PooledArray&& other) noexcept {
+        std::swap(items, other.items);
+        std::swap(count, other.count);
+        return *this;
+    }
+    PooledArray(const PooledArray&) = delete;
+    PooledArray& operator=(const PooledArray&) = delete;
+    ~PooledArray() {
+        if (items) BufferPool::instance().release(items, count * sizeof(T));
+    }
+
+    T* data() { return items; }
+    const T* data() const { return items; }
+    size_t size() const { return count; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+
+private:
+    T* items;
+    size_t count;
+};
+
+#endif // BUFFER_POOL_H
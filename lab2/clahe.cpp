@@ -0,0 +1,251 @@
+#include "clahe.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Value channel of the image as its own plane.
+void valuePlane(const PlanarImage& src, PlanarImage& value) {
+    int width = src.getWidth();
+    value.allocate(width, src.getHeight(), 1);
+    parallelFor(0, src.getHeight(), std::max(1, (1 << 15) / width), [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uint8_t* r = src.row(0, y);
+            const uint8_t* g = src.row(1, y);
+            const uint8_t* b = src.row(2, y);
+            uint8_t* v = value.row(0, y);
+            for (int x = 0; x < width; ++x) {
+                v[x] = std::max(r[x], std::max(g[x], b[x]));
+            }
+        }
+    });
+}
+
+// dst = src with every pixel's RGB scaled so that its value becomes newValue.
+void scaleToValue(const PlanarImage& src, const PlanarImage& value, const PlanarImage& newValue, PlanarImage& dst) {
+    int width = src.getWidth();
+    if (&src != &dst) {
+        dst.allocate(width, src.getHeight(), src.getChannels());
+    }
+
+    parallelFor(0, src.getHeight(), std::max(1, (1 << 15) / width), [&](int y0, int y1) {
+        const int kBlock = 256;
+        uint32_t gains[kBlock];
+        for (int y = y0; y < y1; ++y) {
+            for (int c = 3; c < src.getChannels(); ++c) {
+                std::memcpy(dst.row(c, y), src.row(c, y), width);
+            }
+
+            for (int x0 = 0; x0 < width; x0 += kBlock) {
+                int n = std::min(kBlock, width - x0);
+                const uint8_t* v = value.row(0, y) + x0;
+                const uint8_t* nv = newValue.row(0, y) + x0;
+                for (int x = 0; x < n; ++x) {
+                    gains[x] = v[x] ? (static_cast<uint32_t>(nv[x]) << 16) / v[x] : 0;
+                }
+                for (int c = 0; c < 3; ++c) {
+                    const uint8_t* in = src.row(c, y) + x0;
+                    uint8_t* out = dst.row(c, y) + x0;
+                    for (int x = 0; x < n; ++x) {
+                        uint32_t scaled = (in[x] * gains[x] + 32768) >> 16;
+                        // Black pixels have no hue to keep; they become gray at the new value.
+                        scaled = v[x] ? scaled : nv[x];
+                        out[x] = static_cast<uint8_t>(scaled > 255 ? 255 : scaled);
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Clips the histogram at clipLimit times the mean bin height, spreads the
+// excess evenly over all bins and turns the result into a 0..255 mapping.
+void clippedMapping(int* histogram, int pixels, double clipLimit, uint8_t* map) {
+    int limit = std::max(1, static_cast<int>(clipLimit * pixels / 256));
+
+    int excess = 0;
+    for (int i = 0; i < 256; ++i) {
+        if (histogram[i] > limit) {
+            excess += histogram[i] - limit;
+            histogram[i] = limit;
+        }
+    }
+
+    int share = excess / 256;
+    int remainder = excess % 256;
+    int cdf = 0;
+    for (int i = 0; i < 256; ++i) {
+        cdf += histogram[i] + share + (i < remainder ? 1 : 0);
+        map[i] = static_cast<uint8_t>(std::min(255, static_cast<int>(static_cast<int64_t>(cdf) * 255 / pixels)));
+    }
+}
+
+// Tile coordinate and Q8 blend weight for a pixel position along one axis.
+void tileAxis(int size, int tiles, std::vector<int>& first, std::vector<int>& second, std::vector<int>& weight) {
+    first.resize(size);
+    second.resize(size);
+    weight.resize(size);
+    double tileSize = static_cast<double>(size) / tiles;
+    for (int i = 0; i < size; ++i) {
+        double f = (i + 0.5) / tileSize - 0.5;
+        int t0 = static_cast<int>(std::floor(f));
+        double w = f - t0;
+        if (t0 < 0) {
+            t0 = 0;
+            w = 0;
+        }
+        if (t0 >= tiles - 1) {
+            t0 = tiles - 1;
+            w = 0;
+        }
+        first[i] = t0;
+        second[i] = std::min(t0 + 1, tiles - 1);
+        weight[i] = static_cast<int>(w * 256 + 0.5);
+    }
+}
+
+}
+
+void applyClahe(const PlanarImage& src, PlanarImage& dst, const ClaheParams& params) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    int width = src.getWidth();
+    int height = src.getHeight();
+    int tilesX = std::max(1, std::min(params.tilesX, width));
+    int tilesY = std::max(1, std::min(params.tilesY, height));
+
+    PlanarImage value;
+    valuePlane(src, value);
+
+    // One clipped mapping per tile; tiles are independent.
+    std::vector<uint8_t> maps(static_cast<size_t>(tilesX) * tilesY * 256);
+    parallelFor(0, tilesX * tilesY, 1, [&](int t0, int t1) {
+        for (int t = t0; t < t1; ++t) {
+            int tx = t % tilesX;
+            int ty = t / tilesX;
+            int xBegin = static_cast<int>(static_cast<int64_t>(tx) * width / tilesX);
+            int xEnd = static_cast<int>(static_cast<int64_t>(tx + 1) * width / tilesX);
+            int yBegin = static_cast<int>(static_cast<int64_t>(ty) * height / tilesY);
+            int yEnd = static_cast<int>(static_cast<int64_t>(ty + 1) * height / tilesY);
+
+            int histogram[256] = {0};
+            for (int y = yBegin; y < yEnd; ++y) {
+                const uint8_t* v = value.row(0, y);
+                for (int x = xBegin; x < xEnd; ++x) {
+                    histogram[v[x]]++;
+                }
+            }
+            clippedMapping(histogram, (xEnd - xBegin) * (yEnd - yBegin), params.clipLimit, &maps[static_cast<size_t>(t) * 256]);
+        }
+    });
+
+    std::vector<int> tx0, tx1, wx, ty0, ty1, wy;
+    tileAxis(width, tilesX, tx0, tx1, wx);
+    tileAxis(height, tilesY, ty0, ty1, wy);
+
+    PlanarImage newValue(width, height, 1);
+    parallelFor(0, height, std::max(1, (1 << 14) / width), [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uint8_t* top0 = &maps[static_cast<size_t>(ty0[y]) * tilesX * 256];
+            const uint8_t* bottom0 = &maps[static_cast<size_t>(ty1[y]) * tilesX * 256];
+            int wb = wy[y];
+            int wt = 256 - wb;
+            const uint8_t* v = value.row(0, y);
+            uint8_t* out = newValue.row(0, y);
+            for (int x = 0; x < width; ++x) {
+                int left = tx0[x] * 256 + v[x];
+                int right = tx1[x] * 256 + v[x];
+                int wr = wx[x];
+                int wl = 256 - wr;
+                int top = top0[left] * wl + top0[right] * wr;
+                int bottom = bottom0[left] * wl + bottom0[right] * wr;
+                out[x] = static_cast<uint8_t>((top * wt + bottom * wb + 32768) >> 16);
+            }
+        }
+    });
+
+    scaleToValue(src, value, newValue, dst);
+}
+
+void applyClaheSliding(const PlanarImage& src, PlanarImage& dst, int radius, double clipLimit) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    int width = src.getWidth();
+    int height = src.getHeight();
+    radius = std::max(1, radius);
+    int side = 2 * radius + 1;
+    int limit = std::max(1, static_cast<int>(clipLimit * side * side / 256));
+
+    PlanarImage value;
+    valuePlane(src, value);
+    PlanarImage newValue(width, height, 1);
+
+    parallelFor(0, height, 1, [&](int yBegin, int yEnd) {
+        int histogram[256];
+        int clippedBlock[16];
+        int excess = 0;
+        int count = 0;
+
+        // Maintain min(h, limit) per 16-bin block and the total above the
+        // limit, so adding or removing one pixel is O(1).
+        auto add = [&](int v) {
+            if (histogram[v] < limit) clippedBlock[v >> 4]++;
+            else excess++;
+            histogram[v]++;
+            count++;
+        };
+        auto remove = [&](int v) {
+            histogram[v]--;
+            if (histogram[v] < limit) clippedBlock[v >> 4]--;
+            else excess--;
+            count--;
+        };
+
+        for (int y = yBegin; y < yEnd; ++y) {
+            int top = std::max(0, y - radius);
+            int bottom = std::min(height - 1, y + radius);
+
+            std::memset(histogram, 0, sizeof(histogram));
+            std::memset(clippedBlock, 0, sizeof(clippedBlock));
+            excess = 0;
+            count = 0;
+            for (int yy = top; yy <= bottom; ++yy) {
+                const uint8_t* v = value.row(0, yy);
+                for (int x = 0; x <= std::min(width - 1, radius); ++x) {
+                    add(v[x]);
+                }
+            }
+
+            const uint8_t* center = value.row(0, y);
+            uint8_t* out = newValue.row(0, y);
+            for (int x = 0; x < width; ++x) {
+                if (x > 0) {
+                    int leaving = x - radius - 1;
+                    int entering = x + radius;
+                    for (int yy = top; yy <= bottom; ++yy) {
+                        const uint8_t* v = value.row(0, yy);
+                        if (leaving >= 0) remove(v[leaving]);
+                        if (entering < width) add(v[entering]);
+                    }
+                }
+
+                int v = center[x];
+                int block = v >> 4;
+                int64_t cdf = 0;
+                for (int k = 0; k < block; ++k) {
+                    cdf += clippedBlock[k];
+                }
+                for (int i = block << 4; i <= v; ++i) {
+                    cdf += std::min(histogram[i], limit);
+                }
+                cdf += static_cast<int64_t>(excess) * (v + 1) / 256;
+                out[x] = static_cast<uint8_t>(std::min<int64_t>(255, cdf * 255 / count));
+            }
+        }
+    });
+
+    scaleToValue(src, value, newValue, dst);
+}
@@ -0,0 +1,27 @@
+#ifndef CLAHE_H
+#define CLAHE_H
+
+#include "planar_image.h"
+
+// Contrast-limited adaptive histogram equalization on the HSV value channel
+// (max of R, G, B). Like equalizeValue, RGB is scaled by V'/V, so hue and
+// saturation are kept. clipLimit is in multiples of the mean bin height.
+struct ClaheParams {
+    int tilesX;
+    int tilesY;
+    double clipLimit;
+
+    ClaheParams() : tilesX(8), tilesY(8), clipLimit(2.0) {}
+};
+
+// Per-tile clipped histograms (computed in parallel) whose mappings are
+// blended bilinearly between tile centers.
+void applyClahe(const PlanarImage& src, PlanarImage& dst, const ClaheParams& params);
+
+// Exact variant: every pixel is mapped with the clipped histogram of the
+// (2 * radius + 1)^2 window around it. The window histogram is updated
+// incrementally as it slides one pixel along a row, and the clipped CDF is
+// kept per 16-bin block so a lookup touches at most 32 entries.
+void applyClaheSliding(const PlanarImage& src, PlanarImage& dst, int radius, double clipLimit);
+
+#endif // CLAHE_H
@@ -0,0 +1,252 @@
+#include "color_kernels.h"
+#include "histogram.h"
+#include "parallel.h"
+#include "tone_lut.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int kBlock = 256;
+
+inline uint8_t max3(uint8_t a, uint8_t b, uint8_t c) {
+    return std::max(a, std::max(b, c));
+}
+
+inline uint8_t min3(uint8_t a, uint8_t b, uint8_t c) {
+    return std::min(a, std::min(b, c));
+}
+
+}
+
+void rgbToHsvRow(const uint8_t* r8, const uint8_t* g8, const uint8_t* b8,
+                 float* h, float* s, float* v, int width) {
+    for (int x = 0; x < width; ++x) {
+        float r = r8[x] / 255.0f;
+        float g = g8[x] / 255.0f;
+        float b = b8[x] / 255.0f;
+
+        float maxVal = std::max(r, std::max(g, b));
+        float minVal = std::min(r, std::min(g, b));
+        float delta = maxVal - minVal;
+        bool chromatic = delta > 0.0001f;
+        float safeDelta = chromatic ? delta : 1.0f;
+
+        // (g - b) / delta is already within [-1, 1], so fmod(..., 6) is a no-op.
+        float hr = 60 * ((g - b) / safeDelta);
+        float hg = 60 * (((b - r) / safeDelta) + 2);
+        float hb = 60 * (((r - g) / safeDelta) + 4);
+        float hue = (maxVal == r) ? hr : (maxVal == g) ? hg : hb;
+        hue = hue < 0 ? hue + 360 : hue;
+
+        h[x] = chromatic ? hue : 0.0f;
+        s[x] = chromatic ? delta / maxVal * 100 : 0.0f;
+        v[x] = maxVal * 100;
+    }
+}
+
+void hsvToRgbRow(const float* h, const float* s, const float* v,
+                 uint8_t* r8, uint8_t* g8, uint8_t* b8, int width) {
+    for (int x = 0; x < width; ++x) {
+        float sat = s[x] / 100.0f;
+        float val = v[x] / 100.0f;
+
+        float hh = h[x] / 60.0f;
+        float c = val * sat;
+        float f = hh - 2.0f * std::floor(hh * 0.5f);
+        float xx = c * (1 - std::fabs(f - 1));
+        float m = val - c;
+
+        int sector = std::min(5, static_cast<int>(hh));
+        float r = (sector == 0 || sector == 5) ? c : (sector == 1 || sector == 4) ? xx : 0.0f;
+        float g = (sector == 1 || sector == 2) ? c : (sector == 0 || sector == 3) ? xx : 0.0f;
+        float b = (sector == 3 || sector == 4) ? c : (sector == 2 || sector == 5) ? xx : 0.0f;
+
+        // Grayscale
+        bool gray = sat < 0.001f;
+        r8[x] = static_cast<uint8_t>(gray ? val * 255 : (r + m) * 255);
+        g8[x] = static_cast<uint8_t>(gray ? val * 255 : (g + m) * 255);
+        b8[x] = static_cast<uint8_t>(gray ? val * 255 : (b + m) * 255);
+    }
+}
+
+std::vector<int> computeValueHistogram(const PlanarImage& image) {
+    if (image.empty() || image.getChannels() < 3) return std::vector<int>(256, 0);
+
+    int width = image.getWidth();
+    return computeDerivedHistogram(width, image.getHeight(), [&](int y, unsigned char* value) {
+        const uint8_t* r = image.row(0, y);
+        const uint8_t* g = image.row(1, y);
+        const uint8_t* b = image.row(2, y);
+        for (int x = 0; x < width; ++x) {
+            value[x] = max3(r[x], g[x], b[x]);
+        }
+    });
+}
+
+std::vector<int> computeLightnessHistogram(const PlanarImage& image) {
+    if (image.empty() || image.getChannels() < 3) return std::vector<int>(256, 0);
+
+    int width = image.getWidth();
+    return computeDerivedHistogram(width, image.getHeight(), [&](int y, unsigned char* lightness) {
+        const uint8_t* r = image.row(0, y);
+        const uint8_t* g = image.row(1, y);
+        const uint8_t* b = image.row(2, y);
+        for (int x = 0; x < width; ++x) {
+            lightness[x] = static_cast<unsigned char>((max3(r[x], g[x], b[x]) + min3(r[x], g[x], b[x]) + 1) >> 1);
+        }
+    });
+}
+
+void equalizeValue(const PlanarImage& src, PlanarImage& dst) {
+    if (src.empty() || src.getChannels() < 3) return;
+    equalizeValue(src, dst, computeValueHistogram(src));
+}
+
+void equalizeValue(const PlanarImage& src, PlanarImage& dst, const std::vector<int>& valueHistogram) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    uint8_t map[256];
+    buildEqualizationMap(valueHistogram, map);
+
+    // With H and S fixed, HSV -> RGB is linear in V: every channel scales by V'/V.
+    uint32_t gain[256];
+    gain[0] = 0;
+    for (int v = 1; v < 256; ++v) {
+        gain[v] = static_cast<uint32_t>(map[v] * 65536.0f / v + 0.5f);
+    }
+
+    if (&src != &dst) {
+        dst.allocate(src.getWidth(), src.getHeight(), src.getChannels());
+    }
+
+    int width = src.getWidth();
+    parallelFor(0, src.getHeight(), std::max(1, (1 << 15) / width), [&](int y0, int y1) {
+        uint32_t gains[kBlock];
+        for (int y = y0; y < y1; ++y) {
+            for (int c = 3; c < src.getChannels(); ++c) {
+                std::copy(src.row(c, y), src.row(c, y) + width, dst.row(c, y));
+            }
+
+            for (int x0 = 0; x0 < width; x0 += kBlock) {
+                int n = std::min(kBlock, width - x0);
+                const uint8_t* r = src.row(0, y) + x0;
+                const uint8_t* g = src.row(1, y) + x0;
+                const uint8_t* b = src.row(2, y) + x0;
+                for (int x = 0; x < n; ++x) {
+                    gains[x] = gain[max3(r[x], g[x], b[x])];
+                }
+                for (int c = 0; c < 3; ++c) {
+                    const uint8_t* in = src.row(c, y) + x0;
+                    uint8_t* out = dst.row(c, y) + x0;
+                    for (int x = 0; x < n; ++x) {
+                        uint32_t value = (in[x] * gains[x] + 32768) >> 16;
+                        out[x] = static_cast<uint8_t>(value > 255 ? 255 : value);
+                    }
+                }
+            }
+        }
+    });
+}
+
+void equalizeLightness(const PlanarImage& src, PlanarImage& dst) {
+    if (src.empty() || src.getChannels() < 3) return;
+    equalizeLightness(src, dst, computeLightnessHistogram(src));
+}
+
+void equalizeLightness(const PlanarImage& src, PlanarImage& dst, const std::vector<int>& lightnessHistogram) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    uint8_t map[256];
+    buildEqualizationMap(lightnessHistogram, map);
+
+    // Indexed by max + min = 2L. In HLS every channel is L + C * (t - 1/2),
+    // where t depends only on hue and C = (1 - |2L - 1|) * S. Keeping H and S
+    // while moving L to L' therefore maps c -> L' + (c - L) * C'/C.
+    float newLightness[511];
+    float chromaRatio[511];
+    for (int sum = 0; sum <= 510; ++sum) {
+        float target = map[(sum + 1) >> 1];
+        float chroma = 255.0f - std::fabs(static_cast<float>(sum) - 255.0f);
+        float newChroma = 255.0f - std::fabs(2.0f * target - 255.0f);
+        newLightness[sum] = target;
+        chromaRatio[sum] = chroma > 0 ? newChroma / chroma : 0.0f;
+    }
+
+    if (&src != &dst) {
+        dst.allocate(src.getWidth(), src.getHeight(), src.getChannels());
+    }
+
+    int width = src.getWidth();
+    parallelFor(0, src.getHeight(), std::max(1, (1 << 15) / width), [&](int y0, int y1) {
+        float lightness[kBlock], offset[kBlock], ratio[kBlock];
+        for (int y = y0; y < y1; ++y) {
+            for (int c = 3; c < src.getChannels(); ++c) {
+                std::copy(src.row(c, y), src.row(c, y) + width, dst.row(c, y));
+            }
+
+            for (int x0 = 0; x0 < width; x0 += kBlock) {
+                int n = std::min(kBlock, width - x0);
+                const uint8_t* r = src.row(0, y) + x0;
+                const uint8_t* g = src.row(1, y) + x0;
+                const uint8_t* b = src.row(2, y) + x0;
+                for (int x = 0; x < n; ++x) {
+                    int sum = max3(r[x], g[x], b[x]) + min3(r[x], g[x], b[x]);
+                    lightness[x] = 0.5f * sum;
+                    offset[x] = newLightness[sum];
+                    ratio[x] = chromaRatio[sum];
+                }
+                for (int c = 0; c < 3; ++c) {
+                    const uint8_t* in = src.row(c, y) + x0;
+                    uint8_t* out = dst.row(c, y) + x0;
+                    for (int x = 0; x < n; ++x) {
+                        float value = offset[x] + (in[x] - lightness[x]) * ratio[x] + 0.5f;
+                        out[x] = static_cast<uint8_t>(std::max(0.0f, std::min(255.0f, value)));
+                    }
+                }
+            }
+        }
+    });
+}
+
+void equalizeValueReference(const PlanarImage& src, PlanarImage& dst) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    int width = src.getWidth();
+    int height = src.getHeight();
+    std::vector<float> h(static_cast<size_t>(width) * height);
+    std::vector<float> s(h.size());
+    std::vector<float> v(h.size());
+
+    parallelFor(0, height, 1, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            size_t offset = static_cast<size_t>(y) * width;
+            rgbToHsvRow(src.row(0, y), src.row(1, y), src.row(2, y),
+                        &h[offset], &s[offset], &v[offset], width);
+        }
+    });
+
+    std::vector<int> histogram(256, 0);
+    for (float value : v) {
+        histogram[static_cast<int>(value * 2.55f + 0.5f)]++;
+    }
+    uint8_t map[256];
+    buildEqualizationMap(histogram, map);
+    for (float& value : v) {
+        value = map[static_cast<int>(value * 2.55f + 0.5f)] / 2.55f;
+    }
+
+    if (&src != &dst) {
+        dst.allocate(width, height, src.getChannels());
+    }
+    parallelFor(0, height, 1, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            size_t offset = static_cast<size_t>(y) * width;
+            hsvToRgbRow(&h[offset], &s[offset], &v[offset],
+                        dst.row(0, y), dst.row(1, y), dst.row(2, y), width);
+            for (int c = 3; c < src.getChannels(); ++c) {
+                std::copy(src.row(c, y), src.row(c, y) + width, dst.row(c, y));
+            }
+        }
+    });
+}
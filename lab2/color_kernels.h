@@ -0,0 +1,38 @@
+#ifndef COLOR_KERNELS_H
+#define COLOR_KERNELS_H
+
+#include <cstdint>
+#include <vector>
+#include "planar_image.h"
+
+// Row-wise RGB <-> HSV over planar data, using the same formulas as
+// lab1's ColorConverter::rgbToHsv/hsvToRgb (H in degrees, S and V in
+// percent, truncating back to bytes). Written branch-free so the loops
+// vectorize over whole rows.
+void rgbToHsvRow(const uint8_t* r, const uint8_t* g, const uint8_t* b,
+                 float* h, float* s, float* v, int width);
+void hsvToRgbRow(const float* h, const float* s, const float* v,
+                 uint8_t* r, uint8_t* g, uint8_t* b, int width);
+
+// Histograms of HSV value (max of R, G, B) and HLS lightness ((max + min) / 2).
+std::vector<int> computeValueHistogram(const PlanarImage& image);
+std::vector<int> computeLightnessHistogram(const PlanarImage& image);
+
+// Equalize only V (HSV) or L (HLS), keeping hue and saturation. Each is two
+// passes: a histogram pass, then one pass that converts, maps the channel
+// through the equalization table and converts back per pixel. With H and S
+// fixed the round trip reduces to closed-form per-pixel arithmetic, so no
+// HSV image is ever materialized.
+void equalizeValue(const PlanarImage& src, PlanarImage& dst);
+void equalizeLightness(const PlanarImage& src, PlanarImage& dst);
+
+// Same, with the mapping built from a histogram gathered elsewhere, e.g. over
+// all row bands of an image that is processed out of core.
+void equalizeValue(const PlanarImage& src, PlanarImage& dst, const std::vector<int>& valueHistogram);
+void equalizeLightness(const PlanarImage& src, PlanarImage& dst, const std::vector<int>& lightnessHistogram);
+
+// Straightforward version of equalizeValue that converts the whole image to
+// HSV planes and back with the row kernels above. Kept for comparison.
+void equalizeValueReference(const PlanarImage& src, PlanarImage& dst);
+
+#endif // COLOR_KERNELS_H
@@ -0,0 +1,23 @@
+#include "cpu_features.h"
+
+namespace {
+
+CpuFeatures detect() {
+    CpuFeatures features = {false, false, false, false};
+#ifdef LAB2_X86_DISPATCH
+    __builtin_cpu_init();
+    features.ssse3 = __builtin_cpu_supports("ssse3");
+    features.sse42 = __builtin_cpu_supports("sse4.2");
+    features.avx2 = __builtin_cpu_supports("avx2");
+    features.avx512vbmi = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                          __builtin_cpu_supports("avx512vbmi");
+#endif
+    return features;
+}
+
+}
+
+const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = detect();
+    return features;
+}
@@ -0,0 +1,23 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// The kernels' SIMD paths are compiled with per-function target attributes
+// and picked at run time, so a portable build still uses them on CPUs that
+// have the instructions. Only on x86-64 with GCC or Clang; elsewhere the
+// scalar paths are all there is.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LAB2_X86_DISPATCH 1
+#define LAB2_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+struct CpuFeatures {
+    bool ssse3;
+    bool sse42;
+    bool avx2;
+    bool avx512vbmi; // with AVX-512 F and BW, which the VBMI path also uses
+};
+
+// Detected once, on first use.
+const CpuFeatures& cpuFeatures();
+
+#endif // CPU_FEATURES_H
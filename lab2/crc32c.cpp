@@ -0,0 +1,55 @@
+#include "crc32c.h"
+#include "cpu_features.h"
+#include <cstring>
+
+#ifdef LAB2_X86_DISPATCH
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+struct Crc32cTable {
+    uint32_t entries[256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+const Crc32cTable table;
+
+#ifdef LAB2_X86_DISPATCH
+LAB2_TARGET("sse4.2")
+uint32_t crc32cSse42(const unsigned char* data, size_t size, uint32_t crc) {
+    uint64_t wide = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = static_cast<uint32_t>(wide);
+    for (; size > 0; ++data, --size) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+}
+
+uint32_t crc32c(const unsigned char* data, size_t size, uint32_t crc) {
+    crc = ~crc;
+#ifdef LAB2_X86_DISPATCH
+    if (cpuFeatures().sse42) return ~crc32cSse42(data, size, crc);
+#endif
+    for (; size > 0; ++data, --size) {
+        crc = table.entries[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
@@ -0,0 +1,12 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli), as used by iSCSI/ext4. Pass the previous result as
+// crc to continue a running checksum; start from 0. Uses the SSE4.2 crc32
+// instruction when available, a lookup table otherwise.
+uint32_t crc32c(const unsigned char* data, size_t size, uint32_t crc = 0);
+
+#endif // CRC32C_H
@@ -0,0 +1,281 @@
+#include "edges.h"
+#include "buffer_pool.h"
+#include "histogram.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const int kBandRows = 64;
+
+enum : uint8_t { kNone = 0, kWeak = 1, kStrong = 2 };
+
+inline int ringSlot(int y, int size) {
+    return ((y % size) + size) % size;
+}
+
+// Union-find over candidates, numbered in scan order. Roots are the smallest
+// number of their component; strong[root] says whether the component has a
+// strong pixel.
+template <typename Labels>
+int findRoot(Labels& parent, int p) {
+    while (parent[p] != p) {
+        parent[p] = parent[parent[p]];
+        p = parent[p];
+    }
+    return p;
+}
+
+template <typename Labels, typename Flags>
+void unite(Labels& parent, Flags& strong, int a, int b) {
+    int ra = findRoot(parent, a);
+    int rb = findRoot(parent, b);
+    if (ra == rb) return;
+    if (ra > rb) std::swap(ra, rb);
+    parent[rb] = ra;
+    strong[ra] |= strong[rb];
+}
+
+// Candidates of one band, numbered from 0 in scan order, linked among
+// themselves; and the numbers of its first and last rows (-1 where there is
+// no candidate), for joining it to its neighbours.
+struct BandLabels {
+    std::vector<int> parent;
+    std::vector<uint8_t> strong;
+    std::vector<int> firstRow, lastRow;
+};
+
+// Gray, blur, Sobel and NMS for one band of rows, one row at a time. Each
+// ensure* call extends its stage up to row y, pulling rows from the stage
+// before it; rows outside the image are replicated from the edge.
+class BandPipeline {
+public:
+    BandPipeline(const PlanarImage& src, int y0, int lowThreshold, int highThreshold)
+        : src(src), width(src.getWidth()), height(src.getHeight()),
+          low(lowThreshold), high(highThreshold),
+          gray(5 * (width + 4)), vertical(width + 4), blurred(3 * (width + 2)),
+          magnitude(3 * (width + 2), 0), direction(3 * width),
+          lastGray(y0 - 5), lastBlurred(y0 - 3), lastGradient(y0 - 2) {}
+
+    // Writes the NMS classification (kNone/kWeak/kStrong) of row y.
+    void classifyRow(int y, uint8_t* out) {
+        ensureGradient(y + 1);
+        const int16_t* above = gradientRow(y - 1);
+        const int16_t* center = gradientRow(y);
+        const int16_t* below = gradientRow(y + 1);
+        const uint8_t* dir = &direction[ringSlot(y, 3) * width];
+
+        // Every neighbour is loaded and the pair across the edge selected, so
+        // the loop has no branches and vectorizes like the stages before it.
+        for (int x = 0; x < width; ++x) {
+            int m = center[x];
+            // Neighbours across the edge: 0 = left/right, 1 = main diagonal,
+            // 2 = up/down, 3 = anti-diagonal.
+            int d = dir[x];
+            int left = center[x - 1], right = center[x + 1];
+            int upLeft = above[x - 1], up = above[x], upRight = above[x + 1];
+            int downLeft = below[x - 1], down = below[x], downRight = below[x + 1];
+            int diagonal1 = d == 1 ? upLeft : upRight;
+            int diagonal2 = d == 1 ? downRight : downLeft;
+            int n1 = d == 0 ? left : d == 2 ? up : diagonal1;
+            int n2 = d == 0 ? right : d == 2 ? down : diagonal2;
+            int peak = (m > low) & (m > n1) & (m >= n2);
+            out[x] = static_cast<uint8_t>(peak * (1 + (m > high)));
+        }
+    }
+
+private:
+    uint8_t* grayRow(int y) { return &gray[ringSlot(y, 5) * (width + 4)]; }
+    uint8_t* blurredRow(int y) { return &blurred[ringSlot(y, 3) * (width + 2)]; }
+    // Points at x = 0; x = -1 and x = width read the zero padding.
+    int16_t* gradientRow(int y) { return &magnitude[ringSlot(y, 3) * (width + 2) + 1]; }
+
+    void ensureGray(int y) {
+        for (int row = lastGray + 1; row <= y; ++row) {
+            int sy = std::max(0, std::min(height - 1, row));
+            const uint8_t* r = src.row(0, sy);
+            const uint8_t* g = src.row(1, sy);
+            const uint8_t* b = src.row(2, sy);
+            uint8_t* out = grayRow(row) + 2;
+            for (int x = 0; x < width; ++x) {
+                out[x] = static_cast<uint8_t>(lumaOf(r[x], g[x], b[x]));
+            }
+            out[-2] = out[-1] = out[0];
+            out[width] = out[width + 1] = out[width - 1];
+        }
+        lastGray = std::max(lastGray, y);
+    }
+
+    // 5x5 binomial [1 4 6 4 1]^2 / 256, vertical then horizontal.
+    void ensureBlurred(int y) {
+        for (int row = lastBlurred + 1; row <= y; ++row) {
+            ensureGray(row + 2);
+            const uint8_t* g0 = grayRow(row - 2);
+            const uint8_t* g1 = grayRow(row - 1);
+            const uint8_t* g2 = grayRow(row);
+            const uint8_t* g3 = grayRow(row + 1);
+            const uint8_t* g4 = grayRow(row + 2);
+            for (int x = 0; x < width + 4; ++x) {
+                vertical[x] = static_cast<int16_t>(g0[x] + 4 * g1[x] + 6 * g2[x] + 4 * g3[x] + g4[x]);
+            }
+            uint8_t* out = blurredRow(row) + 1;
+            const int16_t* v = vertical.data();
+            for (int x = 0; x < width; ++x) {
+                int sum = v[x] + 4 * v[x + 1] + 6 * v[x + 2] + 4 * v[x + 3] + v[x + 4];
+                out[x] = static_cast<uint8_t>((sum + 128) >> 8);
+            }
+            out[-1] = out[0];
+            out[width] = out[width - 1];
+        }
+        lastBlurred = std::max(lastBlurred, y);
+    }
+
+    // Sobel magnitude |gx| + |gy| and the quantized gradient direction.
+    void ensureGradient(int y) {
+        for (int row = lastGradient + 1; row <= y; ++row) {
+            ensureBlurred(row + 1);
+            const uint8_t* a = blurredRow(row - 1) + 1;
+            const uint8_t* c = blurredRow(row) + 1;
+            const uint8_t* b = blurredRow(row + 1) + 1;
+            int16_t* mag = gradientRow(row);
+            uint8_t* dir = &direction[ringSlot(row, 3) * width];
+            for (int x = 0; x < width; ++x) {
+                int gx = (a[x + 1] - a[x - 1]) + 2 * (c[x + 1] - c[x - 1]) + (b[x + 1] - b[x - 1]);
+                int gy = (b[x - 1] + 2 * b[x] + b[x + 1]) - (a[x - 1] + 2 * a[x] + a[x + 1]);
+                int ax = std::abs(gx);
+                int ay = std::abs(gy);
+                mag[x] = static_cast<int16_t>(ax + ay);
+                // tan(22.5) ~ 424/1024, tan(67.5) ~ 2472/1024
+                bool horizontal = ay * 1024 < ax * 424;
+                bool vertical = ay * 1024 > ax * 2472;
+                bool sameSign = (gx ^ gy) >= 0;
+                dir[x] = horizontal ? 0 : vertical ? 2 : sameSign ? 1 : 3;
+            }
+        }
+        lastGradient = std::max(lastGradient, y);
+    }
+
+    const PlanarImage& src;
+    int width, height;
+    int low, high;
+    std::vector<uint8_t> gray;
+    std::vector<int16_t> vertical;
+    std::vector<uint8_t> blurred;
+    std::vector<int16_t> magnitude;
+    std::vector<uint8_t> direction;
+    int lastGray, lastBlurred, lastGradient;
+};
+
+}
+
+void cannyEdges(const PlanarImage& src, PlanarImage& dst, int lowThreshold, int highThreshold) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    int width = src.getWidth();
+    int height = src.getHeight();
+    if (lowThreshold > highThreshold) std::swap(lowThreshold, highThreshold);
+
+    // Classification per pixel, later overwritten with the final 0/255 mask.
+    PlanarImage edges(width, height, 1);
+    int bands = (height + kBandRows - 1) / kBandRows;
+    std::vector<BandLabels> labels(bands);
+
+    // Pass 1: fused pipeline per band; candidates are numbered and linked to
+    // their already classified 8-neighbours (W, NW, N, NE) inside the band.
+    // Only two rows of numbers are kept, plus the band's first row.
+    parallelFor(0, bands, 1, [&](int b0, int b1) {
+        std::vector<int> rows(2 * static_cast<size_t>(width));
+        for (int band = b0; band < b1; ++band) {
+            int y0 = band * kBandRows;
+            int y1 = std::min(height, y0 + kBandRows);
+            BandLabels& local = labels[band];
+            BandPipeline pipeline(src, y0, lowThreshold, highThreshold);
+            for (int y = y0; y < y1; ++y) {
+                uint8_t* row = edges.row(0, y);
+                pipeline.classifyRow(y, row);
+                int* current = &rows[static_cast<size_t>((y - y0) & 1) * width];
+                const int* above = y > y0 ? &rows[static_cast<size_t>((y - y0 + 1) & 1) * width] : nullptr;
+                for (int x = 0; x < width; ++x) {
+                    current[x] = -1;
+                    if (row[x] == kNone) continue;
+                    int p = static_cast<int>(local.parent.size());
+                    current[x] = p;
+                    local.parent.push_back(p);
+                    local.strong.push_back(row[x] == kStrong);
+                    if (x > 0 && current[x - 1] >= 0) unite(local.parent, local.strong, p, current[x - 1]);
+                    if (above) {
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            if (x + dx >= 0 && x + dx < width && above[x + dx] >= 0) {
+                                unite(local.parent, local.strong, p, above[x + dx]);
+                            }
+                        }
+                    }
+                }
+                if (y == y0) local.firstRow.assign(current, current + width);
+                if (y == y1 - 1) local.lastRow.assign(current, current + width);
+            }
+        }
+    });
+
+    // Pass 2: one table over the candidates of all bands, each band's numbers
+    // offset by the candidates before it, with components joined across band
+    // seams. It holds a number and a flag per candidate, not per pixel.
+    std::vector<int> offsets(bands + 1, 0);
+    for (int band = 0; band < bands; ++band) {
+        offsets[band + 1] = offsets[band] + static_cast<int>(labels[band].parent.size());
+    }
+    PooledArray<int> parent(static_cast<size_t>(offsets[bands]));
+    PooledArray<uint8_t> strong(parent.size());
+    for (int band = 0; band < bands; ++band) {
+        BandLabels& local = labels[band];
+        for (size_t i = 0; i < local.parent.size(); ++i) {
+            // Flattened, so the later read-only lookups are short.
+            parent[offsets[band] + i] = offsets[band] + findRoot(local.parent, static_cast<int>(i));
+            strong[offsets[band] + i] = local.strong[i];
+        }
+        std::vector<int>().swap(local.parent);
+        std::vector<uint8_t>().swap(local.strong);
+    }
+    for (int band = 1; band < bands; ++band) {
+        const std::vector<int>& row = labels[band].firstRow;
+        const std::vector<int>& above = labels[band - 1].lastRow;
+        for (int x = 0; x < width; ++x) {
+            if (row[x] < 0) continue;
+            for (int dx = -1; dx <= 1; ++dx) {
+                if (x + dx >= 0 && x + dx < width && above[x + dx] >= 0) {
+                    unite(parent, strong, offsets[band] + row[x], offsets[band - 1] + above[x + dx]);
+                }
+            }
+        }
+    }
+
+    // Pass 3: keep candidates whose component reached a strong pixel. Each
+    // band numbers its candidates again in the same scan order.
+    parallelFor(0, bands, 1, [&](int b0, int b1) {
+        for (int band = b0; band < b1; ++band) {
+            int p = offsets[band];
+            for (int y = band * kBandRows; y < std::min(height, (band + 1) * kBandRows); ++y) {
+                uint8_t* row = edges.row(0, y);
+                for (int x = 0; x < width; ++x) {
+                    if (row[x] == kNone) continue;
+                    int root = p++;
+                    while (parent[root] != root) root = parent[root];
+                    row[x] = strong[root] ? 255 : 0;
+                }
+            }
+        }
+    });
+
+    dst.allocate(width, height, src.getChannels());
+    for (int c = 0; c < 3; ++c) {
+        std::memcpy(dst.plane(c), edges.plane(0), static_cast<size_t>(edges.getStride()) * height);
+    }
+    for (int c = 3; c < src.getChannels(); ++c) {
+        if (&src != &dst) {
+            std::memcpy(dst.plane(c), src.plane(c), static_cast<size_t>(src.getStride()) * height);
+        }
+    }
+}
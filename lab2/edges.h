@@ -0,0 +1,24 @@
+#ifndef EDGES_H
+#define EDGES_H
+
+#include "planar_image.h"
+
+// Canny edge detection; dst gets 255 on edges and 0 elsewhere in channels
+// 0..2 (further channels are copied from src).
+//
+// Gray conversion, 5x5 binomial pre-blur, Sobel gradients and non-maximum
+// suppression run fused per 64-row band: each stage keeps only the few rows
+// the next one needs in small ring buffers, so no full-size gray, blurred or
+// gradient image exists. The row loops are written to auto-vectorize (NMS
+// picks its neighbours with selects, not branches). Thresholds apply to the
+// L1 gradient magnitude |gx| + |gy| (0..2040).
+//
+// Hysteresis is a parallel union-find over the weak/strong candidates:
+// bands number and link their own candidates while classifying them, band
+// seams are joined afterwards, and a pixel is kept if its component has a
+// strong one. The union-find holds 5 bytes per candidate, not per pixel; the
+// one image-sized scratch buffer is the 1-byte classification that becomes
+// the output mask.
+void cannyEdges(const PlanarImage& src, PlanarImage& dst, int lowThreshold, int highThreshold);
+
+#endif // EDGES_H
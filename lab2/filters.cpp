@@ -0,0 +1,376 @@
+#include "filters.h"
+#include "buffer_pool.h"
+#include "cpu_features.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifdef LAB2_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Median tiles: strips narrow enough that the column histograms of one strip
+// (plus the 2 * radius halo) stay in L2, bands tall enough that building the
+// column histograms at the top of a band is a small fraction of the work.
+const int kMedianStrip = 256;
+const int kMedianBand = 128;
+const int kMaxMedianRadius = 50;
+
+// Copies channels beyond RGB, which the filters do not touch.
+void copyExtraPlanes(const PlanarImage& src, PlanarImage& dst) {
+    for (int c = 3; c < src.getChannels(); ++c) {
+        std::memcpy(dst.plane(c), src.plane(c), static_cast<size_t>(src.getStride()) * src.getHeight());
+    }
+}
+
+// Skip mode: put back the frame of pixels whose window crosses the edge.
+// The interior was computed with full windows, so it matches the old loops.
+void restoreFrame(const PlanarImage& src, PlanarImage& dst, int radius) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    for (int c = 0; c < std::min(3, src.getChannels()); ++c) {
+        for (int y = 0; y < height; ++y) {
+            const uint8_t* in = src.row(c, y);
+            uint8_t* out = dst.row(c, y);
+            if (y < radius || y >= height - radius || width <= 2 * radius) {
+                std::memcpy(out, in, width);
+            } else {
+                std::memcpy(out, in, radius);
+                std::memcpy(out + width - radius, in + width - radius, radius);
+            }
+        }
+    }
+}
+
+// Source row extended by radius pixels on both sides.
+void padRow(const uint8_t* in, int width, int radius, BorderMode border, uint8_t* out) {
+    for (int i = 0; i < radius; ++i) {
+        out[i] = in[borderIndex(i - radius, width, border)];
+        out[radius + width + i] = in[borderIndex(width + i, width, border)];
+    }
+    std::memcpy(out + radius, in, width);
+}
+
+// Runs kernel(paddedRows, out) for every output row of channels
+// 0..2, in parallel row bands. paddedRows[k] is source row y - radius + k,
+// already extended by radius pixels on both sides.
+template <typename RowKernel>
+void runRowFilter(const PlanarImage& src, PlanarImage& dst, int radius, BorderMode border, RowKernel kernel) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    int side = 2 * radius + 1;
+    int paddedWidth = width + 2 * radius;
+    BorderMode edge = border == BorderMode::Skip ? BorderMode::Clamp : border;
+
+    parallelFor(0, 3 * height, std::max(1, (1 << 14) / (width * side)), [&](int begin, int end) {
+        // Ring of padded rows: moving down one row pads one new source row.
+        PooledArray<uint8_t> ring(static_cast<size_t>(side) * paddedWidth);
+        std::vector<const uint8_t*> rows(side);
+        int ringChannel = -1;
+        int ringNext = 0;
+
+        for (int i = begin; i < end; ++i) {
+            int channel = i / height;
+            int y = i % height;
+            if (channel != ringChannel || y != ringNext) {
+                for (int k = 0; k < side - 1; ++k) {
+                    int sy = y - radius + k;
+                    padRow(src.row(channel, borderIndex(sy, height, edge)), width, radius, edge,
+                           &ring[static_cast<size_t>((sy + side * height) % side) * paddedWidth]);
+                }
+                ringChannel = channel;
+            }
+            int newest = y + radius;
+            padRow(src.row(channel, borderIndex(newest, height, edge)), width, radius, edge,
+                   &ring[static_cast<size_t>((newest + side * height) % side) * paddedWidth]);
+            ringNext = y + 1;
+
+            for (int k = 0; k < side; ++k) {
+                rows[k] = &ring[static_cast<size_t>((y - radius + k + side * height) % side) * paddedWidth];
+            }
+            kernel(rows.data(), dst.row(channel, y));
+        }
+    });
+
+    copyExtraPlanes(src, dst);
+    if (border == BorderMode::Skip) {
+        restoreFrame(src, dst, radius);
+    }
+}
+
+// Position of the median within 16 histogram bins: the first bin at which
+// offset plus the running total exceeds half. *before receives offset plus
+// the counts of the bins ahead of it. medianTile is instantiated per search.
+struct ScalarBinSearch {
+    static int find(const uint16_t* counts, int offset, int half, int* before) {
+        int bin = 0;
+        int total = offset;
+        *before = offset;
+        for (int i = 0; i < 16; ++i) {
+            total += counts[i];
+            int below = total <= half;
+            bin += below;
+            *before += below ? counts[i] : 0;
+        }
+        return bin;
+    }
+};
+
+#ifdef LAB2_X86_DISPATCH
+struct Avx2BinSearch {
+    LAB2_TARGET("avx2")
+    static int find(const uint16_t* counts, int offset, int half, int* before) {
+        // Prefix sums within each 128-bit lane, then carry the low lane's total up.
+        __m256i sum = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts));
+        sum = _mm256_add_epi16(sum, _mm256_slli_si256(sum, 2));
+        sum = _mm256_add_epi16(sum, _mm256_slli_si256(sum, 4));
+        sum = _mm256_add_epi16(sum, _mm256_slli_si256(sum, 8));
+        __m256i low = _mm256_permute2x128_si256(sum, sum, 0x08);
+        sum = _mm256_add_epi16(sum, _mm256_shuffle_epi8(low, _mm256_set1_epi16(0x0F0E)));
+        sum = _mm256_add_epi16(sum, _mm256_set1_epi16(static_cast<short>(offset)));
+
+        // Window counts are at most 101 * 101, so signed 16-bit compares are safe.
+        __m256i above = _mm256_cmpgt_epi16(sum, _mm256_set1_epi16(static_cast<short>(half)));
+        int bin = __builtin_ctz(_mm256_movemask_epi8(above)) >> 1;
+        alignas(32) uint16_t prefix[16];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(prefix), sum);
+        *before = bin > 0 ? prefix[bin - 1] : offset;
+        return bin;
+    }
+};
+#endif
+
+// Column histograms of one median tile: a 256-bin fine level and a 16-bin
+// coarse level per column, counts of the 2 * radius + 1 rows in the window.
+struct ColumnHistograms {
+    std::vector<uint16_t> fine;
+    std::vector<uint16_t> coarse;
+
+    explicit ColumnHistograms(int columns)
+        : fine(static_cast<size_t>(columns) * 256, 0), coarse(static_cast<size_t>(columns) * 16, 0) {}
+
+    void add(int column, uint8_t value) {
+        fine[column * 256 + value]++;
+        coarse[column * 16 + (value >> 4)]++;
+    }
+
+    void remove(int column, uint8_t value) {
+        fine[column * 256 + value]--;
+        coarse[column * 16 + (value >> 4)]--;
+    }
+};
+
+template <typename BinSearch>
+void medianTile(const PlanarImage& src, PlanarImage& dst, int channel, int x0, int x1, int y0, int y1,
+                int radius, BorderMode border) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    int side = 2 * radius + 1;
+    int columns = (x1 - x0) + 2 * radius;
+    int half = (side * side) / 2;
+
+    // Padded column c of this tile reads source column sourceX[c].
+    std::vector<int> sourceX(columns);
+    for (int c = 0; c < columns; ++c) {
+        sourceX[c] = borderIndex(x0 - radius + c, width, border);
+    }
+
+    ColumnHistograms hist(columns);
+    auto addRow = [&](int y) {
+        const uint8_t* in = src.row(channel, borderIndex(y, height, border));
+        for (int c = 0; c < columns; ++c) hist.add(c, in[sourceX[c]]);
+    };
+    auto removeRow = [&](int y) {
+        const uint8_t* in = src.row(channel, borderIndex(y, height, border));
+        for (int c = 0; c < columns; ++c) hist.remove(c, in[sourceX[c]]);
+    };
+
+    for (int y = y0 - radius; y < y0 + radius; ++y) addRow(y);
+
+    alignas(32) uint16_t coarse[16];
+    alignas(32) uint16_t fine[16][16];
+    // fine[k] holds bins 16k..16k+15 summed over columns [next[k] - side, next[k]).
+    int next[16];
+
+    for (int y = y0; y < y1; ++y) {
+        if (y > y0) removeRow(y - radius - 1);
+        addRow(y + radius);
+
+        std::memset(coarse, 0, sizeof(coarse));
+        for (int c = 0; c < side; ++c) {
+            const uint16_t* h = &hist.coarse[c * 16];
+            for (int k = 0; k < 16; ++k) coarse[k] += h[k];
+        }
+        std::fill(next, next + 16, 0);
+
+        uint8_t* out = dst.row(channel, y) + x0;
+        for (int x = 0; x < x1 - x0; ++x) {
+            // Window covers padded columns [x, x + side).
+            if (x > 0) {
+                const uint16_t* in = &hist.coarse[(x + side - 1) * 16];
+                const uint16_t* outgoing = &hist.coarse[(x - 1) * 16];
+                for (int k = 0; k < 16; ++k) coarse[k] += in[k] - outgoing[k];
+            }
+
+            int count;
+            int k = BinSearch::find(coarse, 0, half, &count);
+
+            // Bring the fine slice of bucket k up to this window: rebuild it if
+            // it shares no column with the current window, slide it otherwise.
+            uint16_t* slice = fine[k];
+            if (next[k] <= x) {
+                std::memset(slice, 0, sizeof(fine[k]));
+                for (int c = x; c < x + side; ++c) {
+                    const uint16_t* h = &hist.fine[c * 256 + k * 16];
+                    for (int b = 0; b < 16; ++b) slice[b] += h[b];
+                }
+            } else {
+                for (int c = next[k]; c < x + side; ++c) {
+                    const uint16_t* in = &hist.fine[c * 256 + k * 16];
+                    const uint16_t* outgoing = &hist.fine[(c - side) * 256 + k * 16];
+                    for (int b = 0; b < 16; ++b) slice[b] += in[b] - outgoing[b];
+                }
+            }
+            next[k] = x + side;
+
+            int b = BinSearch::find(slice, count, half, &count);
+            out[x] = static_cast<uint8_t>(k * 16 + b);
+        }
+    }
+}
+
+#ifdef LAB2_X86_DISPATCH
+// Flattening inlines the AVX2 bin search, and everything else, into an AVX2
+// copy of the tile loop; the search alone is too small to call out of line.
+LAB2_TARGET("avx2") __attribute__((flatten))
+void medianTileAvx2(const PlanarImage& src, PlanarImage& dst, int channel, int x0, int x1, int y0, int y1,
+                    int radius, BorderMode border) {
+    medianTile<Avx2BinSearch>(src, dst, channel, x0, x1, y0, y1, radius, border);
+}
+#endif
+
+}
+
+int borderIndex(int i, int n, BorderMode mode) {
+    if (i >= 0 && i < n) return i;
+    if (n == 1) return 0;
+    if (mode == BorderMode::Reflect) {
+        int period = 2 * n - 2;
+        i %= period;
+        if (i < 0) i += period;
+        return i < n ? i : period - i;
+    }
+    return i < 0 ? 0 : n - 1;
+}
+
+void boxFilter(const PlanarImage& src, PlanarImage& dst, int kernelSize, BorderMode border) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    if (kernelSize % 2 == 0 || kernelSize < 3) {
+        kernelSize = 3;
+    }
+    int radius = kernelSize / 2;
+    int count = kernelSize * kernelSize;
+    int width = src.getWidth();
+    dst.allocate(width, src.getHeight(), src.getChannels());
+
+    runRowFilter(src, dst, radius, border, [&](const uint8_t* const* rows, uint8_t* out) {
+        // Per-thread accumulator, reused across rows.
+        thread_local std::vector<int> sum;
+        sum.assign(width, 0);
+        for (int ky = 0; ky < kernelSize; ++ky) {
+            for (int kx = 0; kx < kernelSize; ++kx) {
+                const uint8_t* p = rows[ky] + kx;
+                for (int x = 0; x < width; ++x) {
+                    sum[x] += p[x];
+                }
+            }
+        }
+        for (int x = 0; x < width; ++x) {
+            out[x] = static_cast<uint8_t>(sum[x] / count);
+        }
+    });
+}
+
+void gaussianFilter(const PlanarImage& src, PlanarImage& dst, int kernelSize, double sigma, BorderMode border) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    if (kernelSize % 2 == 0 || kernelSize < 3) {
+        kernelSize = 3;
+    }
+    int radius = kernelSize / 2;
+
+    std::vector<double> kernel(kernelSize * kernelSize);
+    double sum_kernel = 0.0;
+    for (int i = -radius; i <= radius; i++) {
+        for (int j = -radius; j <= radius; j++) {
+            double value = exp(-(i*i + j*j) / (2 * sigma * sigma));
+            kernel[(i + radius) * kernelSize + j + radius] = value;
+            sum_kernel += value;
+        }
+    }
+    for (double& value : kernel) {
+        value /= sum_kernel;
+    }
+
+    int width = src.getWidth();
+    dst.allocate(width, src.getHeight(), src.getChannels());
+
+    // Accumulating whole rows in the same (ky, kx) order as the per-pixel
+    // loop keeps results bit-identical while letting the x loop vectorize.
+    runRowFilter(src, dst, radius, border, [&](const uint8_t* const* rows, uint8_t* out) {
+        thread_local std::vector<double> sum;
+        sum.assign(width, 0.0);
+        for (int ky = 0; ky < kernelSize; ++ky) {
+            for (int kx = 0; kx < kernelSize; ++kx) {
+                const uint8_t* p = rows[ky] + kx;
+                double weight = kernel[ky * kernelSize + kx];
+                for (int x = 0; x < width; ++x) {
+                    sum[x] += p[x] * weight;
+                }
+            }
+        }
+        for (int x = 0; x < width; ++x) {
+            out[x] = static_cast<uint8_t>(std::max(0.0, std::min(255.0, sum[x])));
+        }
+    });
+}
+
+void medianFilter(const PlanarImage& src, PlanarImage& dst, int radius, BorderMode border) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    radius = std::max(1, std::min(kMaxMedianRadius, radius));
+    int width = src.getWidth();
+    int height = src.getHeight();
+    dst.allocate(width, height, src.getChannels());
+
+    BorderMode edge = border == BorderMode::Skip ? BorderMode::Clamp : border;
+    int strips = (width + kMedianStrip - 1) / kMedianStrip;
+    int bands = (height + kMedianBand - 1) / kMedianBand;
+
+    auto tile = &medianTile<ScalarBinSearch>;
+#ifdef LAB2_X86_DISPATCH
+    if (cpuFeatures().avx2) tile = &medianTileAvx2;
+#endif
+
+    parallelFor(0, 3 * strips * bands, 1, [&](int t0, int t1) {
+        for (int t = t0; t < t1; ++t) {
+            int channel = t / (strips * bands);
+            int strip = (t / bands) % strips;
+            int band = t % bands;
+            tile(src, dst, channel,
+                 strip * kMedianStrip, std::min(width, (strip + 1) * kMedianStrip),
+                 band * kMedianBand, std::min(height, (band + 1) * kMedianBand),
+                 radius, edge);
+        }
+    });
+
+    copyExtraPlanes(src, dst);
+    if (border == BorderMode::Skip) {
+        restoreFrame(src, dst, radius);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include "planar_image.h"
+
+// How neighborhood filters treat pixels whose window crosses the image edge.
+enum class BorderMode {
+    Skip,     // leave a radius-wide frame unfiltered (the original lab behaviour)
+    Clamp,    // repeat the edge pixel
+    Reflect   // mirror around the edge pixel: ... 2 1 | 0 1 2 ...
+};
+
+// Source index for position i on an axis of n samples under the border mode.
+int borderIndex(int i, int n, BorderMode mode);
+
+// Filters channels 0..2 of src into dst (dst must not alias src); any further
+// planes are copied. Work is split into row bands (median: column strips x
+// row bands) that run on the shared thread pool.
+void boxFilter(const PlanarImage& src, PlanarImage& dst, int kernelSize, BorderMode border);
+void gaussianFilter(const PlanarImage& src, PlanarImage& dst, int kernelSize, double sigma, BorderMode border);
+
+// Constant-time median (Perreault & Hebert 2007): per-column histograms slide
+// down the image, the window histogram slides along the row by adding one
+// column histogram and removing another, and a 16-bin coarse level narrows
+// the search so only one 16-bin slice of the fine level is touched per pixel.
+// Cost per pixel does not depend on the radius. Radius is clamped to [1, 50].
+void medianFilter(const PlanarImage& src, PlanarImage& dst, int radius, BorderMode border);
+
+#endif // FILTERS_H
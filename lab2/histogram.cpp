@@ -0,0 +1,133 @@
+#include "histogram.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Four interleaved sub-histograms: consecutive equal pixels increment
+// different counters, so the loop does not stall on store-to-load forwarding.
+void countRows(const PlanarImage& image, int channel, int y0, int y1, uint32_t sub[4][256]) {
+    int width = image.getWidth();
+    for (int y = y0; y < y1; ++y) {
+        const unsigned char* p = image.row(channel, y);
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            sub[0][p[x]]++;
+            sub[1][p[x + 1]]++;
+            sub[2][p[x + 2]]++;
+            sub[3][p[x + 3]]++;
+        }
+        for (; x < width; ++x) {
+            sub[0][p[x]]++;
+        }
+    }
+}
+
+void countDerived(const unsigned char* values, int width, uint32_t sub[4][256]) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        sub[0][values[x]]++;
+        sub[1][values[x + 1]]++;
+        sub[2][values[x + 2]]++;
+        sub[3][values[x + 3]]++;
+    }
+    for (; x < width; ++x) {
+        sub[0][values[x]]++;
+    }
+}
+
+}
+
+ChannelHistograms computeHistograms(const PlanarImage& image, int channels) {
+    ChannelHistograms histogram(channels, std::vector<int>(256, 0));
+    if (image.empty()) return histogram;
+
+    std::mutex merge;
+    int grain = std::max(1, (1 << 16) / std::max(1, image.getWidth()));
+
+    parallelFor(0, image.getHeight(), grain, [&](int y0, int y1) {
+        uint32_t sub[4][256];
+        for (int channel = 0; channel < channels; ++channel) {
+            std::memset(sub, 0, sizeof(sub));
+            countRows(image, channel, y0, y1, sub);
+
+            std::lock_guard<std::mutex> lock(merge);
+            std::vector<int>& h = histogram[channel];
+            for (int i = 0; i < 256; ++i) {
+                h[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+            }
+        }
+    });
+
+    return histogram;
+}
+
+std::vector<int> computeDerivedHistogram(int width, int height,
+                                         const std::function<void(int, unsigned char*)>& derive) {
+    std::vector<int> histogram(256, 0);
+    if (width <= 0 || height <= 0) return histogram;
+
+    std::mutex merge;
+    int grain = std::max(1, (1 << 16) / width);
+
+    parallelFor(0, height, grain, [&](int y0, int y1) {
+        uint32_t sub[4][256];
+        std::memset(sub, 0, sizeof(sub));
+        std::vector<unsigned char> values(width);
+
+        for (int y = y0; y < y1; ++y) {
+            derive(y, values.data());
+            countDerived(values.data(), width, sub);
+        }
+
+        std::lock_guard<std::mutex> lock(merge);
+        for (int i = 0; i < 256; ++i) {
+            histogram[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+        }
+    });
+
+    return histogram;
+}
+
+std::vector<int> computeLumaHistogram(const PlanarImage& image) {
+    if (image.empty() || image.getChannels() < 3) return std::vector<int>(256, 0);
+
+    int width = image.getWidth();
+    return computeDerivedHistogram(width, image.getHeight(), [&](int y, unsigned char* luma) {
+        const unsigned char* r = image.row(0, y);
+        const unsigned char* g = image.row(1, y);
+        const unsigned char* b = image.row(2, y);
+        for (int x = 0; x < width; ++x) {
+            luma[x] = static_cast<unsigned char>(lumaOf(r[x], g[x], b[x]));
+        }
+    });
+}
+
+HistogramService::HistogramService() : cachedVersion(0), valid(false), cachedLumaVersion(0), lumaValid(false) {}
+
+ChannelHistograms HistogramService::get(const PlanarImage& image, uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!valid || cachedVersion != version) {
+        cached = computeHistograms(image);
+        cachedVersion = version;
+        valid = true;
+    }
+    return cached;
+}
+
+std::vector<int> HistogramService::getLuma(const PlanarImage& image, uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!lumaValid || cachedLumaVersion != version) {
+        cachedLuma = computeLumaHistogram(image);
+        cachedLumaVersion = version;
+        lumaValid = true;
+    }
+    return cachedLuma;
+}
+
+void HistogramService::invalidate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    valid = false;
+    lumaValid = false;
+}
@@ -0,0 +1,47 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "planar_image.h"
+
+typedef std::vector<std::vector<int>> ChannelHistograms;
+
+// Integer Rec.601 luma, weights sum to 256: Y = (77R + 150G + 29B) >> 8.
+inline int lumaOf(int r, int g, int b) {
+    return (77 * r + 150 * g + 29 * b) >> 8;
+}
+
+// Counts the first `channels` planes of the image. Row bands are counted in
+// parallel, each thread into private sub-histograms that are merged at the end.
+ChannelHistograms computeHistograms(const PlanarImage& image, int channels = 3);
+// Histogram of a per-pixel byte that derive(y, out) writes for row y, e.g.
+// luma or HSV value. Rows are derived and counted in parallel bands.
+std::vector<int> computeDerivedHistogram(int width, int height,
+                                         const std::function<void(int, unsigned char*)>& derive);
+// Histogram of lumaOf() over channels 0..2.
+std::vector<int> computeLumaHistogram(const PlanarImage& image);
+
+// Caches the histograms of one image against a version number the owner bumps
+// on every edit, so repeated requests for an unchanged image cost nothing.
+class HistogramService {
+public:
+    HistogramService();
+
+    ChannelHistograms get(const PlanarImage& image, uint64_t version);
+    std::vector<int> getLuma(const PlanarImage& image, uint64_t version);
+    void invalidate();
+
+private:
+    std::mutex mutex;
+    ChannelHistograms cached;
+    uint64_t cachedVersion;
+    bool valid;
+    std::vector<int> cachedLuma;
+    uint64_t cachedLumaVersion;
+    bool lumaValid;
+};
+
+#endif // HISTOGRAM_H
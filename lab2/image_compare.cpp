@@ -0,0 +1,107 @@
+#include "image_compare.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+
+namespace {
+
+const int kWindow = 8;
+const int kStep = 4;
+
+// SSIM of one window of two planes, from its first and second moments.
+double windowSsim(const PlanarImage& a, const PlanarImage& b, int c, int x0, int y0, int w, int h) {
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+    for (int y = y0; y < y0 + h; ++y) {
+        const uint8_t* ra = a.row(c, y);
+        const uint8_t* rb = b.row(c, y);
+        for (int x = x0; x < x0 + w; ++x) {
+            double va = ra[x];
+            double vb = rb[x];
+            sumA += va;
+            sumB += vb;
+            sumAA += va * va;
+            sumBB += vb * vb;
+            sumAB += va * vb;
+        }
+    }
+    double n = static_cast<double>(w) * h;
+    double meanA = sumA / n;
+    double meanB = sumB / n;
+    double varA = sumAA / n - meanA * meanA;
+    double varB = sumBB / n - meanB * meanB;
+    double cov = sumAB / n - meanA * meanB;
+    return ((2 * meanA * meanB + c1) * (2 * cov + c2)) /
+           ((meanA * meanA + meanB * meanB + c1) * (varA + varB + c2));
+}
+
+// Window origins along an axis of n samples: every kStep, the last one
+// flush with the end so the edge is covered.
+int windowCount(int n, int window) {
+    return n <= window ? 1 : (n - window + kStep - 1) / kStep + 1;
+}
+
+int windowStart(int i, int n, int window) {
+    return std::min(i * kStep, n - window);
+}
+
+}
+
+bool compareImages(const PlanarImage& a, const PlanarImage& b, ImageDifference& difference) {
+    if (a.empty() || b.empty() || !a.sameGeometry(b)) return false;
+
+    int width = a.getWidth();
+    int height = a.getHeight();
+    int channels = a.getChannels();
+    int windowWidth = std::min(kWindow, width);
+    int windowHeight = std::min(kWindow, height);
+    int columns = windowCount(width, windowWidth);
+    int rows = windowCount(height, windowHeight);
+
+    std::mutex mutex;
+    int maxError = 0;
+    double squared = 0;
+    double ssimSum = 0;
+
+    // One task per plane and window row: its windows, and the sample rows
+    // that start there (all of the rest in the last window row).
+    parallelFor(0, channels * rows, 1, [&](int t0, int t1) {
+        int localMax = 0;
+        double localSquared = 0;
+        double localSsim = 0;
+        for (int t = t0; t < t1; ++t) {
+            int c = t / rows;
+            int i = t % rows;
+            int y0 = windowStart(i, height, windowHeight);
+            for (int j = 0; j < columns; ++j) {
+                localSsim += windowSsim(a, b, c, windowStart(j, width, windowWidth), y0, windowWidth, windowHeight);
+            }
+
+            int first = i * kStep;
+            int last = i + 1 < rows ? (i + 1) * kStep : height;
+            for (int y = first; y < last; ++y) {
+                const uint8_t* ra = a.row(c, y);
+                const uint8_t* rb = b.row(c, y);
+                for (int x = 0; x < width; ++x) {
+                    int d = std::abs(ra[x] - rb[x]);
+                    localMax = std::max(localMax, d);
+                    localSquared += static_cast<double>(d) * d;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        maxError = std::max(maxError, localMax);
+        squared += localSquared;
+        ssimSum += localSsim;
+    });
+
+    double mse = squared / (static_cast<double>(width) * height * channels);
+    difference.maxError = maxError;
+    difference.psnr = mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+    difference.ssim = maxError == 0 ? 1.0 : ssimSum / (static_cast<double>(columns) * rows * channels);
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef IMAGE_COMPARE_H
+#define IMAGE_COMPARE_H
+
+#include "planar_image.h"
+
+// How far one image is from another of the same geometry, over all planes.
+struct ImageDifference {
+    int maxError;   // largest absolute difference of any sample
+    double psnr;    // dB; infinity for identical images
+    // Mean SSIM of 8x8 windows every 4 pixels (the whole plane when it is
+    // smaller), per plane, then averaged over planes. 1 for identical images.
+    double ssim;
+};
+
+// False (difference untouched) if the geometries differ or either is empty.
+// Rows are compared in parallel on the shared pool.
+bool compareImages(const PlanarImage& a, const PlanarImage& b, ImageDifference& difference);
+
+#endif // IMAGE_COMPARE_H
@@ -0,0 +1,138 @@
+#include "image_io.h"
+#include "band_io.h"
+#include "mapped_file.h"
+#include "predictive_codec.h"
+#include "rle_stream.h"
+#include <cctype>
+#include <cstring>
+#include <new>
+#include <vector>
+#ifdef LAB2_HAVE_PNG
+#include <png.h>
+#endif
+
+namespace {
+
+bool readNetpbm(const std::string& path, PlanarImage& image) {
+    NetpbmBandSource source;
+    if (!source.open(path)) return false;
+
+    try {
+        PlanarImage decoded(source.getWidth(), source.getHeight(), source.getChannels());
+        if (!source.read(decoded, 0, decoded.getHeight())) return false;
+        image = std::move(decoded);
+        return true;
+    }
+    catch (const std::bad_alloc&) {
+        return false;
+    }
+}
+
+bool writeNetpbm(const std::string& path, const PlanarImage& image, bool gray) {
+    NetpbmBandSink sink;
+    if (!sink.open(path, image.getWidth(), image.getHeight(), gray)) return false;
+    bool ok = sink.write(image, 0, image.getHeight());
+    return sink.close() && ok;
+}
+
+#ifdef LAB2_HAVE_PNG
+bool readPng(const std::string& path, PlanarImage& image) {
+    png_image png;
+    std::memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&png, path.c_str())) return false;
+
+    bool alpha = png.format & PNG_FORMAT_FLAG_ALPHA;
+    png.format = alpha ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+    try {
+        std::vector<unsigned char> pixels(PNG_IMAGE_SIZE(png));
+        if (!png_image_finish_read(&png, nullptr, pixels.data(), 0, nullptr)) return false;
+
+        image.fromInterleaved(pixels.data(), png.width, png.height, PNG_IMAGE_ROW_STRIDE(png), alpha ? 4 : 3);
+        return true;
+    }
+    catch (const std::bad_alloc&) {
+        png_image_free(&png);
+        return false;
+    }
+}
+
+bool writePng(const std::string& path, const PlanarImage& image) {
+    png_image png;
+    std::memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    png.width = image.getWidth();
+    png.height = image.getHeight();
+    png.format = image.getChannels() == 4 ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+
+    try {
+        int stride = image.getWidth() * image.getChannels();
+        std::vector<unsigned char> pixels(static_cast<size_t>(stride) * image.getHeight());
+        image.toInterleaved(pixels.data(), stride);
+        return png_image_write_to_file(&png, path.c_str(), 0, pixels.data(), stride, nullptr) != 0;
+    }
+    catch (const std::bad_alloc&) {
+        return false;
+    }
+}
+#endif
+
+}
+
+std::string fileExtension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return std::string();
+
+    std::string extension = path.substr(dot);
+    for (char& c : extension) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return extension;
+}
+
+bool isImageFileSupported(const std::string& path) {
+    std::string extension = fileExtension(path);
+#ifdef LAB2_HAVE_PNG
+    if (extension == ".png") return true;
+#endif
+    return extension == ".rle" || extension == ".lpc" || extension == ".ppm" || extension == ".pgm";
+}
+
+bool readImageFile(const std::string& path, PlanarImage& image) {
+    std::string extension = fileExtension(path);
+    if (extension == ".rle") return loadRleFile(path, image);
+    if (extension == ".lpc") return loadLosslessFile(path, image);
+    if (extension == ".ppm" || extension == ".pgm") return readNetpbm(path, image);
+#ifdef LAB2_HAVE_PNG
+    if (extension == ".png") return readPng(path, image);
+#endif
+    return false;
+}
+
+bool writeImageFile(const std::string& path, const PlanarImage& image) {
+    if (image.empty()) return false;
+
+    std::string extension = fileExtension(path);
+    if (extension == ".rle") return saveRleFile(path, image);
+    if (extension == ".lpc") return saveLosslessFile(path, image);
+    if (extension == ".ppm") return writeNetpbm(path, image, false);
+    if (extension == ".pgm") return writeNetpbm(path, image, true);
+#ifdef LAB2_HAVE_PNG
+    if (extension == ".png") return writePng(path, image);
+#endif
+    return false;
+}
+
+bool saveLosslessFile(const std::string& path, const PlanarImage& image) {
+    auto encoded = encodePredictive(image);
+    if (encoded.empty()) return false;
+
+    BufferedFileWriter writer;
+    return writer.open(path) && writer.write(encoded.data(), encoded.size()) && writer.close();
+}
+
+bool loadLosslessFile(const std::string& path, PlanarImage& image) {
+    MappedFile file;
+    return file.open(path) && decodePredictive(file.data(), file.size(), image);
+}
@@ -0,0 +1,25 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <string>
+#include "planar_image.h"
+
+// Image files without GTK, picked by extension (case-insensitive):
+//   .rle         RLE container (rle_codec.h)
+//   .lpc         lossless predictive codec (predictive_codec.h)
+//   .ppm .pgm    binary netpbm (P6, P5), 8 bits per sample; gray is read
+//                as RGB and written as luma, alpha is dropped
+//   .png         through libpng, only when built with LAB2_HAVE_PNG
+// Readers leave image untouched on failure.
+
+// Lower-case extension including the dot, e.g. ".png"; empty if none.
+std::string fileExtension(const std::string& path);
+bool isImageFileSupported(const std::string& path);
+
+bool readImageFile(const std::string& path, PlanarImage& image);
+bool writeImageFile(const std::string& path, const PlanarImage& image);
+
+bool saveLosslessFile(const std::string& path, const PlanarImage& image);
+bool loadLosslessFile(const std::string& path, PlanarImage& image);
+
+#endif // IMAGE_IO_H
@@ -0,0 +1,426 @@
+#include "image_processor.h"
+#include "buffer_pool.h"
+#include "image_io.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <new>
+#include <utility>
+
+namespace {
+
+// Operation names in the pipeline's stage syntax, for the metrics and for
+// running the operation on a region.
+std::string number(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%g", value);
+    return text;
+}
+
+const char* borderName(BorderMode border) {
+    switch (border) {
+        case BorderMode::Clamp: return "clamp";
+        case BorderMode::Reflect: return "reflect";
+        default: return "skip";
+    }
+}
+
+}
+
+ImageProcessor::ImageProcessor()
+        : width(0), height(0), originalVersion(0), filteredVersion(0), regionStatistics(true) {}
+
+void ImageProcessor::setImage(PlanarImage&& image) {
+    OperationTimer timer("set image", image.getWidth(), image.getHeight());
+    bool resized = !original.sameGeometry(image);
+    original = std::move(image);
+    width = original.getWidth();
+    height = original.getHeight();
+
+    filtered.copyFrom(original);
+    ++originalVersion;
+    ++filteredVersion;
+
+    history.reset(filtered.planeViews());
+    originalSnapshot = history.current();
+
+    // Blocks kept for the previous image size would only sit there.
+    if (resized) {
+        region = ImageRegion();
+        BufferPool::instance().trim();
+    }
+}
+
+void ImageProcessor::setRegion(const ImageRegion& selected) {
+    region = selected;
+    clipRegion(region, width, height);
+}
+
+void ImageProcessor::clearRegion() {
+    region = ImageRegion();
+}
+
+void ImageProcessor::applyLowPassFilter(int kernelSize, BorderMode border) {
+    if (filtered.empty()) return;
+
+    std::string stage = "box:k=" + std::to_string(kernelSize) + ",border=" + borderName(border);
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, filtered, timer)) return;
+
+    PlanarImage result;
+    boxFilter(filtered, result, kernelSize, border);
+    std::swap(filtered, result);
+
+    filteredChanged();
+}
+
+void ImageProcessor::applyGaussianFilter(int kernelSize, double sigma, BorderMode border) {
+    if (filtered.empty()) return;
+
+    std::string stage = "gaussian:k=" + std::to_string(kernelSize) + ",s=" + number(sigma) +
+                        ",border=" + borderName(border);
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, filtered, timer)) return;
+
+    PlanarImage result;
+    gaussianFilter(filtered, result, kernelSize, sigma, border);
+    std::swap(filtered, result);
+
+    filteredChanged();
+}
+
+void ImageProcessor::applyMedianFilter(int radius, BorderMode border) {
+    if (filtered.empty()) return;
+
+    std::string stage = "median:r=" + std::to_string(radius) + ",border=" + borderName(border);
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, filtered, timer)) return;
+
+    PlanarImage result;
+    medianFilter(filtered, result, radius, border);
+    std::swap(filtered, result);
+
+    filteredChanged();
+}
+
+void ImageProcessor::applyBilateralFilter(double sigmaSpatial, double sigmaRange) {
+    if (filtered.empty()) return;
+
+    std::string stage = "bilateral:s=" + number(sigmaSpatial) + ",r=" + number(sigmaRange);
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, filtered, timer)) return;
+
+    bilateralFilter(filtered, filtered, sigmaSpatial, sigmaRange);
+
+    filteredChanged();
+}
+
+void ImageProcessor::applyMorphology(MorphologyOp op, int kernelWidth, int kernelHeight, bool binary) {
+    if (filtered.empty()) return;
+
+    static const char* names[] = {"erode", "dilate", "open", "close"};
+    std::string stage = std::string(names[static_cast<int>(op)]) + ":w=" + std::to_string(kernelWidth) +
+                        ",h=" + std::to_string(kernelHeight) + ",binary=" + (binary ? "1" : "0");
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, filtered, timer)) return;
+
+    if (binary) {
+        binaryMorphology(filtered, filtered, op, kernelWidth, kernelHeight);
+    } else {
+        morphology(filtered, filtered, op, kernelWidth, kernelHeight);
+    }
+
+    filteredChanged();
+}
+
+void ImageProcessor::applyEdgeDetection(int lowThreshold, int highThreshold) {
+    if (filtered.empty()) return;
+
+    std::string stage = "edges:low=" + std::to_string(lowThreshold) + ",high=" + std::to_string(highThreshold);
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, filtered, timer)) return;
+
+    cannyEdges(filtered, filtered, lowThreshold, highThreshold);
+
+    filteredChanged();
+}
+
+std::vector<std::vector<int>> ImageProcessor::getHistogram() {
+    return originalHistograms.get(original, originalVersion);
+}
+
+void ImageProcessor::applyHistogramEqualization(int type) {
+    if (original.empty()) return;
+
+    static const char* modes[] = {"rgb", "luma", "hsv", "hls"};
+    std::string stage = std::string("equalize:mode=") + modes[std::max(0, std::min(3, type))];
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, original, timer)) return;
+
+    TonePipeline pipeline;
+    switch (type) {
+        case 0:
+            // RGB equalization - все каналы
+            pipeline.add(makeEqualizationStage(getHistogram()));
+            pipeline.apply(original, filtered);
+            break;
+        case 1:
+            // Яркость (luma) - масштабирование RGB
+            pipeline.add(makeLumaEqualizationStage(originalHistograms.getLuma(original, originalVersion)));
+            pipeline.apply(original, filtered);
+            break;
+        case 2:
+            // HSV - только канал V
+            equalizeValue(original, filtered);
+            break;
+        default:
+            // HLS - только канал L
+            equalizeLightness(original, filtered);
+            break;
+    }
+
+    filteredChanged();
+}
+
+void ImageProcessor::applyCLAHE(int tiles, double clipLimit, bool slidingWindow) {
+    if (original.empty()) return;
+
+    std::string stage = "clahe:tiles=" + std::to_string(tiles) + ",clip=" + number(clipLimit) +
+                        ",sliding=" + (slidingWindow ? "1" : "0");
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, original, timer)) return;
+
+    if (slidingWindow) {
+        // Окно того же размера, что и плитка
+        int radius = std::max(1, std::min(width, height) / (2 * std::max(1, tiles)));
+        applyClaheSliding(original, filtered, radius, clipLimit);
+    } else {
+        ClaheParams params;
+        params.tilesX = tiles;
+        params.tilesY = tiles;
+        params.clipLimit = clipLimit;
+        applyClahe(original, filtered, params);
+    }
+
+    filteredChanged();
+}
+
+void ImageProcessor::applyLinearContrast(int min_out, int max_out) {
+    if (original.empty()) return;
+
+    std::string stage = "contrast:min=" + std::to_string(min_out) + ",max=" + std::to_string(max_out);
+    OperationTimer timer(stage, width, height);
+    if (applyToRegion(stage, original, timer)) return;
+
+    TonePipeline pipeline;
+    pipeline.add(makeLinearContrastStage(originalHistograms.getLuma(original, originalVersion), min_out, max_out));
+
+    pipeline.apply(original, filtered);
+    filteredChanged();
+}
+
+void ImageProcessor::applyTonePipeline(const TonePipeline& pipeline) {
+    if (filtered.empty() || pipeline.empty()) return;
+
+    OperationTimer timer("tone", width, height);
+    PipelineStage stage;
+    stage.name = "tone";
+    stage.banded = [&pipeline](int, int, int& halo) -> ImageOp {
+        halo = 0;
+        return [&pipeline](PlanarImage& image) { pipeline.apply(image); };
+    };
+    if (applyToRegion(stage, filtered, timer)) return;
+
+    pipeline.apply(filtered);
+    filteredChanged();
+}
+
+bool ImageProcessor::computeStage(const PipelineStage& stage, bool fromOriginal, PendingResult& result,
+                                  JobControl& control) const {
+    OperationTimer timer(stage.name, width, height);
+    try {
+        if (!region.empty()) {
+            timer.setSize(region.width, region.height);
+            result.region = region;
+            return runStageInRegion(stage, fromOriginal ? original : filtered, region, regionStatistics,
+                                    result.image, control);
+        }
+        if (!runStageInBands(stage, fromOriginal ? original : filtered, result.image, control)) return false;
+
+        // Capturing against the current state is the expensive part of a commit.
+        result.snapshot = TiledSnapshot::capture(result.image.planeViews(), &history.current());
+    }
+    catch (const std::bad_alloc&) {
+        result = PendingResult();
+        return false;
+    }
+    return !control.cancelled();
+}
+
+void ImageProcessor::commitResult(PendingResult& result) {
+    if (result.image.empty()) return;
+
+    OperationTimer timer("commit", result.image.getWidth(), result.image.getHeight());
+
+    if (!result.region.empty()) {
+        const ImageRegion& changed = result.region;
+        if (changed.x + changed.width > width || changed.y + changed.height > height) return;
+        blendRegion(result.image, result.region, filtered);
+        filteredChanged(result.region);
+        return;
+    }
+    std::swap(filtered, result.image);
+    width = filtered.getWidth();
+    height = filtered.getHeight();
+    history.commit(result.snapshot);
+    ++filteredVersion;
+}
+
+std::vector<unsigned char> ImageProcessor::encodeRLE() {
+    OperationTimer timer("rle encode", width, height);
+    return encodeRle(filtered);
+}
+
+bool ImageProcessor::decodeRLE(const std::vector<unsigned char>& encoded) {
+    OperationTimer timer("rle decode", 0, 0);
+    if (!decodeRle(encoded.data(), encoded.size(), filtered)) return false;
+    timer.setSize(filtered.getWidth(), filtered.getHeight());
+    return filteredReplaced();
+}
+
+bool ImageProcessor::saveRLEToFile(const std::string& filename) {
+    OperationTimer timer("save rle", width, height);
+    return saveRleFile(filename, filtered);
+}
+
+bool ImageProcessor::loadRLEFromFile(const std::string& filename) {
+    OperationTimer timer("load rle", 0, 0);
+    if (!loadRleFile(filename, filtered)) return false;
+    timer.setSize(filtered.getWidth(), filtered.getHeight());
+    return filteredReplaced();
+}
+
+bool ImageProcessor::decodeArchive(const RleArchive& archive, PlanarImage& image) {
+    OperationTimer timer("decode rle archive", archive.getWidth(), archive.getHeight());
+    return archive.decodeAll(image);
+}
+
+bool ImageProcessor::loadDecoded(PlanarImage& image) {
+    if (image.empty()) return false;
+    std::swap(filtered, image);
+    image.release();
+    return filteredReplaced();
+}
+
+bool ImageProcessor::saveLosslessToFile(const std::string& filename) {
+    OperationTimer timer("save lpc", width, height);
+    return saveLosslessFile(filename, filtered);
+}
+
+bool ImageProcessor::loadLosslessFromFile(const std::string& filename) {
+    OperationTimer timer("load lpc", 0, 0);
+    if (!loadLosslessFile(filename, filtered)) return false;
+    timer.setSize(filtered.getWidth(), filtered.getHeight());
+    return filteredReplaced();
+}
+
+bool ImageProcessor::filteredReplaced() {
+    if (filtered.getWidth() != width || filtered.getHeight() != height) region = ImageRegion();
+    width = filtered.getWidth();
+    height = filtered.getHeight();
+    ++filteredVersion;
+    history.reset(filtered.planeViews());
+
+    return true;
+}
+
+void ImageProcessor::setOriginalFromFiltered() {
+    if (filtered.empty()) return;
+
+    OperationTimer timer("set original", width, height);
+
+    // The current history state already holds the filtered tiles, so the new
+    // original shares them; only tiles that differ from the old original are
+    // written. A loaded image of another size is copied whole.
+    TiledSnapshot previous = originalSnapshot;
+    originalSnapshot = history.current();
+
+    std::vector<PlaneView> planes = original.planeViews();
+    if (!original.empty() && previous.matches(planes) && originalSnapshot.matches(planes)) {
+        originalSnapshot.restore(planes, &previous);
+    } else {
+        original.copyFrom(filtered);
+    }
+    ++originalVersion;
+}
+
+void ImageProcessor::resetToOriginal() {
+    if (original.empty()) return;
+
+    OperationTimer timer("reset", width, height);
+
+    restoreOriginalInto();
+    history.commit(originalSnapshot);
+    ++filteredVersion;
+}
+
+bool ImageProcessor::hasImage() const { return !original.empty(); }
+
+bool ImageProcessor::undo() {
+    OperationTimer timer("undo", width, height);
+    if (!history.undo(filtered.planeViews())) return false;
+    ++filteredVersion;
+    return true;
+}
+
+bool ImageProcessor::redo() {
+    OperationTimer timer("redo", width, height);
+    if (!history.redo(filtered.planeViews())) return false;
+    ++filteredVersion;
+    return true;
+}
+
+bool ImageProcessor::canUndo() const { return history.canUndo(); }
+bool ImageProcessor::canRedo() const { return history.canRedo(); }
+
+bool ImageProcessor::applyToRegion(const std::string& stage, const PlanarImage& source, OperationTimer& timer) {
+    if (region.empty()) return false;
+
+    // Every operation's name parses; should one not, the image is left alone.
+    Pipeline pipeline;
+    std::string error;
+    if (!pipeline.parse(stage, error)) return true;
+    return applyToRegion(pipeline.stage(0), source, timer);
+}
+
+bool ImageProcessor::applyToRegion(const PipelineStage& stage, const PlanarImage& source, OperationTimer& timer) {
+    if (region.empty()) return false;
+
+    timer.setSize(region.width, region.height);
+    JobControl control;
+    PlanarImage result;
+    if (runStageInRegion(stage, source, region, regionStatistics, result, control)) {
+        blendRegion(result, region, filtered);
+        filteredChanged(region);
+    }
+    return true;
+}
+
+void ImageProcessor::restoreOriginalInto() {
+    // Rewrites only the tiles where the working image differs from the original.
+    if (filtered.sameGeometry(original) && originalSnapshot.matches(filtered.planeViews())) {
+        originalSnapshot.restore(filtered.planeViews(), &history.current());
+    } else {
+        filtered.copyFrom(original);
+    }
+}
+
+void ImageProcessor::filteredChanged() {
+    history.commit(filtered.planeViews());
+    ++filteredVersion;
+}
+
+void ImageProcessor::filteredChanged(const ImageRegion& changed) {
+    history.commit(filtered.planeViews(), PlaneRect{changed.x, changed.y, changed.width, changed.height});
+    ++filteredVersion;
+}
@@ -0,0 +1,133 @@
+#ifndef IMAGE_PROCESSOR_H
+#define IMAGE_PROCESSOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bilateral.h"
+#include "clahe.h"
+#include "color_kernels.h"
+#include "edges.h"
+#include "filters.h"
+#include "histogram.h"
+#include "image_region.h"
+#include "job_control.h"
+#include "morphology.h"
+#include "pipeline.h"
+#include "planar_image.h"
+#include "predictive_codec.h"
+#include "rle_archive.h"
+#include "rle_codec.h"
+#include "rle_stream.h"
+#include "tile_history.h"
+#include "tone_lut.h"
+
+class OperationTimer;
+
+// Result of an operation computed away from the editing thread, with the
+// undo snapshot it will be recorded as. For an operation confined to a
+// region, image covers only the region's rectangle and the snapshot is
+// taken when it is blended in.
+struct PendingResult {
+    PlanarImage image;
+    TiledSnapshot snapshot;
+    ImageRegion region;
+};
+
+// The editing core: an original and a processed (filtered) image with undo
+// history. It does not depend on GTK; the window converts images for display
+// and keys its caches on the version numbers, which are bumped on every change.
+class ImageProcessor {
+public:
+    ImageProcessor();
+    // Takes over image as both the original and the processed image.
+    void setImage(PlanarImage&& image);
+    // Confines every following operation to region, clipped to the image; an
+    // empty region, or one outside the image, selects the whole image again.
+    // Operations then read only the region plus the context they need and
+    // blend their result in through the mask, so they cost in proportion to
+    // the region. Those that start from the original (equalization, contrast,
+    // CLAHE) still leave the rest of the processed image as it is. Cleared
+    // when the image size changes.
+    void setRegion(const ImageRegion& region);
+    void clearRegion();
+    bool hasRegion() const { return !region.empty(); }
+    const ImageRegion& getRegion() const { return region; }
+    // Whether histogram operations on a region take their statistics from
+    // the region (the default) or from the whole image.
+    void setRegionStatistics(bool fromRegion) { regionStatistics = fromRegion; }
+    bool getRegionStatistics() const { return regionStatistics; }
+    void applyLowPassFilter(int kernelSize, BorderMode border = BorderMode::Skip);
+    void applyGaussianFilter(int kernelSize, double sigma, BorderMode border = BorderMode::Skip);
+    void applyMedianFilter(int radius, BorderMode border = BorderMode::Skip);
+    void applyBilateralFilter(double sigmaSpatial, double sigmaRange);
+    void applyMorphology(MorphologyOp op, int kernelWidth, int kernelHeight, bool binary = false);
+    void applyEdgeDetection(int lowThreshold, int highThreshold);
+    std::vector<std::vector<int>> getHistogram();
+    void applyHistogramEqualization(int type = 0); // 0 = RGB, 1 = luma, 2 = HSV V, 3 = HLS L
+    void applyLinearContrast(int min_out, int max_out);
+    void applyCLAHE(int tiles, double clipLimit, bool slidingWindow = false);
+    // Runs a chain of compiled point operations on the processed image.
+    void applyTonePipeline(const TonePipeline& pipeline);
+    // Background form of the apply* methods. computeStage runs a pipeline
+    // stage on the original (equalization, contrast, CLAHE) or the processed
+    // image into result, in bands under control (runStageInBands). It only
+    // reads the processor, which must not change until commitResult takes
+    // the result over on the owning thread. With a region set only the region
+    // is computed (runStageInRegion). False if cancelled or out of memory.
+    bool computeStage(const PipelineStage& stage, bool fromOriginal, PendingResult& result,
+                      JobControl& control) const;
+    void commitResult(PendingResult& result);
+    std::vector<unsigned char> encodeRLE();
+    bool decodeRLE(const std::vector<unsigned char>& encoded);
+    bool saveRLEToFile(const std::string& filename);
+    bool loadRLEFromFile(const std::string& filename);
+    // Loading an indexed archive on a worker, in the manner of computeStage:
+    // decodeArchive only reads the archive, on any thread, and loadDecoded
+    // then takes the image over as the processed image on the owning thread.
+    static bool decodeArchive(const RleArchive& archive, PlanarImage& image);
+    bool loadDecoded(PlanarImage& image);
+    bool saveLosslessToFile(const std::string& filename);
+    bool loadLosslessFromFile(const std::string& filename);
+    void setOriginalFromFiltered();
+    void resetToOriginal();
+    bool hasImage() const;
+    bool undo();
+    bool redo();
+    bool canUndo() const;
+    bool canRedo() const;
+
+    const PlanarImage& getOriginal() const { return original; }
+    const PlanarImage& getFiltered() const { return filtered; }
+    uint64_t getOriginalVersion() const { return originalVersion; }
+    uint64_t getFilteredVersion() const { return filteredVersion; }
+
+private:
+    // With a region set, runs stage (pipeline.h syntax, as the operations
+    // name themselves for the metrics) on it from source and returns true.
+    bool applyToRegion(const std::string& stage, const PlanarImage& source, OperationTimer& timer);
+    bool applyToRegion(const PipelineStage& stage, const PlanarImage& source, OperationTimer& timer);
+    void restoreOriginalInto();
+    void filteredChanged();
+    // The same when only the rectangle of changed was written.
+    void filteredChanged(const ImageRegion& changed);
+    bool filteredReplaced();
+
+    // Working images; all processing runs on these planar buffers.
+    PlanarImage original;
+    PlanarImage filtered;
+    int width, height;
+
+    // Bumped whenever the image changes. originalVersion also keys the
+    // histogram cache.
+    uint64_t originalVersion, filteredVersion;
+    HistogramService originalHistograms;
+
+    EditHistory history;
+    TiledSnapshot originalSnapshot;
+
+    ImageRegion region;
+    bool regionStatistics;
+};
+
+#endif // IMAGE_PROCESSOR_H
@@ -0,0 +1,166 @@
+#include "image_region.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Shrinks the rectangle to the bounding box of the nonzero mask values.
+ImageRegion trimToMask(const ImageRegion& region) {
+    int left = region.width, right = -1, top = region.height, bottom = -1;
+    for (int y = 0; y < region.height; ++y) {
+        const uint8_t* row = &region.mask[static_cast<size_t>(y) * region.width];
+        for (int x = 0; x < region.width; ++x) {
+            if (!row[x]) continue;
+            left = std::min(left, x);
+            right = std::max(right, x);
+            top = std::min(top, y);
+            bottom = std::max(bottom, y);
+        }
+    }
+    if (right < 0) return ImageRegion();
+
+    ImageRegion trimmed(region.x + left, region.y + top, right - left + 1, bottom - top + 1);
+    trimmed.mask.resize(static_cast<size_t>(trimmed.width) * trimmed.height);
+    for (int y = 0; y < trimmed.height; ++y) {
+        std::memcpy(&trimmed.mask[static_cast<size_t>(y) * trimmed.width],
+                    &region.mask[static_cast<size_t>(top + y) * region.width + left], trimmed.width);
+    }
+    return trimmed;
+}
+
+}
+
+ImageRegion ellipseRegion(int x, int y, int width, int height) {
+    ImageRegion region(x, y, width, height);
+    if (region.empty()) return ImageRegion();
+
+    double rx = width / 2.0;
+    double ry = height / 2.0;
+    region.mask.resize(static_cast<size_t>(width) * height);
+    for (int row = 0; row < height; ++row) {
+        double dy = (row + 0.5 - ry) / ry;
+        for (int column = 0; column < width; ++column) {
+            double dx = (column + 0.5 - rx) / rx;
+            region.mask[static_cast<size_t>(row) * width + column] = dx * dx + dy * dy <= 1.0 ? 255 : 0;
+        }
+    }
+    return trimToMask(region);
+}
+
+ImageRegion polygonRegion(const std::vector<std::pair<double, double>>& points) {
+    if (points.size() < 3) return ImageRegion();
+
+    double minX = points[0].first, maxX = minX, minY = points[0].second, maxY = minY;
+    for (const auto& p : points) {
+        minX = std::min(minX, p.first);
+        maxX = std::max(maxX, p.first);
+        minY = std::min(minY, p.second);
+        maxY = std::max(maxY, p.second);
+    }
+    int x0 = static_cast<int>(std::floor(minX));
+    int y0 = static_cast<int>(std::floor(minY));
+    ImageRegion region(x0, y0, static_cast<int>(std::ceil(maxX)) - x0 + 1, static_cast<int>(std::ceil(maxY)) - y0 + 1);
+    region.mask.assign(static_cast<size_t>(region.width) * region.height, 0);
+
+    // Even-odd scanline fill at pixel centers.
+    std::vector<double> crossings;
+    for (int row = 0; row < region.height; ++row) {
+        double cy = y0 + row + 0.5;
+        crossings.clear();
+        for (size_t i = 0; i < points.size(); ++i) {
+            const auto& a = points[i];
+            const auto& b = points[(i + 1) % points.size()];
+            if ((a.second <= cy) == (b.second <= cy)) continue;
+            crossings.push_back(a.first + (cy - a.second) * (b.first - a.first) / (b.second - a.second));
+        }
+        std::sort(crossings.begin(), crossings.end());
+        uint8_t* out = &region.mask[static_cast<size_t>(row) * region.width];
+        for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+            // Pixels whose center x + 0.5 lies in [crossings[i], crossings[i + 1]).
+            int first = std::max(0, static_cast<int>(std::ceil(crossings[i] - 0.5)) - x0);
+            int last = std::min(region.width, static_cast<int>(std::ceil(crossings[i + 1] - 0.5)) - x0);
+            for (int x = first; x < last; ++x) out[x] = 255;
+        }
+    }
+    return trimToMask(region);
+}
+
+bool clipRegion(ImageRegion& region, int width, int height) {
+    int left = std::max(0, region.x);
+    int top = std::max(0, region.y);
+    int right = std::min(width, region.x + region.width);
+    int bottom = std::min(height, region.y + region.height);
+    if (left >= right || top >= bottom) {
+        region = ImageRegion();
+        return false;
+    }
+    if (left == region.x && top == region.y && right - left == region.width && bottom - top == region.height) {
+        return true;
+    }
+
+    ImageRegion clipped(left, top, right - left, bottom - top);
+    if (region.hasMask()) {
+        clipped.mask.resize(static_cast<size_t>(clipped.width) * clipped.height);
+        for (int y = 0; y < clipped.height; ++y) {
+            std::memcpy(&clipped.mask[static_cast<size_t>(y) * clipped.width],
+                        &region.mask[static_cast<size_t>(top - region.y + y) * region.width + (left - region.x)],
+                        clipped.width);
+        }
+        clipped = trimToMask(clipped);
+    }
+    region = std::move(clipped);
+    return !region.empty();
+}
+
+void gatherRegionPixels(const PlanarImage& image, const ImageRegion& region, PlanarImage& pixels) {
+    int channels = image.getChannels();
+    size_t count = 0;
+    if (region.hasMask()) {
+        count = static_cast<size_t>(std::count_if(region.mask.begin(), region.mask.end(),
+                                                  [](uint8_t m) { return m != 0; }));
+    }
+    if (count == 0) {
+        pixels.allocate(region.width, region.height, channels);
+        for (int c = 0; c < channels; ++c) {
+            for (int y = 0; y < region.height; ++y) {
+                std::memcpy(pixels.row(c, y), image.row(c, region.y + y) + region.x, region.width);
+            }
+        }
+        return;
+    }
+
+    pixels.allocate(static_cast<int>(count), 1, channels);
+    for (int c = 0; c < channels; ++c) {
+        uint8_t* out = pixels.plane(c);
+        for (int y = 0; y < region.height; ++y) {
+            const uint8_t* in = image.row(c, region.y + y) + region.x;
+            const uint8_t* mask = &region.mask[static_cast<size_t>(y) * region.width];
+            for (int x = 0; x < region.width; ++x) {
+                if (mask[x]) *out++ = in[x];
+            }
+        }
+    }
+}
+
+void blendRegion(const PlanarImage& result, const ImageRegion& region, PlanarImage& image) {
+    int channels = std::min(result.getChannels(), image.getChannels());
+    parallelFor(0, region.height, 16, [&](int y0, int y1) {
+        for (int c = 0; c < channels; ++c) {
+            for (int y = y0; y < y1; ++y) {
+                const uint8_t* in = result.row(c, y);
+                uint8_t* out = image.row(c, region.y + y) + region.x;
+                if (!region.hasMask()) {
+                    std::memcpy(out, in, region.width);
+                    continue;
+                }
+                const uint8_t* mask = &region.mask[static_cast<size_t>(y) * region.width];
+                for (int x = 0; x < region.width; ++x) {
+                    int m = mask[x];
+                    out[x] = static_cast<uint8_t>((in[x] * m + out[x] * (255 - m) + 127) / 255);
+                }
+            }
+        }
+    });
+}
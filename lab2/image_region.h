@@ -0,0 +1,43 @@
+#ifndef IMAGE_REGION_H
+#define IMAGE_REGION_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "planar_image.h"
+
+// The part of an image an edit is confined to: a rectangle and, optionally, a
+// mask over it whose values weight the edited pixels against the untouched
+// ones (255 takes the edit, 0 keeps the pixel). Without a mask the whole
+// rectangle is edited.
+struct ImageRegion {
+    int x, y, width, height;
+    std::vector<uint8_t> mask; // width * height, row by row; empty for the whole rectangle
+
+    ImageRegion() : x(0), y(0), width(0), height(0) {}
+    ImageRegion(int x, int y, int width, int height) : x(x), y(y), width(width), height(height) {}
+
+    bool empty() const { return width <= 0 || height <= 0; }
+    bool hasMask() const { return !mask.empty(); }
+};
+
+// Regions from the shapes drawn in the view, in image pixels. A pixel belongs
+// to a shape if its center does; the rectangle is cut down to the pixels that
+// do, so it is empty if none does.
+ImageRegion ellipseRegion(int x, int y, int width, int height);
+ImageRegion polygonRegion(const std::vector<std::pair<double, double>>& points);
+
+// Cuts region to a width x height image, cropping the mask alike. False if
+// nothing is left.
+bool clipRegion(ImageRegion& region, int width, int height);
+
+// The selected pixels of image (within it): the rectangle, or with a mask
+// the pixels where it is nonzero as a single row. For statistics, where the
+// layout does not matter.
+void gatherRegionPixels(const PlanarImage& image, const ImageRegion& region, PlanarImage& pixels);
+
+// Writes result, the size of the region's rectangle, into image there,
+// weighted by the mask. All planes, alpha included.
+void blendRegion(const PlanarImage& result, const ImageRegion& region, PlanarImage& image);
+
+#endif // IMAGE_REGION_H
@@ -0,0 +1,503 @@
+#include "image_view.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double kMaxZoom = 32.0;
+const double kScrollStep = 64.0;
+const double kZoomStep = 1.25;
+// Full-size tiles kept between frames: 32 MiB, several screens' worth.
+const size_t kMaxTiles = 128;
+// Freehand points closer than this many screen pixels are merged.
+const double kFreehandStep = 3.0;
+
+}
+
+ImageView::ImageView()
+        : image(nullptr), version(0), regionX(0), regionY(0), imageWidth(0), imageHeight(0), zoom(1.0),
+          previewFactor(1), detailX(0), detailY(0), cancelBuild(false), frame(0), dragX(0), dragY(0), dragH(0),
+          dragV(0), tool(SelectionTool::None), selectionShape(SelectionTool::None), selecting(false) {
+    hadjustment = Gtk::Adjustment::create(0, 0, 1, kScrollStep, 1, 1);
+    vadjustment = Gtk::Adjustment::create(0, 0, 1, kScrollStep, 1, 1);
+    hscroll.set_adjustment(hadjustment);
+    vscroll.set_adjustment(vadjustment);
+    vscroll.set_orientation(Gtk::ORIENTATION_VERTICAL);
+    hadjustment->signal_value_changed().connect([this]() { viewChanged(); });
+    vadjustment->signal_value_changed().connect([this]() { viewChanged(); });
+
+    canvas.set_hexpand(true);
+    canvas.set_vexpand(true);
+    canvas.add_events(Gdk::SCROLL_MASK | Gdk::SMOOTH_SCROLL_MASK | Gdk::BUTTON_PRESS_MASK | Gdk::BUTTON_RELEASE_MASK |
+                      Gdk::BUTTON_MOTION_MASK);
+    canvas.signal_draw().connect([this](const Cairo::RefPtr<Cairo::Context>& cr) { return onDraw(cr); });
+    canvas.signal_scroll_event().connect([this](GdkEventScroll* event) { return onScroll(event); });
+    canvas.signal_button_press_event().connect([this](GdkEventButton* event) { return onButtonPress(event); });
+    canvas.signal_motion_notify_event().connect([this](GdkEventMotion* event) { return onMotion(event); });
+    canvas.signal_button_release_event().connect([this](GdkEventButton* event) { return onButtonRelease(event); });
+    canvas.signal_size_allocate().connect([this](Gtk::Allocation&) { updateAdjustments(); });
+    levelReady.connect([this]() { canvas.queue_draw(); });
+
+    attach(canvas, 0, 0, 1, 1);
+    attach(vscroll, 1, 0, 1, 1);
+    attach(hscroll, 0, 1, 1, 1);
+}
+
+ImageView::~ImageView() {
+    stopBuilding();
+}
+
+void ImageView::setImage(const PlanarImage& source, uint64_t sourceVersion) {
+    if (&source == image && sourceVersion == version) {
+        canvas.queue_draw();
+        return;
+    }
+    stopBuilding();
+    tiles.clear();
+    regionSurface.reset();
+    regionPixels.clear();
+    image = &source;
+    version = sourceVersion;
+
+    pyramid = std::make_shared<MipPyramid>();
+    if (!pyramid->reset(source)) {
+        pyramid.reset();
+    } else if (pyramid->readyLevels() < pyramid->levelCount()) {
+        std::shared_ptr<MipPyramid> building = pyramid;
+        builder = std::thread([this, building]() {
+            if (building->buildLevels(cancelBuild)) levelReady.emit();
+        });
+    }
+    showSize(source.getWidth(), source.getHeight());
+    canvas.queue_draw();
+}
+
+void ImageView::setRegion(const PlanarImage& region, int x, int y, int width, int height) {
+    stopBuilding();
+    pyramid.reset();
+    tiles.clear();
+    image = nullptr;
+    version = 0;
+
+    regionSurface = toSurface(region, regionPixels);
+    regionX = x;
+    regionY = y;
+    showSize(width, height);
+    canvas.queue_draw();
+}
+
+void ImageView::clear() {
+    stopBuilding();
+    pyramid.reset();
+    tiles.clear();
+    regionSurface.reset();
+    regionPixels.clear();
+    image = nullptr;
+    version = 0;
+    imageWidth = imageHeight = 0;
+    updateAdjustments();
+    canvas.queue_draw();
+}
+
+void ImageView::setPreview(const PlanarImage& proxy, int factor) {
+    previewSurface = toSurface(proxy, previewPixels);
+    previewFactor = factor;
+    detailSurface.reset();
+    canvas.queue_draw();
+}
+
+void ImageView::setPreviewDetail(const PlanarImage& detail, int x, int y) {
+    detailSurface = toSurface(detail, detailPixels);
+    detailX = x;
+    detailY = y;
+    canvas.queue_draw();
+}
+
+void ImageView::clearPreview() {
+    previewSurface.reset();
+    detailSurface.reset();
+    previewPixels = std::vector<uint32_t>();
+    detailPixels = std::vector<uint32_t>();
+    canvas.queue_draw();
+}
+
+void ImageView::setZoom(double value) {
+    zoomAround(value, canvas.get_allocated_width() / 2.0, canvas.get_allocated_height() / 2.0);
+}
+
+void ImageView::zoomToFit() {
+    setZoom(fitZoom());
+}
+
+void ImageView::setSelectionTool(SelectionTool value) {
+    tool = value;
+    selecting = false;
+}
+
+void ImageView::clearSelection() {
+    selection.clear();
+    selecting = false;
+    canvas.queue_draw();
+}
+
+void ImageView::getVisibleRect(int& x, int& y, int& width, int& height) const {
+    x = std::max(0, std::min(imageWidth, static_cast<int>(std::floor(-originX() / zoom))));
+    y = std::max(0, std::min(imageHeight, static_cast<int>(std::floor(-originY() / zoom))));
+    width = std::min(imageWidth - x, static_cast<int>(std::ceil(canvas.get_allocated_width() / zoom)) + 1);
+    height = std::min(imageHeight - y, static_cast<int>(std::ceil(canvas.get_allocated_height() / zoom)) + 1);
+}
+
+bool ImageView::onDraw(const Cairo::RefPtr<Cairo::Context>& cr) {
+    if (imageWidth == 0 || imageHeight == 0) return true;
+    cr->save();
+    drawImage(cr);
+    cr->restore();
+    drawSelection(cr);
+    return true;
+}
+
+void ImageView::drawImage(const Cairo::RefPtr<Cairo::Context>& cr) {
+    ++frame;
+
+    cr->translate(originX(), originY());
+    if (previewSurface) {
+        cr->scale(zoom, zoom);
+        cr->rectangle(0, 0, imageWidth, imageHeight);
+        cr->clip();
+        auto pattern = Cairo::SurfacePattern::create(previewSurface);
+        pattern->set_filter(zoom * previewFactor >= 1.0 ? Cairo::FILTER_BILINEAR : Cairo::FILTER_GOOD);
+        pattern->set_extend(Cairo::EXTEND_PAD);
+        pattern->set_matrix(Cairo::scaling_matrix(1.0 / previewFactor, 1.0 / previewFactor));
+        cr->set_source(pattern);
+        cr->paint();
+        if (detailSurface) {
+            cr->set_source(detailSurface, detailX, detailY);
+            cr->rectangle(detailX, detailY, detailSurface->get_width(), detailSurface->get_height());
+            cr->fill();
+        }
+        return;
+    }
+    if (!image) {
+        // A region preview: gray where nothing is decoded yet.
+        cr->scale(zoom, zoom);
+        cr->set_source_rgb(0.5, 0.5, 0.5);
+        cr->rectangle(0, 0, imageWidth, imageHeight);
+        cr->fill();
+        if (regionSurface) {
+            cr->set_source(regionSurface, regionX, regionY);
+            cr->rectangle(regionX, regionY, regionSurface->get_width(), regionSurface->get_height());
+            cr->fill();
+        }
+        return;
+    }
+
+    // The level closest to the zoom, or the nearest finer one still being built.
+    int level = 0;
+    int levelWidth = imageWidth;
+    int levelHeight = imageHeight;
+    if (pyramid) {
+        level = std::min(pyramid->levelForScale(zoom), pyramid->readyLevels() - 1);
+        if (level > 0) {
+            levelWidth = pyramid->level(level).width;
+            levelHeight = pyramid->level(level).height;
+        }
+    }
+    double scale = zoom * (1 << level);
+    cr->scale(scale, scale);
+
+    double clipX0, clipY0, clipX1, clipY1;
+    cr->get_clip_extents(clipX0, clipY0, clipX1, clipY1);
+    int x0 = std::max(0, static_cast<int>(std::floor(clipX0)));
+    int y0 = std::max(0, static_cast<int>(std::floor(clipY0)));
+    int x1 = std::min(levelWidth, static_cast<int>(std::ceil(clipX1)));
+    int y1 = std::min(levelHeight, static_cast<int>(std::ceil(clipY1)));
+    if (x0 >= x1 || y0 >= y1) return;
+
+    // Tiles meet on whole level pixels; without antialiasing their edges
+    // cover every screen pixel exactly once, so no seams show.
+    cr->set_antialias(Cairo::ANTIALIAS_NONE);
+    Cairo::Filter filter = scale >= 1.0 ? Cairo::FILTER_NEAREST : Cairo::FILTER_GOOD;
+    const int tileSize = MipPyramid::kTileSize;
+    for (int ty = y0 / tileSize; ty <= (y1 - 1) / tileSize; ++ty) {
+        for (int tx = x0 / tileSize; tx <= (x1 - 1) / tileSize; ++tx) {
+            int x = tx * tileSize;
+            int y = ty * tileSize;
+            int width = std::min(tileSize, levelWidth - x);
+            int height = std::min(tileSize, levelHeight - y);
+
+            Cairo::RefPtr<Cairo::ImageSurface> surface;
+            if (level == 0) {
+                surface = fullTile(tx, ty);
+            } else {
+                // Pyramid levels are painted in place, one tile-sized window at a time.
+                const MipPyramid::Level& l = pyramid->level(level);
+                const uint32_t* first = &l.pixels[static_cast<size_t>(y) * l.width + x];
+                surface = Cairo::ImageSurface::create(reinterpret_cast<unsigned char*>(const_cast<uint32_t*>(first)),
+                                                      Cairo::FORMAT_ARGB32, width, height, l.width * 4);
+            }
+            if (!surface) continue;
+
+            auto pattern = Cairo::SurfacePattern::create(surface);
+            pattern->set_filter(filter);
+            pattern->set_extend(Cairo::EXTEND_PAD);
+            pattern->set_matrix(Cairo::translation_matrix(-x, -y));
+            cr->set_source(pattern);
+            cr->rectangle(x, y, width, height);
+            cr->fill();
+        }
+    }
+    evictTiles();
+}
+
+// The outline is drawn in screen pixels, so it stays thin at any zoom:
+// black dashes over white, visible on any image.
+void ImageView::drawSelection(const Cairo::RefPtr<Cairo::Context>& cr) {
+    if (selection.size() < 2) return;
+    auto toView = [this](const std::pair<double, double>& p) {
+        return std::make_pair(originX() + p.first * zoom, originY() + p.second * zoom);
+    };
+    std::pair<double, double> a = toView(selection.front());
+    std::pair<double, double> b = toView(selection.back());
+    double left = std::min(a.first, b.first);
+    double top = std::min(a.second, b.second);
+    double width = std::abs(b.first - a.first);
+    double height = std::abs(b.second - a.second);
+
+    switch (selectionShape) {
+        case SelectionTool::Rectangle:
+            cr->rectangle(left + 0.5, top + 0.5, width, height);
+            break;
+        case SelectionTool::Ellipse:
+            if (width < 1 || height < 1) return;
+            cr->save();
+            cr->translate(left + width / 2, top + height / 2);
+            cr->scale(width / 2, height / 2);
+            cr->arc(0, 0, 1, 0, 2 * M_PI);
+            cr->restore();
+            break;
+        default:
+            cr->move_to(a.first, a.second);
+            for (size_t i = 1; i < selection.size(); ++i) {
+                std::pair<double, double> p = toView(selection[i]);
+                cr->line_to(p.first, p.second);
+            }
+            cr->close_path();
+            break;
+    }
+    cr->set_line_width(1.0);
+    cr->set_source_rgb(1, 1, 1);
+    cr->stroke_preserve();
+    std::vector<double> dashes = {4.0, 4.0};
+    cr->set_dash(dashes, 0);
+    cr->set_source_rgb(0, 0, 0);
+    cr->stroke();
+}
+
+bool ImageView::onScroll(GdkEventScroll* event) {
+    double dx = 0, dy = 0;
+    switch (event->direction) {
+        case GDK_SCROLL_UP: dy = -1; break;
+        case GDK_SCROLL_DOWN: dy = 1; break;
+        case GDK_SCROLL_LEFT: dx = -1; break;
+        case GDK_SCROLL_RIGHT: dx = 1; break;
+        case GDK_SCROLL_SMOOTH: dx = event->delta_x; dy = event->delta_y; break;
+        default: return false;
+    }
+
+    if (event->state & GDK_CONTROL_MASK) {
+        zoomAround(zoom * std::pow(kZoomStep, -dy), event->x, event->y);
+    } else {
+        if ((event->state & GDK_SHIFT_MASK) && dx == 0) std::swap(dx, dy);
+        hadjustment->set_value(hadjustment->get_value() + dx * kScrollStep);
+        vadjustment->set_value(vadjustment->get_value() + dy * kScrollStep);
+    }
+    return true;
+}
+
+bool ImageView::onButtonPress(GdkEventButton* event) {
+    if (event->button != 1) return false;
+    if (event->type == GDK_2BUTTON_PRESS) {
+        // Double click toggles between actual size and fit.
+        zoomAround(zoom == 1.0 ? fitZoom() : 1.0, event->x, event->y);
+        return true;
+    }
+    dragX = event->x;
+    dragY = event->y;
+    dragH = hadjustment->get_value();
+    dragV = vadjustment->get_value();
+    if (tool != SelectionTool::None && imageWidth > 0) {
+        selecting = true;
+        selectionShape = tool;
+        selection.assign(1, toImage(event->x, event->y));
+        canvas.queue_draw();
+    }
+    return true;
+}
+
+bool ImageView::onMotion(GdkEventMotion* event) {
+    if (!(event->state & GDK_BUTTON1_MASK)) return false;
+    if (!selecting) {
+        hadjustment->set_value(dragH - (event->x - dragX));
+        vadjustment->set_value(dragV - (event->y - dragY));
+        return true;
+    }
+
+    std::pair<double, double> point = toImage(event->x, event->y);
+    if (selectionShape != SelectionTool::Freehand) {
+        selection.resize(1);
+        selection.push_back(point);
+    } else if (std::hypot(point.first - selection.back().first, point.second - selection.back().second) * zoom >=
+               kFreehandStep) {
+        selection.push_back(point);
+    }
+    canvas.queue_draw();
+    return true;
+}
+
+bool ImageView::onButtonRelease(GdkEventButton* event) {
+    if (event->button != 1 || !selecting) return false;
+    selecting = false;
+    ImageRegion region = selectedRegion();
+    if (region.empty()) selection.clear();
+    canvas.queue_draw();
+    if (onSelectionChanged) onSelectionChanged(region);
+    return true;
+}
+
+// Image coordinates of a view point, kept on the image.
+std::pair<double, double> ImageView::toImage(double viewX, double viewY) const {
+    return std::make_pair(std::max(0.0, std::min<double>(imageWidth, (viewX - originX()) / zoom)),
+                          std::max(0.0, std::min<double>(imageHeight, (viewY - originY()) / zoom)));
+}
+
+ImageRegion ImageView::selectedRegion() const {
+    if (selection.size() < 2) return ImageRegion();
+    if (selectionShape == SelectionTool::Freehand) return polygonRegion(selection);
+
+    // Corners rounded to the nearest pixel edges.
+    const std::pair<double, double>& a = selection.front();
+    const std::pair<double, double>& b = selection.back();
+    int x0 = static_cast<int>(std::lround(std::min(a.first, b.first)));
+    int y0 = static_cast<int>(std::lround(std::min(a.second, b.second)));
+    int x1 = static_cast<int>(std::lround(std::max(a.first, b.first)));
+    int y1 = static_cast<int>(std::lround(std::max(a.second, b.second)));
+    if (selectionShape == SelectionTool::Ellipse) return ellipseRegion(x0, y0, x1 - x0, y1 - y0);
+    return ImageRegion(x0, y0, x1 - x0, y1 - y0);
+}
+
+void ImageView::showSize(int width, int height) {
+    if (width != imageWidth || height != imageHeight) {
+        imageWidth = width;
+        imageHeight = height;
+        selection.clear();
+        selecting = false;
+        zoom = std::min(1.0, fitZoom());
+        hadjustment->set_value(0);
+        vadjustment->set_value(0);
+    }
+    updateAdjustments();
+}
+
+void ImageView::zoomAround(double value, double viewX, double viewY) {
+    if (imageWidth == 0 || imageHeight == 0) return;
+    value = std::max(std::min(1.0, fitZoom()), std::min(kMaxZoom, value));
+
+    // Keep the image point under (viewX, viewY) in place.
+    double imageX = (viewX - originX()) / zoom;
+    double imageY = (viewY - originY()) / zoom;
+    zoom = value;
+    updateAdjustments();
+    hadjustment->set_value(imageX * zoom - viewX);
+    vadjustment->set_value(imageY * zoom - viewY);
+    viewChanged();
+}
+
+void ImageView::updateAdjustments() {
+    double viewWidth = std::max(1, canvas.get_allocated_width());
+    double viewHeight = std::max(1, canvas.get_allocated_height());
+    double width = std::max(viewWidth, std::ceil(imageWidth * zoom));
+    double height = std::max(viewHeight, std::ceil(imageHeight * zoom));
+    hadjustment->configure(std::min(hadjustment->get_value(), width - viewWidth), 0, width, kScrollStep,
+                           viewWidth * 0.9, viewWidth);
+    vadjustment->configure(std::min(vadjustment->get_value(), height - viewHeight), 0, height, kScrollStep,
+                           viewHeight * 0.9, viewHeight);
+}
+
+// Screen position of the image's top-left corner: centered while the image is
+// narrower than the view, scrolled otherwise. Whole pixels keep tiles aligned.
+double ImageView::originX() const {
+    double scaled = imageWidth * zoom;
+    int view = canvas.get_allocated_width();
+    return scaled < view ? std::floor((view - scaled) / 2) : -std::floor(hadjustment->get_value());
+}
+
+double ImageView::originY() const {
+    double scaled = imageHeight * zoom;
+    int view = canvas.get_allocated_height();
+    return scaled < view ? std::floor((view - scaled) / 2) : -std::floor(vadjustment->get_value());
+}
+
+double ImageView::fitZoom() const {
+    int viewWidth = canvas.get_allocated_width();
+    int viewHeight = canvas.get_allocated_height();
+    if (imageWidth == 0 || imageHeight == 0 || viewWidth <= 1 || viewHeight <= 1) return 1.0;
+    return std::min(static_cast<double>(viewWidth) / imageWidth, static_cast<double>(viewHeight) / imageHeight);
+}
+
+Cairo::RefPtr<Cairo::ImageSurface> ImageView::toSurface(const PlanarImage& image, std::vector<uint32_t>& pixels) {
+    if (image.empty() || image.getChannels() < 3) {
+        pixels.clear();
+        return Cairo::RefPtr<Cairo::ImageSurface>();
+    }
+    pixels.resize(static_cast<size_t>(image.getWidth()) * image.getHeight());
+    toArgb(image, 0, 0, image.getWidth(), image.getHeight(), pixels.data(), image.getWidth());
+    return Cairo::ImageSurface::create(reinterpret_cast<unsigned char*>(pixels.data()), Cairo::FORMAT_ARGB32,
+                                       image.getWidth(), image.getHeight(), image.getWidth() * 4);
+}
+
+void ImageView::viewChanged() {
+    canvas.queue_draw();
+    if (onViewChanged) onViewChanged();
+}
+
+Cairo::RefPtr<Cairo::ImageSurface> ImageView::fullTile(int tx, int ty) {
+    auto found = tiles.find(std::make_pair(tx, ty));
+    if (found != tiles.end()) {
+        found->second.lastUse = frame;
+        return found->second.surface;
+    }
+
+    const int tileSize = MipPyramid::kTileSize;
+    int x = tx * tileSize;
+    int y = ty * tileSize;
+    int width = std::min(tileSize, imageWidth - x);
+    int height = std::min(tileSize, imageHeight - y);
+
+    Tile& tile = tiles[std::make_pair(tx, ty)];
+    tile.lastUse = frame;
+    tile.pixels.resize(static_cast<size_t>(width) * height);
+    toArgb(*image, x, y, width, height, tile.pixels.data(), width);
+    tile.surface = Cairo::ImageSurface::create(reinterpret_cast<unsigned char*>(tile.pixels.data()),
+                                               Cairo::FORMAT_ARGB32, width, height, width * 4);
+    return tile.surface;
+}
+
+void ImageView::evictTiles() {
+    if (tiles.size() <= kMaxTiles) return;
+    std::vector<std::pair<uint64_t, std::pair<int, int>>> byAge;
+    for (const auto& entry : tiles) {
+        if (entry.second.lastUse != frame) byAge.push_back(std::make_pair(entry.second.lastUse, entry.first));
+    }
+    std::sort(byAge.begin(), byAge.end());
+    for (size_t i = 0; i < byAge.size() && tiles.size() > kMaxTiles; ++i) {
+        tiles.erase(byAge[i].second);
+    }
+}
+
+void ImageView::stopBuilding() {
+    if (builder.joinable()) {
+        cancelBuild = true;
+        builder.join();
+    }
+    cancelBuild = false;
+}
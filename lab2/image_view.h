@@ -0,0 +1,133 @@
+#ifndef IMAGE_VIEW_H
+#define IMAGE_VIEW_H
+
+#include <gtkmm.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "image_region.h"
+#include "mip_pyramid.h"
+
+// Zoomable, scrollable view of a PlanarImage for the main window panes.
+// Drawing takes the pyramid level closest to the zoom (mip_pyramid.h) and
+// paints only the tiles that intersect the visible area, so the cost of a
+// frame depends on the window size rather than the image size. Levels below
+// full size are built on a background thread after each new image; until
+// they are ready the nearest finer level is used.
+//
+// Ctrl+wheel zooms around the pointer, the wheel scrolls (Shift for
+// horizontal), and dragging with the left button pans, or draws a selection
+// while a selection tool is chosen.
+class ImageView : public Gtk::Grid {
+public:
+    enum class SelectionTool { None, Rectangle, Ellipse, Freehand };
+
+    ImageView();
+    ~ImageView();
+
+    // Shows image, which must stay alive and unchanged until the next call
+    // or clear(). A version equal to the current one only redraws. The zoom
+    // is kept while the size stays the same, and reset to fit otherwise.
+    void setImage(const PlanarImage& image, uint64_t version);
+    // Shows region placed at (x, y) in an otherwise gray width x height image,
+    // for previews of a file still being decoded. The region is copied.
+    void setRegion(const PlanarImage& region, int x, int y, int width, int height);
+    void clear();
+
+    // Live preview over the current image, until clearPreview: proxy drawn
+    // factor times larger to cover it, and detail, a full-size piece, at
+    // (x, y) on top. Both are copied.
+    void setPreview(const PlanarImage& proxy, int factor);
+    void setPreviewDetail(const PlanarImage& detail, int x, int y);
+    void clearPreview();
+
+    double getZoom() const { return zoom; }
+    // Zooms around the center of the view; 1 is one screen pixel per image pixel.
+    void setZoom(double value);
+    void zoomToFit();
+    // The part of the image currently in view, in image pixels.
+    void getVisibleRect(int& x, int& y, int& width, int& height) const;
+
+    // The shape the left button draws; None pans. The drawn outline stays
+    // over the image until clearSelection or the next drag.
+    void setSelectionTool(SelectionTool tool);
+    void clearSelection();
+
+    // Called after every scroll or zoom.
+    std::function<void()> onViewChanged;
+    // Called when a selection is drawn, with the region it covers in image
+    // pixels; empty for a click without a drag.
+    std::function<void(const ImageRegion&)> onSelectionChanged;
+
+private:
+    struct Tile {
+        std::vector<uint32_t> pixels;
+        Cairo::RefPtr<Cairo::ImageSurface> surface;
+        uint64_t lastUse;
+    };
+
+    bool onDraw(const Cairo::RefPtr<Cairo::Context>& cr);
+    void drawImage(const Cairo::RefPtr<Cairo::Context>& cr);
+    void drawSelection(const Cairo::RefPtr<Cairo::Context>& cr);
+    bool onScroll(GdkEventScroll* event);
+    bool onButtonPress(GdkEventButton* event);
+    bool onMotion(GdkEventMotion* event);
+    bool onButtonRelease(GdkEventButton* event);
+    std::pair<double, double> toImage(double viewX, double viewY) const;
+    ImageRegion selectedRegion() const;
+
+    static Cairo::RefPtr<Cairo::ImageSurface> toSurface(const PlanarImage& image, std::vector<uint32_t>& pixels);
+    void viewChanged();
+    void showSize(int width, int height);
+    void zoomAround(double value, double viewX, double viewY);
+    void updateAdjustments();
+    double originX() const;
+    double originY() const;
+    double fitZoom() const;
+    Cairo::RefPtr<Cairo::ImageSurface> fullTile(int tx, int ty);
+    void evictTiles();
+    void stopBuilding();
+
+    Gtk::DrawingArea canvas;
+    Gtk::Scrollbar hscroll, vscroll;
+    Glib::RefPtr<Gtk::Adjustment> hadjustment, vadjustment;
+
+    // The caller's image, or null while a region preview is shown.
+    const PlanarImage* image;
+    uint64_t version;
+    std::vector<uint32_t> regionPixels;
+    Cairo::RefPtr<Cairo::ImageSurface> regionSurface;
+    int regionX, regionY;
+    int imageWidth, imageHeight;
+    double zoom;
+
+    std::vector<uint32_t> previewPixels, detailPixels;
+    Cairo::RefPtr<Cairo::ImageSurface> previewSurface, detailSurface;
+    int previewFactor;
+    int detailX, detailY;
+
+    // Reduced levels, built by builder; cancelBuild stops it early.
+    std::shared_ptr<MipPyramid> pyramid;
+    std::thread builder;
+    std::atomic<bool> cancelBuild;
+    Glib::Dispatcher levelReady;
+
+    // Full-size tiles converted on demand, least recently drawn dropped first.
+    std::map<std::pair<int, int>, Tile> tiles;
+    uint64_t frame;
+
+    double dragX, dragY, dragH, dragV;
+
+    // The selection in image pixels: two corners for a rectangle or the
+    // ellipse inside it, the path for freehand.
+    SelectionTool tool, selectionShape;
+    std::vector<std::pair<double, double>> selection;
+    bool selecting;
+};
+
+#endif // IMAGE_VIEW_H
@@ -0,0 +1,38 @@
+#ifndef JOB_CONTROL_H
+#define JOB_CONTROL_H
+
+#include <atomic>
+#include <functional>
+
+// Progress and cancellation shared between a job running on a worker thread
+// and whoever started it. The job reports with setProgress and polls
+// cancelled() between pieces of work; onProgress, when set, is called on the
+// worker after every report (the GUI hooks a Glib::Dispatcher there).
+class JobControl {
+public:
+    JobControl() : progress(0), cancelRequested(false) {}
+
+    // Clears progress and cancellation before the next job.
+    void reset() {
+        progress.store(0);
+        cancelRequested.store(false);
+    }
+
+    void cancel() { cancelRequested.store(true); }
+    bool cancelled() const { return cancelRequested.load(std::memory_order_relaxed); }
+
+    // Fraction done in [0, 1], or negative while the job cannot tell.
+    void setProgress(double fraction) {
+        progress.store(fraction);
+        if (onProgress) onProgress();
+    }
+    double getProgress() const { return progress.load(); }
+
+    std::function<void()> onProgress;
+
+private:
+    std::atomic<double> progress;
+    std::atomic<bool> cancelRequested;
+};
+
+#endif // JOB_CONTROL_H
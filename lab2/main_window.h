@@ -4,35 +4,13 @@
 #include <gtkmm.h>
 #include <vector>
 #include <string>
-#include <fstream>
-
-class ImageProcessor {
-public:
-    ImageProcessor();
-    bool loadImage(const std::string& filename);
-    void applyLowPassFilter(int kernelSize);
-    void applyGaussianFilter(int kernelSize, double sigma);
-    std::vector<std::vector<int>> getHistogram();
-    void applyHistogramEqualization(int type = 0); // 0 = RGB, 1 = HSV/HLS
-    void applyLinearContrast(int min_out, int max_out);
-    std::vector<unsigned char> encodeRLE();
-    bool decodeRLE(const std::vector<unsigned char>& encoded);
-    bool saveRLEToFile(const std::string& filename);
-    bool loadRLEFromFile(const std::string& filename);
-    void setOriginalFromFiltered();
-    Glib::RefPtr<Gdk::Pixbuf> getOriginalPixbuf();
-    Glib::RefPtr<Gdk::Pixbuf> getFilteredPixbuf();
-    void resetToOriginal();
-    bool hasImage() const;
-
-private:
-    void applyRGBEqualization();
-    void applyBrightnessEqualization();
-    
-    Glib::RefPtr<Gdk::Pixbuf> originalPixbuf;
-    Glib::RefPtr<Gdk::Pixbuf> filteredPixbuf;
-    int width, height;
-};
+#include <functional>
+#include <thread>
+#include "image_processor.h"
+#include "job_control.h"
+#include "metrics.h"
+#include "stage_preview.h"
+#include "image_view.h"
 
 class HistogramDrawingArea : public Gtk::DrawingArea {
 public:
@@ -58,11 +36,40 @@ private:
     HistogramDrawingArea* blueDrawingArea;
 };
 
+// The operations recorded this session, newest last.
+class MetricsDialog : public Gtk::Dialog {
+public:
+    enum Response { RESPONSE_CLEAR = 1, RESPONSE_EXPORT = 2 };
+
+    MetricsDialog(Gtk::Window& parent);
+    void refresh();
+
+private:
+    struct Columns : public Gtk::TreeModelColumnRecord {
+        Columns() {
+            add(operation); add(size); add(wallMs); add(cpuMs); add(peakMb); add(allocatedMb); add(pixbufCopies);
+            add(threads);
+        }
+        Gtk::TreeModelColumn<Glib::ustring> operation, size;
+        Gtk::TreeModelColumn<double> wallMs, cpuMs, peakMb, allocatedMb;
+        Gtk::TreeModelColumn<int> pixbufCopies, threads;
+    };
+
+    Columns columns;
+    Glib::RefPtr<Gtk::ListStore> store;
+    Gtk::ScrolledWindow scroll;
+    Gtk::TreeView view;
+    Gtk::Label poolLabel;
+};
+
 class ContrastDialog : public Gtk::Dialog {
 public:
     ContrastDialog(Gtk::Window& parent);
     int getMinValue() const;
     int getMaxValue() const;
+
+    // Called whenever a setting changes, for the live preview.
+    std::function<void()> onChanged;
     
 private:
     Gtk::Box mainBox{Gtk::ORIENTATION_VERTICAL, 10};
@@ -77,34 +84,92 @@ class FilterDialog : public Gtk::Dialog {
 public:
     FilterDialog(Gtk::Window& parent);
     int getKernelSize() const;
-    int getFilterType() const;
+    int getFilterType() const; // 0 = average, 1 = Gaussian, 2 = median, 3 = bilateral
     double getSigma() const;
+    int getMedianRadius() const;
+    double getSpatialSigma() const;
+    double getRangeSigma() const;
+    BorderMode getBorderMode() const;
+
+    // Called whenever a setting changes, for the live preview.
+    std::function<void()> onChanged;
     
 private:
     Gtk::Box mainBox{Gtk::ORIENTATION_VERTICAL, 10};
     Gtk::Box filterTypeBox{Gtk::ORIENTATION_HORIZONTAL, 5};
     Gtk::Box kernelSizeBox{Gtk::ORIENTATION_HORIZONTAL, 5};
     Gtk::Box sigmaBox{Gtk::ORIENTATION_HORIZONTAL, 5};
-    Gtk::Label filterTypeLabel, kernelSizeLabel, sigmaLabel;
-    Gtk::ComboBoxText filterTypeCombo, kernelSizeCombo;
-    Gtk::Scale sigmaScale;
+    Gtk::Box radiusBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Box spatialBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Box rangeBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Box borderBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Label filterTypeLabel, kernelSizeLabel, sigmaLabel, radiusLabel, spatialLabel, rangeLabel, borderLabel;
+    Gtk::ComboBoxText filterTypeCombo, kernelSizeCombo, borderCombo;
+    Gtk::Scale sigmaScale, radiusScale, spatialScale, rangeScale;
 };
 
 class EqualizationDialog : public Gtk::Dialog {
 public:
     EqualizationDialog(Gtk::Window& parent);
     int getEqualizationType() const;
+    double getClipLimit() const;
+    int getTileCount() const;
+    bool getSlidingWindow() const;
 
 private:
     Gtk::Box mainBox{Gtk::ORIENTATION_VERTICAL, 10};
     Gtk::Box typeBox{Gtk::ORIENTATION_HORIZONTAL, 5};
     Gtk::Label typeLabel{"Equalization Type:"};
     Gtk::ComboBoxText typeCombo;
+    Gtk::Box claheBox{Gtk::ORIENTATION_VERTICAL, 5};
+    Gtk::Box clipLimitBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Box tilesBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Label clipLimitLabel{"Clip limit:"};
+    Gtk::Label tilesLabel{"Tiles per side:"};
+    Gtk::Scale clipLimitScale, tilesScale;
+    Gtk::CheckButton slidingCheck{"Sliding window (exact, slower)"};
+};
+
+class MorphologyDialog : public Gtk::Dialog {
+public:
+    MorphologyDialog(Gtk::Window& parent);
+    MorphologyOp getOperation() const;
+    int getKernelWidth() const;
+    int getKernelHeight() const;
+    bool getBinary() const;
+
+private:
+    Gtk::Box mainBox{Gtk::ORIENTATION_VERTICAL, 10};
+    Gtk::Box operationBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Box widthBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Box heightBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Label operationLabel{"Operation:"};
+    Gtk::Label widthLabel{"Element width:"};
+    Gtk::Label heightLabel{"Element height:"};
+    Gtk::ComboBoxText operationCombo;
+    Gtk::Scale widthScale, heightScale;
+    Gtk::CheckButton binaryCheck{"Binary (threshold luma at 128)"};
+};
+
+class EdgeDialog : public Gtk::Dialog {
+public:
+    EdgeDialog(Gtk::Window& parent);
+    int getLowThreshold() const;
+    int getHighThreshold() const;
+
+private:
+    Gtk::Box mainBox{Gtk::ORIENTATION_VERTICAL, 10};
+    Gtk::Box lowBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Box highBox{Gtk::ORIENTATION_HORIZONTAL, 5};
+    Gtk::Label lowLabel{"Low threshold:"};
+    Gtk::Label highLabel{"High threshold:"};
+    Gtk::Scale lowScale, highScale;
 };
 
 class MainWindow : public Gtk::Window {
 public:
     MainWindow();
+    ~MainWindow();
     
 private:
     void setupUI();
@@ -112,27 +177,107 @@ private:
     void on_open_clicked();
     void on_save_clicked();
     void on_lowpass_clicked();
+    void on_morphology_clicked();
+    void on_edges_clicked();
     void on_equalize_clicked();
     void on_contrast_clicked();
     void on_show_histogram_clicked();
+    void on_show_metrics_clicked();
     void on_encode_and_save_rle_clicked();
     void on_decode_and_open_rle_clicked();
+    // Shows the part of an open archive in view before the whole is decoded.
+    void showRlePreview(const RleArchive& archive);
+    // Decodes rleArchive on the worker; onRleDecoded loads the result.
+    void startRleDecode();
+    void onRleDecoded();
+    // Makes a loaded RLE or LPC image the original and reports the outcome.
+    void finishRleLoad(bool loaded);
     void on_reset_clicked();
+    void on_undo_clicked();
+    void on_redo_clicked();
+    void on_clear_region_clicked();
     void updateImages();
+    // Shows the processor's region, or that operations cover the whole image.
+    void updateRegion();
+    // Shows the last recorded operation in the status bar.
+    void updateStatus();
+    // Runs a pipeline stage (pipeline.h syntax) on a worker thread, on the
+    // original image or on the current result, and commits it when done;
+    // message, if any, is shown afterwards.
+    void startJob(const std::string& stage, bool fromOriginal, const std::string& message);
+    void onJobFinished();
+    void setBusy(bool busy);
+    // Live preview in the processed pane while a settings dialog is open.
+    // stage describes the dialog's settings with sizes multiplied by scale;
+    // fromOriginal is as for startJob.
+    void beginPreview(bool fromOriginal, std::function<std::string(double scale)> stage);
+    void requestPreview();
+    void scheduleRefine();
+    void runPreview(bool refine);
+    void onPreviewReady();
+    void endPreview();
+    bool loadImageFile(const std::string& filename);
+    Glib::RefPtr<Gdk::Pixbuf> getFilteredPixbuf();
+    static Glib::RefPtr<Gdk::Pixbuf> toPixbuf(const PlanarImage& image, Glib::RefPtr<Gdk::Pixbuf> reuse);
     
     ImageProcessor processor;
+
+    // Interleaved copy for saving, refreshed lazily when the processor's
+    // version moves past the one it was made from.
+    Glib::RefPtr<Gdk::Pixbuf> filteredPixbuf;
+    uint64_t filteredPixbufVersion;
+
+    // The running operation. The worker only reads the processor's images
+    // and writes jobResult; everything else happens here after jobFinished.
+    std::thread worker;
+    JobControl job;
+    Pipeline jobPipeline;
+    PendingResult jobResult;
+    bool jobSucceeded;
+    std::string jobMessage;
+    Glib::Dispatcher jobProgress, jobFinished;
+    sigc::connection pulseTimer;
+    // An archive being decoded on the worker, which writes only rleImage.
+    RleArchive rleArchive;
+    PlanarImage rleImage;
+    Glib::Dispatcher rleDecoded;
+
+    // The preview: a proxy render after every change (one at a time, the
+    // latest change winning), then, once the settings and the view have
+    // been still for a moment, the visible region at full size.
+    StagePreview preview;
+    std::function<std::string(double)> previewStage;
+    std::thread previewWorker;
+    JobControl previewJob;
+    Pipeline previewPipeline;
+    PlanarImage previewResult;
+    int previewX, previewY, previewWidth, previewHeight;
+    bool previewRefining, previewSucceeded, previewPending;
+    Glib::Dispatcher previewReady;
+    sigc::connection previewTimer;
     
     Gtk::Box mainBox{Gtk::ORIENTATION_VERTICAL, 10};
     Gtk::Box contentBox{Gtk::ORIENTATION_HORIZONTAL, 10};
     Gtk::Box imageStackBox{Gtk::ORIENTATION_VERTICAL, 10};
     Gtk::Frame originalFrame, filteredFrame;
-    Gtk::ScrolledWindow originalScrolled, filteredScrolled;
-    Gtk::Image originalImage, filteredImage;
+    ImageView originalView, filteredView;
     Gtk::Box controlsBox{Gtk::ORIENTATION_VERTICAL, 10};
     
-    Gtk::Button openButton, saveButton, lowpassButton, equalizeButton;
-    Gtk::Button contrastButton, showHistogramButton;
+    Gtk::Button openButton, saveButton, lowpassButton, morphologyButton, edgesButton, equalizeButton;
+    Gtk::Button contrastButton, showHistogramButton, showMetricsButton;
     Gtk::Button encodeAndSaveRLEButton, decodeAndOpenRLEButton, resetButton;
+    Gtk::Button undoButton, redoButton;
+
+    // Drawn on the processed pane; operations are confined to it.
+    Gtk::ComboBoxText regionToolCombo;
+    Gtk::CheckButton regionStatisticsCheck{"Histogram from region"};
+    Gtk::Button clearRegionButton;
+    Gtk::Label regionLabel;
+
+    Gtk::Box progressBox{Gtk::ORIENTATION_HORIZONTAL, 10};
+    Gtk::ProgressBar progressBar;
+    Gtk::Button cancelButton;
+    Gtk::Statusbar statusBar;
 };
 
 #endif // MAIN_WINDOW_H
\ No newline at end of file
@@ -1,446 +1,9 @@
 #include "main_window.h"
+#include "buffer_pool.h"
 #include <iostream>
 #include <cmath>
-
-ImageProcessor::ImageProcessor() : width(0), height(0) {}
-
-bool ImageProcessor::loadImage(const std::string& filename) {
-    try {
-        auto pixbuf = Gdk::Pixbuf::create_from_file(filename);
-        if (!pixbuf) return false;
-
-        width = pixbuf->get_width();
-        height = pixbuf->get_height();
-
-        originalPixbuf = pixbuf;
-        filteredPixbuf = pixbuf->copy();
-
-        return true;
-    }
-    catch (const Glib::Exception& ex) {
-        std::cerr << "Error loading image: " << ex.what() << std::endl;
-        return false;
-    }
-}
-
-void ImageProcessor::applyLowPassFilter(int kernelSize) {
-    if (!filteredPixbuf) return;
-
-    auto tempPixbuf = filteredPixbuf->copy();
-
-    if (kernelSize % 2 == 0 || kernelSize < 3) {
-        kernelSize = 3;
-    }
-
-    int radius = kernelSize / 2;
-    guint8* src_pixels = tempPixbuf->get_pixels();
-    guint8* dst_pixels = filteredPixbuf->get_pixels();
-    int rowstride = filteredPixbuf->get_rowstride();
-    int n_channels = filteredPixbuf->get_n_channels();
-
-    for (int y = radius; y < height - radius; ++y) {
-        for (int x = radius; x < width - radius; ++x) {
-            for (int channel = 0; channel < 3; channel++) {
-                int sum = 0;
-                int count = 0;
-
-                for (int ky = -radius; ky <= radius; ++ky) {
-                    for (int kx = -radius; kx <= radius; ++kx) {
-                        guint8* p = src_pixels + (y + ky) * rowstride + (x + kx) * n_channels;
-                        sum += p[channel];
-                        count++;
-                    }
-                }
-
-                guint8* dst_p = dst_pixels + y * rowstride + x * n_channels;
-                dst_p[channel] = static_cast<guint8>(sum / count);
-            }
-        }
-    }
-}
-
-void ImageProcessor::applyGaussianFilter(int kernelSize, double sigma) {
-    if (!filteredPixbuf) return;
-
-    auto tempPixbuf = filteredPixbuf->copy();
-
-    if (kernelSize % 2 == 0 || kernelSize < 3) {
-        kernelSize = 3;
-    }
-
-    int radius = kernelSize / 2;
-    guint8* src_pixels = tempPixbuf->get_pixels();
-    guint8* dst_pixels = filteredPixbuf->get_pixels();
-    int rowstride = filteredPixbuf->get_rowstride();
-    int n_channels = filteredPixbuf->get_n_channels();
-
-    std::vector<std::vector<double>> kernel(kernelSize, std::vector<double>(kernelSize));
-    double sum_kernel = 0.0;
-
-    for (int i = -radius; i <= radius; i++) {
-        for (int j = -radius; j <= radius; j++) {
-            double value = exp(-(i*i + j*j) / (2 * sigma * sigma));
-            kernel[i + radius][j + radius] = value;
-            sum_kernel += value;
-        }
-    }
-
-    for (int i = 0; i < kernelSize; i++) {
-        for (int j = 0; j < kernelSize; j++) {
-            kernel[i][j] /= sum_kernel;
-        }
-    }
-
-    for (int y = radius; y < height - radius; ++y) {
-        for (int x = radius; x < width - radius; ++x) {
-            for (int channel = 0; channel < 3; channel++) {
-                double sum = 0.0;
-
-                for (int ky = -radius; ky <= radius; ++ky) {
-                    for (int kx = -radius; kx <= radius; ++kx) {
-                        guint8* p = src_pixels + (y + ky) * rowstride + (x + kx) * n_channels;
-                        double weight = kernel[ky + radius][kx + radius];
-                        sum += p[channel] * weight;
-                    }
-                }
-
-                guint8* dst_p = dst_pixels + y * rowstride + x * n_channels;
-                dst_p[channel] = static_cast<guint8>(std::max(0.0, std::min(255.0, sum)));
-            }
-        }
-    }
-}
-
-std::vector<std::vector<int>> ImageProcessor::getHistogram() {
-    std::vector<std::vector<int>> histogram(3, std::vector<int>(256, 0));
-
-    if (!originalPixbuf) return histogram;
-
-    guint8* pixels = originalPixbuf->get_pixels();
-    int rowstride = originalPixbuf->get_rowstride();
-    int n_channels = originalPixbuf->get_n_channels();
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            guint8* p = pixels + y * rowstride + x * n_channels;
-            histogram[0][p[0]]++;
-            histogram[1][p[1]]++;
-            histogram[2][p[2]]++;
-        }
-    }
-
-    return histogram;
-}
-
-void ImageProcessor::applyHistogramEqualization(int type) {
-    if (!originalPixbuf) return;
-
-    filteredPixbuf = originalPixbuf->copy();
-
-    if (type == 0) {
-        // RGB equalization - все каналы
-        applyRGBEqualization();
-    } else {
-        // HSV/HLS equalization - только яркость
-        applyBrightnessEqualization();
-    }
-}
-
-void ImageProcessor::applyRGBEqualization() {
-    auto histogram = getHistogram();
-
-    std::vector<std::vector<int>> cdf(3, std::vector<int>(256, 0));
-    int total_pixels = width * height;
-
-    for (int channel = 0; channel < 3; channel++) {
-        cdf[channel][0] = histogram[channel][0];
-        for (int i = 1; i < 256; i++) {
-            cdf[channel][i] = cdf[channel][i-1] + histogram[channel][i];
-        }
-    }
-
-    std::vector<int> cdf_min(3, total_pixels);
-    for (int channel = 0; channel < 3; channel++) {
-        for (int i = 0; i < 256; i++) {
-            if (histogram[channel][i] != 0) {
-                cdf_min[channel] = std::min(cdf_min[channel], cdf[channel][i]);
-            }
-        }
-    }
-
-    guint8* pixels = filteredPixbuf->get_pixels();
-    int rowstride = filteredPixbuf->get_rowstride();
-    int n_channels = filteredPixbuf->get_n_channels();
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            guint8* p = pixels + y * rowstride + x * n_channels;
-            for (int channel = 0; channel < 3; channel++) {
-                int old_intensity = p[channel];
-                if (cdf[channel][old_intensity] > cdf_min[channel]) {
-                    float equalized = (cdf[channel][old_intensity] - cdf_min[channel]) /
-                                      static_cast<float>(total_pixels - cdf_min[channel]);
-                    p[channel] = static_cast<guint8>(equalized * 255);
-                } else {
-                    p[channel] = 0;
-                }
-            }
-        }
-    }
-}
-
-void ImageProcessor::applyBrightnessEqualization() {
-    // Конвертируем в HSV/HLS и выравниваем только яркость/освещенность
-    guint8* pixels = filteredPixbuf->get_pixels();
-    int rowstride = filteredPixbuf->get_rowstride();
-    int n_channels = filteredPixbuf->get_n_channels();
-
-    // Собираем гистограмму яркости
-    std::vector<int> brightness_histogram(256, 0);
-    
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            guint8* p = pixels + y * rowstride + x * n_channels;
-            // Вычисляем яркость по формуле Y = 0.299R + 0.587G + 0.114B
-            float brightness = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
-            int bright_int = static_cast<int>(brightness);
-            brightness_histogram[bright_int]++;
-        }
-    }
-
-    // Вычисляем CDF для яркости
-    std::vector<int> cdf(256, 0);
-    int total_pixels = width * height;
-    
-    cdf[0] = brightness_histogram[0];
-    for (int i = 1; i < 256; i++) {
-        cdf[i] = cdf[i-1] + brightness_histogram[i];
-    }
-
-    // Находим минимальное значение CDF
-    int cdf_min = total_pixels;
-    for (int i = 0; i < 256; i++) {
-        if (brightness_histogram[i] != 0) {
-            cdf_min = std::min(cdf_min, cdf[i]);
-        }
-    }
-
-    // Создаем lookup table для преобразования яркости
-    std::vector<guint8> brightness_map(256);
-    for (int i = 0; i < 256; i++) {
-        if (cdf[i] > cdf_min) {
-            float equalized = (cdf[i] - cdf_min) / static_cast<float>(total_pixels - cdf_min);
-            brightness_map[i] = static_cast<guint8>(equalized * 255);
-        } else {
-            brightness_map[i] = 0;
-        }
-    }
-
-    // Применяем преобразование только к яркости, сохраняя цвет
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            guint8* p = pixels + y * rowstride + x * n_channels;
-            
-            // Получаем исходные RGB значения
-            float r = p[0], g = p[1], b = p[2];
-            
-            // Вычисляем исходную яркость
-            float old_brightness = 0.299f * r + 0.587f * g + 0.114f * b;
-            int old_bright_int = static_cast<int>(old_brightness);
-            
-            // Получаем новую яркость
-            float new_brightness = brightness_map[old_bright_int];
-            
-            // Если исходная яркость была 0, избегаем деления на ноль
-            if (old_brightness > 0) {
-                // Масштабируем RGB каналы для сохранения цветового тона
-                float scale = new_brightness / old_brightness;
-                
-                p[0] = static_cast<guint8>(std::max(0.0f, std::min(255.0f, r * scale)));
-                p[1] = static_cast<guint8>(std::max(0.0f, std::min(255.0f, g * scale)));
-                p[2] = static_cast<guint8>(std::max(0.0f, std::min(255.0f, b * scale)));
-            } else {
-                // Если яркость была 0, просто устанавливаем новую яркость
-                p[0] = p[1] = p[2] = static_cast<guint8>(new_brightness);
-            }
-        }
-    }
-}
-
-void ImageProcessor::applyLinearContrast(int min_out, int max_out) {
-    if (!originalPixbuf) return;
-
-    filteredPixbuf = originalPixbuf->copy();
-
-    int min_brightness = 255;
-    int max_brightness = 0;
-
-    guint8* orig_pixels = originalPixbuf->get_pixels();
-    int rowstride = originalPixbuf->get_rowstride();
-    int n_channels = originalPixbuf->get_n_channels();
-
-    // Находим минимальную и максимальную яркость по всему изображению
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            guint8* p = orig_pixels + y * rowstride + x * n_channels;
-            
-            // Вычисляем яркость по формуле Y = 0.299R + 0.587G + 0.114B
-            float brightness = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
-            int bright_int = static_cast<int>(brightness);
-            
-            min_brightness = std::min(min_brightness, bright_int);
-            max_brightness = std::max(max_brightness, bright_int);
-        }
-    }
-
-    // Если все пиксели одинаковой яркости, избегаем деления на ноль
-    if (max_brightness == min_brightness) {
-        return;
-    }
-
-    guint8* pixels = filteredPixbuf->get_pixels();
-
-    // Применяем контрастирование ко всем каналам с одинаковым коэффициентом
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            guint8* p = pixels + y * rowstride + x * n_channels;
-            
-            // Вычисляем яркость текущего пикселя
-            float brightness = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
-            int bright_int = static_cast<int>(brightness);
-            
-            // Нормализуем яркость
-            float normalized = static_cast<float>(bright_int - min_brightness) / 
-                              (max_brightness - min_brightness);
-            
-            // Вычисляем новый уровень яркости
-            int new_brightness = static_cast<int>(min_out + normalized * (max_out - min_out));
-            new_brightness = std::max(0, std::min(255, new_brightness));
-            
-            // Вычисляем коэффициент масштабирования для каждого канала
-            float scale_factor = (bright_int == 0) ? 1.0f : static_cast<float>(new_brightness) / bright_int;
-            
-            // Применяем одинаковое преобразование ко всем каналам
-            for (int channel = 0; channel < 3; channel++) {
-                int new_value = static_cast<int>(p[channel] * scale_factor);
-                p[channel] = static_cast<guint8>(std::max(0, std::min(255, new_value)));
-            }
-        }
-    }
-}
-
-std::vector<unsigned char> ImageProcessor::encodeRLE() {
-    std::vector<unsigned char> encoded;
-    if (!filteredPixbuf) return encoded;
-
-    guint8* pixels = filteredPixbuf->get_pixels();
-    int rowstride = filteredPixbuf->get_rowstride();
-    int n_channels = filteredPixbuf->get_n_channels();
-
-    encoded.push_back((width >> 8) & 0xFF);
-    encoded.push_back(width & 0xFF);
-    encoded.push_back((height >> 8) & 0xFF);
-    encoded.push_back(height & 0xFF);
-
-    for (int y = 0; y < height; ++y) {
-        for (int channel = 0; channel < 3; channel++) {
-            int count = 1;
-            unsigned char current = pixels[y * rowstride + channel];
-
-            for (int x = 1; x < width; ++x) {
-                unsigned char next = pixels[y * rowstride + x * n_channels + channel];
-                if (next == current && count < 255) {
-                    count++;
-                } else {
-                    encoded.push_back(count);
-                    encoded.push_back(current);
-                    current = next;
-                    count = 1;
-                }
-            }
-            encoded.push_back(count);
-            encoded.push_back(current);
-        }
-    }
-
-    return encoded;
-}
-
-bool ImageProcessor::decodeRLE(const std::vector<unsigned char>& encoded) {
-    if (encoded.size() < 4) return false;
-
-    int decoded_width = (encoded[0] << 8) | encoded[1];
-    int decoded_height = (encoded[2] << 8) | encoded[3];
-
-    filteredPixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, false, 8, decoded_width, decoded_height);
-    width = decoded_width;
-    height = decoded_height;
-
-    guint8* pixels = filteredPixbuf->get_pixels();
-    int rowstride = filteredPixbuf->get_rowstride();
-    int n_channels = filteredPixbuf->get_n_channels();
-
-    size_t pos = 4;
-
-    for (int y = 0; y < height && pos < encoded.size(); ++y) {
-        for (int channel = 0; channel < 3 && pos < encoded.size(); channel++) {
-            int x = 0;
-            while (x < width && pos + 1 < encoded.size()) {
-                unsigned char count = encoded[pos++];
-                unsigned char value = encoded[pos++];
-
-                for (int i = 0; i < count && x < width; ++i) {
-                    pixels[y * rowstride + x * n_channels + channel] = value;
-                    x++;
-                }
-            }
-        }
-    }
-
-    return true;
-}
-
-bool ImageProcessor::saveRLEToFile(const std::string& filename) {
-    auto encoded = encodeRLE();
-    if (encoded.empty()) return false;
-
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) return false;
-
-    file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
-    return file.good();
-}
-
-bool ImageProcessor::loadRLEFromFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) return false;
-
-    file.seekg(0, std::ios::end);
-    size_t size = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    std::vector<unsigned char> encoded(size);
-    file.read(reinterpret_cast<char*>(encoded.data()), size);
-
-    return decodeRLE(encoded);
-}
-
-void ImageProcessor::setOriginalFromFiltered() {
-    if (filteredPixbuf) {
-        originalPixbuf = filteredPixbuf->copy();
-    }
-}
-
-Glib::RefPtr<Gdk::Pixbuf> ImageProcessor::getOriginalPixbuf() { return originalPixbuf; }
-Glib::RefPtr<Gdk::Pixbuf> ImageProcessor::getFilteredPixbuf() { return filteredPixbuf; }
-
-void ImageProcessor::resetToOriginal() {
-    if (originalPixbuf) {
-        filteredPixbuf = originalPixbuf->copy();
-    }
-}
-
-bool ImageProcessor::hasImage() const { return (bool)originalPixbuf; }
+#include <cstdio>
+#include <utility>
 
 HistogramDrawingArea::HistogramDrawingArea(const std::vector<int>& histogram, const Gdk::RGBA& color)
         : histogram(histogram), color(color) {
@@ -537,6 +100,61 @@ HistogramDialog::HistogramDialog(Gtk::Window& parent, const std::vector<std::vec
     blueDrawingArea->queue_draw();
 }
 
+MetricsDialog::MetricsDialog(Gtk::Window& parent)
+        : Gtk::Dialog("Operation Metrics", parent, true) {
+
+    set_default_size(760, 400);
+    set_border_width(10);
+
+    Gtk::Box* contentBox = get_content_area();
+
+    store = Gtk::ListStore::create(columns);
+    view.set_model(store);
+    view.append_column("Operation", columns.operation);
+    view.append_column("Size", columns.size);
+    view.append_column_numeric("Wall ms", columns.wallMs, "%.1f");
+    view.append_column_numeric("CPU ms", columns.cpuMs, "%.1f");
+    view.append_column_numeric("Peak +MB", columns.peakMb, "%.1f");
+    view.append_column_numeric("New MB", columns.allocatedMb, "%.1f");
+    view.append_column("Pixbuf copies", columns.pixbufCopies);
+    view.append_column("Threads", columns.threads);
+
+    scroll.set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
+    scroll.add(view);
+    contentBox->pack_start(scroll, true, true, 0);
+    poolLabel.set_xalign(0.0);
+    contentBox->pack_start(poolLabel, Gtk::PACK_SHRINK, 5);
+
+    add_button("C_lear", RESPONSE_CLEAR);
+    add_button("_Export CSV...", RESPONSE_EXPORT);
+    add_button("_Close", Gtk::RESPONSE_CLOSE);
+
+    refresh();
+    show_all_children();
+}
+
+void MetricsDialog::refresh() {
+    store->clear();
+    for (const OperationRecord& record : MetricsRegistry::instance().records()) {
+        Gtk::TreeRow row = *store->append();
+        row[columns.operation] = record.operation;
+        row[columns.size] = std::to_string(record.width) + "x" + std::to_string(record.height);
+        row[columns.wallMs] = record.wallMs;
+        row[columns.cpuMs] = record.cpuMs;
+        row[columns.peakMb] = record.peakExtraBytes / (1024.0 * 1024.0);
+        row[columns.allocatedMb] = record.allocatedBytes / (1024.0 * 1024.0);
+        row[columns.pixbufCopies] = record.pixbufCopies;
+        row[columns.threads] = record.threads;
+    }
+
+    BufferPool::Statistics pool = BufferPool::instance().statistics();
+    char text[256];
+    std::snprintf(text, sizeof(text), "Buffer pool: %.1f%% of %llu requests reused, %.0f MB allocated, %.0f MB kept",
+                  pool.reuseRate() * 100, static_cast<unsigned long long>(pool.requests),
+                  pool.allocatedBytes / (1024.0 * 1024.0), (pool.idleBytes + pool.threadBytes) / (1024.0 * 1024.0));
+    poolLabel.set_text(text);
+}
+
 ContrastDialog::ContrastDialog(Gtk::Window& parent)
         : Gtk::Dialog("Linear Contrast Settings", parent, true) {
     
@@ -561,6 +179,9 @@ ContrastDialog::ContrastDialog(Gtk::Window& parent)
     maxBox.pack_start(maxLabel, false, false, 5);
     maxBox.pack_start(maxScale, true, true, 5);
     
+    minScale.signal_value_changed().connect([this]() { if (onChanged) onChanged(); });
+    maxScale.signal_value_changed().connect([this]() { if (onChanged) onChanged(); });
+    
     mainBox.pack_start(minBox, true, true, 5);
     mainBox.pack_start(maxBox, true, true, 5);
     
@@ -583,7 +204,7 @@ int ContrastDialog::getMaxValue() const {
 FilterDialog::FilterDialog(Gtk::Window& parent)
         : Gtk::Dialog("Low-Pass Filter Settings", parent, true) {
     
-    set_default_size(300, 200);
+    set_default_size(300, 380);
     set_border_width(10);
     
     Gtk::Box* contentBox = get_content_area();
@@ -591,6 +212,8 @@ FilterDialog::FilterDialog(Gtk::Window& parent)
     filterTypeLabel.set_label("Filter Type:");
     filterTypeCombo.append("Average Filter");
     filterTypeCombo.append("Gaussian Filter");
+    filterTypeCombo.append("Median Filter");
+    filterTypeCombo.append("Bilateral Filter");
     filterTypeCombo.set_active(0);
     
     kernelSizeLabel.set_label("Kernel Size:");
@@ -607,6 +230,52 @@ FilterDialog::FilterDialog(Gtk::Window& parent)
     sigmaScale.set_increments(0.1, 0.5);
     sigmaScale.set_digits(1);
     
+    radiusLabel.set_label("Radius (for Median):");
+    radiusScale.set_range(1, 50);
+    radiusScale.set_value(2);
+    radiusScale.set_increments(1, 5);
+    radiusScale.set_digits(0);
+    
+    spatialLabel.set_label("Spatial sigma (px):");
+    spatialScale.set_range(2, 32);
+    spatialScale.set_value(8);
+    spatialScale.set_increments(1, 4);
+    spatialScale.set_digits(0);
+    
+    rangeLabel.set_label("Range sigma:");
+    rangeScale.set_range(5, 100);
+    rangeScale.set_value(20);
+    rangeScale.set_increments(1, 10);
+    rangeScale.set_digits(0);
+    
+    borderLabel.set_label("Border:");
+    borderCombo.append("Leave unfiltered");
+    borderCombo.append("Replicate edge");
+    borderCombo.append("Reflect");
+    borderCombo.set_active(0);
+    
+    // Kernel size applies to average/Gaussian, radius to median, the two
+    // sigmas to bilateral (which has no border parameter)
+    filterTypeCombo.signal_changed().connect([this]() {
+        int type = filterTypeCombo.get_active_row_number();
+        kernelSizeBox.set_sensitive(type < 2);
+        sigmaBox.set_sensitive(type == 1);
+        radiusBox.set_sensitive(type == 2);
+        spatialBox.set_sensitive(type == 3);
+        rangeBox.set_sensitive(type == 3);
+        borderBox.set_sensitive(type != 3);
+    });
+    for (Gtk::ComboBoxText* combo : {&filterTypeCombo, &kernelSizeCombo, &borderCombo}) {
+        combo->signal_changed().connect([this]() { if (onChanged) onChanged(); });
+    }
+    for (Gtk::Scale* scale : {&sigmaScale, &radiusScale, &spatialScale, &rangeScale}) {
+        scale->signal_value_changed().connect([this]() { if (onChanged) onChanged(); });
+    }
+    sigmaBox.set_sensitive(false);
+    radiusBox.set_sensitive(false);
+    spatialBox.set_sensitive(false);
+    rangeBox.set_sensitive(false);
+    
     filterTypeBox.pack_start(filterTypeLabel, false, false, 5);
     filterTypeBox.pack_start(filterTypeCombo, true, true, 5);
     
@@ -616,9 +285,25 @@ FilterDialog::FilterDialog(Gtk::Window& parent)
     sigmaBox.pack_start(sigmaLabel, false, false, 5);
     sigmaBox.pack_start(sigmaScale, true, true, 5);
     
+    radiusBox.pack_start(radiusLabel, false, false, 5);
+    radiusBox.pack_start(radiusScale, true, true, 5);
+    
+    spatialBox.pack_start(spatialLabel, false, false, 5);
+    spatialBox.pack_start(spatialScale, true, true, 5);
+    
+    rangeBox.pack_start(rangeLabel, false, false, 5);
+    rangeBox.pack_start(rangeScale, true, true, 5);
+    
+    borderBox.pack_start(borderLabel, false, false, 5);
+    borderBox.pack_start(borderCombo, true, true, 5);
+    
     mainBox.pack_start(filterTypeBox, true, true, 5);
     mainBox.pack_start(kernelSizeBox, true, true, 5);
     mainBox.pack_start(sigmaBox, true, true, 5);
+    mainBox.pack_start(radiusBox, true, true, 5);
+    mainBox.pack_start(spatialBox, true, true, 5);
+    mainBox.pack_start(rangeBox, true, true, 5);
+    mainBox.pack_start(borderBox, true, true, 5);
     
     contentBox->pack_start(mainBox, true, true, 0);
     
@@ -648,22 +333,69 @@ double FilterDialog::getSigma() const {
     return sigmaScale.get_value();
 }
 
+int FilterDialog::getMedianRadius() const {
+    return static_cast<int>(radiusScale.get_value());
+}
+
+double FilterDialog::getSpatialSigma() const {
+    return spatialScale.get_value();
+}
+
+double FilterDialog::getRangeSigma() const {
+    return rangeScale.get_value();
+}
+
+BorderMode FilterDialog::getBorderMode() const {
+    switch (borderCombo.get_active_row_number()) {
+        case 1: return BorderMode::Clamp;
+        case 2: return BorderMode::Reflect;
+        default: return BorderMode::Skip;
+    }
+}
+
 EqualizationDialog::EqualizationDialog(Gtk::Window& parent)
         : Gtk::Dialog("Histogram Equalization Settings", parent, true) {
     
-    set_default_size(350, 150);
+    set_default_size(350, 250);
     set_border_width(10);
     
     Gtk::Box* contentBox = get_content_area();
     
     typeCombo.append("RGB - Equalize all channels");
-    typeCombo.append("HSV/HLS - Equalize brightness only");
+    typeCombo.append("Luma - Rescale RGB by brightness");
+    typeCombo.append("HSV - Equalize value (V) only");
+    typeCombo.append("HLS - Equalize lightness (L) only");
+    typeCombo.append("CLAHE - Adaptive, contrast limited");
     typeCombo.set_active(0);
+    typeCombo.signal_changed().connect([this]() {
+        claheBox.set_sensitive(typeCombo.get_active_row_number() == 4);
+    });
+    
+    clipLimitScale.set_range(1.0, 8.0);
+    clipLimitScale.set_value(2.0);
+    clipLimitScale.set_increments(0.1, 0.5);
+    clipLimitScale.set_digits(1);
+    
+    tilesScale.set_range(2, 32);
+    tilesScale.set_value(8);
+    tilesScale.set_increments(1, 4);
+    tilesScale.set_digits(0);
     
     typeBox.pack_start(typeLabel, false, false, 5);
     typeBox.pack_start(typeCombo, true, true, 5);
     
+    clipLimitBox.pack_start(clipLimitLabel, false, false, 5);
+    clipLimitBox.pack_start(clipLimitScale, true, true, 5);
+    tilesBox.pack_start(tilesLabel, false, false, 5);
+    tilesBox.pack_start(tilesScale, true, true, 5);
+    
+    claheBox.pack_start(clipLimitBox, true, true, 0);
+    claheBox.pack_start(tilesBox, true, true, 0);
+    claheBox.pack_start(slidingCheck, false, false, 0);
+    claheBox.set_sensitive(false);
+    
     mainBox.pack_start(typeBox, true, true, 5);
+    mainBox.pack_start(claheBox, true, true, 5);
     
     contentBox->pack_start(mainBox, true, true, 0);
     
@@ -677,18 +409,210 @@ int EqualizationDialog::getEqualizationType() const {
     return typeCombo.get_active_row_number();
 }
 
-MainWindow::MainWindow() {
+double EqualizationDialog::getClipLimit() const {
+    return clipLimitScale.get_value();
+}
+
+int EqualizationDialog::getTileCount() const {
+    return static_cast<int>(tilesScale.get_value());
+}
+
+bool EqualizationDialog::getSlidingWindow() const {
+    return slidingCheck.get_active();
+}
+
+MorphologyDialog::MorphologyDialog(Gtk::Window& parent)
+        : Gtk::Dialog("Morphology Settings", parent, true) {
+    
+    set_default_size(300, 200);
+    set_border_width(10);
+    
+    Gtk::Box* contentBox = get_content_area();
+    
+    operationCombo.append("Erode");
+    operationCombo.append("Dilate");
+    operationCombo.append("Open");
+    operationCombo.append("Close");
+    operationCombo.set_active(2);
+    
+    widthScale.set_range(1, 101);
+    widthScale.set_value(3);
+    widthScale.set_increments(1, 10);
+    widthScale.set_digits(0);
+    
+    heightScale.set_range(1, 101);
+    heightScale.set_value(3);
+    heightScale.set_increments(1, 10);
+    heightScale.set_digits(0);
+    
+    operationBox.pack_start(operationLabel, false, false, 5);
+    operationBox.pack_start(operationCombo, true, true, 5);
+    
+    widthBox.pack_start(widthLabel, false, false, 5);
+    widthBox.pack_start(widthScale, true, true, 5);
+    
+    heightBox.pack_start(heightLabel, false, false, 5);
+    heightBox.pack_start(heightScale, true, true, 5);
+    
+    mainBox.pack_start(operationBox, true, true, 5);
+    mainBox.pack_start(widthBox, true, true, 5);
+    mainBox.pack_start(heightBox, true, true, 5);
+    mainBox.pack_start(binaryCheck, false, false, 5);
+    
+    contentBox->pack_start(mainBox, true, true, 0);
+    
+    add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    add_button("_Apply", Gtk::RESPONSE_OK);
+    
+    show_all_children();
+}
+
+MorphologyOp MorphologyDialog::getOperation() const {
+    switch (operationCombo.get_active_row_number()) {
+        case 0: return MorphologyOp::Erode;
+        case 1: return MorphologyOp::Dilate;
+        case 3: return MorphologyOp::Close;
+        default: return MorphologyOp::Open;
+    }
+}
+
+int MorphologyDialog::getKernelWidth() const {
+    return static_cast<int>(widthScale.get_value());
+}
+
+int MorphologyDialog::getKernelHeight() const {
+    return static_cast<int>(heightScale.get_value());
+}
+
+bool MorphologyDialog::getBinary() const {
+    return binaryCheck.get_active();
+}
+
+EdgeDialog::EdgeDialog(Gtk::Window& parent)
+        : Gtk::Dialog("Edge Detection Settings", parent, true) {
+    
+    set_default_size(300, 150);
+    set_border_width(10);
+    
+    Gtk::Box* contentBox = get_content_area();
+    
+    // Thresholds on |gx| + |gy| of the Sobel gradient
+    lowScale.set_range(0, 1020);
+    lowScale.set_value(50);
+    lowScale.set_increments(1, 10);
+    lowScale.set_digits(0);
+    
+    highScale.set_range(1, 1020);
+    highScale.set_value(150);
+    highScale.set_increments(1, 10);
+    highScale.set_digits(0);
+    
+    lowBox.pack_start(lowLabel, false, false, 5);
+    lowBox.pack_start(lowScale, true, true, 5);
+    
+    highBox.pack_start(highLabel, false, false, 5);
+    highBox.pack_start(highScale, true, true, 5);
+    
+    mainBox.pack_start(lowBox, true, true, 5);
+    mainBox.pack_start(highBox, true, true, 5);
+    
+    contentBox->pack_start(mainBox, true, true, 0);
+    
+    add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    add_button("_Apply", Gtk::RESPONSE_OK);
+    
+    show_all_children();
+}
+
+int EdgeDialog::getLowThreshold() const {
+    return static_cast<int>(lowScale.get_value());
+}
+
+int EdgeDialog::getHighThreshold() const {
+    return static_cast<int>(highScale.get_value());
+}
+
+namespace {
+
+const char* kBorderNames[] = {"skip", "clamp", "reflect"};
+
+// Enough digits for the stage parser to read back the same double.
+std::string exact(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.17g", value);
+    return text;
+}
+
+// Odd size of a k-wide kernel seen scale times smaller, at least 3 (the
+// smallest the filters run).
+int scaledKernel(int k, double scale) {
+    return std::max(3, 2 * static_cast<int>(std::lround(k / 2 * scale)) + 1);
+}
+
+// The filter set up in dialog as a pipeline stage, its reach multiplied by
+// scale for a preview on a smaller proxy. Empty if it is too small to show
+// at that scale.
+std::string filterStage(const FilterDialog& dialog, double scale) {
+    std::string border = kBorderNames[static_cast<int>(dialog.getBorderMode())];
+    int kernelSize = scaledKernel(dialog.getKernelSize(), scale);
+    switch (dialog.getFilterType()) {
+        case 0:
+            return "box:k=" + std::to_string(kernelSize) + ",border=" + border;
+        case 1:
+            return "gaussian:k=" + std::to_string(kernelSize) + ",s=" + exact(std::max(0.1, dialog.getSigma() * scale)) +
+                   ",border=" + border;
+        case 3:
+            // The grid gets slow below a spatial sigma of about two pixels,
+            // where a proxy shows little difference anyway.
+            return "bilateral:s=" + exact(std::max(2.0, dialog.getSpatialSigma() * scale)) +
+                   ",r=" + exact(dialog.getRangeSigma());
+        default: {
+            int radius = static_cast<int>(std::lround(dialog.getMedianRadius() * scale));
+            if (radius == 0) return "";
+            return "median:r=" + std::to_string(radius) + ",border=" + border;
+        }
+    }
+}
+
+std::string contrastStage(const ContrastDialog& dialog) {
+    return "contrast:min=" + std::to_string(dialog.getMinValue()) + ",max=" + std::to_string(dialog.getMaxValue());
+}
+
+}
+
+MainWindow::MainWindow()
+        : filteredPixbufVersion(0), jobSucceeded(false), previewX(0), previewY(0), previewWidth(0), previewHeight(0),
+          previewRefining(false), previewSucceeded(false), previewPending(false) {
     set_title("Image Processing Application");
     set_default_size(1200, 800);
     set_border_width(10);
     
     setupUI();
+
+    // The dispatchers are emitted from the workers; the handlers run here.
+    job.onProgress = [this]() { jobProgress.emit(); };
+    jobProgress.connect([this]() {
+        double progress = job.getProgress();
+        if (progress >= 0) progressBar.set_fraction(progress);
+    });
+    jobFinished.connect([this]() { onJobFinished(); });
+    previewReady.connect([this]() { onPreviewReady(); });
+    rleDecoded.connect([this]() { onRleDecoded(); });
+}
+
+MainWindow::~MainWindow() {
+    endPreview();
+    if (worker.joinable()) {
+        job.cancel();
+        worker.join();
+    }
 }
 
 void MainWindow::setupUI() {
     add(mainBox);
     setupLayout();
     show_all_children();
+    progressBox.hide();
 }
 
 void MainWindow::setupLayout() {
@@ -699,15 +623,11 @@ void MainWindow::setupLayout() {
     contentBox.pack_start(imageStackBox, true, true, 0);
 
     originalFrame.set_label("Original Image");
-    originalScrolled.set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
-    originalScrolled.add(originalImage);
-    originalFrame.add(originalScrolled);
+    originalFrame.add(originalView);
     imageStackBox.pack_start(originalFrame, true, true, 0);
 
     filteredFrame.set_label("Processed Image");
-    filteredScrolled.set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
-    filteredScrolled.add(filteredImage);
-    filteredFrame.add(filteredScrolled);
+    filteredFrame.add(filteredView);
     imageStackBox.pack_start(filteredFrame, true, true, 0);
 
     controlsBox.set_border_width(10);
@@ -722,13 +642,19 @@ void MainWindow::setupLayout() {
 
     auto openIcon = Gtk::manage(new Gtk::Image("document-open-symbolic", Gtk::ICON_SIZE_BUTTON));
     auto saveIcon = Gtk::manage(new Gtk::Image("document-save-symbolic", Gtk::ICON_SIZE_BUTTON));
+    auto selectAllIcon = Gtk::manage(new Gtk::Image("edit-select-all-symbolic", Gtk::ICON_SIZE_BUTTON));
     auto lowpassIcon = Gtk::manage(new Gtk::Image("view-grid-symbolic", Gtk::ICON_SIZE_BUTTON));
+    auto morphologyIcon = Gtk::manage(new Gtk::Image("zoom-fit-best-symbolic", Gtk::ICON_SIZE_BUTTON));
+    auto edgesIcon = Gtk::manage(new Gtk::Image("image-x-generic-symbolic", Gtk::ICON_SIZE_BUTTON));
     auto equalizeIcon = Gtk::manage(new Gtk::Image("color-balance-symbolic", Gtk::ICON_SIZE_BUTTON));
     auto contrastIcon = Gtk::manage(new Gtk::Image("display-brightness-symbolic", Gtk::ICON_SIZE_BUTTON));
     auto histogramIcon = Gtk::manage(new Gtk::Image("view-histogram-symbolic", Gtk::ICON_SIZE_BUTTON));
+    auto metricsIcon = Gtk::manage(new Gtk::Image("utilities-system-monitor-symbolic", Gtk::ICON_SIZE_BUTTON));
     auto encodeIcon = Gtk::manage(new Gtk::Image("archive-insert-symbolic", Gtk::ICON_SIZE_BUTTON));
     auto decodeIcon = Gtk::manage(new Gtk::Image("archive-extract-symbolic", Gtk::ICON_SIZE_BUTTON));
     auto resetIcon = Gtk::manage(new Gtk::Image("edit-undo-symbolic", Gtk::ICON_SIZE_BUTTON));
+    auto undoIcon = Gtk::manage(new Gtk::Image("edit-undo-symbolic", Gtk::ICON_SIZE_BUTTON));
+    auto redoIcon = Gtk::manage(new Gtk::Image("edit-redo-symbolic", Gtk::ICON_SIZE_BUTTON));
 
     openButton.set_label("Open Image");
     openButton.set_image(*openIcon);
@@ -744,6 +670,45 @@ void MainWindow::setupLayout() {
 
     controlsBox.pack_start(*Gtk::manage(new Gtk::Separator(Gtk::ORIENTATION_HORIZONTAL)), Gtk::PACK_SHRINK, 10);
 
+    auto regionTitle = Gtk::manage(new Gtk::Label("<b>Region</b>"));
+    regionTitle->set_use_markup(true);
+    regionTitle->set_xalign(0.0);
+    controlsBox.pack_start(*regionTitle, Gtk::PACK_SHRINK, 5);
+
+    // In the order of ImageView::SelectionTool.
+    regionToolCombo.append("Pan");
+    regionToolCombo.append("Select Rectangle");
+    regionToolCombo.append("Select Ellipse");
+    regionToolCombo.append("Select Freehand");
+    regionToolCombo.set_active(0);
+    regionToolCombo.signal_changed().connect([this]() {
+        filteredView.setSelectionTool(static_cast<ImageView::SelectionTool>(regionToolCombo.get_active_row_number()));
+    });
+    controlsBox.pack_start(regionToolCombo, Gtk::PACK_SHRINK);
+
+    filteredView.onSelectionChanged = [this](const ImageRegion& region) {
+        processor.setRegion(region);
+        updateRegion();
+    };
+
+    regionStatisticsCheck.set_active(processor.getRegionStatistics());
+    regionStatisticsCheck.signal_toggled().connect([this]() {
+        processor.setRegionStatistics(regionStatisticsCheck.get_active());
+    });
+    controlsBox.pack_start(regionStatisticsCheck, Gtk::PACK_SHRINK);
+
+    clearRegionButton.set_label("Select Whole Image");
+    clearRegionButton.set_image(*selectAllIcon);
+    clearRegionButton.set_always_show_image(true);
+    clearRegionButton.signal_clicked().connect([this]() { on_clear_region_clicked(); });
+    controlsBox.pack_start(clearRegionButton, Gtk::PACK_SHRINK);
+
+    regionLabel.set_xalign(0.0);
+    controlsBox.pack_start(regionLabel, Gtk::PACK_SHRINK);
+    updateRegion();
+
+    controlsBox.pack_start(*Gtk::manage(new Gtk::Separator(Gtk::ORIENTATION_HORIZONTAL)), Gtk::PACK_SHRINK, 10);
+
     auto filterLabel = Gtk::manage(new Gtk::Label("<b>Filters</b>"));
     filterLabel->set_use_markup(true);
     filterLabel->set_xalign(0.0);
@@ -755,6 +720,18 @@ void MainWindow::setupLayout() {
     lowpassButton.signal_clicked().connect([this]() { on_lowpass_clicked(); });
     controlsBox.pack_start(lowpassButton, Gtk::PACK_SHRINK);
 
+    morphologyButton.set_label("Apply Morphology");
+    morphologyButton.set_image(*morphologyIcon);
+    morphologyButton.set_always_show_image(true);
+    morphologyButton.signal_clicked().connect([this]() { on_morphology_clicked(); });
+    controlsBox.pack_start(morphologyButton, Gtk::PACK_SHRINK);
+
+    edgesButton.set_label("Detect Edges (Canny)");
+    edgesButton.set_image(*edgesIcon);
+    edgesButton.set_always_show_image(true);
+    edgesButton.signal_clicked().connect([this]() { on_edges_clicked(); });
+    controlsBox.pack_start(edgesButton, Gtk::PACK_SHRINK);
+
     controlsBox.pack_start(*Gtk::manage(new Gtk::Separator(Gtk::ORIENTATION_HORIZONTAL)), Gtk::PACK_SHRINK, 10);
 
     auto histLabel = Gtk::manage(new Gtk::Label("<b>Histogram</b>"));
@@ -780,6 +757,12 @@ void MainWindow::setupLayout() {
     showHistogramButton.signal_clicked().connect([this]() { on_show_histogram_clicked(); });
     controlsBox.pack_start(showHistogramButton, Gtk::PACK_SHRINK);
 
+    showMetricsButton.set_label("Show Metrics");
+    showMetricsButton.set_image(*metricsIcon);
+    showMetricsButton.set_always_show_image(true);
+    showMetricsButton.signal_clicked().connect([this]() { on_show_metrics_clicked(); });
+    controlsBox.pack_start(showMetricsButton, Gtk::PACK_SHRINK);
+
     controlsBox.pack_start(*Gtk::manage(new Gtk::Separator(Gtk::ORIENTATION_HORIZONTAL)), Gtk::PACK_SHRINK, 10);
 
     auto rleLabel = Gtk::manage(new Gtk::Label("<b>Compression (RLE)</b>"));
@@ -799,11 +782,40 @@ void MainWindow::setupLayout() {
     decodeAndOpenRLEButton.signal_clicked().connect([this]() { on_decode_and_open_rle_clicked(); });
     controlsBox.pack_start(decodeAndOpenRLEButton, Gtk::PACK_SHRINK);
 
+    controlsBox.pack_start(*Gtk::manage(new Gtk::Separator(Gtk::ORIENTATION_HORIZONTAL)), Gtk::PACK_SHRINK, 10);
+
+    auto historyLabel = Gtk::manage(new Gtk::Label("<b>History</b>"));
+    historyLabel->set_use_markup(true);
+    historyLabel->set_xalign(0.0);
+    controlsBox.pack_start(*historyLabel, Gtk::PACK_SHRINK, 5);
+
+    undoButton.set_label("Undo");
+    undoButton.set_image(*undoIcon);
+    undoButton.set_always_show_image(true);
+    undoButton.set_sensitive(false);
+    undoButton.signal_clicked().connect([this]() { on_undo_clicked(); });
+    controlsBox.pack_start(undoButton, Gtk::PACK_SHRINK);
+
+    redoButton.set_label("Redo");
+    redoButton.set_image(*redoIcon);
+    redoButton.set_always_show_image(true);
+    redoButton.set_sensitive(false);
+    redoButton.signal_clicked().connect([this]() { on_redo_clicked(); });
+    controlsBox.pack_start(redoButton, Gtk::PACK_SHRINK);
+
     controlsBox.pack_end(resetButton, Gtk::PACK_SHRINK, 10);
     resetButton.set_label("Reset to Original");
     resetButton.set_image(*resetIcon);
     resetButton.set_always_show_image(true);
     resetButton.signal_clicked().connect([this]() { on_reset_clicked(); });
+
+    progressBar.set_show_text(true);
+    progressBox.pack_start(progressBar, true, true, 0);
+    cancelButton.set_label("Cancel");
+    cancelButton.signal_clicked().connect([this]() { job.cancel(); });
+    progressBox.pack_start(cancelButton, Gtk::PACK_SHRINK);
+    mainBox.pack_end(statusBar, Gtk::PACK_SHRINK);
+    mainBox.pack_end(progressBox, Gtk::PACK_SHRINK);
 }
 
 void MainWindow::on_open_clicked() {
@@ -826,7 +838,7 @@ void MainWindow::on_open_clicked() {
 
     if (dialog.run() == Gtk::RESPONSE_OK) {
         std::string filename = dialog.get_filename();
-        if (processor.loadImage(filename)) {
+        if (loadImageFile(filename)) {
             updateImages();
         } else {
             Gtk::MessageDialog error(*this, "Failed to load image", false, Gtk::MESSAGE_ERROR);
@@ -878,7 +890,12 @@ void MainWindow::on_save_clicked() {
                     file_type = "bmp";
                 }
                 
-                processor.getFilteredPixbuf()->save(filename, file_type);
+                {
+                    OperationTimer timer("save:" + file_type, processor.getFiltered().getWidth(),
+                                         processor.getFiltered().getHeight());
+                    getFilteredPixbuf()->save(filename, file_type);
+                }
+                updateStatus();
                 
                 Gtk::MessageDialog success(*this, "Image saved successfully", false, Gtk::MESSAGE_INFO);
                 success.run();
@@ -898,27 +915,66 @@ void MainWindow::on_lowpass_clicked() {
     }
 
     FilterDialog dialog(*this);
-    if (dialog.run() == Gtk::RESPONSE_OK) {
+    beginPreview(false, [&dialog](double scale) { return filterStage(dialog, scale); });
+    dialog.onChanged = [this]() { requestPreview(); };
+    int response = dialog.run();
+    endPreview();
+    if (response == Gtk::RESPONSE_OK) {
         int kernelSize = dialog.getKernelSize();
         int filterType = dialog.getFilterType();
-        double sigma = dialog.getSigma();
+        std::string message;
 
         if (filterType == 0) {
-            processor.applyLowPassFilter(kernelSize);
-            Gtk::MessageDialog info(*this, 
-                "Applied average filter with kernel size " + std::to_string(kernelSize) + "x" + std::to_string(kernelSize), 
-                false, Gtk::MESSAGE_INFO);
-            info.run();
+            message = "Applied average filter with kernel size " + std::to_string(kernelSize) + "x" +
+                      std::to_string(kernelSize);
+        } else if (filterType == 1) {
+            message = "Applied Gaussian filter with kernel size " + std::to_string(kernelSize) + "x" +
+                      std::to_string(kernelSize) + " and sigma=" + std::to_string(dialog.getSigma());
+        } else if (filterType == 3) {
+            message = "Applied bilateral filter with spatial sigma=" + std::to_string(dialog.getSpatialSigma()) +
+                      " and range sigma=" + std::to_string(dialog.getRangeSigma());
         } else {
-            processor.applyGaussianFilter(kernelSize, sigma);
-            Gtk::MessageDialog info(*this, 
-                "Applied Gaussian filter with kernel size " + std::to_string(kernelSize) + "x" + std::to_string(kernelSize) + 
-                " and sigma=" + std::to_string(sigma), 
-                false, Gtk::MESSAGE_INFO);
-            info.run();
+            message = "Applied median filter with radius " + std::to_string(dialog.getMedianRadius());
         }
-        
-        updateImages();
+        startJob(filterStage(dialog, 1.0), false, message);
+    }
+}
+
+void MainWindow::on_morphology_clicked() {
+    if (!processor.hasImage()) {
+        Gtk::MessageDialog error(*this, "No image loaded", false, Gtk::MESSAGE_WARNING);
+        error.run();
+        return;
+    }
+
+    MorphologyDialog dialog(*this);
+    if (dialog.run() == Gtk::RESPONSE_OK) {
+        static const char* names[] = {"erode", "dilate", "open", "close"};
+        startJob(std::string(names[static_cast<int>(dialog.getOperation())]) +
+                 ":w=" + std::to_string(dialog.getKernelWidth()) + ",h=" + std::to_string(dialog.getKernelHeight()) +
+                 ",binary=" + (dialog.getBinary() ? "1" : "0"), false, "");
+    }
+}
+
+void MainWindow::on_edges_clicked() {
+    if (!processor.hasImage()) {
+        Gtk::MessageDialog error(*this, "No image loaded", false, Gtk::MESSAGE_WARNING);
+        error.run();
+        return;
+    }
+
+    EdgeDialog dialog(*this);
+    if (dialog.run() == Gtk::RESPONSE_OK) {
+        int low = dialog.getLowThreshold();
+        int high = dialog.getHighThreshold();
+
+        if (low >= high) {
+            Gtk::MessageDialog error(*this, "Low threshold must be less than high threshold", false, Gtk::MESSAGE_ERROR);
+            error.run();
+            return;
+        }
+
+        startJob("edges:low=" + std::to_string(low) + ",high=" + std::to_string(high), false, "");
     }
 }
 
@@ -932,15 +988,26 @@ void MainWindow::on_equalize_clicked() {
     EqualizationDialog dialog(*this);
     if (dialog.run() == Gtk::RESPONSE_OK) {
         int equalizationType = dialog.getEqualizationType();
-        processor.applyHistogramEqualization(equalizationType);
-        updateImages();
+        std::string stage;
+        if (equalizationType == 4) {
+            stage = "clahe:tiles=" + std::to_string(dialog.getTileCount()) + ",clip=" + exact(dialog.getClipLimit()) +
+                    ",sliding=" + (dialog.getSlidingWindow() ? "1" : "0");
+        } else {
+            static const char* modes[] = {"rgb", "luma", "hsv", "hls"};
+            stage = std::string("equalize:mode=") + modes[equalizationType];
+        }
         
         // Опционально: показать информацию о примененном методе
-        std::string method = (equalizationType == 0) ? "RGB (all channels)" : "HSV/HLS (brightness only)";
-        Gtk::MessageDialog info(*this, 
-            "Applied histogram equalization: " + method, 
-            false, Gtk::MESSAGE_INFO);
-        info.run();
+        std::string method;
+        switch (equalizationType) {
+            case 0: method = "RGB (all channels)"; break;
+            case 1: method = "Luma (brightness ratio)"; break;
+            case 2: method = "HSV (value only)"; break;
+            case 3: method = "HLS (lightness only)"; break;
+            default: method = "CLAHE (value, " + std::to_string(dialog.getTileCount()) + "x" +
+                               std::to_string(dialog.getTileCount()) + " tiles)"; break;
+        }
+        startJob(stage, true, "Applied histogram equalization: " + method);
     }
 }
 
@@ -952,7 +1019,11 @@ void MainWindow::on_contrast_clicked() {
     }
 
     ContrastDialog dialog(*this);
-    if (dialog.run() == Gtk::RESPONSE_OK) {
+    beginPreview(true, [&dialog](double) { return contrastStage(dialog); });
+    dialog.onChanged = [this]() { requestPreview(); };
+    int response = dialog.run();
+    endPreview();
+    if (response == Gtk::RESPONSE_OK) {
         int min_out = dialog.getMinValue();
         int max_out = dialog.getMaxValue();
 
@@ -962,8 +1033,7 @@ void MainWindow::on_contrast_clicked() {
             return;
         }
 
-        processor.applyLinearContrast(min_out, max_out);
-        updateImages();
+        startJob(contrastStage(dialog), true, "");
     }
 }
 
@@ -979,6 +1049,42 @@ void MainWindow::on_show_histogram_clicked() {
     dialog.run();
 }
 
+void MainWindow::on_show_metrics_clicked() {
+    MetricsDialog dialog(*this);
+    for (;;) {
+        int response = dialog.run();
+        if (response == MetricsDialog::RESPONSE_CLEAR) {
+            MetricsRegistry::instance().clear();
+            dialog.refresh();
+        } else if (response == MetricsDialog::RESPONSE_EXPORT) {
+            Gtk::FileChooserDialog chooser("Export metrics", Gtk::FILE_CHOOSER_ACTION_SAVE);
+            chooser.set_transient_for(dialog);
+            chooser.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+            chooser.add_button("_Save", Gtk::RESPONSE_OK);
+            chooser.set_do_overwrite_confirmation(true);
+            chooser.set_current_name("metrics.csv");
+            if (chooser.run() == Gtk::RESPONSE_OK) {
+                chooser.hide();
+                if (!MetricsRegistry::instance().writeCsv(chooser.get_filename())) {
+                    Gtk::MessageDialog error(dialog, "Failed to write the CSV file", false, Gtk::MESSAGE_ERROR);
+                    error.run();
+                }
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+namespace {
+
+bool hasExtension(const std::string& filename, const std::string& extension) {
+    return filename.size() >= extension.size() &&
+           filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+}
+
 void MainWindow::on_encode_and_save_rle_clicked() {
     if (!processor.hasImage()) {
         Gtk::MessageDialog error(*this, "No image loaded", false, Gtk::MESSAGE_WARNING);
@@ -997,12 +1103,19 @@ void MainWindow::on_encode_and_save_rle_clicked() {
     filter_rle->add_pattern("*.rle");
     dialog.add_filter(filter_rle);
 
+    auto filter_lpc = Gtk::FileFilter::create();
+    filter_lpc->set_name("Lossless predictive (*.lpc)");
+    filter_lpc->add_pattern("*.lpc");
+    dialog.add_filter(filter_lpc);
+
     dialog.set_current_name("image.rle");
 
     if (dialog.run() == Gtk::RESPONSE_OK) {
         std::string filename = dialog.get_filename();
         if (!filename.empty()) {
-            if (processor.saveRLEToFile(filename)) {
+            bool saved = hasExtension(filename, ".lpc") ? processor.saveLosslessToFile(filename)
+                                                        : processor.saveRLEToFile(filename);
+            if (saved) {
                 Gtk::MessageDialog success(*this, "RLE saved successfully", false, Gtk::MESSAGE_INFO);
                 success.run();
             } else {
@@ -1023,20 +1136,93 @@ void MainWindow::on_decode_and_open_rle_clicked() {
     auto filter_rle = Gtk::FileFilter::create();
     filter_rle->set_name("RLE files");
     filter_rle->add_pattern("*.rle");
+    filter_rle->add_pattern("*.lpc");
     dialog.add_filter(filter_rle);
 
     if (dialog.run() == Gtk::RESPONSE_OK) {
         std::string filename = dialog.get_filename();
-        if (processor.loadRLEFromFile(filename)) {
-            processor.setOriginalFromFiltered();
-            updateImages();
-            Gtk::MessageDialog success(*this, "RLE loaded as original image", false, Gtk::MESSAGE_INFO);
-            success.run();
-        } else {
-            Gtk::MessageDialog error(*this, "Failed to load RLE file", false, Gtk::MESSAGE_ERROR);
-            error.run();
+        dialog.hide();
+
+        // Indexed archives show the visible part first, then decode the rest
+        // on the worker while the window stays live.
+        bool lossless = hasExtension(filename, ".lpc");
+        if (!lossless && rleArchive.open(filename)) {
+            showRlePreview(rleArchive);
+            startRleDecode();
+            return;
         }
+        finishRleLoad(lossless ? processor.loadLosslessFromFile(filename) : processor.loadRLEFromFile(filename));
+    }
+}
+
+void MainWindow::startRleDecode() {
+    job.reset();
+    progressBar.set_text("decode rle archive");
+    setBusy(true);
+    // The decode cannot report progress; a cancel only drops its result.
+    pulseTimer = Glib::signal_timeout().connect([this]() {
+        progressBar.pulse();
+        return true;
+    }, 100);
+
+    worker = std::thread([this]() {
+        jobSucceeded = ImageProcessor::decodeArchive(rleArchive, rleImage);
+        rleDecoded.emit();
+    });
+}
+
+void MainWindow::onRleDecoded() {
+    worker.join();
+    pulseTimer.disconnect();
+    rleArchive.close();
+    setBusy(false);
+
+    if (job.cancelled()) {
+        rleImage.release();
+        // Back to the image the preview was drawn over, or to an empty view.
+        updateImages();
+        return;
+    }
+    finishRleLoad(jobSucceeded && processor.loadDecoded(rleImage));
+    rleImage.release();
+}
+
+void MainWindow::finishRleLoad(bool loaded) {
+    if (loaded) {
+        processor.setOriginalFromFiltered();
+        updateImages();
+        Gtk::MessageDialog success(*this, "RLE loaded as original image", false, Gtk::MESSAGE_INFO);
+        success.run();
+    } else {
+        updateImages();
+        Gtk::MessageDialog error(*this, "Failed to load RLE file", false, Gtk::MESSAGE_ERROR);
+        error.run();
+    }
+}
+
+void MainWindow::showRlePreview(const RleArchive& archive) {
+    // Size the view for the archive first, so that the visible part is known.
+    filteredView.setRegion(PlanarImage(), 0, 0, archive.getWidth(), archive.getHeight());
+    int x, y, w, h;
+    filteredView.getVisibleRect(x, y, w, h);
+
+    // Zoomed out, the visible part may be most of the file; decode a
+    // screen-sized piece of its center instead.
+    int maxWidth = std::max(1, filteredView.get_allocated_width());
+    int maxHeight = std::max(1, filteredView.get_allocated_height());
+    if (w > maxWidth) {
+        x += (w - maxWidth) / 2;
+        w = maxWidth;
+    }
+    if (h > maxHeight) {
+        y += (h - maxHeight) / 2;
+        h = maxHeight;
     }
+
+    // Only the decoded rectangle holds pixels until the full decode finishes.
+    PlanarImage region;
+    if (!archive.decodeRegion(x, y, w, h, region)) return;
+    filteredView.setRegion(region, x, y, archive.getWidth(), archive.getHeight());
 }
 
 void MainWindow::on_reset_clicked() {
@@ -1049,17 +1235,252 @@ void MainWindow::on_reset_clicked() {
     updateImages();
 }
 
+void MainWindow::on_undo_clicked() {
+    if (processor.undo()) {
+        updateImages();
+    }
+}
+
+void MainWindow::on_redo_clicked() {
+    if (processor.redo()) {
+        updateImages();
+    }
+}
+
+void MainWindow::on_clear_region_clicked() {
+    processor.clearRegion();
+    updateRegion();
+}
+
 void MainWindow::updateImages() {
     if (processor.hasImage()) {
-        auto original = processor.getOriginalPixbuf();
-        auto filtered = processor.getFilteredPixbuf();
+        originalView.setImage(processor.getOriginal(), processor.getOriginalVersion());
+        filteredView.setImage(processor.getFiltered(), processor.getFilteredVersion());
+    } else {
+        // No image to go back to: drop what a cancelled or failed RLE decode previewed.
+        filteredView.clear();
+    }
+
+    undoButton.set_sensitive(processor.canUndo());
+    redoButton.set_sensitive(processor.canRedo());
+    updateRegion();
+    updateStatus();
+}
+
+void MainWindow::updateRegion() {
+    // The processor drops a region that does not fit a new image.
+    if (!processor.hasRegion()) {
+        filteredView.clearSelection();
+        regionLabel.set_text("Whole image");
+        return;
+    }
+    const ImageRegion& region = processor.getRegion();
+    regionLabel.set_text(std::to_string(region.width) + "x" + std::to_string(region.height) + " at (" +
+                         std::to_string(region.x) + ", " + std::to_string(region.y) + ")" +
+                         (region.hasMask() ? ", masked" : ""));
+}
+
+void MainWindow::updateStatus() {
+    OperationRecord record;
+    statusBar.remove_all_messages(0);
+    if (!MetricsRegistry::instance().last(record)) return;
+
+    char text[512];
+    std::snprintf(text, sizeof(text),
+                  "%s  %dx%d  %.1f ms wall, %.1f ms CPU, +%.1f MB peak, %.1f MB new, %d thread%s",
+                  record.operation.c_str(), record.width, record.height, record.wallMs, record.cpuMs,
+                  record.peakExtraBytes / (1024.0 * 1024.0), record.allocatedBytes / (1024.0 * 1024.0),
+                  record.threads, record.threads == 1 ? "" : "s");
+    statusBar.push(text, 0);
+}
+
+void MainWindow::startJob(const std::string& stage, bool fromOriginal, const std::string& message) {
+    std::string error;
+    if (!jobPipeline.parse(stage, error)) {
+        Gtk::MessageDialog dialog(*this, error, false, Gtk::MESSAGE_ERROR);
+        dialog.run();
+        return;
+    }
+
+    job.reset();
+    jobMessage = message;
+    progressBar.set_fraction(0);
+    progressBar.set_text(jobPipeline.stageName(0));
+    setBusy(true);
 
-        if (original) {
-            originalImage.set(original);
+    // Stages that cannot report progress get a pulsing bar instead.
+    pulseTimer = Glib::signal_timeout().connect([this]() {
+        if (job.getProgress() < 0) progressBar.pulse();
+        return true;
+    }, 100);
+
+    worker = std::thread([this, fromOriginal]() {
+        jobSucceeded = processor.computeStage(jobPipeline.stage(0), fromOriginal, jobResult, job);
+        jobFinished.emit();
+    });
+}
+
+void MainWindow::onJobFinished() {
+    worker.join();
+    pulseTimer.disconnect();
+
+    bool committed = jobSucceeded && !job.cancelled();
+    if (committed) {
+        processor.commitResult(jobResult);
+    }
+    jobResult = PendingResult();
+
+    setBusy(false);
+    updateImages();
+
+    if (!committed && !job.cancelled()) {
+        Gtk::MessageDialog error(*this, "Not enough memory for this operation", false, Gtk::MESSAGE_ERROR);
+        error.run();
+    } else if (committed && !jobMessage.empty()) {
+        Gtk::MessageDialog info(*this, jobMessage, false, Gtk::MESSAGE_INFO);
+        info.run();
+    }
+}
+
+void MainWindow::setBusy(bool busy) {
+    controlsBox.set_sensitive(!busy);
+    // The running job reads the region; the pane only pans meanwhile.
+    int tool = busy ? 0 : regionToolCombo.get_active_row_number();
+    filteredView.setSelectionTool(static_cast<ImageView::SelectionTool>(tool));
+    if (busy) {
+        progressBox.show();
+    } else {
+        progressBox.hide();
+    }
+}
+
+void MainWindow::beginPreview(bool fromOriginal, std::function<std::string(double scale)> stage) {
+    const PlanarImage& source = fromOriginal ? processor.getOriginal() : processor.getFiltered();
+    // A proxy no larger than the pane: at the zoom that fits the image it
+    // shows everything the full result would.
+    if (!preview.setSource(source, filteredView.get_allocated_width(), filteredView.get_allocated_height())) return;
+    previewStage = stage;
+    filteredView.onViewChanged = [this]() { scheduleRefine(); };
+    requestPreview();
+}
+
+void MainWindow::requestPreview() {
+    if (!previewStage) return;
+    previewTimer.disconnect();
+    previewJob.cancel();
+    previewPending = true;
+    if (!previewWorker.joinable()) runPreview(false);
+}
+
+// The proxy is enough until the view magnifies it; past twice its scale the
+// visible region is rendered again at full size once things settle.
+void MainWindow::scheduleRefine() {
+    previewTimer.disconnect();
+    if (!previewStage || filteredView.getZoom() * preview.getFactor() < 2.0) return;
+    previewTimer = Glib::signal_timeout().connect([this]() {
+        if (previewWorker.joinable()) {
+            // A refine of an older view is dropped; a proxy is let finish.
+            if (previewRefining) previewJob.cancel();
+            return true;
         }
+        runPreview(true);
+        return false;
+    }, 150);
+}
 
-        if (filtered) {
-            filteredImage.set(filtered);
+void MainWindow::runPreview(bool refine) {
+    if (!refine) previewPending = false;
+    std::string description = previewStage(refine ? 1.0 : 1.0 / preview.getFactor());
+    // A stage too small to show on the proxy leaves it as it is. At full
+    // size every stage shows.
+    bool passThrough = !refine && description.empty();
+    std::string error;
+    if (!passThrough && !previewPipeline.parse(description, error)) return;
+
+    previewRefining = refine;
+    if (refine) {
+        filteredView.getVisibleRect(previewX, previewY, previewWidth, previewHeight);
+    }
+    previewJob.reset();
+    previewWorker = std::thread([this, passThrough]() {
+        if (passThrough) {
+            previewResult.copyFrom(preview.getProxy());
+            previewSucceeded = !previewResult.empty();
+        } else {
+            const PipelineStage& stage = previewPipeline.stage(0);
+            previewSucceeded = previewRefining
+                ? preview.renderRegion(stage, previewX, previewY, previewWidth, previewHeight, previewResult,
+                                       previewJob)
+                : preview.renderProxy(stage, previewResult, previewJob);
         }
+        previewReady.emit();
+    });
+}
+
+void MainWindow::onPreviewReady() {
+    // Already joined by endPreview.
+    if (!previewWorker.joinable()) return;
+    previewWorker.join();
+
+    if (previewPending) {
+        runPreview(false);
+        return;
+    }
+    if (!previewSucceeded || previewJob.cancelled()) return;
+    if (previewRefining) {
+        filteredView.setPreviewDetail(previewResult, previewX, previewY);
+    } else {
+        filteredView.setPreview(previewResult, preview.getFactor());
+        scheduleRefine();
+    }
+}
+
+void MainWindow::endPreview() {
+    previewTimer.disconnect();
+    previewJob.cancel();
+    if (previewWorker.joinable()) previewWorker.join();
+    previewStage = nullptr;
+    previewPending = false;
+    filteredView.onViewChanged = nullptr;
+    filteredView.clearPreview();
+    previewResult.release();
+}
+
+bool MainWindow::loadImageFile(const std::string& filename) {
+    OperationTimer timer("open", 0, 0);
+    try {
+        auto pixbuf = Gdk::Pixbuf::create_from_file(filename);
+        if (!pixbuf) return false;
+        timer.setSize(pixbuf->get_width(), pixbuf->get_height());
+
+        PlanarImage image;
+        image.fromInterleaved(pixbuf->get_pixels(), pixbuf->get_width(), pixbuf->get_height(),
+                              pixbuf->get_rowstride(), pixbuf->get_n_channels());
+        MetricsRegistry::instance().countPixbufCopy();
+        processor.setImage(std::move(image));
+        return true;
     }
-}
\ No newline at end of file
+    catch (const Glib::Exception& ex) {
+        std::cerr << "Error loading image: " << ex.what() << std::endl;
+        return false;
+    }
+}
+
+Glib::RefPtr<Gdk::Pixbuf> MainWindow::getFilteredPixbuf() {
+    if (filteredPixbufVersion != processor.getFilteredVersion()) {
+        filteredPixbuf = toPixbuf(processor.getFiltered(), filteredPixbuf);
+        filteredPixbufVersion = processor.getFilteredVersion();
+    }
+    return filteredPixbuf;
+}
+
+Glib::RefPtr<Gdk::Pixbuf> MainWindow::toPixbuf(const PlanarImage& image, Glib::RefPtr<Gdk::Pixbuf> reuse) {
+    bool has_alpha = image.getChannels() == 4;
+    if (!reuse || reuse->get_width() != image.getWidth() || reuse->get_height() != image.getHeight() ||
+        reuse->get_has_alpha() != has_alpha) {
+        reuse = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, has_alpha, 8, image.getWidth(), image.getHeight());
+    }
+    image.toInterleaved(reuse->get_pixels(), reuse->get_rowstride());
+    MetricsRegistry::instance().countPixbufCopy();
+    return reuse;
+}
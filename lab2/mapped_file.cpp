@@ -0,0 +1,64 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : bytes(nullptr), length(0) {}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : bytes(other.bytes), length(other.length) {
+    other.bytes = nullptr;
+    other.length = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        bytes = other.bytes;
+        length = other.length;
+        other.bytes = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path, Access access) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+    if (mapping == MAP_FAILED) return false;
+
+    if (access == Access::Sequential) {
+        // Aggressive read-ahead, and pages behind the decoder can be dropped early.
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        madvise(mapping, size, MADV_WILLNEED);
+    } else {
+        madvise(mapping, size, MADV_RANDOM);
+    }
+
+    bytes = static_cast<unsigned char*>(mapping);
+    length = size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) munmap(bytes, length);
+    bytes = nullptr;
+    length = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. Decoders read straight from the
+// page cache instead of copying the file into a heap buffer first.
+class MappedFile {
+public:
+    enum class Access { Sequential, Random };
+
+    MappedFile();
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Maps a regular, non-empty file; false otherwise (the caller can fall
+    // back to buffered reads). The access hint is passed on with madvise.
+    bool open(const std::string& path, Access access = Access::Sequential);
+    void close();
+
+    bool isOpen() const { return bytes != nullptr; }
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    unsigned char* bytes;
+    size_t length;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,133 @@
+#include "metrics.h"
+#include "buffer_pool.h"
+#include "parallel.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+// Enough for a long session; the oldest records go first.
+const size_t kMaxRecords = 10000;
+
+double cpuSeconds() {
+#if defined(CLOCK_PROCESS_CPUTIME_ID)
+    timespec now;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now) == 0) return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+// A "VmRSS:"-style line of /proc/self/status in bytes, 0 if unavailable.
+size_t statusBytes(const char* key) {
+    size_t bytes = 0;
+#ifdef __linux__
+    if (FILE* file = std::fopen("/proc/self/status", "r")) {
+        char line[256];
+        size_t length = std::strlen(key);
+        while (std::fgets(line, sizeof(line), file)) {
+            if (std::strncmp(line, key, length) == 0) {
+                bytes = static_cast<size_t>(std::strtoull(line + length, nullptr, 10)) * 1024;
+                break;
+            }
+        }
+        std::fclose(file);
+    }
+#else
+    (void)key;
+#endif
+    return bytes;
+}
+
+// Restarts the VmHWM high-water mark from the current resident size.
+void resetPeakResident() {
+#ifdef __linux__
+    if (FILE* file = std::fopen("/proc/self/clear_refs", "w")) {
+        std::fputs("5", file);
+        std::fclose(file);
+    }
+#endif
+}
+
+// CSV field, quoted when it holds a comma or a quote.
+std::string csvField(const std::string& text) {
+    if (text.find_first_of(",\"\n") == std::string::npos) return text;
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+void MetricsRegistry::record(const OperationRecord& record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back(record);
+    if (entries.size() > kMaxRecords) entries.pop_front();
+}
+
+std::vector<OperationRecord> MetricsRegistry::records() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::vector<OperationRecord>(entries.begin(), entries.end());
+}
+
+bool MetricsRegistry::last(OperationRecord& record) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.empty()) return false;
+    record = entries.back();
+    return true;
+}
+
+void MetricsRegistry::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
+
+bool MetricsRegistry::writeCsv(const std::string& path) const {
+    std::vector<OperationRecord> snapshot = records();
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) return false;
+    std::fprintf(file, "operation,width,height,wall_ms,cpu_ms,peak_extra_mb,allocated_mb,pixbuf_copies,threads\n");
+    for (const OperationRecord& r : snapshot) {
+        std::fprintf(file, "%s,%d,%d,%.3f,%.3f,%.1f,%.1f,%d,%d\n", csvField(r.operation).c_str(), r.width, r.height,
+                     r.wallMs, r.cpuMs, r.peakExtraBytes / (1024.0 * 1024.0), r.allocatedBytes / (1024.0 * 1024.0),
+                     r.pixbufCopies, r.threads);
+    }
+    return std::fclose(file) == 0;
+}
+
+OperationTimer::OperationTimer(const std::string& operation, int width, int height) {
+    result.operation = operation;
+    result.width = width;
+    result.height = height;
+    result.threads = ThreadPool::instance().activeThreads();
+    pixbufCopiesStart = MetricsRegistry::instance().getPixbufCopies();
+    allocatedStart = BufferPool::instance().statistics().allocatedBytes;
+    resetPeakResident();
+    residentStart = statusBytes("VmRSS:");
+    cpuStart = cpuSeconds();
+    start = std::chrono::steady_clock::now();
+}
+
+OperationTimer::~OperationTimer() {
+    result.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    result.cpuMs = (cpuSeconds() - cpuStart) * 1e3;
+    size_t peak = statusBytes("VmHWM:");
+    result.peakExtraBytes = peak > residentStart ? peak - residentStart : 0;
+    result.allocatedBytes = BufferPool::instance().statistics().allocatedBytes - allocatedStart;
+    result.pixbufCopies = MetricsRegistry::instance().getPixbufCopies() - pixbufCopiesStart;
+    MetricsRegistry::instance().record(result);
+}
+
+void OperationTimer::setSize(int width, int height) {
+    result.width = width;
+    result.height = height;
+}
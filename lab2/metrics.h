@@ -0,0 +1,70 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One finished operation.
+struct OperationRecord {
+    std::string operation; // name and parameters, e.g. "median:r=5,border=clamp"
+    int width, height;
+    double wallMs, cpuMs;  // CPU time of the whole process, all pool threads included
+    // Growth of the process's resident memory at its highest point during
+    // the operation (Linux only, 0 elsewhere).
+    size_t peakExtraBytes;
+    size_t allocatedBytes; // new blocks the buffer pool had to allocate
+    int pixbufCopies;      // images copied to or from a GdkPixbuf
+    int threads;           // pool threads the operation could use
+};
+
+// The operations run in this session, for the metrics dialog and CSV
+// export. Process-wide figures (CPU time, memory) include whatever else ran
+// at the same time, such as a preview next to a background job.
+class MetricsRegistry {
+public:
+    static MetricsRegistry& instance();
+
+    void record(const OperationRecord& record);
+    std::vector<OperationRecord> records() const;
+    // The most recent record; false if there is none.
+    bool last(OperationRecord& record) const;
+    void clear();
+    bool writeCsv(const std::string& path) const;
+
+    // Called wherever the GUI converts between a PlanarImage and a pixbuf.
+    void countPixbufCopy() { pixbufCopies.fetch_add(1, std::memory_order_relaxed); }
+    int getPixbufCopies() const { return pixbufCopies.load(std::memory_order_relaxed); }
+
+private:
+    MetricsRegistry() : pixbufCopies(0) {}
+
+    mutable std::mutex mutex;
+    std::deque<OperationRecord> entries;
+    std::atomic<int> pixbufCopies;
+};
+
+// Measures its own lifetime as one operation and records it when destroyed.
+class OperationTimer {
+public:
+    OperationTimer(const std::string& operation, int width, int height);
+    ~OperationTimer();
+
+    // For operations that only learn the image size on the way (loading).
+    void setSize(int width, int height);
+
+private:
+    OperationRecord result;
+    std::chrono::steady_clock::time_point start;
+    double cpuStart;
+    size_t residentStart;
+    uint64_t allocatedStart;
+    int pixbufCopiesStart;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,172 @@
+#include "mip_pyramid.h"
+#include "parallel.h"
+#include <algorithm>
+#include <new>
+
+const int MipPyramid::kTileSize;
+
+namespace {
+
+uint32_t opaque(uint32_t r, uint32_t g, uint32_t b) {
+    return 0xFF000000u | (r << 16) | (g << 8) | b;
+}
+
+// c * a / 255, rounded.
+uint32_t premultiply(uint32_t c, uint32_t a) {
+    uint32_t t = c * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+// Rounded per-byte mean of four ARGB words: two bytes at a time in 16-bit lanes.
+uint32_t average4(uint32_t p, uint32_t q, uint32_t r, uint32_t s) {
+    const uint32_t m = 0x00FF00FF;
+    uint32_t lo = (p & m) + (q & m) + (r & m) + (s & m) + 0x00020002;
+    uint32_t hi = ((p >> 8) & m) + ((q >> 8) & m) + ((r >> 8) & m) + ((s >> 8) & m) + 0x00020002;
+    return ((lo >> 2) & m) | (((hi >> 2) & m) << 8);
+}
+
+// Level 1 straight from the planes: 2x2 means of every channel, premultiplied
+// per source pixel when there is alpha. Odd last columns and rows average
+// with themselves.
+void halveImage(const PlanarImage& image, MipPyramid::Level& dst) {
+    int width = image.getWidth();
+    int height = image.getHeight();
+    bool alpha = image.getChannels() == 4;
+
+    parallelFor(0, dst.height, std::max(1, (1 << 14) / dst.width), [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            int ya = 2 * y;
+            int yb = std::min(ya + 1, height - 1);
+            const unsigned char* r[2] = {image.row(0, ya), image.row(0, yb)};
+            const unsigned char* g[2] = {image.row(1, ya), image.row(1, yb)};
+            const unsigned char* b[2] = {image.row(2, ya), image.row(2, yb)};
+            uint32_t* out = &dst.pixels[static_cast<size_t>(y) * dst.width];
+
+            if (!alpha) {
+                for (int x = 0; x < dst.width; ++x) {
+                    int xa = 2 * x;
+                    int xb = std::min(xa + 1, width - 1);
+                    uint32_t rs = r[0][xa] + r[0][xb] + r[1][xa] + r[1][xb];
+                    uint32_t gs = g[0][xa] + g[0][xb] + g[1][xa] + g[1][xb];
+                    uint32_t bs = b[0][xa] + b[0][xb] + b[1][xa] + b[1][xb];
+                    out[x] = opaque((rs + 2) >> 2, (gs + 2) >> 2, (bs + 2) >> 2);
+                }
+                continue;
+            }
+
+            const unsigned char* a[2] = {image.row(3, ya), image.row(3, yb)};
+            for (int x = 0; x < dst.width; ++x) {
+                int xs[2] = {2 * x, std::min(2 * x + 1, width - 1)};
+                uint32_t as = 0, rs = 0, gs = 0, bs = 0;
+                for (int j = 0; j < 2; ++j) {
+                    for (int i = 0; i < 2; ++i) {
+                        uint32_t av = a[j][xs[i]];
+                        as += av;
+                        rs += premultiply(r[j][xs[i]], av);
+                        gs += premultiply(g[j][xs[i]], av);
+                        bs += premultiply(b[j][xs[i]], av);
+                    }
+                }
+                out[x] = (((as + 2) >> 2) << 24) | (((rs + 2) >> 2) << 16) | (((gs + 2) >> 2) << 8) | ((bs + 2) >> 2);
+            }
+        }
+    });
+}
+
+bool halveLevel(const MipPyramid::Level& src, MipPyramid::Level& dst, const std::atomic<bool>& cancel) {
+    parallelFor(0, dst.height, std::max(1, (1 << 14) / dst.width), [&](int y0, int y1) {
+        if (cancel.load(std::memory_order_relaxed)) return;
+        for (int y = y0; y < y1; ++y) {
+            const uint32_t* top = &src.pixels[static_cast<size_t>(2 * y) * src.width];
+            const uint32_t* bottom = &src.pixels[static_cast<size_t>(std::min(2 * y + 1, src.height - 1)) * src.width];
+            uint32_t* out = &dst.pixels[static_cast<size_t>(y) * dst.width];
+            for (int x = 0; x < dst.width; ++x) {
+                int xa = 2 * x;
+                int xb = std::min(xa + 1, src.width - 1);
+                out[x] = average4(top[xa], top[xb], bottom[xa], bottom[xb]);
+            }
+        }
+    });
+    return !cancel.load(std::memory_order_relaxed);
+}
+
+}
+
+MipPyramid::MipPyramid() : width(0), height(0), ready(0) {}
+
+bool MipPyramid::reset(const PlanarImage& image) {
+    width = image.getWidth();
+    height = image.getHeight();
+    levels.clear();
+    ready.store(0, std::memory_order_release);
+    if (image.empty()) return true;
+    if (image.getChannels() < 3) return false;
+    ready.store(1, std::memory_order_release);
+
+    int w = width, h = height;
+    while (std::max(w, h) > kTileSize) {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        Level level;
+        level.width = w;
+        level.height = h;
+        levels.push_back(level);
+    }
+    if (levels.empty()) return true;
+
+    try {
+        levels[0].pixels.resize(static_cast<size_t>(levels[0].width) * levels[0].height);
+    }
+    catch (const std::bad_alloc&) {
+        levels.clear();
+        return false;
+    }
+    halveImage(image, levels[0]);
+    ready.store(2, std::memory_order_release);
+    return true;
+}
+
+bool MipPyramid::buildLevels(const std::atomic<bool>& cancel) {
+    // Level 1 (index 0) comes from reset.
+    for (size_t i = std::max(1, readyLevels() - 1); i < levels.size(); ++i) {
+        if (cancel.load(std::memory_order_relaxed)) return false;
+        try {
+            levels[i].pixels.resize(static_cast<size_t>(levels[i].width) * levels[i].height);
+        }
+        catch (const std::bad_alloc&) {
+            return false;
+        }
+        if (!halveLevel(levels[i - 1], levels[i], cancel)) return false;
+        ready.store(static_cast<int>(i) + 2, std::memory_order_release);
+    }
+    return true;
+}
+
+int MipPyramid::levelForScale(double scale) const {
+    int l = 0;
+    while (l + 1 < levelCount() && scale * static_cast<double>(1 << (l + 1)) <= 1.0) {
+        ++l;
+    }
+    return l;
+}
+
+void toArgb(const PlanarImage& image, int x, int y, int width, int height, uint32_t* dst, int dstStride) {
+    bool alpha = image.getChannels() == 4;
+    for (int row = 0; row < height; ++row) {
+        const unsigned char* r = image.row(0, y + row) + x;
+        const unsigned char* g = image.row(1, y + row) + x;
+        const unsigned char* b = image.row(2, y + row) + x;
+        uint32_t* out = dst + static_cast<size_t>(row) * dstStride;
+        if (alpha) {
+            const unsigned char* a = image.row(3, y + row) + x;
+            for (int i = 0; i < width; ++i) {
+                out[i] = (uint32_t(a[i]) << 24) | (premultiply(r[i], a[i]) << 16) | (premultiply(g[i], a[i]) << 8) |
+                         premultiply(b[i], a[i]);
+            }
+        } else {
+            for (int i = 0; i < width; ++i) {
+                out[i] = opaque(r[i], g[i], b[i]);
+            }
+        }
+    }
+}
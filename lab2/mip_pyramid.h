@@ -0,0 +1,56 @@
+#ifndef MIP_PYRAMID_H
+#define MIP_PYRAMID_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "planar_image.h"
+
+// Reduced copies of an image for display at any zoom. Level l is the image
+// shrunk 2^l times by averaging 2x2 blocks (sides round up), in Cairo's
+// ARGB32 layout: one native 0xAARRGGBB word per pixel, alpha premultiplied.
+//
+// Level 0 is not stored; a view converts the few full-size tiles it shows
+// with toArgb. Level 1 is built from the image when the pyramid is reset,
+// every further level from the one before it by buildLevels, which may run
+// on another thread while the image itself changes. Levels stop at the first
+// one that fits in a single tile.
+class MipPyramid {
+public:
+    static const int kTileSize = 256;
+
+    struct Level {
+        int width, height;
+        std::vector<uint32_t> pixels; // width words per row
+    };
+
+    MipPyramid();
+
+    // Sizes the levels for image and builds level 1. False if out of memory.
+    bool reset(const PlanarImage& image);
+    // Builds the remaining levels in order, each becoming readable as soon
+    // as it is done. False if out of memory or cancelled on the way.
+    bool buildLevels(const std::atomic<bool>& cancel);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    // All levels including 0, and how many of them can be drawn so far.
+    int levelCount() const { return static_cast<int>(levels.size()) + 1; }
+    int readyLevels() const { return ready.load(std::memory_order_acquire); }
+    // Level l >= 1; only valid below readyLevels().
+    const Level& level(int l) const { return levels[l - 1]; }
+
+    // The coarsest level that still has a pixel per screen pixel at `scale`
+    // screen pixels per image pixel.
+    int levelForScale(double scale) const;
+
+private:
+    int width, height;
+    std::vector<Level> levels;
+    std::atomic<int> ready;
+};
+
+// Converts the rectangle at (x, y) of image to ARGB32, dstStride words apart.
+void toArgb(const PlanarImage& image, int x, int y, int width, int height, uint32_t* dst, int dstStride);
+
+#endif // MIP_PYRAMID_H
@@ -0,0 +1,205 @@
+#include "morphology.h"
+#include "buffer_pool.h"
+#include "histogram.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Vertical pass: column strips wide enough to vectorize well, narrow enough
+// that g and h for a tall image stay in L2. Horizontal pass: row strips that
+// become tile columns after the transpose.
+const int kColumnStrip = 256;
+const int kRowStrip = 64;
+const int kTransposeBlock = 32;
+
+struct MinOp {
+    uint8_t operator()(uint8_t a, uint8_t b) const { return a < b ? a : b; }
+};
+
+struct MaxOp {
+    uint8_t operator()(uint8_t a, uint8_t b) const { return a > b ? a : b; }
+};
+
+// van Herk / Gil-Werman along the row axis of a rows x cols buffer:
+// out row y = op of in rows [y - anchor, y - anchor + k). g and h are scratch.
+template <typename Op>
+void vhgwRows(const uint8_t* in, int inStride, uint8_t* out, int outStride, int rows, int cols, int k, int anchor,
+              uint8_t identity, std::vector<uint8_t>& g, std::vector<uint8_t>& h) {
+    Op op;
+    int padded = rows + k - 1;
+    g.resize(static_cast<size_t>(padded) * cols);
+    h.resize(g.size());
+    std::vector<uint8_t> edge(cols, identity);
+
+    // Padded row p holds input row p - anchor, or the identity outside.
+    auto source = [&](int p) {
+        int y = p - anchor;
+        return (y >= 0 && y < rows) ? in + static_cast<size_t>(y) * inStride : edge.data();
+    };
+
+    for (int p = 0; p < padded; ++p) {
+        const uint8_t* s = source(p);
+        uint8_t* gp = &g[static_cast<size_t>(p) * cols];
+        if (p % k == 0) {
+            std::memcpy(gp, s, cols);
+        } else {
+            const uint8_t* prev = gp - cols;
+            for (int x = 0; x < cols; ++x) gp[x] = op(prev[x], s[x]);
+        }
+    }
+    for (int p = padded - 1; p >= 0; --p) {
+        const uint8_t* s = source(p);
+        uint8_t* hp = &h[static_cast<size_t>(p) * cols];
+        if (p % k == k - 1 || p == padded - 1) {
+            std::memcpy(hp, s, cols);
+        } else {
+            const uint8_t* next = hp + cols;
+            for (int x = 0; x < cols; ++x) hp[x] = op(next[x], s[x]);
+        }
+    }
+    for (int y = 0; y < rows; ++y) {
+        const uint8_t* start = &h[static_cast<size_t>(y) * cols];
+        const uint8_t* end = &g[static_cast<size_t>(y + k - 1) * cols];
+        uint8_t* o = out + static_cast<size_t>(y) * outStride;
+        for (int x = 0; x < cols; ++x) o[x] = op(start[x], end[x]);
+    }
+}
+
+// dst[x * dstStride + y] = src[y * srcStride + x] for a rows x cols block.
+void transpose(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int rows, int cols) {
+    for (int y0 = 0; y0 < rows; y0 += kTransposeBlock) {
+        for (int x0 = 0; x0 < cols; x0 += kTransposeBlock) {
+            int y1 = std::min(rows, y0 + kTransposeBlock);
+            int x1 = std::min(cols, x0 + kTransposeBlock);
+            for (int y = y0; y < y1; ++y) {
+                const uint8_t* s = src + static_cast<size_t>(y) * srcStride;
+                for (int x = x0; x < x1; ++x) {
+                    dst[static_cast<size_t>(x) * dstStride + y] = s[x];
+                }
+            }
+        }
+    }
+}
+
+// Erosion (Op = MinOp) or dilation (MaxOp) of one plane; src and dst may be
+// the same plane. reflected anchors the rectangle at (w - 1 - w / 2,
+// h - 1 - h / 2) instead of (w / 2, h / 2); the two differ for even sizes.
+template <typename Op>
+void morphPlane(const uint8_t* src, uint8_t* dst, int stride, int width, int height,
+                int kernelWidth, int kernelHeight, uint8_t identity, bool reflected = false) {
+    int anchorX = reflected ? kernelWidth - 1 - kernelWidth / 2 : kernelWidth / 2;
+    int anchorY = reflected ? kernelHeight - 1 - kernelHeight / 2 : kernelHeight / 2;
+    PooledArray<uint8_t> columns(static_cast<size_t>(stride) * height);
+
+    // Vertical pass into a scratch plane, one column strip per task.
+    int strips = (width + kColumnStrip - 1) / kColumnStrip;
+    parallelFor(0, strips, 1, [&](int s0, int s1) {
+        std::vector<uint8_t> g, h;
+        for (int s = s0; s < s1; ++s) {
+            int x0 = s * kColumnStrip;
+            int cols = std::min(kColumnStrip, width - x0);
+            vhgwRows<Op>(src + x0, stride, &columns[x0], stride, height, cols, kernelHeight, anchorY, identity,
+                         g, h);
+        }
+    });
+
+    // Horizontal pass: transpose a strip of rows so image x becomes the row
+    // axis, run the same pass, transpose back.
+    int bands = (height + kRowStrip - 1) / kRowStrip;
+    parallelFor(0, bands, 1, [&](int b0, int b1) {
+        PooledArray<uint8_t> tile(static_cast<size_t>(width) * kRowStrip);
+        PooledArray<uint8_t> result(tile.size());
+        std::vector<uint8_t> g, h;
+        for (int b = b0; b < b1; ++b) {
+            int y0 = b * kRowStrip;
+            int rows = std::min(kRowStrip, height - y0);
+            const uint8_t* band = &columns[static_cast<size_t>(y0) * stride];
+            transpose(band, stride, tile.data(), rows, rows, width);
+            vhgwRows<Op>(tile.data(), rows, result.data(), rows, width, rows, kernelWidth, anchorX, identity,
+                         g, h);
+            transpose(result.data(), rows, dst + static_cast<size_t>(y0) * stride, stride, width, rows);
+        }
+    });
+}
+
+// Opening and closing run their second pass with the reflected rectangle,
+// which keeps them anti-extensive (extensive) and idempotent for even sizes.
+void applyToPlane(const uint8_t* src, uint8_t* dst, int stride, int width, int height,
+                  MorphologyOp op, int kernelWidth, int kernelHeight) {
+    switch (op) {
+        case MorphologyOp::Erode:
+            morphPlane<MinOp>(src, dst, stride, width, height, kernelWidth, kernelHeight, 255);
+            break;
+        case MorphologyOp::Dilate:
+            morphPlane<MaxOp>(src, dst, stride, width, height, kernelWidth, kernelHeight, 0);
+            break;
+        case MorphologyOp::Open:
+            morphPlane<MinOp>(src, dst, stride, width, height, kernelWidth, kernelHeight, 255);
+            morphPlane<MaxOp>(dst, dst, stride, width, height, kernelWidth, kernelHeight, 0, true);
+            break;
+        case MorphologyOp::Close:
+            morphPlane<MaxOp>(src, dst, stride, width, height, kernelWidth, kernelHeight, 0);
+            morphPlane<MinOp>(dst, dst, stride, width, height, kernelWidth, kernelHeight, 255, true);
+            break;
+    }
+}
+
+void copyExtraPlanes(const PlanarImage& src, PlanarImage& dst) {
+    for (int c = 3; c < src.getChannels(); ++c) {
+        std::memcpy(dst.plane(c), src.plane(c), static_cast<size_t>(src.getStride()) * src.getHeight());
+    }
+}
+
+}
+
+void morphology(const PlanarImage& src, PlanarImage& dst, MorphologyOp op, int kernelWidth, int kernelHeight) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    kernelWidth = std::max(1, kernelWidth);
+    kernelHeight = std::max(1, kernelHeight);
+    if (&src != &dst) {
+        dst.allocate(src.getWidth(), src.getHeight(), src.getChannels());
+        copyExtraPlanes(src, dst);
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        applyToPlane(src.plane(c), dst.plane(c), src.getStride(), src.getWidth(), src.getHeight(),
+                     op, kernelWidth, kernelHeight);
+    }
+}
+
+void binaryMorphology(const PlanarImage& src, PlanarImage& dst, MorphologyOp op,
+                      int kernelWidth, int kernelHeight, int threshold) {
+    if (src.empty() || src.getChannels() < 3) return;
+
+    int width = src.getWidth();
+    int height = src.getHeight();
+    kernelWidth = std::max(1, kernelWidth);
+    kernelHeight = std::max(1, kernelHeight);
+
+    PlanarImage mask(width, height, 1);
+    parallelFor(0, height, std::max(1, (1 << 15) / width), [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uint8_t* r = src.row(0, y);
+            const uint8_t* g = src.row(1, y);
+            const uint8_t* b = src.row(2, y);
+            uint8_t* m = mask.row(0, y);
+            for (int x = 0; x < width; ++x) {
+                m[x] = lumaOf(r[x], g[x], b[x]) >= threshold ? 255 : 0;
+            }
+        }
+    });
+
+    applyToPlane(mask.plane(0), mask.plane(0), mask.getStride(), width, height, op, kernelWidth, kernelHeight);
+
+    if (&src != &dst) {
+        dst.allocate(width, height, src.getChannels());
+        copyExtraPlanes(src, dst);
+    }
+    for (int c = 0; c < 3; ++c) {
+        std::memcpy(dst.plane(c), mask.plane(0), static_cast<size_t>(mask.getStride()) * height);
+    }
+}
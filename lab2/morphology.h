@@ -0,0 +1,29 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include "planar_image.h"
+
+enum class MorphologyOp { Erode, Dilate, Open, Close };
+
+// Grayscale morphology of channels 0..2 with a kernelWidth x kernelHeight
+// rectangle anchored at (kernelWidth / 2, kernelHeight / 2). Opening and
+// closing use the reflected anchor (kernelWidth - 1 - kernelWidth / 2, ...)
+// for their second pass, so that with even sizes too opening never brightens
+// and closing never darkens a pixel, and repeating either changes nothing.
+// Pixels outside the image never win (255 for erosion, 0 for dilation).
+//
+// Uses van Herk / Gil-Werman: the rectangle is separable, and along each axis
+// the line is cut into blocks of k samples with running min/max from the
+// block start (g) and from the block end (h); any k-wide window spans at most
+// two blocks, so its result is op(h[start], g[end]). That is three
+// comparisons per pixel per axis whatever k is. The vertical pass works on
+// whole rows of column strips, so it vectorizes across x; the horizontal pass
+// runs the same code on row strips transposed into tiles.
+void morphology(const PlanarImage& src, PlanarImage& dst, MorphologyOp op, int kernelWidth, int kernelHeight);
+
+// Binary morphology: luma is thresholded to 0/255 first, and the result is
+// written to all three channels.
+void binaryMorphology(const PlanarImage& src, PlanarImage& dst, MorphologyOp op,
+                      int kernelWidth, int kernelHeight, int threshold = 128);
+
+#endif // MORPHOLOGY_H
@@ -0,0 +1,135 @@
+#include "parallel.h"
+#include <algorithm>
+#include <exception>
+
+namespace {
+thread_local bool insideWorker = false;
+std::mutex submitMutex;
+}
+
+int hardwareThreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : static_cast<int>(n);
+}
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool(hardwareThreads());
+    return pool;
+}
+
+ThreadPool::ThreadPool(int threads) : job(nullptr), active(std::max(1, threads)), stopping(false) {
+    // The submitting thread participates, so one worker fewer is enough.
+    for (int i = 1; i < threads; ++i) {
+        workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::size() const {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+void ThreadPool::setActiveThreads(int threads) {
+    std::lock_guard<std::mutex> lock(mutex);
+    active = threads <= 0 ? size() : std::min(threads, size());
+}
+
+int ThreadPool::activeThreads() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return active;
+}
+
+bool ThreadPool::runChunk(Job& current, std::unique_lock<std::mutex>& lock) {
+    if (current.next >= current.end) return false;
+
+    int chunkBegin = current.next;
+    int chunkEnd = std::min(current.end, chunkBegin + current.grain);
+    current.next = chunkEnd;
+
+    lock.unlock();
+    (*current.body)(chunkBegin, chunkEnd);
+    lock.lock();
+
+    if (--current.pending == 0) {
+        done.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerLoop(int index) {
+    insideWorker = true;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        // Workers past the active count sit out; the caller is thread 0.
+        wake.wait(lock, [this, index]() { return stopping || (job && job->next < job->end && index < active); });
+        if (stopping) return;
+        runChunk(*job, lock);
+    }
+}
+
+void ThreadPool::parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+    if (end <= begin) return;
+    grain = std::max(1, grain);
+
+    int count = end - begin;
+    int threads = activeThreads();
+    int maxChunks = threads * 4;
+    int chunks = std::min(maxChunks, (count + grain - 1) / grain);
+
+    if (chunks <= 1 || threads <= 1 || insideWorker) {
+        body(begin, end);
+        return;
+    }
+
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    std::function<void(int, int)> guarded = [&](int b, int e) {
+        try {
+            body(b, e);
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(errorMutex);
+            if (!error) error = std::current_exception();
+        }
+    };
+
+    std::lock_guard<std::mutex> submit(submitMutex);
+
+    Job current;
+    current.body = &guarded;
+    current.begin = begin;
+    current.end = end;
+    current.grain = (count + chunks - 1) / chunks;
+    current.next = begin;
+    current.pending = (count + current.grain - 1) / current.grain;
+
+    // Nested parallelFor calls from the chunks this thread runs must not resubmit.
+    insideWorker = true;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &current;
+    wake.notify_all();
+
+    while (runChunk(current, lock)) {
+    }
+    done.wait(lock, [&current]() { return current.pending == 0; });
+    job = nullptr;
+    lock.unlock();
+
+    insideWorker = false;
+
+    if (error) std::rethrow_exception(error);
+}
+
+void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+    ThreadPool::instance().parallelFor(begin, end, grain, body);
+}
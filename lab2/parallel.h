@@ -0,0 +1,52 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by all image kernels. parallelFor splits
+// a range into chunks and blocks until every chunk is done; the calling
+// thread works on chunks too. Calls made from inside a worker run inline.
+class ThreadPool {
+public:
+    static ThreadPool& instance();
+
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    int size() const;
+    // Caps the threads (the caller included) that work on each parallelFor,
+    // for measuring how kernels scale; 0 or more than size() means all.
+    void setActiveThreads(int threads);
+    int activeThreads() const;
+    void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+private:
+    struct Job {
+        const std::function<void(int, int)>* body;
+        int begin, end, grain;
+        int next;
+        int pending;
+    };
+
+    void workerLoop(int index);
+    bool runChunk(Job& job, std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> workers;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    Job* job;
+    int active;
+    bool stopping;
+};
+
+int hardwareThreads();
+
+// Runs body(rowBegin, rowEnd) over [begin, end) in chunks of at least `grain` items.
+void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+#endif // PARALLEL_H
@@ -0,0 +1,605 @@
+#include "pipeline.h"
+#include "bilateral.h"
+#include "clahe.h"
+#include "color_kernels.h"
+#include "edges.h"
+#include "filters.h"
+#include "histogram.h"
+#include "image_io.h"
+#include "morphology.h"
+#include "tone_lut.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <utility>
+
+namespace {
+
+std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return std::string();
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    size_t begin = 0;
+    while (true) {
+        size_t end = text.find(separator, begin);
+        parts.push_back(trim(text.substr(begin, end == std::string::npos ? std::string::npos : end - begin)));
+        if (end == std::string::npos) return parts;
+        begin = end + 1;
+    }
+}
+
+// Parameters of one stage. bind() assigns names to positional values, after
+// which the getters look values up by name and range-check them.
+class StageParams {
+public:
+    StageParams(const std::string& stage, const std::vector<std::string>& args) : stage(stage), args(args) {}
+
+    bool bind(const std::vector<std::string>& names, std::string& error) {
+        size_t position = 0;
+        for (const std::string& arg : args) {
+            std::string key, value;
+            size_t equals = arg.find('=');
+            if (equals != std::string::npos) {
+                key = trim(arg.substr(0, equals));
+                value = trim(arg.substr(equals + 1));
+                if (std::find(names.begin(), names.end(), key) == names.end()) {
+                    error = stage + ": unknown parameter '" + key + "'";
+                    return false;
+                }
+            } else {
+                if (position >= names.size()) {
+                    error = stage + ": too many parameters";
+                    return false;
+                }
+                key = names[position++];
+                value = arg;
+            }
+            if (value.empty()) {
+                error = stage + ": empty value for '" + key + "'";
+                return false;
+            }
+            if (!values.insert(std::make_pair(key, value)).second) {
+                error = stage + ": '" + key + "' given twice";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool getInt(const std::string& key, int fallback, int lo, int hi, int& value, std::string& error) const {
+        double number;
+        if (!getDouble(key, fallback, lo, hi, number, error)) return false;
+        if (number != static_cast<int>(number)) {
+            error = stage + ": '" + key + "' must be an integer";
+            return false;
+        }
+        value = static_cast<int>(number);
+        return true;
+    }
+
+    bool getDouble(const std::string& key, double fallback, double lo, double hi, double& value,
+                   std::string& error) const {
+        auto it = values.find(key);
+        if (it == values.end()) {
+            value = fallback;
+            return true;
+        }
+        char* end = nullptr;
+        errno = 0;
+        value = std::strtod(it->second.c_str(), &end);
+        if (errno != 0 || end == it->second.c_str() || *end != '\0') {
+            error = stage + ": '" + key + "' is not a number";
+            return false;
+        }
+        if (value < lo || value > hi) {
+            error = stage + ": '" + key + "' must be in [" + trimNumber(lo) + ", " + trimNumber(hi) + "]";
+            return false;
+        }
+        return true;
+    }
+
+    bool getChoice(const std::string& key, int fallback, const std::vector<std::string>& choices, int& index,
+                   std::string& error) const {
+        auto it = values.find(key);
+        if (it == values.end()) {
+            index = fallback;
+            return true;
+        }
+        auto found = std::find(choices.begin(), choices.end(), it->second);
+        if (found == choices.end()) {
+            error = stage + ": '" + key + "' must be one of";
+            for (const std::string& choice : choices) error += " " + choice;
+            return false;
+        }
+        index = static_cast<int>(found - choices.begin());
+        return true;
+    }
+
+    bool getBorder(BorderMode& border, std::string& error) const {
+        int index;
+        if (!getChoice("border", 0, {"skip", "clamp", "reflect"}, index, error)) return false;
+        border = index == 0 ? BorderMode::Skip : index == 1 ? BorderMode::Clamp : BorderMode::Reflect;
+        return true;
+    }
+
+private:
+    static std::string trimNumber(double value) {
+        std::string text = std::to_string(value);
+        text.erase(text.find_last_not_of('0') + 1);
+        if (text.back() == '.') text.pop_back();
+        return text;
+    }
+
+    std::string stage;
+    std::vector<std::string> args;
+    std::map<std::string, std::string> values;
+};
+
+bool oddKernel(const std::string& stage, int k, std::string& error) {
+    if (k % 2 == 1) return true;
+    error = stage + ": kernel size must be odd";
+    return false;
+}
+
+// Runs a filter that needs a separate destination and keeps its result.
+template <typename Filter>
+void replaceWith(PlanarImage& image, Filter filter) {
+    PlanarImage result;
+    filter(image, result);
+    std::swap(image, result);
+}
+
+// Band operation of such a filter. The destination is kept from one band to
+// the next, so equal bands swap between two buffers instead of allocating new
+// ones each time, which fragments the heap well past the streaming budget.
+template <typename Filter>
+ImageOp replacingBands(Filter filter) {
+    std::shared_ptr<PlanarImage> result = std::make_shared<PlanarImage>();
+    return [filter, result](PlanarImage& image) {
+        filter(image, *result);
+        std::swap(image, *result);
+    };
+}
+
+// Operation and context rows of a neighborhood stage whose reach does not
+// depend on the image size.
+std::function<ImageOp(int, int, int&)> withHalo(const ImageOp& op, int rows) {
+    return [op, rows](int, int, int& halo) {
+        halo = rows;
+        return op;
+    };
+}
+
+template <typename Filter>
+std::function<ImageOp(int, int, int&)> filterWithHalo(Filter filter, int rows) {
+    return [filter, rows](int, int, int& halo) {
+        halo = rows;
+        return replacingBands(filter);
+    };
+}
+
+ImageOp toneOp(const ToneStage& stage) {
+    TonePipeline tone;
+    tone.add(stage);
+    return [tone](PlanarImage& image) { tone.apply(image); };
+}
+
+// Histograms summed over bands. gather computes them for one band, build
+// turns the sums into the stage's operation.
+class HistogramStatistics : public PointStatistics {
+public:
+    typedef std::function<ChannelHistograms(const PlanarImage&)> Gather;
+    typedef std::function<ImageOp(const ChannelHistograms&)> Build;
+
+    HistogramStatistics(const Gather& gather, const Build& build) : gather(gather), build(build) {}
+
+    void add(const PlanarImage& band) override {
+        ChannelHistograms histograms = gather(band);
+        sums.resize(histograms.size(), std::vector<uint64_t>(256, 0));
+        for (size_t c = 0; c < histograms.size(); ++c) {
+            for (int i = 0; i < 256; ++i) sums[c][i] += histograms[c][i];
+        }
+    }
+
+    ImageOp compile() const override {
+        // The tone tables count in int. Larger sums (images beyond 2^30
+        // pixels) are scaled down, keeping empty bins empty.
+        uint64_t total = 0;
+        for (const auto& sum : sums) {
+            uint64_t count = 0;
+            for (uint64_t bin : sum) count += bin;
+            total = std::max(total, count);
+        }
+        uint64_t scale = total / (uint64_t(1) << 30) + 1;
+
+        ChannelHistograms histograms(sums.size(), std::vector<int>(256, 0));
+        for (size_t c = 0; c < sums.size(); ++c) {
+            for (int i = 0; i < 256; ++i) {
+                if (sums[c][i] > 0) histograms[c][i] = static_cast<int>(std::max<uint64_t>(1, sums[c][i] / scale));
+            }
+        }
+        return build(histograms);
+    }
+
+private:
+    Gather gather;
+    Build build;
+    std::vector<std::vector<uint64_t>> sums;
+};
+
+// Whole-image runs gather and apply on the same image.
+void setHistogramStage(PipelineStage& stage, const HistogramStatistics::Gather& gather,
+                       const HistogramStatistics::Build& build) {
+    stage.statistics = [gather, build]() {
+        return std::unique_ptr<PointStatistics>(new HistogramStatistics(gather, build));
+    };
+    auto statistics = stage.statistics;
+    stage.apply = [statistics](PlanarImage& image) {
+        std::unique_ptr<PointStatistics> gathered = statistics();
+        gathered->add(image);
+        gathered->compile()(image);
+    };
+}
+
+bool buildStage(const std::string& name, const StageParams& params, PipelineStage& stage, std::string& error) {
+    if (name == "box" || name == "lowpass") {
+        int k;
+        BorderMode border;
+        if (!params.getInt("k", 3, 3, 255, k, error) || !oddKernel(name, k, error) ||
+            !params.getBorder(border, error)) {
+            return false;
+        }
+        auto filter = [k, border](const PlanarImage& src, PlanarImage& dst) { boxFilter(src, dst, k, border); };
+        stage.apply = [filter](PlanarImage& image) { replaceWith(image, filter); };
+        stage.banded = filterWithHalo(filter, k / 2);
+    } else if (name == "gaussian") {
+        int k;
+        double sigma;
+        BorderMode border;
+        if (!params.getInt("k", 5, 3, 255, k, error) || !oddKernel(name, k, error) ||
+            !params.getDouble("s", 1.0, 0.1, 100.0, sigma, error) || !params.getBorder(border, error)) {
+            return false;
+        }
+        auto filter = [k, sigma, border](const PlanarImage& src, PlanarImage& dst) {
+            gaussianFilter(src, dst, k, sigma, border);
+        };
+        stage.apply = [filter](PlanarImage& image) { replaceWith(image, filter); };
+        stage.banded = filterWithHalo(filter, k / 2);
+    } else if (name == "median") {
+        int radius;
+        BorderMode border;
+        if (!params.getInt("r", 2, 1, 50, radius, error) || !params.getBorder(border, error)) return false;
+        auto filter = [radius, border](const PlanarImage& src, PlanarImage& dst) {
+            medianFilter(src, dst, radius, border);
+        };
+        stage.apply = [filter](PlanarImage& image) { replaceWith(image, filter); };
+        stage.banded = filterWithHalo(filter, radius);
+    } else if (name == "bilateral") {
+        double spatial, range;
+        if (!params.getDouble("s", 4.0, 0.5, 64.0, spatial, error) ||
+            !params.getDouble("r", 30.0, 1.0, 255.0, range, error)) {
+            return false;
+        }
+        stage.apply = [spatial, range](PlanarImage& image) { bilateralFilter(image, image, spatial, range); };
+    } else if (name == "erode" || name == "dilate" || name == "open" || name == "close") {
+        MorphologyOp op = name == "erode" ? MorphologyOp::Erode
+                        : name == "dilate" ? MorphologyOp::Dilate
+                        : name == "open" ? MorphologyOp::Open : MorphologyOp::Close;
+        int w, h, binary;
+        if (!params.getInt("w", 3, 1, 255, w, error) || !params.getInt("h", w, 1, 255, h, error) ||
+            !params.getInt("binary", 0, 0, 1, binary, error)) {
+            return false;
+        }
+        stage.apply = [op, w, h, binary](PlanarImage& image) {
+            if (binary) {
+                binaryMorphology(image, image, op, w, h);
+            } else {
+                morphology(image, image, op, w, h);
+            }
+        };
+        // Opening and closing are two passes, each reaching h / 2 rows and w / 2 columns.
+        int passes = op == MorphologyOp::Open || op == MorphologyOp::Close ? 2 : 1;
+        stage.banded = withHalo(stage.apply, passes * (h / 2));
+        stage.columnHalo = passes * (w / 2);
+    } else if (name == "edges" || name == "canny") {
+        int low, high;
+        if (!params.getInt("low", 50, 0, 1020, low, error) || !params.getInt("high", 150, 1, 1020, high, error)) {
+            return false;
+        }
+        if (low > high) {
+            error = name + ": low must not exceed high";
+            return false;
+        }
+        stage.apply = [low, high](PlanarImage& image) { cannyEdges(image, image, low, high); };
+    } else if (name == "equalize") {
+        int mode;
+        if (!params.getChoice("mode", 0, {"rgb", "luma", "hsv", "hls"}, mode, error)) return false;
+        HistogramStatistics::Gather gather = [mode](const PlanarImage& band) {
+            switch (mode) {
+                case 0: return computeHistograms(band);
+                case 1: return ChannelHistograms{computeLumaHistogram(band)};
+                case 2: return ChannelHistograms{computeValueHistogram(band)};
+                default: return ChannelHistograms{computeLightnessHistogram(band)};
+            }
+        };
+        HistogramStatistics::Build build = [mode](const ChannelHistograms& histograms) -> ImageOp {
+            switch (mode) {
+                case 0: return toneOp(makeEqualizationStage(histograms));
+                case 1: return toneOp(makeLumaEqualizationStage(histograms[0]));
+                case 2: return [histograms](PlanarImage& image) { equalizeValue(image, image, histograms[0]); };
+                default: return [histograms](PlanarImage& image) { equalizeLightness(image, image, histograms[0]); };
+            }
+        };
+        setHistogramStage(stage, gather, build);
+    } else if (name == "clahe") {
+        int tiles, sliding;
+        double clip;
+        if (!params.getInt("tiles", 8, 1, 64, tiles, error) || !params.getDouble("clip", 2.0, 1.0, 64.0, clip, error) ||
+            !params.getInt("sliding", 0, 0, 1, sliding, error)) {
+            return false;
+        }
+        if (sliding) {
+            // Window of the same size as a tile, as in the GUI; bands use the
+            // radius of the whole image.
+            auto filterFor = [tiles, clip](int width, int height, int& radius) {
+                radius = std::max(1, std::min(width, height) / (2 * tiles));
+                int r = radius;
+                return [r, clip](const PlanarImage& src, PlanarImage& dst) { applyClaheSliding(src, dst, r, clip); };
+            };
+            stage.apply = [filterFor](PlanarImage& image) {
+                int radius;
+                replaceWith(image, filterFor(image.getWidth(), image.getHeight(), radius));
+            };
+            stage.banded = [filterFor](int width, int height, int& halo) {
+                return replacingBands(filterFor(width, height, halo));
+            };
+        } else {
+            stage.apply = [tiles, clip](PlanarImage& image) {
+                ClaheParams claheParams;
+                claheParams.tilesX = tiles;
+                claheParams.tilesY = tiles;
+                claheParams.clipLimit = clip;
+                replaceWith(image, [&](const PlanarImage& src, PlanarImage& dst) { applyClahe(src, dst, claheParams); });
+            };
+        }
+    } else if (name == "contrast") {
+        int minOut, maxOut;
+        if (!params.getInt("min", 0, 0, 254, minOut, error) || !params.getInt("max", 255, 1, 255, maxOut, error)) {
+            return false;
+        }
+        if (minOut >= maxOut) {
+            error = name + ": min must be below max";
+            return false;
+        }
+        setHistogramStage(stage,
+                          [](const PlanarImage& band) { return ChannelHistograms{computeLumaHistogram(band)}; },
+                          [minOut, maxOut](const ChannelHistograms& histograms) {
+                              return toneOp(makeLinearContrastStage(histograms[0], minOut, maxOut));
+                          });
+    } else {
+        error = "unknown stage '" + name + "'";
+        return false;
+    }
+    return true;
+}
+
+// Context around a region for stages that need the whole image (bilateral
+// grid, Canny hysteresis, tiled CLAHE): a few bilateral cells at the largest
+// spatial sigma the dialogs offer.
+const int kRegionMargin = 96;
+
+void copyRect(const PlanarImage& src, int x, int y, int width, int height, PlanarImage& dst) {
+    dst.allocate(width, height, src.getChannels());
+    for (int c = 0; c < src.getChannels(); ++c) {
+        for (int row = 0; row < height; ++row) {
+            std::memcpy(dst.row(c, row), src.row(c, y + row) + x, width);
+        }
+    }
+}
+
+// Runs op on row bands of src, each read with halo rows of context, into dst.
+bool runBands(const ImageOp& op, int halo, const PlanarImage& src, PlanarImage& dst, JobControl& control) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    int channels = src.getChannels();
+
+    // About 64 bands, each at least four halos tall so that the overlap
+    // computed twice stays small.
+    int bandRows = std::max(std::max((height + 63) / 64, 4 * halo), 16);
+    size_t stride = src.getStride();
+    dst.allocate(width, height, channels);
+    PlanarImage window;
+    for (int y0 = 0; y0 < height; y0 += bandRows) {
+        if (control.cancelled()) return false;
+        int y1 = std::min(height, y0 + bandRows);
+        int top = std::max(0, y0 - halo);
+        int bottom = std::min(height, y1 + halo);
+
+        window.allocate(width, bottom - top, channels);
+        for (int c = 0; c < channels; ++c) {
+            std::memcpy(window.plane(c), src.row(c, top), (bottom - top) * stride);
+        }
+        op(window);
+        for (int c = 0; c < channels; ++c) {
+            std::memcpy(dst.row(c, y0), window.row(c, y0 - top), (y1 - y0) * stride);
+        }
+        control.setProgress(static_cast<double>(y1) / height);
+    }
+    return true;
+}
+
+// Positional parameter order of every stage, as documented by stageHelp().
+std::vector<std::string> parameterNames(const std::string& name) {
+    if (name == "box" || name == "lowpass") return {"k", "border"};
+    if (name == "gaussian") return {"k", "s", "border"};
+    if (name == "median") return {"r", "border"};
+    if (name == "bilateral") return {"s", "r"};
+    if (name == "erode" || name == "dilate" || name == "open" || name == "close") return {"w", "h", "binary"};
+    if (name == "edges" || name == "canny") return {"low", "high"};
+    if (name == "equalize") return {"mode"};
+    if (name == "clahe") return {"tiles", "clip", "sliding"};
+    if (name == "contrast") return {"min", "max"};
+    return {};
+}
+
+}
+
+bool Pipeline::parse(const std::string& description, std::string& error) {
+    std::vector<PipelineStage> parsed;
+    std::string parsedOutput;
+
+    std::vector<std::string> texts = split(description, '|');
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const std::string& text = texts[i];
+        if (text.empty()) {
+            error = "empty stage";
+            return false;
+        }
+
+        size_t colon = text.find(':');
+        std::string name = trim(text.substr(0, colon));
+        std::vector<std::string> args;
+        if (colon != std::string::npos) args = split(text.substr(colon + 1), ',');
+
+        if (name == "rle" || name == "lpc" || name == "ppm" || name == "pgm" || name == "png") {
+            if (i + 1 != texts.size()) {
+                error = "output format '" + name + "' must be the last stage";
+                return false;
+            }
+            if (!args.empty()) {
+                error = name + ": takes no parameters";
+                return false;
+            }
+            if (!isImageFileSupported("." + name)) {
+                error = name + ": not supported by this build";
+                return false;
+            }
+            parsedOutput = "." + name;
+            break;
+        }
+
+        std::vector<std::string> names = parameterNames(name);
+        if (names.empty()) {
+            error = "unknown stage '" + name + "'";
+            return false;
+        }
+
+        StageParams params(name, args);
+        PipelineStage stage;
+        stage.name = text;
+        if (!params.bind(names, error) || !buildStage(name, params, stage, error)) return false;
+        parsed.push_back(std::move(stage));
+    }
+
+    stages = std::move(parsed);
+    output = parsedOutput;
+    return true;
+}
+
+void Pipeline::run(PlanarImage& image) const {
+    for (const PipelineStage& stage : stages) {
+        stage.apply(image);
+    }
+}
+
+std::string Pipeline::stageHelp() {
+    return "  box:k=3,border=skip              box (average) filter, odd k >= 3; alias lowpass\n"
+           "  gaussian:k=5,s=1,border=skip     Gaussian filter, odd k >= 3\n"
+           "  median:r=2,border=skip           median filter, radius 1..50\n"
+           "  bilateral:s=4,r=30               bilateral grid, spatial and range sigma\n"
+           "  erode|dilate|open|close:w=3,h=w,binary=0\n"
+           "                                   rectangle morphology\n"
+           "  edges:low=50,high=150            Canny edges; alias canny\n"
+           "  equalize:mode=rgb                histogram equalization: rgb, luma, hsv, hls\n"
+           "  clahe:tiles=8,clip=2,sliding=0   adaptive equalization of HSV value\n"
+           "  contrast:min=0,max=255           linear luma contrast stretch\n"
+           "  rle | lpc | ppm | pgm | png      output format, last stage only\n"
+           "  border is one of skip, clamp, reflect\n";
+}
+
+bool runStageInBands(const PipelineStage& stage, const PlanarImage& src, PlanarImage& dst, JobControl& control) {
+    if (src.empty() || control.cancelled()) return false;
+
+    if (!stage.banded && !stage.statistics) {
+        control.setProgress(-1);
+        dst.copyFrom(src);
+        stage.apply(dst);
+        control.setProgress(1);
+        return !control.cancelled();
+    }
+
+    ImageOp op;
+    int halo = 0;
+    if (stage.banded) {
+        op = stage.banded(src.getWidth(), src.getHeight(), halo);
+    } else {
+        std::unique_ptr<PointStatistics> statistics = stage.statistics();
+        statistics->add(src);
+        op = statistics->compile();
+    }
+    return runBands(op, halo, src, dst, control);
+}
+
+bool runStageInRegion(const PipelineStage& stage, const PlanarImage& src, const ImageRegion& region,
+                      bool regionStatistics, PlanarImage& dst, JobControl& control) {
+    if (src.empty() || region.empty() || control.cancelled()) return false;
+    if (region.x < 0 || region.y < 0 || region.x + region.width > src.getWidth() ||
+        region.y + region.height > src.getHeight()) {
+        return false;
+    }
+
+    try {
+        // The operation is fixed for the whole image (a banded stage's reach
+        // may depend on its size) and then run on the part around the region.
+        ImageOp op;
+        int halo = 0, columnHalo = 0;
+        if (stage.banded) {
+            op = stage.banded(src.getWidth(), src.getHeight(), halo);
+            columnHalo = stage.columnHalo < 0 ? halo : stage.columnHalo;
+        } else if (stage.statistics) {
+            std::unique_ptr<PointStatistics> statistics = stage.statistics();
+            if (regionStatistics) {
+                PlanarImage pixels;
+                gatherRegionPixels(src, region, pixels);
+                statistics->add(pixels);
+            } else {
+                statistics->add(src);
+            }
+            if (control.cancelled()) return false;
+            op = statistics->compile();
+        } else {
+            halo = columnHalo = kRegionMargin;
+        }
+
+        int left = std::max(0, region.x - columnHalo);
+        int top = std::max(0, region.y - halo);
+        int right = std::min(src.getWidth(), region.x + region.width + columnHalo);
+        int bottom = std::min(src.getHeight(), region.y + region.height + halo);
+        PlanarImage window;
+        copyRect(src, left, top, right - left, bottom - top, window);
+        if (op) {
+            PlanarImage result;
+            if (!runBands(op, halo, window, result, control)) return false;
+            std::swap(window, result);
+        } else {
+            control.setProgress(-1);
+            stage.apply(window);
+        }
+        if (control.cancelled()) return false;
+        copyRect(window, region.x - left, region.y - top, region.width, region.height, dst);
+    }
+    catch (const std::bad_alloc&) {
+        return false;
+    }
+    control.setProgress(1);
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "image_region.h"
+#include "job_control.h"
+#include "planar_image.h"
+
+typedef std::function<void(PlanarImage& image)> ImageOp;
+
+// Statistics of a histogram-driven stage, gathered band by band before the
+// operation is fixed, so an out-of-core run (stream_pipeline.h) can make one
+// pass to gather and a second to apply.
+class PointStatistics {
+public:
+    virtual ~PointStatistics() {}
+    virtual void add(const PlanarImage& band) = 0;
+    // The per-pixel operation built from everything added so far.
+    virtual ImageOp compile() const = 0;
+};
+
+struct PipelineStage {
+    std::string name;
+    ImageOp apply;
+
+    // Out-of-core support. For an image of the given size, banded returns
+    // the operation to run on row bands and sets halo to the rows of context
+    // it needs above and below every output row (0 for per-pixel stages).
+    // Histogram stages set statistics instead. Stages that need the whole
+    // image at once (bilateral grid, Canny hysteresis, tiled CLAHE) set neither.
+    std::function<ImageOp(int width, int height, int& halo)> banded;
+    std::function<std::unique_ptr<PointStatistics>()> statistics;
+    // Columns of context left and right of every output pixel, for runs on
+    // a rectangle (runStageInRegion), when it differs from halo.
+    int columnHalo = -1;
+};
+
+// A processing chain described as text, for batch runs without the GUI:
+//
+//   gaussian:k=7,s=2 | equalize:hsv | contrast:20,230 | rle
+//
+// Stages are separated by '|'. Parameters follow a ':' and are separated by
+// commas, either positional (in the order listed by stageHelp()) or as
+// key=value. Unlike the GUI, where equalization and contrast always start
+// from the original image, every stage here works on the previous stage's
+// output. The last stage may be an output format (rle, lpc, ppm, pgm, png).
+class Pipeline {
+public:
+    // Replaces the current stages; false with a message in error if the
+    // description does not parse.
+    bool parse(const std::string& description, std::string& error);
+
+    size_t size() const { return stages.size(); }
+    const std::string& stageName(size_t i) const { return stages[i].name; }
+    const PipelineStage& stage(size_t i) const { return stages[i]; }
+    void runStage(size_t i, PlanarImage& image) const { stages[i].apply(image); }
+    void run(PlanarImage& image) const;
+
+    // Extension of the output stage (".rle", ...), empty if there is none.
+    const std::string& outputExtension() const { return output; }
+
+    // One line per stage with its parameters and defaults.
+    static std::string stageHelp();
+
+private:
+    std::vector<PipelineStage> stages;
+    std::string output;
+};
+
+// Runs one stage from src into dst (a different image) in row bands, for
+// jobs on a worker thread: progress is reported after every band and the run
+// stops at the next band once cancelled (false, dst undefined). Stages that
+// need the whole image run in one piece with unknown progress. The result
+// equals stage.apply on a copy of src.
+bool runStageInBands(const PipelineStage& stage, const PlanarImage& src, PlanarImage& dst, JobControl& control);
+
+// Runs one stage on the rectangle of region (which must lie within src) into
+// dst, the rectangle's size; the mask is left to blendRegion. Banded stages
+// read only the rectangle plus their halo on every side, in bands as above,
+// and match a run on all of src. Histogram stages gather from the selected
+// pixels if regionStatistics is set and from all of src otherwise. Stages that
+// need the whole image read a fixed margin around the rectangle and come out
+// close but not exact near its edges. False if cancelled or out of memory.
+bool runStageInRegion(const PipelineStage& stage, const PlanarImage& src, const ImageRegion& region,
+                      bool regionStatistics, PlanarImage& dst, JobControl& control);
+
+#endif // PIPELINE_H
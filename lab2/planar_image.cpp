@@ -0,0 +1,244 @@
+#include "planar_image.h"
+#include "buffer_pool.h"
+#include "cpu_features.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#ifdef LAB2_X86_DISPATCH
+#include <tmmintrin.h>
+#endif
+
+namespace {
+
+#ifdef LAB2_X86_DISPATCH
+// pshufb masks for 16 pixels of N interleaved channels, which span N 16-byte
+// blocks. Output byte j of channel c comes from interleaved byte N*j + c;
+// interleaved byte k of block b comes from pixel (16b + k) / N of channel (16b + k) % N.
+struct ShuffleMasks {
+    __m128i deinterleave[2][4][4]; // [N - 3][channel][block]
+    __m128i interleave[2][4][4];   // [N - 3][block][channel]
+
+    ShuffleMasks() {
+        for (int n = 3; n <= 4; ++n) {
+            for (int a = 0; a < n; ++a) {
+                for (int b = 0; b < n; ++b) {
+                    alignas(16) signed char de[16];
+                    alignas(16) signed char in[16];
+                    for (int j = 0; j < 16; ++j) {
+                        int src = n * j + a - 16 * b;
+                        de[j] = (src >= 0 && src < 16) ? static_cast<signed char>(src) : -1;
+
+                        int k = 16 * a + j;
+                        in[j] = (k % n == b) ? static_cast<signed char>(k / n) : -1;
+                    }
+                    deinterleave[n - 3][a][b] = _mm_load_si128(reinterpret_cast<const __m128i*>(de));
+                    interleave[n - 3][a][b] = _mm_load_si128(reinterpret_cast<const __m128i*>(in));
+                }
+            }
+        }
+    }
+};
+
+const ShuffleMasks& shuffleMasks() {
+    static const ShuffleMasks masks;
+    return masks;
+}
+
+template <int N>
+LAB2_TARGET("ssse3")
+int deinterleaveRowSSSE3(const unsigned char* src, unsigned char* const* dst, int width) {
+    const ShuffleMasks& m = shuffleMasks();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i in[N];
+        for (int b = 0; b < N; ++b) {
+            in[b] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + N * x + 16 * b));
+        }
+        for (int c = 0; c < N; ++c) {
+            __m128i out = _mm_shuffle_epi8(in[0], m.deinterleave[N - 3][c][0]);
+            for (int b = 1; b < N; ++b) {
+                out = _mm_or_si128(out, _mm_shuffle_epi8(in[b], m.deinterleave[N - 3][c][b]));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst[c] + x), out);
+        }
+    }
+    return x;
+}
+
+template <int N>
+LAB2_TARGET("ssse3")
+int interleaveRowSSSE3(const unsigned char* const* src, unsigned char* dst, int width) {
+    const ShuffleMasks& m = shuffleMasks();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i in[N];
+        for (int c = 0; c < N; ++c) {
+            in[c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src[c] + x));
+        }
+        for (int b = 0; b < N; ++b) {
+            __m128i out = _mm_shuffle_epi8(in[0], m.interleave[N - 3][b][0]);
+            for (int c = 1; c < N; ++c) {
+                out = _mm_or_si128(out, _mm_shuffle_epi8(in[c], m.interleave[N - 3][b][c]));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + N * x + 16 * b), out);
+        }
+    }
+    return x;
+}
+#endif
+
+int deinterleaveRowSIMD(const unsigned char* src, unsigned char* const* dst, int width, int n_channels) {
+#ifdef LAB2_X86_DISPATCH
+    if (!cpuFeatures().ssse3) return 0;
+    if (n_channels == 3) return deinterleaveRowSSSE3<3>(src, dst, width);
+    if (n_channels == 4) return deinterleaveRowSSSE3<4>(src, dst, width);
+#endif
+    (void)src; (void)dst; (void)width; (void)n_channels;
+    return 0;
+}
+
+int interleaveRowSIMD(const unsigned char* const* src, unsigned char* dst, int width, int n_channels) {
+#ifdef LAB2_X86_DISPATCH
+    if (!cpuFeatures().ssse3) return 0;
+    if (n_channels == 3) return interleaveRowSSSE3<3>(src, dst, width);
+    if (n_channels == 4) return interleaveRowSSSE3<4>(src, dst, width);
+#endif
+    (void)src; (void)dst; (void)width; (void)n_channels;
+    return 0;
+}
+
+}
+
+PlanarImage::PlanarImage() : data(nullptr), planeSize(0), width(0), height(0), channels(0), stride(0) {}
+
+PlanarImage::PlanarImage(int width, int height, int channels) : PlanarImage() {
+    allocate(width, height, channels);
+}
+
+PlanarImage::PlanarImage(const PlanarImage& other) : PlanarImage() {
+    copyFrom(other);
+}
+
+PlanarImage::PlanarImage(PlanarImage&& other) noexcept
+        : data(other.data), planeSize(other.planeSize),
+          width(other.width), height(other.height), channels(other.channels), stride(other.stride) {
+    other.data = nullptr;
+    other.release();
+}
+
+PlanarImage& PlanarImage::operator=(const PlanarImage& other) {
+    if (this != &other) copyFrom(other);
+    return *this;
+}
+
+PlanarImage& PlanarImage::operator=(PlanarImage&& other) noexcept {
+    if (this != &other) {
+        release();
+        std::swap(data, other.data);
+        std::swap(planeSize, other.planeSize);
+        std::swap(width, other.width);
+        std::swap(height, other.height);
+        std::swap(channels, other.channels);
+        std::swap(stride, other.stride);
+    }
+    return *this;
+}
+
+PlanarImage::~PlanarImage() {
+    release();
+}
+
+bool PlanarImage::fitsGeometry(long long w, long long h, long long c) {
+    if (w <= 0 || h <= 0 || c <= 0 || w > INT_MAX - (kAlignment - 1)) return false;
+    long long paddedStride = (w + kAlignment - 1) / kAlignment * kAlignment;
+    return h <= INT_MAX / paddedStride && c <= INT_MAX;
+}
+
+void PlanarImage::allocate(int w, int h, int c) {
+    if (data && w == width && h == height && c == channels) return;
+    release();
+    if (w <= 0 || h <= 0 || c <= 0) return;
+    if (!fitsGeometry(w, h, c)) throw std::bad_alloc();
+
+    width = w;
+    height = h;
+    channels = c;
+    stride = (w + kAlignment - 1) / kAlignment * kAlignment;
+    planeSize = static_cast<size_t>(stride) * h;
+
+    try {
+        data = static_cast<unsigned char*>(BufferPool::instance().acquire(planeSize * c));
+    }
+    catch (const std::bad_alloc&) {
+        release();
+        throw;
+    }
+}
+
+void PlanarImage::release() {
+    if (data) BufferPool::instance().release(data, planeSize * channels);
+    data = nullptr;
+    planeSize = 0;
+    width = height = channels = stride = 0;
+}
+
+void PlanarImage::copyFrom(const PlanarImage& other) {
+    if (other.empty()) {
+        release();
+        return;
+    }
+    allocate(other.width, other.height, other.channels);
+    std::memcpy(data, other.data, planeSize * channels);
+}
+
+bool PlanarImage::sameGeometry(const PlanarImage& other) const {
+    return width == other.width && height == other.height && channels == other.channels;
+}
+
+std::vector<PlaneView> PlanarImage::planeViews() {
+    std::vector<PlaneView> views;
+    for (int c = 0; c < channels; ++c) {
+        PlaneView view;
+        view.data = plane(c);
+        view.rowBytes = width;
+        view.rows = height;
+        view.stride = stride;
+        views.push_back(view);
+    }
+    return views;
+}
+
+void PlanarImage::fromInterleaved(const unsigned char* src, int w, int h, int rowstride, int n_channels) {
+    allocate(w, h, n_channels);
+
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* s = src + static_cast<size_t>(y) * rowstride;
+        unsigned char* dst[4];
+        for (int c = 0; c < channels; ++c) dst[c] = row(c, y);
+
+        int x = deinterleaveRowSIMD(s, dst, width, channels);
+        for (; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) {
+                dst[c][x] = s[x * channels + c];
+            }
+        }
+    }
+}
+
+void PlanarImage::toInterleaved(unsigned char* dst, int rowstride) const {
+    for (int y = 0; y < height; ++y) {
+        unsigned char* d = dst + static_cast<size_t>(y) * rowstride;
+        const unsigned char* src[4];
+        for (int c = 0; c < channels; ++c) src[c] = row(c, y);
+
+        int x = interleaveRowSIMD(src, d, width, channels);
+        for (; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) {
+                d[x * channels + c] = src[c][x];
+            }
+        }
+    }
+}
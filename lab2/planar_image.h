@@ -0,0 +1,57 @@
+#ifndef PLANAR_IMAGE_H
+#define PLANAR_IMAGE_H
+
+#include <cstddef>
+#include <vector>
+#include "tile_history.h"
+
+// 8-bit image stored as separate channel planes. Every row starts on a
+// 64-byte boundary and is padded to a multiple of 64 bytes, so per-channel
+// loops run over contiguous, aligned memory and vectorize cleanly.
+// Interleaved data (Gdk::Pixbuf, files) is converted only at the boundary.
+class PlanarImage {
+public:
+    static const int kAlignment = 64;
+
+    PlanarImage();
+    PlanarImage(int width, int height, int channels);
+    PlanarImage(const PlanarImage& other);
+    PlanarImage(PlanarImage&& other) noexcept;
+    PlanarImage& operator=(const PlanarImage& other);
+    PlanarImage& operator=(PlanarImage&& other) noexcept;
+    ~PlanarImage();
+
+    // Whether allocate() can hold this geometry: the padded stride and one
+    // plane (stride * height) must both fit in an int.
+    static bool fitsGeometry(long long width, long long height, long long channels);
+
+    // Reallocates only when the geometry changes; contents are undefined afterwards.
+    void allocate(int width, int height, int channels);
+    void release();
+    void copyFrom(const PlanarImage& other);
+
+    bool empty() const { return data == nullptr; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getChannels() const { return channels; }
+    int getStride() const { return stride; }
+    bool sameGeometry(const PlanarImage& other) const;
+
+    unsigned char* plane(int channel) { return data + channel * planeSize; }
+    const unsigned char* plane(int channel) const { return data + channel * planeSize; }
+    unsigned char* row(int channel, int y) { return plane(channel) + static_cast<size_t>(y) * stride; }
+    const unsigned char* row(int channel, int y) const { return plane(channel) + static_cast<size_t>(y) * stride; }
+
+    std::vector<PlaneView> planeViews();
+
+    // Interleaved <-> planar conversion; n_channels is 3 (RGB) or 4 (RGBA).
+    void fromInterleaved(const unsigned char* src, int width, int height, int rowstride, int n_channels);
+    void toInterleaved(unsigned char* dst, int rowstride) const;
+
+private:
+    unsigned char* data;
+    size_t planeSize;
+    int width, height, channels, stride;
+};
+
+#endif // PLANAR_IMAGE_H
@@ -0,0 +1,502 @@
+#include "predictive_codec.h"
+#include "crc32c.h"
+#include "parallel.h"
+#include "rle_codec.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace {
+
+const unsigned char kMagic[4] = {0x89, 'L', 'P', 'C'};
+const int kVersion = 1;
+const int kFlagGreenDifference = 1;
+
+enum Filter : unsigned char { kNone = 0, kSub = 1, kUp = 2, kAverage = 3, kPaeth = 4, kFilterCount = 5 };
+
+// rANS with 8-bit renormalization and 12-bit probabilities (ryg_rans style).
+const int kScaleBits = 12;
+const uint32_t kScale = 1u << kScaleBits;
+const uint32_t kRansLow = 1u << 23;
+const int kStates = 4;
+
+// a = left, b = up, c = up-left. |p - a| etc. with p = a + b - c expanded,
+// which keeps the serial decode chain short (pa does not depend on a).
+inline int paeth(int a, int b, int c) {
+    int pa = std::abs(b - c);
+    int pb = std::abs(a - c);
+    int pc = std::abs(a + b - 2 * c);
+    int bc = pb <= pc ? b : c;
+    return pa <= pb && pa <= pc ? a : bc;
+}
+
+// Residual of row cur against filter f; prev is the row above (zeros for the
+// first row of a group). Returns the sum of absolute signed residuals.
+int filterRow(Filter f, const unsigned char* cur, const unsigned char* prev, int n, unsigned char* out) {
+    switch (f) {
+        case kNone:
+            std::memcpy(out, cur, n);
+            break;
+        case kSub:
+            out[0] = cur[0];
+            for (int x = 1; x < n; ++x) out[x] = static_cast<unsigned char>(cur[x] - cur[x - 1]);
+            break;
+        case kUp:
+            for (int x = 0; x < n; ++x) out[x] = static_cast<unsigned char>(cur[x] - prev[x]);
+            break;
+        case kAverage:
+            out[0] = static_cast<unsigned char>(cur[0] - (prev[0] >> 1));
+            for (int x = 1; x < n; ++x) out[x] = static_cast<unsigned char>(cur[x] - ((cur[x - 1] + prev[x]) >> 1));
+            break;
+        default:
+            out[0] = static_cast<unsigned char>(cur[0] - prev[0]);
+            for (int x = 1; x < n; ++x) out[x] = static_cast<unsigned char>(cur[x] - paeth(cur[x - 1], prev[x], prev[x - 1]));
+            break;
+    }
+    int cost = 0;
+    for (int x = 0; x < n; ++x) cost += std::abs(static_cast<signed char>(out[x]));
+    return cost;
+}
+
+void unfilterRow(Filter f, const unsigned char* residual, const unsigned char* prev, int n, unsigned char* cur) {
+    switch (f) {
+        case kNone:
+            std::memcpy(cur, residual, n);
+            break;
+        case kSub: {
+            unsigned char left = 0;
+            for (int x = 0; x < n; ++x) cur[x] = left = static_cast<unsigned char>(residual[x] + left);
+            break;
+        }
+        case kUp:
+            for (int x = 0; x < n; ++x) cur[x] = static_cast<unsigned char>(residual[x] + prev[x]);
+            break;
+        case kAverage: {
+            int left = 0;
+            for (int x = 0; x < n; ++x) cur[x] = static_cast<unsigned char>(left = (residual[x] + ((left + prev[x]) >> 1)) & 0xFF);
+            break;
+        }
+        default: {
+            int left = 0;
+            int upLeft = 0;
+            for (int x = 0; x < n; ++x) {
+                int up = prev[x];
+                cur[x] = static_cast<unsigned char>(left = (residual[x] + paeth(left, up, upLeft)) & 0xFF);
+                upLeft = up;
+            }
+            break;
+        }
+    }
+}
+
+// Scales symbol counts to frequencies summing to kScale, keeping every
+// present symbol at least 1.
+void normalizeFrequencies(const uint32_t* counts, uint64_t total, uint32_t* freq) {
+    uint32_t sum = 0;
+    int largest = 0;
+    for (int s = 0; s < 256; ++s) {
+        freq[s] = counts[s] ? std::max<uint32_t>(1, static_cast<uint32_t>(static_cast<uint64_t>(counts[s]) * kScale / total)) : 0;
+        sum += freq[s];
+        if (counts[s] > counts[largest]) largest = s;
+    }
+    if (sum < kScale) {
+        freq[largest] += kScale - sum;
+        return;
+    }
+    // Rounding rare symbols up overshot; take it back from the largest ones.
+    while (sum > kScale) {
+        int best = -1;
+        for (int s = 0; s < 256; ++s) {
+            if (freq[s] > 1 && (best < 0 || freq[s] > freq[best])) best = s;
+        }
+        uint32_t take = std::min(sum - kScale, freq[best] - 1);
+        take = std::max<uint32_t>(1, std::min(take, freq[best] / 2));
+        freq[best] -= take;
+        sum -= take;
+    }
+}
+
+// Encodes symbols with kStates interleaved states; symbol i uses state
+// i % kStates. Output is appended to out.
+void ransEncode(const unsigned char* symbols, size_t n, const uint32_t* freq, std::vector<unsigned char>& scratch,
+                std::vector<unsigned char>& out) {
+    uint32_t start[256];
+    uint32_t cumulative = 0;
+    for (int s = 0; s < 256; ++s) {
+        start[s] = cumulative;
+        cumulative += freq[s];
+    }
+
+    // At most two renormalization bytes per symbol, plus the final states.
+    scratch.resize(2 * n + 4 * kStates);
+    unsigned char* end = scratch.data() + scratch.size();
+    unsigned char* ptr = end;
+    uint32_t state[kStates];
+    for (int i = 0; i < kStates; ++i) state[i] = kRansLow;
+
+    for (size_t i = n; i-- > 0;) {
+        uint32_t& x = state[i % kStates];
+        uint32_t f = freq[symbols[i]];
+        uint32_t xMax = ((kRansLow >> kScaleBits) << 8) * f;
+        while (x >= xMax) {
+            *--ptr = static_cast<unsigned char>(x & 0xFF);
+            x >>= 8;
+        }
+        x = ((x / f) << kScaleBits) + (x % f) + start[symbols[i]];
+    }
+    for (int i = kStates - 1; i >= 0; --i) {
+        ptr -= 4;
+        storeLe32(ptr, state[i]);
+    }
+
+    unsigned char size[4];
+    storeLe32(size, static_cast<uint32_t>(end - ptr));
+    out.insert(out.end(), size, size + 4);
+    out.insert(out.end(), ptr, end);
+}
+
+struct DecodeEntry {
+    uint16_t freq;
+    uint16_t bias; // slot - start
+};
+
+struct ChannelDecoder {
+    unsigned char symbol[kScale];
+    DecodeEntry entry[kScale];
+    const unsigned char* filters;
+    const unsigned char* ptr;
+    const unsigned char* end;
+    uint32_t state[kStates];
+    int phase;
+
+    // One symbol with state s; false if the stream runs out.
+    bool step(uint32_t& s, unsigned char& out) {
+        uint32_t slot = s & (kScale - 1);
+        out = symbol[slot];
+        s = entry[slot].freq * (s >> kScaleBits) + entry[slot].bias;
+        while (s < kRansLow) {
+            if (ptr >= end) return false;
+            s = (s << 8) | *ptr++;
+        }
+        return true;
+    }
+
+    bool decodeRow(unsigned char* out, int n) {
+        int x = 0;
+        for (; x < n && phase != 0; ++x) {
+            if (!step(state[phase], out[x])) return false;
+            phase = (phase + 1) % kStates;
+        }
+        // Each symbol reads at most two bytes, so with eight left a group of
+        // four needs no bounds checks.
+        uint32_t s0 = state[0], s1 = state[1], s2 = state[2], s3 = state[3];
+        for (; x + kStates <= n && end - ptr >= 2 * kStates; x += kStates) {
+            uint32_t* states[kStates] = {&s0, &s1, &s2, &s3};
+            for (int i = 0; i < kStates; ++i) {
+                uint32_t& st = *states[i];
+                uint32_t slot = st & (kScale - 1);
+                out[x + i] = symbol[slot];
+                st = entry[slot].freq * (st >> kScaleBits) + entry[slot].bias;
+                if (st < kRansLow) st = (st << 8) | *ptr++;
+                if (st < kRansLow) st = (st << 8) | *ptr++;
+            }
+        }
+        state[0] = s0, state[1] = s1, state[2] = s2, state[3] = s3;
+        for (; x < n; ++x) {
+            if (!step(state[phase], out[x])) return false;
+            phase = (phase + 1) % kStates;
+        }
+        return true;
+    }
+};
+
+void putVarint(uint32_t v, std::vector<unsigned char>& out) {
+    while (v >= 128) {
+        out.push_back(static_cast<unsigned char>(0x80 | (v & 0x7F)));
+        v >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(v));
+}
+
+bool getVarint(const unsigned char*& in, const unsigned char* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 21; shift += 7) {
+        if (in >= end) return false;
+        unsigned char b = *in++;
+        v |= static_cast<uint32_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+struct GroupScratch {
+    std::vector<unsigned char> rows;      // current and previous transformed rows per channel
+    std::vector<unsigned char> residuals; // whole group, per channel
+    std::vector<unsigned char> filters;
+    std::vector<unsigned char> candidate;
+    std::vector<unsigned char> rans;
+};
+
+// Red and blue minus green; other channels are used as stored.
+void transformRow(const PlanarImage& image, int y, int c, bool greenDifference, unsigned char* out) {
+    int width = image.getWidth();
+    const unsigned char* in = image.row(c, y);
+    if (greenDifference && (c == 0 || c == 2)) {
+        const unsigned char* g = image.row(1, y);
+        for (int x = 0; x < width; ++x) out[x] = static_cast<unsigned char>(in[x] - g[x]);
+    } else {
+        std::memcpy(out, in, width);
+    }
+}
+
+void encodeGroup(const PlanarImage& image, int y0, int y1, bool greenDifference, GroupScratch& scratch,
+                 std::vector<unsigned char>& out) {
+    int width = image.getWidth();
+    int channels = image.getChannels();
+    int rows = y1 - y0;
+    size_t rowBytes = width;
+
+    // Current and previous transformed row per channel, alternating by row
+    // parity; the "previous" row of the first one is zeros.
+    scratch.rows.assign(2 * channels * rowBytes, 0);
+    scratch.residuals.resize(static_cast<size_t>(channels) * rows * width);
+    scratch.filters.resize(static_cast<size_t>(channels) * rows);
+    scratch.candidate.resize(2 * static_cast<size_t>(width));
+
+    for (int y = y0; y < y1; ++y) {
+        int r = y - y0;
+        for (int c = 0; c < channels; ++c) {
+            unsigned char* cur = &scratch.rows[(2 * c + (r & 1)) * rowBytes];
+            unsigned char* prev = &scratch.rows[(2 * c + ((r + 1) & 1)) * rowBytes];
+            transformRow(image, y, c, greenDifference, cur);
+
+            unsigned char* best = &scratch.candidate[0];
+            unsigned char* trial = &scratch.candidate[width];
+            int bestCost = -1;
+            Filter bestFilter = kNone;
+            for (int f = 0; f < kFilterCount; ++f) {
+                // Nothing above the first row of a group.
+                if (r == 0 && (f == kUp || f == kPaeth)) continue;
+                int cost = filterRow(static_cast<Filter>(f), cur, prev, width, trial);
+                if (bestCost < 0 || cost < bestCost) {
+                    bestCost = cost;
+                    bestFilter = static_cast<Filter>(f);
+                    std::swap(best, trial);
+                }
+            }
+            scratch.filters[static_cast<size_t>(c) * rows + r] = bestFilter;
+            std::memcpy(&scratch.residuals[(static_cast<size_t>(c) * rows + r) * width], best, width);
+        }
+    }
+
+    size_t frame = out.size();
+    out.resize(frame + 4);
+    for (int c = 0; c < channels; ++c) {
+        const unsigned char* symbols = &scratch.residuals[static_cast<size_t>(c) * rows * width];
+        size_t n = static_cast<size_t>(rows) * width;
+
+        uint32_t counts[256] = {0};
+        for (size_t i = 0; i < n; ++i) ++counts[symbols[i]];
+        uint32_t freq[256];
+        normalizeFrequencies(counts, n, freq);
+
+        out.insert(out.end(), &scratch.filters[static_cast<size_t>(c) * rows],
+                   &scratch.filters[static_cast<size_t>(c) * rows] + rows);
+        for (int s = 0; s < 256; ++s) putVarint(freq[s], out);
+        ransEncode(symbols, n, freq, scratch.rans, out);
+    }
+
+    uint32_t payload = static_cast<uint32_t>(out.size() - frame - 4);
+    storeLe32(&out[frame], payload);
+    out.resize(out.size() + 4);
+    storeLe32(&out[out.size() - 4], crc32c(&out[frame + 4], payload));
+}
+
+bool decodeGroup(const unsigned char* payload, size_t size, int y0, int y1, bool greenDifference,
+                 std::vector<ChannelDecoder>& decoders, std::vector<unsigned char>& rowBuffer, PlanarImage& image) {
+    int width = image.getWidth();
+    int channels = image.getChannels();
+    int rows = y1 - y0;
+    const unsigned char* in = payload;
+    const unsigned char* end = payload + size;
+
+    for (int c = 0; c < channels; ++c) {
+        ChannelDecoder& d = decoders[c];
+        if (end - in < rows) return false;
+        d.filters = in;
+        in += rows;
+        for (int r = 0; r < rows; ++r) {
+            if (d.filters[r] >= kFilterCount) return false;
+        }
+
+        uint32_t cumulative = 0;
+        for (int s = 0; s < 256; ++s) {
+            uint32_t f;
+            if (!getVarint(in, end, f) || f > kScale - cumulative) return false;
+            for (uint32_t slot = cumulative; slot < cumulative + f; ++slot) {
+                d.symbol[slot] = static_cast<unsigned char>(s);
+                d.entry[slot].freq = static_cast<uint16_t>(f);
+                d.entry[slot].bias = static_cast<uint16_t>(slot - cumulative);
+            }
+            cumulative += f;
+        }
+        if (cumulative != kScale) return false;
+
+        if (end - in < 4) return false;
+        uint32_t streamSize = loadLe32(in);
+        in += 4;
+        if (static_cast<size_t>(end - in) < streamSize || streamSize < 4 * kStates) return false;
+        d.ptr = in;
+        d.end = in + streamSize;
+        for (int i = 0; i < kStates; ++i) {
+            d.state[i] = loadLe32(d.ptr);
+            d.ptr += 4;
+        }
+        d.phase = 0;
+        in += streamSize;
+    }
+    if (in != end) return false;
+
+    size_t rowBytes = width;
+    rowBuffer.assign((2 * channels + 1) * rowBytes, 0);
+    unsigned char* residual = &rowBuffer[2 * channels * rowBytes];
+
+    for (int y = y0; y < y1; ++y) {
+        int r = y - y0;
+        for (int c = 0; c < channels; ++c) {
+            unsigned char* cur = &rowBuffer[(2 * c + (r & 1)) * rowBytes];
+            unsigned char* prev = &rowBuffer[(2 * c + ((r + 1) & 1)) * rowBytes];
+            if (!decoders[c].decodeRow(residual, width)) return false;
+            unfilterRow(static_cast<Filter>(decoders[c].filters[r]), residual, prev, width, cur);
+        }
+
+        const unsigned char* g = &rowBuffer[(2 + (r & 1)) * rowBytes];
+        for (int c = 0; c < channels; ++c) {
+            const unsigned char* cur = &rowBuffer[(2 * c + (r & 1)) * rowBytes];
+            unsigned char* dst = image.row(c, y);
+            if (greenDifference && (c == 0 || c == 2)) {
+                for (int x = 0; x < width; ++x) dst[x] = static_cast<unsigned char>(cur[x] + g[x]);
+            } else {
+                std::memcpy(dst, cur, width);
+            }
+        }
+    }
+
+    // Every stream must be used up exactly, back at the encoder's start state.
+    for (int c = 0; c < channels; ++c) {
+        const ChannelDecoder& d = decoders[c];
+        if (d.ptr != d.end) return false;
+        for (int i = 0; i < kStates; ++i) {
+            if (d.state[i] != kRansLow) return false;
+        }
+    }
+    return true;
+}
+
+}
+
+bool isPredictiveData(const unsigned char* data, size_t size) {
+    return size >= 4 && std::memcmp(data, kMagic, 4) == 0;
+}
+
+std::vector<unsigned char> encodePredictive(const PlanarImage& image, int rowsPerGroup) {
+    std::vector<unsigned char> encoded;
+    if (image.empty() || image.getChannels() < 3 || image.getChannels() > 4) return encoded;
+
+    int width = image.getWidth();
+    int height = image.getHeight();
+    rowsPerGroup = std::max(1, rowsPerGroup);
+    int groupCount = (height + rowsPerGroup - 1) / rowsPerGroup;
+    bool greenDifference = true;
+
+    std::vector<std::vector<unsigned char>> groups(groupCount);
+    parallelFor(0, groupCount, 1, [&](int g0, int g1) {
+        GroupScratch scratch;
+        for (int g = g0; g < g1; ++g) {
+            int y0 = g * rowsPerGroup;
+            encodeGroup(image, y0, std::min(height, y0 + rowsPerGroup), greenDifference, scratch, groups[g]);
+        }
+    });
+
+    size_t total = kPredictiveHeaderSize;
+    for (const auto& group : groups) total += group.size();
+    encoded.resize(kPredictiveHeaderSize);
+    encoded.reserve(total);
+
+    unsigned char* h = encoded.data();
+    std::memcpy(h, kMagic, 4);
+    h[4] = kVersion;
+    h[5] = static_cast<unsigned char>(image.getChannels());
+    h[6] = greenDifference ? kFlagGreenDifference : 0;
+    h[7] = 0;
+    storeLe32(h + 8, width);
+    storeLe32(h + 12, height);
+    storeLe32(h + 16, rowsPerGroup);
+    storeLe32(h + 20, groupCount);
+    storeLe32(h + 24, crc32c(h, 24));
+
+    for (const auto& group : groups) encoded.insert(encoded.end(), group.begin(), group.end());
+    return encoded;
+}
+
+bool decodePredictive(const unsigned char* data, size_t size, PlanarImage& image) {
+    if (size < kPredictiveHeaderSize || !isPredictiveData(data, size)) return false;
+    if (crc32c(data, 24) != loadLe32(data + 24)) return false;
+
+    int version = data[4];
+    int channels = data[5];
+    int flags = data[6] | (data[7] << 8);
+    uint32_t width = loadLe32(data + 8);
+    uint32_t height = loadLe32(data + 12);
+    uint32_t rowsPerGroup = loadLe32(data + 16);
+    uint32_t groupCount = loadLe32(data + 20);
+    if (version != kVersion || (channels != 3 && channels != 4) || (flags & ~kFlagGreenDifference)) return false;
+    if (width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF || rowsPerGroup == 0) return false;
+    if (groupCount != (static_cast<uint64_t>(height) + rowsPerGroup - 1) / rowsPerGroup) return false;
+    // Every group frame takes at least 8 bytes.
+    if (groupCount > (size - kPredictiveHeaderSize) / 8) return false;
+    bool greenDifference = flags & kFlagGreenDifference;
+
+    // Group offsets come from one pass over the frame sizes.
+    std::vector<size_t> offsets(groupCount);
+    size_t pos = kPredictiveHeaderSize;
+    for (uint32_t g = 0; g < groupCount; ++g) {
+        if (size - pos < 8) return false;
+        offsets[g] = pos;
+        uint32_t payload = loadLe32(data + pos);
+        if (size - pos - 8 < payload) return false;
+        pos += 8 + static_cast<size_t>(payload);
+    }
+
+    try {
+        PlanarImage decoded(width, height, channels);
+        std::atomic<bool> ok(true);
+        parallelFor(0, static_cast<int>(groupCount), 1, [&](int g0, int g1) {
+            std::vector<ChannelDecoder> decoders(channels);
+            std::vector<unsigned char> rowBuffer;
+            for (int g = g0; g < g1 && ok; ++g) {
+                const unsigned char* frame = data + offsets[g];
+                uint32_t payload = loadLe32(frame);
+                if (crc32c(frame + 4, payload) != loadLe32(frame + 4 + payload)) {
+                    ok = false;
+                    break;
+                }
+                uint64_t y0 = static_cast<uint64_t>(g) * rowsPerGroup;
+                uint64_t y1 = std::min<uint64_t>(height, y0 + rowsPerGroup);
+                if (!decodeGroup(frame + 4, payload, static_cast<int>(y0), static_cast<int>(y1), greenDifference,
+                                 decoders, rowBuffer, decoded)) {
+                    ok = false;
+                }
+            }
+        });
+        if (!ok) return false;
+
+        image = std::move(decoded);
+        return true;
+    }
+    catch (const std::bad_alloc&) {
+        return false;
+    }
+}
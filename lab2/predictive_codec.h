@@ -0,0 +1,39 @@
+#ifndef PREDICTIVE_CODEC_H
+#define PREDICTIVE_CODEC_H
+
+#include <cstddef>
+#include <vector>
+#include "planar_image.h"
+
+// Lossless predictive codec for photographic images (.lpc files), where RLE
+// finds few runs.
+//
+// Red and blue are first replaced by their difference to green. Every
+// channel row is then predicted with one of the PNG filters (none, sub, up,
+// average, Paeth), picked per row as the one with the smallest sum of
+// absolute residuals, and the residuals are entropy coded with a 4-way
+// interleaved rANS coder over order-0 frequencies of the row group. Groups
+// of rows are independent (their first row predicts from zeros), so they are
+// encoded and decoded in parallel.
+//
+//   header   magic 89 'L' 'P' 'C', u8 version (1), u8 channels (3 or 4),
+//            u16 flags (bit 0: red and blue are stored minus green),
+//            u32 width, u32 height, u32 rowsPerGroup, u32 groupCount,
+//            u32 CRC-32C of the preceding 24 bytes
+//   group    u32 payload size, payload, u32 CRC-32C of the payload
+//   payload  per channel: one filter byte per row, 256 symbol frequencies
+//            as varints summing to 4096, u32 rANS stream size, the stream
+// All integers are little-endian.
+
+const size_t kPredictiveHeaderSize = 28;
+const int kPredictiveDefaultRowsPerGroup = 64;
+
+std::vector<unsigned char> encodePredictive(const PlanarImage& image,
+                                            int rowsPerGroup = kPredictiveDefaultRowsPerGroup);
+
+// False on truncated or corrupt data; image is left untouched then.
+bool decodePredictive(const unsigned char* data, size_t size, PlanarImage& image);
+
+bool isPredictiveData(const unsigned char* data, size_t size);
+
+#endif // PREDICTIVE_CODEC_H
@@ -0,0 +1,58 @@
+#include "rle_archive.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+bool RleArchive::open(const std::string& path) {
+    close();
+    // Regions touch scattered chunks, so no read-ahead of the whole file.
+    if (!file.open(path, MappedFile::Access::Random)) return false;
+    if (!readRleHeader(file.data(), file.size(), header) ||
+        !readRleIndex(file.data(), file.size(), header, offsets)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void RleArchive::close() {
+    file.close();
+    header = RleHeader();
+    offsets.clear();
+}
+
+bool RleArchive::decodeRegion(int x, int y, int w, int h, PlanarImage& dst) const {
+    if (!isOpen()) return false;
+
+    int x0 = std::max(0, x);
+    int y0 = std::max(0, y);
+    int x1 = std::min(getWidth(), x + std::max(0, w));
+    int y1 = std::min(getHeight(), y + std::max(0, h));
+    if (x0 >= x1 || y0 >= y1) return false;
+
+    try {
+        PlanarImage region(x1 - x0, y1 - y0, header.channels);
+        int rows = static_cast<int>(header.rowsPerChunk);
+        int first = y0 / rows;
+        int last = (y1 - 1) / rows;
+        std::atomic<bool> ok(true);
+        parallelFor(first, last + 1, 1, [&](int k0, int k1) {
+            RleScratch scratch;
+            for (int k = k0; k < k1 && ok; ++k) {
+                if (!decodeRleFrame(file.data(), file.size(), header, offsets, k, region, x0, y0, scratch)) ok = false;
+            }
+        });
+        if (!ok) return false;
+
+        dst = std::move(region);
+        return true;
+    }
+    catch (const std::bad_alloc&) {
+        return false;
+    }
+}
+
+bool RleArchive::decodeAll(PlanarImage& dst) const {
+    return decodeRegion(0, 0, getWidth(), getHeight(), dst);
+}
@@ -0,0 +1,37 @@
+#ifndef RLE_ARCHIVE_H
+#define RLE_ARCHIVE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+#include "planar_image.h"
+#include "rle_codec.h"
+
+// Random access to a mapped v2 RLE file through its chunk index. Only the
+// chunks covering a requested region are read, verified and decoded, in
+// parallel, and only the requested columns are stored, so showing a
+// viewport of a large archive costs about as much as the viewport.
+class RleArchive {
+public:
+    // False for unreadable files, legacy v1 files and damaged headers.
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return file.isOpen(); }
+    int getWidth() const { return static_cast<int>(header.width); }
+    int getHeight() const { return static_cast<int>(header.height); }
+    int getChannels() const { return header.channels; }
+
+    // Decodes the rectangle (x, y, w, h), clipped to the image, into dst.
+    // On failure dst is left untouched.
+    bool decodeRegion(int x, int y, int w, int h, PlanarImage& dst) const;
+    bool decodeAll(PlanarImage& dst) const;
+
+private:
+    MappedFile file;
+    RleHeader header;
+    std::vector<uint64_t> offsets;
+};
+
+#endif // RLE_ARCHIVE_H
@@ -0,0 +1,429 @@
+#include "rle_codec.h"
+#include "crc32c.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+namespace {
+
+const unsigned char kMagic[4] = {0x89, 'R', 'L', 'E'};
+const int kVersion = 2;
+
+enum RowMode : unsigned char { kPlanar = 0, kInterleaved = 1 };
+
+void putU16(unsigned char* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+void putU64(unsigned char* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+uint64_t getU64(const unsigned char* p) {
+    return loadLe32(p) | (static_cast<uint64_t>(loadLe32(p + 4)) << 32);
+}
+
+size_t packBitsBound(int n) {
+    return n + (n + 127) / 128;
+}
+
+// Appends one row: the mode byte, then the planar or interleaved PackBits
+// data, whichever is smaller.
+void encodeRow(const PlanarImage& image, int y, RleScratch& scratch, std::vector<unsigned char>& out) {
+    std::vector<unsigned char>& interleaved = scratch.interleaved;
+    std::vector<unsigned char>& planarOut = scratch.planarOut;
+    std::vector<unsigned char>& interleavedOut = scratch.interleavedOut;
+    int width = image.getWidth();
+    int channels = image.getChannels();
+
+    planarOut.resize(packBitsBound(width) * channels);
+    size_t planarSize = 0;
+    for (int c = 0; c < channels; ++c) {
+        planarSize += packBits(image.row(c, y), width, &planarOut[planarSize]);
+    }
+
+    interleaved.resize(static_cast<size_t>(width) * channels);
+    for (int c = 0; c < channels; ++c) {
+        const unsigned char* in = image.row(c, y);
+        for (int x = 0; x < width; ++x) interleaved[static_cast<size_t>(x) * channels + c] = in[x];
+    }
+    interleavedOut.resize(packBitsBound(width * channels));
+    size_t interleavedSize = packBits(interleaved.data(), width * channels, interleavedOut.data());
+
+    if (interleavedSize < planarSize) {
+        out.push_back(kInterleaved);
+        out.insert(out.end(), interleavedOut.begin(), interleavedOut.begin() + interleavedSize);
+    } else {
+        out.push_back(kPlanar);
+        out.insert(out.end(), planarOut.begin(), planarOut.begin() + planarSize);
+    }
+}
+
+// Like unpackBits, but of the n expanded bytes only [from, to) are stored,
+// starting at dst[0]; with from == to the row is only parsed.
+bool unpackBitsRange(const unsigned char*& in, const unsigned char* end, int n, int from, int to, unsigned char* dst) {
+    int filled = 0;
+    while (filled < n) {
+        if (in >= end) return false;
+        unsigned char h = *in++;
+        if (h < 128) {
+            int count = h + 1;
+            if (end - in < count || n - filled < count) return false;
+            int a = std::max(filled, from);
+            int b = std::min(filled + count, to);
+            if (a < b) std::memcpy(dst + (a - from), in + (a - filled), b - a);
+            in += count;
+            filled += count;
+        } else if (h > 128) {
+            int count = 257 - h;
+            if (in >= end || n - filled < count) return false;
+            int a = std::max(filled, from);
+            int b = std::min(filled + count, to);
+            if (a < b) std::memset(dst + (a - from), *in, b - a);
+            ++in;
+            filled += count;
+        }
+    }
+    return true;
+}
+
+// Decodes one row of a width-pixel image. Columns [x0, x1) go to out[c],
+// which points at column x0's slot; out == nullptr only parses the row.
+bool decodeRow(const unsigned char*& in, const unsigned char* end, int width, int channels,
+               unsigned char* const* out, int x0, int x1, RleScratch& scratch) {
+    if (in >= end) return false;
+    unsigned char mode = *in++;
+    bool whole = out && x0 == 0 && x1 == width;
+    if (!out) x0 = x1 = 0;
+
+    if (mode == kPlanar) {
+        for (int c = 0; c < channels; ++c) {
+            bool ok = whole ? unpackBits(in, end, out[c], width)
+                            : unpackBitsRange(in, end, width, x0, x1, out ? out[c] : nullptr);
+            if (!ok) return false;
+        }
+        return true;
+    }
+    if (mode == kInterleaved) {
+        std::vector<unsigned char>& interleaved = scratch.interleaved;
+        int count = x1 - x0;
+        interleaved.resize(static_cast<size_t>(count) * channels);
+        bool ok = whole ? unpackBits(in, end, interleaved.data(), width * channels)
+                        : unpackBitsRange(in, end, width * channels, x0 * channels, x1 * channels, interleaved.data());
+        if (!ok) return false;
+        if (!out) return true;
+        for (int c = 0; c < channels; ++c) {
+            unsigned char* o = out[c];
+            for (int x = 0; x < count; ++x) o[x] = interleaved[static_cast<size_t>(x) * channels + c];
+        }
+        return true;
+    }
+    return false;
+}
+
+}
+
+uint32_t loadLe32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void storeLe32(unsigned char* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+size_t packBits(const unsigned char* src, int n, unsigned char* out) {
+    size_t o = 0;
+    int i = 0;
+    while (i < n) {
+        int run = 1;
+        while (i + run < n && run < 128 && src[i + run] == src[i]) ++run;
+        if (run >= 2) {
+            out[o++] = static_cast<unsigned char>(257 - run);
+            out[o++] = src[i];
+            i += run;
+            continue;
+        }
+
+        // Literal until a run of three starts (shorter repeats cost no less
+        // inside a literal than as their own run).
+        int start = i;
+        while (i < n && i - start < 128) {
+            if (i + 2 < n && src[i] == src[i + 1] && src[i] == src[i + 2]) break;
+            ++i;
+        }
+        out[o++] = static_cast<unsigned char>(i - start - 1);
+        std::memcpy(out + o, src + start, i - start);
+        o += i - start;
+    }
+    return o;
+}
+
+bool unpackBits(const unsigned char*& in, const unsigned char* end, unsigned char* dst, int n) {
+    int filled = 0;
+    while (filled < n) {
+        if (in >= end) return false;
+        unsigned char h = *in++;
+        if (h < 128) {
+            int count = h + 1;
+            if (end - in < count || n - filled < count) return false;
+            std::memcpy(dst + filled, in, count);
+            in += count;
+            filled += count;
+        } else if (h > 128) {
+            int count = 257 - h;
+            if (in >= end || n - filled < count) return false;
+            std::memset(dst + filled, *in++, count);
+            filled += count;
+        }
+    }
+    return true;
+}
+
+bool readRleHeader(const unsigned char* data, size_t size, RleHeader& header) {
+    if (size < kRleHeaderSize || std::memcmp(data, kMagic, 4) != 0) return false;
+    if (crc32c(data, 32) != loadLe32(data + 32)) return false;
+
+    header.version = data[4];
+    header.channels = data[5];
+    header.width = loadLe32(data + 8);
+    header.height = loadLe32(data + 12);
+    header.rowsPerChunk = loadLe32(data + 16);
+    header.chunkCount = loadLe32(data + 20);
+    header.indexOffset = getU64(data + 24);
+
+    if (header.version != kVersion) return false;
+    if (header.channels != 3 && header.channels != 4) return false;
+    // Sizes the decoder could not allocate without overflowing are corrupt.
+    if (!PlanarImage::fitsGeometry(header.width, header.height, header.channels)) return false;
+    if (header.rowsPerChunk == 0) return false;
+    return header.chunkCount == (static_cast<uint64_t>(header.height) + header.rowsPerChunk - 1) / header.rowsPerChunk;
+}
+
+bool looksLikeRleV2(const unsigned char* data, size_t size) {
+    int magicMatches = 0;
+    for (size_t i = 0; i < 4 && i < size; ++i) magicMatches += data[i] == kMagic[i];
+    return magicMatches >= 3;
+}
+
+RleHeader makeRleHeader(int width, int height, int channels, int rowsPerChunk) {
+    RleHeader header;
+    header.version = kVersion;
+    header.width = width;
+    header.height = height;
+    header.channels = channels;
+    header.rowsPerChunk = std::max(1, rowsPerChunk);
+    header.chunkCount = (static_cast<uint64_t>(height) + header.rowsPerChunk - 1) / header.rowsPerChunk;
+    header.indexOffset = 0;
+    return header;
+}
+
+void writeRleHeader(const RleHeader& header, unsigned char* out) {
+    std::memcpy(out, kMagic, 4);
+    out[4] = static_cast<unsigned char>(header.version);
+    out[5] = static_cast<unsigned char>(header.channels);
+    putU16(out + 6, 0);
+    storeLe32(out + 8, header.width);
+    storeLe32(out + 12, header.height);
+    storeLe32(out + 16, header.rowsPerChunk);
+    storeLe32(out + 20, header.chunkCount);
+    putU64(out + 24, header.indexOffset);
+    storeLe32(out + 32, crc32c(out, 32));
+}
+
+size_t rleChunkBound(uint32_t width, int channels, uint32_t rows) {
+    // Mode byte plus the planar encoding, which is never chosen when larger
+    // than the interleaved one.
+    return (1 + packBitsBound(width) * channels) * static_cast<size_t>(rows);
+}
+
+void encodeRleChunk(const PlanarImage& image, int y0, int y1, RleScratch& scratch, std::vector<unsigned char>& out) {
+    size_t start = out.size();
+    out.resize(start + 4);
+    for (int y = y0; y < y1; ++y) encodeRow(image, y, scratch, out);
+    uint32_t payload = static_cast<uint32_t>(out.size() - start - 4);
+    storeLe32(&out[start], payload);
+    out.resize(out.size() + 4);
+    storeLe32(&out[out.size() - 4], crc32c(&out[start + 4], payload));
+}
+
+bool decodeRleChunk(const unsigned char* payload, size_t size, int width, int chunkY0, int chunkY1,
+                    PlanarImage& dst, int originX, int originY, RleScratch& scratch) {
+    const unsigned char* in = payload;
+    const unsigned char* end = payload + size;
+    int channels = dst.getChannels();
+    int x0 = std::max(0, originX);
+    int x1 = std::min(width, originX + dst.getWidth());
+
+    for (int y = chunkY0; y < chunkY1; ++y) {
+        int dy = y - originY;
+        // The CRC already covered the rest of the payload.
+        if (dy >= dst.getHeight()) return true;
+
+        unsigned char* out[4];
+        bool store = dy >= 0 && x0 < x1;
+        for (int c = 0; c < channels && store; ++c) out[c] = dst.row(c, dy) + (x0 - originX);
+        if (!decodeRow(in, end, width, channels, store ? out : nullptr, x0, x1, scratch)) return false;
+    }
+    return in == end;
+}
+
+bool readRleIndex(const unsigned char* data, size_t size, const RleHeader& header, std::vector<uint64_t>& offsets) {
+    uint64_t count = header.chunkCount;
+    // Every frame takes at least 8 bytes; rejects absurd counts before allocating.
+    if (size < kRleHeaderSize || count > (size - kRleHeaderSize) / 8) return false;
+    offsets.resize(count);
+
+    uint64_t indexOffset = header.indexOffset;
+    if (indexOffset >= kRleHeaderSize && indexOffset <= size && (size - indexOffset) >= count * 8 + 4) {
+        const unsigned char* index = data + indexOffset;
+        bool valid = crc32c(index, count * 8) == loadLe32(index + count * 8);
+        for (uint64_t k = 0; k < count && valid; ++k) {
+            offsets[k] = getU64(index + k * 8);
+            uint64_t previous = k == 0 ? kRleHeaderSize - 8 : offsets[k - 1];
+            valid = (k == 0 ? offsets[k] == kRleHeaderSize : offsets[k] >= previous + 8) &&
+                    offsets[k] + 8 <= indexOffset;
+        }
+        if (valid) return true;
+    }
+
+    // No (usable) index: one pass over the frame sizes.
+    uint64_t pos = kRleHeaderSize;
+    for (uint64_t k = 0; k < count; ++k) {
+        if (size - pos < 8) return false;
+        offsets[k] = pos;
+        uint64_t payload = loadLe32(data + pos);
+        if (size - pos - 8 < payload) return false;
+        pos += 8 + payload;
+    }
+    return true;
+}
+
+void appendRleIndex(const std::vector<uint64_t>& offsets, std::vector<unsigned char>& out) {
+    size_t start = out.size();
+    out.resize(start + offsets.size() * 8 + 4);
+    for (size_t k = 0; k < offsets.size(); ++k) putU64(&out[start + k * 8], offsets[k]);
+    storeLe32(&out[out.size() - 4], crc32c(&out[start], offsets.size() * 8));
+}
+
+bool decodeRleFrame(const unsigned char* data, size_t size, const RleHeader& header,
+                    const std::vector<uint64_t>& offsets, uint32_t k,
+                    PlanarImage& dst, int originX, int originY, RleScratch& scratch) {
+    uint64_t pos = offsets[k];
+    uint64_t limit = k + 1 < offsets.size() ? offsets[k + 1]
+                   : header.indexOffset >= kRleHeaderSize && header.indexOffset <= size ? header.indexOffset : size;
+    if (limit > size || pos > limit || limit - pos < 8) return false;
+
+    uint32_t payload = loadLe32(data + pos);
+    if (limit - pos - 8 < payload) return false;
+    if (k + 1 < offsets.size() && pos + 8 + payload != limit) return false;
+    const unsigned char* bytes = data + pos + 4;
+    if (crc32c(bytes, payload) != loadLe32(bytes + payload)) return false;
+
+    uint64_t y0 = static_cast<uint64_t>(k) * header.rowsPerChunk;
+    uint64_t y1 = std::min<uint64_t>(header.height, y0 + header.rowsPerChunk);
+    return decodeRleChunk(bytes, payload, header.width, static_cast<int>(y0), static_cast<int>(y1),
+                          dst, originX, originY, scratch);
+}
+
+
+bool decodeRleV1(const unsigned char* data, size_t size, PlanarImage& image) {
+    if (size < 4) return false;
+
+    int width = (data[0] << 8) | data[1];
+    int height = (data[2] << 8) | data[3];
+    if (width == 0 || height == 0) return false;
+
+    PlanarImage decoded(width, height, 3);
+    std::memset(decoded.plane(0), 0, static_cast<size_t>(decoded.getStride()) * height * 3);
+    size_t pos = 4;
+
+    // Like the original reader, a short file leaves the remaining rows empty.
+    for (int y = 0; y < height && pos < size; ++y) {
+        for (int channel = 0; channel < 3 && pos < size; channel++) {
+            unsigned char* row = decoded.row(channel, y);
+            int x = 0;
+            while (x < width && pos + 1 < size) {
+                unsigned char count = data[pos++];
+                unsigned char value = data[pos++];
+
+                int n = std::min<int>(count, width - x);
+                std::fill(row + x, row + x + n, value);
+                x += n;
+            }
+        }
+    }
+
+    image = std::move(decoded);
+    return true;
+}
+
+std::vector<unsigned char> encodeRle(const PlanarImage& image, int rowsPerChunk, bool withIndex) {
+    std::vector<unsigned char> encoded;
+    if (image.empty()) return encoded;
+
+    RleHeader header = makeRleHeader(image.getWidth(), image.getHeight(), image.getChannels(), rowsPerChunk);
+    int height = image.getHeight();
+    int rows = static_cast<int>(header.rowsPerChunk);
+    int chunkCount = static_cast<int>(header.chunkCount);
+
+    // Each chunk is framed (size, payload, CRC) independently, so they can be
+    // encoded in parallel and concatenated.
+    std::vector<std::vector<unsigned char>> chunks(chunkCount);
+    parallelFor(0, chunkCount, 1, [&](int k0, int k1) {
+        RleScratch scratch;
+        for (int k = k0; k < k1; ++k) {
+            int y0 = k * rows;
+            encodeRleChunk(image, y0, std::min(height, y0 + rows), scratch, chunks[k]);
+        }
+    });
+
+    std::vector<uint64_t> offsets(chunkCount);
+    uint64_t total = kRleHeaderSize;
+    for (int k = 0; k < chunkCount; ++k) {
+        offsets[k] = total;
+        total += chunks[k].size();
+    }
+    if (withIndex) header.indexOffset = total;
+
+    encoded.resize(kRleHeaderSize);
+    encoded.reserve(total + (withIndex ? offsets.size() * 8 + 4 : 0));
+    writeRleHeader(header, encoded.data());
+    for (const auto& chunk : chunks) encoded.insert(encoded.end(), chunk.begin(), chunk.end());
+    if (withIndex) appendRleIndex(offsets, encoded);
+    return encoded;
+}
+
+bool decodeRle(const unsigned char* data, size_t size, PlanarImage& image) {
+    RleHeader header;
+    if (!readRleHeader(data, size, header)) {
+        // A damaged v2 header must not be misread as a v1 image; a single
+        // flipped magic byte still counts as v2.
+        if (looksLikeRleV2(data, size)) return false;
+        return decodeRleV1(data, size, image);
+    }
+
+    try {
+        std::vector<uint64_t> offsets;
+        if (!readRleIndex(data, size, header, offsets)) return false;
+
+        // Chunks are independent once their offsets are known.
+        PlanarImage decoded(header.width, header.height, header.channels);
+        std::atomic<bool> ok(true);
+        parallelFor(0, static_cast<int>(header.chunkCount), 1, [&](int k0, int k1) {
+            RleScratch scratch;
+            for (int k = k0; k < k1 && ok; ++k) {
+                if (!decodeRleFrame(data, size, header, offsets, k, decoded, 0, 0, scratch)) ok = false;
+            }
+        });
+        if (!ok) return false;
+
+        image = std::move(decoded);
+        return true;
+    }
+    catch (const std::bad_alloc&) {
+        return false;
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef RLE_CODEC_H
+#define RLE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "planar_image.h"
+
+// RLE image files.
+//
+// v1 (legacy, read-only): 16-bit big-endian width and height, then for every
+// row and each of R, G, B a list of (count, value) byte pairs.
+//
+// v2: a 36-byte header followed by chunks of rowsPerChunk rows.
+//   header   magic 89 'R' 'L' 'E', u8 version (2), u8 channels (3 or 4),
+//            u16 flags, u32 width, u32 height, u32 rowsPerChunk,
+//            u32 chunkCount, u64 indexOffset (0 = none), u32 CRC-32C of
+//            the preceding 32 bytes
+//   chunk    u32 payload size, payload, u32 CRC-32C of the payload
+//   row      u8 mode (0 = planar, 1 = interleaved), then PackBits data for
+//            each channel row (planar) or for the interleaved row, whichever
+//            is smaller
+//   index    optional, after the last chunk at indexOffset: u64 file offset
+//            of every chunk frame, then u32 CRC-32C of those offsets. Files
+//            without one (or with a damaged one) are indexed by a scan over
+//            the frame sizes.
+// All integers are little-endian. PackBits: a header byte h < 128 is
+// followed by h + 1 literal bytes, h > 128 repeats the next byte 257 - h
+// times, 128 is a no-op.
+
+struct RleHeader {
+    int version;
+    uint32_t width;
+    uint32_t height;
+    int channels;
+    uint32_t rowsPerChunk;
+    uint32_t chunkCount;
+    uint64_t indexOffset;
+};
+
+const size_t kRleHeaderSize = 36;
+const int kRleDefaultRowsPerChunk = 64;
+
+// Encodes all channels of image as v2. Chunks are encoded in parallel.
+std::vector<unsigned char> encodeRle(const PlanarImage& image, int rowsPerChunk = kRleDefaultRowsPerChunk,
+                                     bool withIndex = true);
+
+// Decodes v2 or v1 data; v2 chunks are decoded in parallel. On failure
+// (truncation, bad CRC, malformed runs) returns false and leaves image
+// untouched.
+bool decodeRle(const unsigned char* data, size_t size, PlanarImage& image);
+
+// Parses and verifies a v2 header; false for v1 data or a damaged header.
+bool readRleHeader(const unsigned char* data, size_t size, RleHeader& header);
+
+// True if data starts like a v2 file (at most one magic byte damaged), so a
+// failed header check must not fall back to reading it as v1.
+bool looksLikeRleV2(const unsigned char* data, size_t size);
+
+// Building blocks shared by the in-memory, streaming and mapped codecs.
+RleHeader makeRleHeader(int width, int height, int channels, int rowsPerChunk);
+void writeRleHeader(const RleHeader& header, unsigned char* out);
+
+// Largest possible payload of a chunk of rows; anything bigger is corrupt.
+size_t rleChunkBound(uint32_t width, int channels, uint32_t rows);
+
+// Reusable per-thread buffers for row encoding/decoding.
+struct RleScratch {
+    std::vector<unsigned char> interleaved;
+    std::vector<unsigned char> planarOut;
+    std::vector<unsigned char> interleavedOut;
+};
+
+// Appends rows [y0, y1) of image to out as one framed chunk
+// (size, payload, CRC).
+void encodeRleChunk(const PlanarImage& image, int y0, int y1, RleScratch& scratch, std::vector<unsigned char>& out);
+
+// Decodes a chunk payload (already CRC-checked) holding rows
+// [chunkY0, chunkY1) of a width-pixel image. Pixel (x, y) lands at
+// (x - originX, y - originY) of dst; pixels outside dst are skipped. False
+// if the payload is malformed.
+bool decodeRleChunk(const unsigned char* payload, size_t size, int width, int chunkY0, int chunkY1,
+                    PlanarImage& dst, int originX, int originY, RleScratch& scratch);
+
+// Fills offsets with the file offset of every chunk frame, from the stored
+// index or by one scan. False if the frames do not fit in size.
+bool readRleIndex(const unsigned char* data, size_t size, const RleHeader& header, std::vector<uint64_t>& offsets);
+void appendRleIndex(const std::vector<uint64_t>& offsets, std::vector<unsigned char>& out);
+
+// Checks the frame and CRC of chunk k and decodes it as decodeRleChunk does.
+bool decodeRleFrame(const unsigned char* data, size_t size, const RleHeader& header,
+                    const std::vector<uint64_t>& offsets, uint32_t k,
+                    PlanarImage& dst, int originX, int originY, RleScratch& scratch);
+
+// Legacy v1 decoding, exposed for the streaming reader.
+bool decodeRleV1(const unsigned char* data, size_t size, PlanarImage& image);
+
+uint32_t loadLe32(const unsigned char* p);
+void storeLe32(unsigned char* p, uint32_t v);
+
+// PackBits of n bytes into out, which needs room for n + (n + 127) / 128
+// bytes; returns the encoded size.
+size_t packBits(const unsigned char* src, int n, unsigned char* out);
+
+// Expands exactly n bytes from [in, end) into dst and advances in; false if
+// the input runs out or a run overshoots n. Runs are filled with memset.
+bool unpackBits(const unsigned char*& in, const unsigned char* end, unsigned char* dst, int n);
+
+#endif // RLE_CODEC_H
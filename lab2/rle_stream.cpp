@@ -0,0 +1,332 @@
+#include "rle_stream.h"
+#include "crc32c.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+BufferedFileWriter::BufferedFileWriter(size_t bufferSize) : buffer(bufferSize), used(0), written(0), failed(false) {}
+
+bool BufferedFileWriter::open(const std::string& path) {
+    file.open(path, std::ios::binary | std::ios::trunc);
+    used = 0;
+    written = 0;
+    failed = !file;
+    return !failed;
+}
+
+bool BufferedFileWriter::flush() {
+    if (used > 0 && !failed) {
+        file.write(reinterpret_cast<const char*>(buffer.data()), used);
+        failed = !file;
+        written += used;
+    }
+    used = 0;
+    return !failed;
+}
+
+bool BufferedFileWriter::write(const void* data, size_t size) {
+    if (failed) return false;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    if (used + size > buffer.size()) {
+        if (!flush()) return false;
+        if (size >= buffer.size()) {
+            file.write(reinterpret_cast<const char*>(bytes), size);
+            failed = !file;
+            written += size;
+            return !failed;
+        }
+    }
+    std::memcpy(&buffer[used], bytes, size);
+    used += size;
+    return true;
+}
+
+bool BufferedFileWriter::patch(uint64_t offset, const void* data, size_t size) {
+    if (!flush() || offset + size > written) return false;
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.write(static_cast<const char*>(data), size);
+    file.seekp(0, std::ios::end);
+    failed = !file;
+    return !failed;
+}
+
+bool BufferedFileWriter::close() {
+    if (!file.is_open()) return false;
+    flush();
+    file.close();
+    failed = failed || !file;
+    return !failed;
+}
+
+BufferedFileReader::BufferedFileReader(size_t bufferSize) : buffer(bufferSize), pos(0), end(0) {}
+
+bool BufferedFileReader::open(const std::string& path) {
+    file.open(path, std::ios::binary);
+    pos = end = 0;
+    return static_cast<bool>(file);
+}
+
+size_t BufferedFileReader::readSome(void* data, size_t size) {
+    unsigned char* out = static_cast<unsigned char*>(data);
+    size_t done = 0;
+    while (done < size) {
+        if (pos == end) {
+            size_t remaining = size - done;
+            if (remaining >= buffer.size()) {
+                file.read(reinterpret_cast<char*>(out + done), remaining);
+                return done + static_cast<size_t>(file.gcount());
+            }
+            file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+            pos = 0;
+            end = static_cast<size_t>(file.gcount());
+            if (end == 0) break;
+        }
+        size_t n = std::min(size - done, end - pos);
+        std::memcpy(out + done, &buffer[pos], n);
+        pos += n;
+        done += n;
+    }
+    return done;
+}
+
+bool BufferedFileReader::read(void* data, size_t size) {
+    return readSome(data, size) == size;
+}
+
+bool BufferedFileReader::seek(uint64_t offset) {
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(offset));
+    pos = end = 0;
+    return static_cast<bool>(file);
+}
+
+RleStreamEncoder::RleStreamEncoder() : bandRows(0), rowsWritten(0), failed(true), withIndex(true) {}
+
+bool RleStreamEncoder::open(const std::string& path, int width, int height, int channels,
+                            int rowsPerChunk, bool writeIndex) {
+    failed = true;
+    if (width <= 0 || height <= 0 || (channels != 3 && channels != 4)) return false;
+
+    header = makeRleHeader(width, height, channels, rowsPerChunk);
+    bandRows = 0;
+    rowsWritten = 0;
+    withIndex = writeIndex;
+    offsets.clear();
+    if (!writer.open(path)) return false;
+
+    unsigned char bytes[kRleHeaderSize];
+    writeRleHeader(header, bytes);
+    failed = !writer.write(bytes, kRleHeaderSize);
+    return !failed;
+}
+
+// Encodes rows [firstRow, firstRow + rowCount) of image as consecutive
+// chunks, at most one per worker at a time so only that many encoded chunks
+// are ever held. rowCount is a whole number of chunks unless it ends the image.
+bool RleStreamEncoder::writeChunks(const PlanarImage& image, int firstRow, int rowCount) {
+    int rows = static_cast<int>(header.rowsPerChunk);
+    int chunkCount = (rowCount + rows - 1) / rows;
+    int batch = std::max(1, hardwareThreads());
+    scratch.resize(batch);
+    encoded.resize(batch);
+
+    for (int k0 = 0; k0 < chunkCount && !failed; k0 += batch) {
+        int k1 = std::min(chunkCount, k0 + batch);
+        parallelFor(k0, k1, 1, [&](int a, int b) {
+            for (int k = a; k < b; ++k) {
+                int y0 = firstRow + k * rows;
+                int y1 = std::min(firstRow + rowCount, y0 + rows);
+                encoded[k - k0].clear();
+                encodeRleChunk(image, y0, y1, scratch[k - k0], encoded[k - k0]);
+            }
+        });
+        for (int k = k0; k < k1 && !failed; ++k) {
+            offsets.push_back(writer.position());
+            failed = !writer.write(encoded[k - k0].data(), encoded[k - k0].size());
+        }
+    }
+    rowsWritten += rowCount;
+    return !failed;
+}
+
+bool RleStreamEncoder::writeRows(const PlanarImage& src, int srcRow, int rowCount) {
+    int width = static_cast<int>(header.width);
+    int height = static_cast<int>(header.height);
+    int rows = static_cast<int>(header.rowsPerChunk);
+    if (failed) return false;
+    if (src.getWidth() != width || src.getChannels() != header.channels || rowCount < 0 ||
+        srcRow < 0 || srcRow + rowCount > src.getHeight() ||
+        static_cast<int64_t>(rowsWritten) + bandRows + rowCount > height) {
+        failed = true;
+        return false;
+    }
+
+    while (rowCount > 0 && !failed) {
+        // Whole chunks (or the rest of the image) are encoded straight from
+        // src; only a partial chunk goes through the band buffer.
+        int direct = rowsWritten + rowCount == height ? rowCount : rowCount / rows * rows;
+        if (bandRows == 0 && direct > 0) {
+            writeChunks(src, srcRow, direct);
+            srcRow += direct;
+            rowCount -= direct;
+            continue;
+        }
+
+        band.allocate(width, rows, header.channels);
+        int n = std::min(rowCount, rows - bandRows);
+        for (int c = 0; c < header.channels; ++c) {
+            for (int i = 0; i < n; ++i) std::memcpy(band.row(c, bandRows + i), src.row(c, srcRow + i), width);
+        }
+        bandRows += n;
+        srcRow += n;
+        rowCount -= n;
+        if (bandRows == rows || rowsWritten + bandRows == height) {
+            writeChunks(band, 0, bandRows);
+            bandRows = 0;
+        }
+    }
+    return !failed;
+}
+
+bool RleStreamEncoder::close() {
+    if (rowsWritten != static_cast<int>(header.height)) failed = true;
+    if (!failed && withIndex) {
+        std::vector<unsigned char> index;
+        appendRleIndex(offsets, index);
+        header.indexOffset = writer.position();
+        unsigned char bytes[kRleHeaderSize];
+        writeRleHeader(header, bytes);
+        failed = !writer.write(index.data(), index.size()) || !writer.patch(0, bytes, kRleHeaderSize);
+    }
+    bool closed = writer.close();
+    band.release();
+    encoded.clear();
+    return closed && !failed;
+}
+
+RleStreamDecoder::RleStreamDecoder()
+    : legacy(false), failed(true), legacyEnded(false), rowsRead(0), payloadBound(0) {
+    header = RleHeader();
+}
+
+bool RleStreamDecoder::open(const std::string& path) {
+    failed = true;
+    rowsRead = 0;
+    legacyEnded = false;
+    if (!reader.open(path)) return false;
+
+    unsigned char bytes[kRleHeaderSize];
+    size_t size = reader.readSome(bytes, kRleHeaderSize);
+    if (readRleHeader(bytes, size, header)) {
+        legacy = false;
+        payloadBound = rleChunkBound(header.width, header.channels, header.rowsPerChunk);
+        failed = false;
+        return true;
+    }
+
+    // A damaged v2 header must not be misread as a v1 image.
+    if (looksLikeRleV2(bytes, size) || size < 4) return false;
+    header = RleHeader();
+    header.version = 1;
+    header.width = (bytes[0] << 8) | bytes[1];
+    header.height = (bytes[2] << 8) | bytes[3];
+    header.channels = 3;
+    header.rowsPerChunk = kRleDefaultRowsPerChunk;
+    if (header.width == 0 || header.height == 0) return false;
+    legacy = true;
+    failed = !reader.seek(4);
+    return !failed;
+}
+
+int RleStreamDecoder::bandRows() const {
+    return std::min(static_cast<int>(header.rowsPerChunk), getHeight() - rowsRead);
+}
+
+bool RleStreamDecoder::readBand(PlanarImage& dst, int dstRow) {
+    int rows = bandRows();
+    if (failed || rows <= 0) return false;
+    if (dst.getWidth() != getWidth() || dst.getChannels() != header.channels ||
+        dstRow < 0 || dstRow + rows > dst.getHeight()) {
+        return false;
+    }
+
+    bool ok = legacy ? readBandV1(dst, dstRow, rows) : readBandV2(dst, dstRow, rows);
+    if (!ok) {
+        failed = true;
+        return false;
+    }
+    rowsRead += rows;
+    return true;
+}
+
+bool RleStreamDecoder::readBandV2(PlanarImage& dst, int dstRow, int rows) {
+    unsigned char frame[4];
+    if (!reader.read(frame, 4)) return false;
+    uint32_t size = loadLe32(frame);
+    // A payload larger than any valid chunk is corruption; never allocate for it.
+    if (size > payloadBound) return false;
+
+    payload.resize(static_cast<size_t>(size) + 4);
+    if (!reader.read(payload.data(), payload.size())) return false;
+    if (crc32c(payload.data(), size) != loadLe32(&payload[size])) return false;
+    return decodeRleChunk(payload.data(), size, getWidth(), rowsRead, rowsRead + rows, dst, 0, rowsRead - dstRow, scratch);
+}
+
+// v1 rows are (count, value) pairs per channel. Like the original reader, a
+// short file leaves the remaining rows empty instead of failing.
+bool RleStreamDecoder::readBandV1(PlanarImage& dst, int dstRow, int rows) {
+    int width = getWidth();
+    for (int y = dstRow; y < dstRow + rows; ++y) {
+        for (int c = 0; c < 3; ++c) {
+            unsigned char* row = dst.row(c, y);
+            int x = 0;
+            unsigned char pair[2];
+            while (x < width && !legacyEnded) {
+                if (!reader.read(pair, 2)) {
+                    legacyEnded = true;
+                    break;
+                }
+                int n = std::min<int>(pair[0], width - x);
+                std::memset(row + x, pair[1], n);
+                x += n;
+            }
+            if (x < width) std::memset(row + x, 0, width - x);
+        }
+    }
+    return true;
+}
+
+bool saveRleFile(const std::string& path, const PlanarImage& image, int rowsPerChunk) {
+    if (image.empty()) return false;
+
+    RleStreamEncoder encoder;
+    if (!encoder.open(path, image.getWidth(), image.getHeight(), image.getChannels(), rowsPerChunk)) return false;
+    bool ok = encoder.writeRows(image, 0, image.getHeight());
+    return encoder.close() && ok;
+}
+
+bool loadRleFile(const std::string& path, PlanarImage& image) {
+    // Regular files are decoded straight from a mapping of the page cache;
+    // the buffered stream is the fallback for pipes and the like.
+    MappedFile mapped;
+    if (mapped.open(path, MappedFile::Access::Sequential)) {
+        return decodeRle(mapped.data(), mapped.size(), image);
+    }
+
+    RleStreamDecoder decoder;
+    if (!decoder.open(path)) return false;
+
+    try {
+        PlanarImage decoded(decoder.getWidth(), decoder.getHeight(), decoder.getChannels());
+        while (!decoder.finished()) {
+            if (!decoder.readBand(decoded, decoder.nextRow())) return false;
+        }
+        image = std::move(decoded);
+        return true;
+    }
+    catch (const std::bad_alloc&) {
+        return false;
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef RLE_STREAM_H
+#define RLE_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "planar_image.h"
+#include "rle_codec.h"
+
+// Streaming access to RLE files (see rle_codec.h for the format). Pixels go
+// through one band of rows at a time and file I/O through fixed-size
+// buffers, so memory does not grow with the image or the file.
+
+const size_t kRleStreamBufferSize = 1 << 20;
+
+// Binary file writer with a fixed-size buffer; writes larger than the buffer
+// go straight to the file.
+class BufferedFileWriter {
+public:
+    explicit BufferedFileWriter(size_t bufferSize = kRleStreamBufferSize);
+
+    bool open(const std::string& path);
+    bool write(const void* data, size_t size);
+    // Overwrites bytes already written at offset (e.g. a header).
+    bool patch(uint64_t offset, const void* data, size_t size);
+    // Bytes written so far.
+    uint64_t position() const { return written + used; }
+    // Flushes and closes; false if any write failed.
+    bool close();
+    bool good() const { return !failed; }
+
+private:
+    bool flush();
+
+    std::ofstream file;
+    std::vector<unsigned char> buffer;
+    size_t used;
+    uint64_t written;
+    bool failed;
+};
+
+// Binary file reader with a fixed-size buffer; reads larger than the buffer
+// go straight to the destination.
+class BufferedFileReader {
+public:
+    explicit BufferedFileReader(size_t bufferSize = kRleStreamBufferSize);
+
+    bool open(const std::string& path);
+    // Reads exactly size bytes; false at end of file or on error.
+    bool read(void* data, size_t size);
+    // Reads up to size bytes, returns how many were read.
+    size_t readSome(void* data, size_t size);
+    bool seek(uint64_t offset);
+
+private:
+    std::ifstream file;
+    std::vector<unsigned char> buffer;
+    size_t pos, end;
+};
+
+// Writes a v2 file band by band. Rows are appended in order with writeRows;
+// every complete chunk is encoded and written right away (in parallel when
+// several are available), a partial one is kept in a one-band buffer. close
+// appends the chunk index and patches its offset into the header.
+class RleStreamEncoder {
+public:
+    RleStreamEncoder();
+
+    bool open(const std::string& path, int width, int height, int channels,
+              int rowsPerChunk = kRleDefaultRowsPerChunk, bool withIndex = true);
+    // Appends rows [srcRow, srcRow + rowCount) of src, which must have the
+    // width and channel count given to open.
+    bool writeRows(const PlanarImage& src, int srcRow, int rowCount);
+    // False if a write failed or fewer rows than the image height were written.
+    bool close();
+
+private:
+    bool writeChunks(const PlanarImage& image, int firstRow, int rowCount);
+
+    BufferedFileWriter writer;
+    RleHeader header;
+    PlanarImage band;
+    int bandRows;
+    int rowsWritten;
+    bool failed;
+    bool withIndex;
+    std::vector<uint64_t> offsets;
+    std::vector<RleScratch> scratch;
+    std::vector<std::vector<unsigned char>> encoded;
+};
+
+// Reads a v2 (or legacy v1) file band by band. Each readBand decodes the
+// next band of rows straight into the destination; runs are expanded with
+// memset.
+class RleStreamDecoder {
+public:
+    RleStreamDecoder();
+
+    bool open(const std::string& path);
+
+    int getWidth() const { return static_cast<int>(header.width); }
+    int getHeight() const { return static_cast<int>(header.height); }
+    int getChannels() const { return header.channels; }
+    // Image row of the next band and its height (0 once everything is read).
+    int nextRow() const { return rowsRead; }
+    int bandRows() const;
+    bool finished() const { return rowsRead >= getHeight(); }
+
+    // Decodes the next band into rows [dstRow, dstRow + bandRows()) of dst,
+    // which must have the stream's width and channel count. False on
+    // truncation or corruption; the decoder is unusable afterwards.
+    bool readBand(PlanarImage& dst, int dstRow);
+
+private:
+    bool readBandV2(PlanarImage& dst, int dstRow, int rows);
+    bool readBandV1(PlanarImage& dst, int dstRow, int rows);
+
+    BufferedFileReader reader;
+    RleHeader header;
+    bool legacy;
+    bool failed;
+    bool legacyEnded;
+    int rowsRead;
+    size_t payloadBound;
+    std::vector<unsigned char> payload;
+    RleScratch scratch;
+};
+
+// Whole-image helpers. loadRleFile maps the file when it can (see
+// mapped_file.h) and streams it otherwise; it leaves image untouched on
+// failure.
+bool saveRleFile(const std::string& path, const PlanarImage& image, int rowsPerChunk = kRleDefaultRowsPerChunk);
+bool loadRleFile(const std::string& path, PlanarImage& image);
+
+#endif // RLE_STREAM_H
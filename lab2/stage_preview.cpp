@@ -0,0 +1,77 @@
+#include "stage_preview.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace {
+
+// dst = the block means of src, factor x factor source pixels each; blocks on
+// the right and bottom edges average what there is.
+void shrink(const PlanarImage& src, int factor, PlanarImage& dst) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    int dstWidth = dst.getWidth();
+
+    for (int c = 0; c < src.getChannels(); ++c) {
+        parallelFor(0, dst.getHeight(), 8, [&](int y0, int y1) {
+            std::vector<uint32_t> sums(dstWidth);
+            for (int y = y0; y < y1; ++y) {
+                int top = y * factor;
+                int rows = std::min(factor, height - top);
+                std::fill(sums.begin(), sums.end(), 0);
+                for (int r = 0; r < rows; ++r) {
+                    const unsigned char* in = src.row(c, top + r);
+                    for (int x = 0, bx = 0; x < width; ++bx) {
+                        int end = std::min(width, x + factor);
+                        uint32_t sum = 0;
+                        for (; x < end; ++x) sum += in[x];
+                        sums[bx] += sum;
+                    }
+                }
+                unsigned char* out = dst.row(c, y);
+                for (int x = 0; x < dstWidth; ++x) {
+                    uint32_t count = static_cast<uint32_t>(rows * std::min(factor, width - x * factor));
+                    out[x] = static_cast<unsigned char>((sums[x] + count / 2) / count);
+                }
+            }
+        });
+    }
+}
+
+}
+
+StagePreview::StagePreview() : source(nullptr), factor(1) {}
+
+bool StagePreview::setSource(const PlanarImage& image, int maxWidth, int maxHeight) {
+    source = &image;
+    maxWidth = std::max(1, maxWidth);
+    maxHeight = std::max(1, maxHeight);
+    factor = std::max(std::max(1, (image.getWidth() + maxWidth - 1) / maxWidth),
+                      (image.getHeight() + maxHeight - 1) / maxHeight);
+    try {
+        if (factor == 1) {
+            proxy.copyFrom(image);
+        } else {
+            proxy.allocate((image.getWidth() + factor - 1) / factor, (image.getHeight() + factor - 1) / factor,
+                           image.getChannels());
+            shrink(image, factor, proxy);
+        }
+    }
+    catch (const std::bad_alloc&) {
+        proxy.release();
+        return false;
+    }
+    return true;
+}
+
+bool StagePreview::renderProxy(const PipelineStage& stage, PlanarImage& dst, JobControl& control) const {
+    return runStageInBands(stage, proxy, dst, control);
+}
+
+bool StagePreview::renderRegion(const PipelineStage& stage, int x, int y, int width, int height, PlanarImage& dst,
+                                 JobControl& control) const {
+    if (!source) return false;
+    return runStageInRegion(stage, *source, ImageRegion(x, y, width, height), false, dst, control);
+}
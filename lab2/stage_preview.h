@@ -0,0 +1,39 @@
+#ifndef STAGE_PREVIEW_H
+#define STAGE_PREVIEW_H
+
+#include "job_control.h"
+#include "pipeline.h"
+#include "planar_image.h"
+
+// Quick renders of a pipeline stage for the live previews in the settings
+// dialogs. First the stage runs on a proxy: the source shrunk by a whole
+// factor (block means) so that it fits the view, with the stage's sizes
+// scaled down by the caller to match. Then, when the view is zoomed in past
+// the proxy, the part of the source in view runs at full size, reading
+// enough context around it that the pixels match a full run.
+class StagePreview {
+public:
+    StagePreview();
+
+    // Builds the proxy, at most maxWidth x maxHeight. source is read by the
+    // render calls and must not change meanwhile. False if out of memory.
+    bool setSource(const PlanarImage& source, int maxWidth, int maxHeight);
+    // Source pixels per proxy pixel, each way.
+    int getFactor() const { return factor; }
+    const PlanarImage& getProxy() const { return proxy; }
+
+    // The stage on the whole proxy into dst. False if cancelled.
+    bool renderProxy(const PipelineStage& stage, PlanarImage& dst, JobControl& control) const;
+    // The stage on the width x height rectangle at (x, y) of the source into
+    // dst, as runStageInRegion does with statistics from the whole source.
+    // False if cancelled or out of memory.
+    bool renderRegion(const PipelineStage& stage, int x, int y, int width, int height, PlanarImage& dst,
+                      JobControl& control) const;
+
+private:
+    const PlanarImage* source;
+    PlanarImage proxy;
+    int factor;
+};
+
+#endif // STAGE_PREVIEW_H
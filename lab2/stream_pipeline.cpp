@@ -0,0 +1,323 @@
+#include "stream_pipeline.h"
+#include "band_io.h"
+#include "buffer_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Narrows what the buffer pool keeps for the length of a run. Kept blocks
+// count against the memory limit like any other, and between bands little
+// more than the windows of the current size is worth keeping.
+class PoolLimit {
+public:
+    explicit PoolLimit(size_t bytes) : previous(BufferPool::instance().getIdleLimit()) {
+        BufferPool::instance().setIdleLimit(std::min(previous, bytes));
+    }
+    ~PoolLimit() {
+        BufferPool::instance().trim();
+        BufferPool::instance().setIdleLimit(previous);
+    }
+
+private:
+    size_t previous;
+};
+
+// One stage of a pass, with the pipeline index its time is booked to.
+struct BandOp {
+    ImageOp op;
+    int halo;
+    size_t stage;
+};
+
+// Removes the file when it goes out of scope.
+struct TempFile {
+    std::string path;
+    ~TempFile() {
+        if (!path.empty()) std::remove(path.c_str());
+    }
+};
+
+bool createTempFile(const std::string& directory, TempFile& file) {
+    std::string dir = directory;
+    if (dir.empty()) {
+        const char* tmp = std::getenv("TMPDIR");
+        dir = tmp && *tmp ? tmp : "/tmp";
+    }
+    std::vector<char> name(dir.begin(), dir.end());
+    const char* suffix = "/lab2-pass-XXXXXX";
+    name.insert(name.end(), suffix, suffix + std::strlen(suffix) + 1);
+    int fd = mkstemp(name.data());
+    if (fd < 0) return false;
+    close(fd);
+    file.path = name.data();
+    return true;
+}
+
+size_t paddedRowBytes(int width, int channels) {
+    size_t stride = (static_cast<size_t>(width) + PlanarImage::kAlignment - 1) / PlanarImage::kAlignment *
+                    PlanarImage::kAlignment;
+    return stride * channels;
+}
+
+// Window-sized images alive at once: the raw input rows, the working copy,
+// a filter's output and its internal scratch, plus the cropped band a
+// histogram stage gathers from when the window has a halo.
+int windowCopies(int halo, bool statistics) {
+    return statistics && halo > 0 ? 5 : 4;
+}
+
+// Output rows per band for a pass whose stages reach `halo` rows, or 0 if the
+// limit does not leave room for a single one.
+int bandRowsFor(const StreamOptions& options, size_t fixedBytes, size_t rowBytes, int halo, bool statistics,
+                int height) {
+    if (options.memoryLimit <= fixedBytes) return 0;
+    size_t windowRows = (options.memoryLimit - fixedBytes) / (windowCopies(halo, statistics) * rowBytes);
+    if (windowRows <= static_cast<size_t>(2 * halo)) return 0;
+    return static_cast<int>(std::min(windowRows - 2 * halo, static_cast<size_t>(height)));
+}
+
+// One pass over the source: every band of output rows is produced from a
+// window with `halo` extra rows on either side, run through the chain, and
+// handed to the statistics and the sink (either may be null). Rows shared by
+// consecutive windows are moved to the front instead of read again.
+bool runPass(BandSource& source, const std::vector<BandOp>& chain, int bandRows, BandSink* sink,
+             PointStatistics* statistics, size_t statisticsStage, StreamReport& report, std::string& error) {
+    int width = source.getWidth();
+    int height = source.getHeight();
+    int channels = source.getChannels();
+    int halo = 0;
+    for (const BandOp& op : chain) halo += op.halo;
+
+    try {
+        PlanarImage input(width, std::min(height, bandRows + 2 * halo), channels);
+        PlanarImage work, band;
+        size_t stride = input.getStride();
+        int inputY0 = 0;
+        int inputRows = 0;
+
+        for (int y0 = 0; y0 < height; y0 += bandRows) {
+            int y1 = std::min(height, y0 + bandRows);
+            int need0 = std::max(0, y0 - halo);
+            int need1 = std::min(height, y1 + halo);
+
+            int drop = need0 - inputY0;
+            if (drop > 0) {
+                int keep = inputRows - drop;
+                for (int c = 0; c < channels; ++c) {
+                    std::memmove(input.row(c, 0), input.row(c, drop), keep * stride);
+                }
+                inputY0 = need0;
+                inputRows = keep;
+            }
+            int missing = need1 - (inputY0 + inputRows);
+            if (missing > 0) {
+                auto start = Clock::now();
+                bool ok = source.read(input, inputRows, missing);
+                report.readSeconds += secondsSince(start);
+                if (!ok) {
+                    error = "reading failed";
+                    return false;
+                }
+                inputRows += missing;
+            }
+
+            work.allocate(width, inputRows, channels);
+            for (int c = 0; c < channels; ++c) {
+                std::memcpy(work.plane(c), input.plane(c), inputRows * stride);
+            }
+            for (const BandOp& op : chain) {
+                auto start = Clock::now();
+                op.op(work);
+                report.stageSeconds[op.stage] += secondsSince(start);
+            }
+
+            int first = y0 - inputY0;
+            int rows = y1 - y0;
+            if (statistics) {
+                auto start = Clock::now();
+                if (first == 0 && rows == work.getHeight()) {
+                    statistics->add(work);
+                } else {
+                    band.allocate(width, rows, channels);
+                    for (int c = 0; c < channels; ++c) {
+                        std::memcpy(band.plane(c), work.row(c, first), rows * stride);
+                    }
+                    statistics->add(band);
+                }
+                report.stageSeconds[statisticsStage] += secondsSince(start);
+            }
+            if (sink) {
+                auto start = Clock::now();
+                bool ok = sink->write(work, first, rows);
+                report.writeSeconds += secondsSince(start);
+                if (!ok) {
+                    error = "writing failed";
+                    return false;
+                }
+            }
+        }
+    }
+    catch (const std::bad_alloc&) {
+        error = "out of memory";
+        return false;
+    }
+    ++report.passes;
+    return true;
+}
+
+}
+
+bool runPipelineStreaming(const Pipeline& pipeline, const std::string& input, const std::string& output,
+                          const StreamOptions& options, std::string& error, StreamReport* report) {
+#ifdef __GLIBC__
+    // glibc raises its mmap threshold to the size of every large block freed,
+    // after which band windows come from the heap, fragment it between bands
+    // and passes, and the process grows to several times the budget. A fixed
+    // threshold keeps them mapped and returned to the system when freed.
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+#endif
+
+    PoolLimit poolLimit(options.memoryLimit / 16);
+
+    StreamReport local;
+    StreamReport& stats = report ? *report : local;
+    stats = StreamReport();
+    stats.stageSeconds.assign(pipeline.size(), 0.0);
+
+    for (size_t i = 0; i < pipeline.size(); ++i) {
+        const PipelineStage& stage = pipeline.stage(i);
+        if (!stage.banded && !stage.statistics) {
+            error = stage.name + ": needs the whole image, cannot run out of core";
+            return false;
+        }
+    }
+    if (!output.empty() && !isBandFileSupported(output)) {
+        error = output + ": cannot be written out of core (use .rle, .ppm or .pgm)";
+        return false;
+    }
+
+    std::unique_ptr<BandSource> source = openBandSource(input);
+    if (!source) {
+        error = input + ": cannot be read out of core (use .rle, .ppm or .pgm)";
+        return false;
+    }
+    int width = source->getWidth();
+    int height = source->getHeight();
+    int channels = source->getChannels();
+    size_t rowBytes = paddedRowBytes(width, channels);
+    stats.width = width;
+    stats.height = height;
+    stats.channels = channels;
+
+    // Sizes the bands of one pass and records its footprint.
+    auto planPass = [&](int halo, bool statistics, size_t sinkBytes, int& bandRows) {
+        size_t fixedBytes = source->bufferBytes() + sinkBytes;
+        bandRows = bandRowsFor(options, fixedBytes, rowBytes, halo, statistics, height);
+        if (bandRows == 0) {
+            size_t needed = fixedBytes + windowCopies(halo, statistics) * (2 * halo + 1) * rowBytes;
+            error = "memory limit too small, one band needs " + std::to_string((needed >> 20) + 1) + " MiB";
+            return false;
+        }
+        size_t windowRows = std::min(height, bandRows + 2 * halo);
+        stats.peakBytes = std::max(stats.peakBytes, fixedBytes + windowCopies(halo, statistics) * windowRows * rowBytes);
+        stats.bandRows = stats.bandRows == 0 ? bandRows : std::min(stats.bandRows, bandRows);
+        return true;
+    };
+    auto chainHalo = [](const std::vector<BandOp>& chain) {
+        int halo = 0;
+        for (const BandOp& op : chain) halo += op.halo;
+        return halo;
+    };
+
+    TempFile spill;
+    std::vector<BandOp> chain;
+    for (size_t i = 0; i < pipeline.size(); ++i) {
+        const PipelineStage& stage = pipeline.stage(i);
+        if (!stage.statistics) {
+            BandOp op;
+            op.op = stage.banded(width, height, op.halo);
+            op.stage = i;
+            chain.push_back(op);
+            continue;
+        }
+
+        // A histogram stage: gather its statistics over the output of the
+        // stages so far. With none, the source is simply read twice.
+        std::unique_ptr<PointStatistics> gathered = stage.statistics();
+        if (chain.empty()) {
+            int bandRows;
+            if (!planPass(0, true, 0, bandRows) ||
+                !runPass(*source, chain, bandRows, nullptr, gathered.get(), i, stats, error)) {
+                return false;
+            }
+            if (!source->rewind()) {
+                error = input + ": cannot be read again";
+                return false;
+            }
+        } else {
+            TempFile next;
+            RleBandSink sink;
+            int bandRows;
+            if (!createTempFile(options.tempDirectory, next) || !sink.open(next.path, width, height, channels)) {
+                error = "cannot create a temporary file";
+                return false;
+            }
+            bool ok = planPass(chainHalo(chain), true, sink.bufferBytes(), bandRows) &&
+                      runPass(*source, chain, bandRows, &sink, gathered.get(), i, stats, error);
+            if (!sink.close() && ok) {
+                error = "writing a temporary file failed";
+                ok = false;
+            }
+            std::unique_ptr<RleBandSource> reopened(new RleBandSource());
+            if (ok && !reopened->open(next.path)) {
+                error = "reading a temporary file failed";
+                ok = false;
+            }
+            if (!ok) return false;
+            source.reset(reopened.release());
+            std::swap(spill.path, next.path);
+            chain.clear();
+        }
+
+        BandOp op;
+        op.op = gathered->compile();
+        op.halo = 0;
+        op.stage = i;
+        chain.push_back(op);
+    }
+
+    std::unique_ptr<BandSink> sink;
+    if (!output.empty()) {
+        sink = createBandSink(output, width, height, channels);
+        if (!sink) {
+            error = output + ": cannot be created";
+            return false;
+        }
+    }
+    int bandRows;
+    bool ok = planPass(chainHalo(chain), false, sink ? sink->bufferBytes() : 0, bandRows) &&
+              runPass(*source, chain, bandRows, sink.get(), nullptr, 0, stats, error);
+    if (sink && !sink->close() && ok) {
+        error = "writing failed";
+        ok = false;
+    }
+    if (!ok && sink) std::remove(output.c_str());
+    return ok;
+}
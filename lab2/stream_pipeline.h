@@ -0,0 +1,50 @@
+#ifndef STREAM_PIPELINE_H
+#define STREAM_PIPELINE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "pipeline.h"
+
+// Out-of-core runs of a Pipeline: the image goes from a band source to a band
+// sink (band_io.h) in row bands sized so that the working set stays under
+// memoryLimit, whatever the image size.
+//
+// Consecutive neighborhood and per-pixel stages run together on a window of
+// input rows: a band of output rows plus the sum of the stages' halos above
+// and below. The overlap is kept between bands rather than read again. Every
+// histogram stage needs a pass of its own: its statistics are gathered while
+// the stages before it run (their output goes to a temporary RLE file when
+// there are any), and it then becomes a per-pixel stage of the next pass.
+// Results are identical to a whole-image run (QualityCheck streams the
+// smallest kernels in as many bands as it can to check).
+
+struct StreamOptions {
+    size_t memoryLimit;
+    // Where intermediate files go; TMPDIR or /tmp when empty.
+    std::string tempDirectory;
+
+    StreamOptions() : memoryLimit(size_t(256) << 20) {}
+};
+
+struct StreamReport {
+    int width, height, channels;
+    int bandRows;
+    int passes;
+    // Estimated peak of band windows and file buffers.
+    size_t peakBytes;
+    // Time spent per pipeline stage, and on reading and writing.
+    std::vector<double> stageSeconds;
+    double readSeconds, writeSeconds;
+
+    StreamReport()
+        : width(0), height(0), channels(0), bandRows(0), passes(0), peakBytes(0), readSeconds(0), writeSeconds(0) {}
+};
+
+// Output may be empty to run the pipeline without keeping the result. False
+// with a message in error on unsupported files or stages, a memory limit too
+// small for one row band, or I/O failure; a partial output file is removed.
+bool runPipelineStreaming(const Pipeline& pipeline, const std::string& input, const std::string& output,
+                          const StreamOptions& options, std::string& error, StreamReport* report = nullptr);
+
+#endif // STREAM_PIPELINE_H
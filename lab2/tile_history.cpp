@@ -0,0 +1,254 @@
+#include "tile_history.h"
+#include <algorithm>
+#include <cstring>
+
+// std::min takes these by reference, so they need a definition.
+const int TiledSnapshot::kTileRows;
+const int TiledSnapshot::kTileBytes;
+
+TiledSnapshot::TiledSnapshot() {}
+
+template <typename Fn>
+void TiledSnapshot::forEachTile(Fn fn) const {
+    for (size_t plane = 0; plane < layout.size(); ++plane) {
+        const PlaneLayout& l = layout[plane];
+        for (int ty = 0; ty < l.tilesY; ++ty) {
+            for (int tx = 0; tx < l.tilesX; ++tx) {
+                int x0 = tx * kTileBytes;
+                int y0 = ty * kTileRows;
+                int w = std::min(kTileBytes, l.rowBytes - x0);
+                int h = std::min(kTileRows, l.rows - y0);
+                fn(plane, l.firstTile + ty * l.tilesX + tx, x0, y0, w, h);
+            }
+        }
+    }
+}
+
+TiledSnapshot TiledSnapshot::capture(const std::vector<PlaneView>& planes, const TiledSnapshot* base) {
+    return captureTiles(planes, base, nullptr);
+}
+
+TiledSnapshot TiledSnapshot::capture(const std::vector<PlaneView>& planes, const TiledSnapshot& base,
+                                     const PlaneRect& changed) {
+    return captureTiles(planes, &base, &changed);
+}
+
+TiledSnapshot TiledSnapshot::captureTiles(const std::vector<PlaneView>& planes, const TiledSnapshot* base,
+                                          const PlaneRect* changed) {
+    TiledSnapshot snapshot;
+    size_t tileCount = 0;
+    for (const PlaneView& p : planes) {
+        PlaneLayout l;
+        l.rowBytes = p.rowBytes;
+        l.rows = p.rows;
+        l.tilesX = (p.rowBytes + kTileBytes - 1) / kTileBytes;
+        l.tilesY = (p.rows + kTileRows - 1) / kTileRows;
+        l.firstTile = tileCount;
+        tileCount += static_cast<size_t>(l.tilesX) * l.tilesY;
+        snapshot.layout.push_back(l);
+    }
+    snapshot.tiles.resize(tileCount);
+
+    if (base && !base->sameGeometry(snapshot)) {
+        base = nullptr;
+    }
+
+    snapshot.forEachTile([&](size_t plane, size_t index, int x0, int y0, int w, int h) {
+        const PlaneView& p = planes[plane];
+        const unsigned char* src = p.data + static_cast<size_t>(y0) * p.stride + x0;
+
+        if (base) {
+            const std::shared_ptr<const ImageTile>& old = base->tiles[index];
+            if (changed && (x0 >= changed->x + changed->width || x0 + w <= changed->x ||
+                            y0 >= changed->y + changed->height || y0 + h <= changed->y)) {
+                snapshot.tiles[index] = old;
+                return;
+            }
+            bool equal = true;
+            for (int y = 0; y < h && equal; ++y) {
+                equal = std::memcmp(old->bytes.data() + y * w, src + static_cast<size_t>(y) * p.stride, w) == 0;
+            }
+            if (equal) {
+                snapshot.tiles[index] = old;
+                return;
+            }
+        }
+
+        auto tile = std::make_shared<ImageTile>();
+        tile->bytes.resize(static_cast<size_t>(w) * h);
+        for (int y = 0; y < h; ++y) {
+            std::memcpy(tile->bytes.data() + y * w, src + static_cast<size_t>(y) * p.stride, w);
+        }
+        snapshot.tiles[index] = tile;
+    });
+
+    return snapshot;
+}
+
+void TiledSnapshot::restore(const std::vector<PlaneView>& planes, const TiledSnapshot* current) const {
+    if (!matches(planes)) return;
+    if (current && !current->sameGeometry(*this)) {
+        current = nullptr;
+    }
+
+    forEachTile([&](size_t plane, size_t index, int x0, int y0, int w, int h) {
+        if (current && current->tiles[index] == tiles[index]) return;
+
+        const PlaneView& p = planes[plane];
+        unsigned char* dst = p.data + static_cast<size_t>(y0) * p.stride + x0;
+        const unsigned char* src = tiles[index]->bytes.data();
+        for (int y = 0; y < h; ++y) {
+            std::memcpy(dst + static_cast<size_t>(y) * p.stride, src + y * w, w);
+        }
+    });
+}
+
+bool TiledSnapshot::empty() const {
+    return tiles.empty();
+}
+
+bool TiledSnapshot::sameGeometry(const TiledSnapshot& other) const {
+    if (layout.size() != other.layout.size()) return false;
+    for (size_t i = 0; i < layout.size(); ++i) {
+        if (layout[i].rowBytes != other.layout[i].rowBytes || layout[i].rows != other.layout[i].rows) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TiledSnapshot::matches(const std::vector<PlaneView>& planes) const {
+    if (planes.size() != layout.size()) return false;
+    for (size_t i = 0; i < planes.size(); ++i) {
+        if (planes[i].rowBytes != layout[i].rowBytes || planes[i].rows != layout[i].rows) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t TiledSnapshot::memoryUsage() const {
+    size_t total = 0;
+    for (const auto& tile : tiles) {
+        total += tile->bytes.size();
+    }
+    return total;
+}
+
+size_t TiledSnapshot::bytesNotIn(const TiledSnapshot& other) const {
+    if (!sameGeometry(other)) return memoryUsage();
+
+    size_t total = 0;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        if (tiles[i] != other.tiles[i]) {
+            total += tiles[i]->bytes.size();
+        }
+    }
+    return total;
+}
+
+EditHistory::EditHistory(size_t budgetBytes) : cursor(0), budget(budgetBytes), usage(0) {}
+
+void EditHistory::clear() {
+    states.clear();
+    cursor = 0;
+    usage = 0;
+}
+
+void EditHistory::reset(const std::vector<PlaneView>& planes) {
+    clear();
+    push(TiledSnapshot::capture(planes));
+}
+
+void EditHistory::commit(const std::vector<PlaneView>& planes) {
+    if (states.empty()) {
+        reset(planes);
+        return;
+    }
+    push(TiledSnapshot::capture(planes, &current()));
+}
+
+void EditHistory::commit(const std::vector<PlaneView>& planes, const PlaneRect& changed) {
+    if (states.empty()) {
+        reset(planes);
+        return;
+    }
+    push(TiledSnapshot::capture(planes, current(), changed));
+}
+
+void EditHistory::commit(const TiledSnapshot& snapshot) {
+    push(snapshot);
+}
+
+void EditHistory::push(const TiledSnapshot& snapshot) {
+    // Anything after the cursor is the redo branch, which a new edit discards.
+    while (!states.empty() && states.size() > cursor + 1) {
+        usage -= states.back().ownBytes;
+        states.pop_back();
+    }
+
+    State state;
+    state.snapshot = snapshot;
+    state.ownBytes = states.empty() ? snapshot.memoryUsage() : snapshot.bytesNotIn(states.back().snapshot);
+    usage += state.ownBytes;
+    states.push_back(state);
+    cursor = states.size() - 1;
+
+    evict();
+}
+
+void EditHistory::evict() {
+    while (usage > budget && cursor > 0) {
+        usage -= states.front().ownBytes;
+        states.pop_front();
+        --cursor;
+
+        // The new oldest state now owns every tile it references.
+        State& front = states.front();
+        usage -= front.ownBytes;
+        front.ownBytes = front.snapshot.memoryUsage();
+        usage += front.ownBytes;
+    }
+}
+
+bool EditHistory::canUndo() const {
+    return cursor > 0;
+}
+
+bool EditHistory::canRedo() const {
+    return cursor + 1 < states.size();
+}
+
+bool EditHistory::undo(const std::vector<PlaneView>& planes) {
+    if (!canUndo()) return false;
+    const TiledSnapshot& from = states[cursor].snapshot;
+    --cursor;
+    states[cursor].snapshot.restore(planes, &from);
+    return true;
+}
+
+bool EditHistory::redo(const std::vector<PlaneView>& planes) {
+    if (!canRedo()) return false;
+    const TiledSnapshot& from = states[cursor].snapshot;
+    ++cursor;
+    states[cursor].snapshot.restore(planes, &from);
+    return true;
+}
+
+const TiledSnapshot& EditHistory::current() const {
+    static const TiledSnapshot emptySnapshot;
+    return states.empty() ? emptySnapshot : states[cursor].snapshot;
+}
+
+size_t EditHistory::memoryUsage() const {
+    return usage;
+}
+
+size_t EditHistory::stateCount() const {
+    return states.size();
+}
+
+void EditHistory::setBudget(size_t budgetBytes) {
+    budget = budgetBytes;
+    evict();
+}
@@ -0,0 +1,116 @@
+#ifndef TILE_HISTORY_H
+#define TILE_HISTORY_H
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// A rectangular byte surface: rowBytes meaningful bytes per row, rows apart by stride.
+struct PlaneView {
+    unsigned char* data;
+    int rowBytes;
+    int rows;
+    int stride;
+};
+
+// Bytes [x, x + width) of rows [y, y + height), the same in every plane.
+struct PlaneRect {
+    int x, y, width, height;
+};
+
+// Immutable, reference-counted block of pixel bytes. Snapshots share tiles
+// that did not change between them, so copies of a snapshot are pointer copies.
+struct ImageTile {
+    std::vector<unsigned char> bytes;
+};
+
+class TiledSnapshot {
+public:
+    static const int kTileRows = 64;
+    static const int kTileBytes = 256;
+
+    TiledSnapshot();
+
+    // Splits the planes into tiles. Tiles whose content equals the tile at the
+    // same position in `base` are shared with it instead of being copied.
+    static TiledSnapshot capture(const std::vector<PlaneView>& planes, const TiledSnapshot* base = nullptr);
+    // The same when only `changed` can differ from `base`: tiles outside it
+    // are shared without being read, so the cost follows the changed area.
+    static TiledSnapshot capture(const std::vector<PlaneView>& planes, const TiledSnapshot& base,
+                                 const PlaneRect& changed);
+
+    // Writes the snapshot back into the planes. When `current` describes what
+    // the planes already hold, only tiles whose pointers differ are copied.
+    void restore(const std::vector<PlaneView>& planes, const TiledSnapshot* current = nullptr) const;
+
+    bool empty() const;
+    bool sameGeometry(const TiledSnapshot& other) const;
+    bool matches(const std::vector<PlaneView>& planes) const;
+    size_t memoryUsage() const;
+    // Bytes held by tiles of this snapshot that `other` does not share.
+    size_t bytesNotIn(const TiledSnapshot& other) const;
+
+private:
+    struct PlaneLayout {
+        int rowBytes;
+        int rows;
+        int tilesX;
+        int tilesY;
+        size_t firstTile;
+    };
+
+    template <typename Fn>
+    void forEachTile(Fn fn) const;
+    static TiledSnapshot captureTiles(const std::vector<PlaneView>& planes, const TiledSnapshot* base,
+                                      const PlaneRect* changed);
+
+    std::vector<PlaneLayout> layout;
+    std::vector<std::shared_ptr<const ImageTile>> tiles;
+};
+
+// Linear undo/redo history of snapshots. Consecutive states share unchanged
+// tiles; the oldest states are evicted once the tiles they alone hold exceed
+// the memory budget. The current state is never evicted.
+class EditHistory {
+public:
+    explicit EditHistory(size_t budgetBytes = 512u * 1024u * 1024u);
+
+    void clear();
+    // Starts a new history whose only state is the given planes.
+    void reset(const std::vector<PlaneView>& planes);
+    // Records the planes as a new state after the current one, dropping any redo states.
+    void commit(const std::vector<PlaneView>& planes);
+    // The same when the planes changed only within `changed`.
+    void commit(const std::vector<PlaneView>& planes, const PlaneRect& changed);
+    // Records an already captured snapshot (e.g. the original image) as a new state.
+    void commit(const TiledSnapshot& snapshot);
+
+    bool canUndo() const;
+    bool canRedo() const;
+    // Move the cursor and write the tiles that differ into the planes.
+    bool undo(const std::vector<PlaneView>& planes);
+    bool redo(const std::vector<PlaneView>& planes);
+
+    const TiledSnapshot& current() const;
+    size_t memoryUsage() const;
+    size_t stateCount() const;
+    void setBudget(size_t budgetBytes);
+
+private:
+    struct State {
+        TiledSnapshot snapshot;
+        // Bytes of tiles that the previous state does not share.
+        size_t ownBytes;
+    };
+
+    void push(const TiledSnapshot& snapshot);
+    void evict();
+
+    std::deque<State> states;
+    size_t cursor;
+    size_t budget;
+    size_t usage;
+};
+
+#endif // TILE_HISTORY_H
@@ -0,0 +1,275 @@
+#include "tone_lut.h"
+#include "cpu_features.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef LAB2_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace {
+
+#ifdef LAB2_X86_DISPATCH
+// Two 128-entry permutes cover the table; bit 7 of the index picks one.
+// Returns the number of bytes mapped, a multiple of 64.
+LAB2_TARGET("avx512f,avx512bw,avx512vbmi")
+int lookupRowVbmi(uint8_t* p, const uint8_t* table, int width) {
+    const __m512i t0 = _mm512_loadu_si512(table);
+    const __m512i t1 = _mm512_loadu_si512(table + 64);
+    const __m512i t2 = _mm512_loadu_si512(table + 128);
+    const __m512i t3 = _mm512_loadu_si512(table + 192);
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        __m512i idx = _mm512_loadu_si512(p + x);
+        __m512i lo = _mm512_permutex2var_epi8(t0, idx, t1);
+        __m512i hi = _mm512_permutex2var_epi8(t2, idx, t3);
+        __mmask64 upper = _mm512_movepi8_mask(idx);
+        _mm512_storeu_si512(p + x, _mm512_mask_blend_epi8(upper, lo, hi));
+    }
+    return x;
+}
+
+// Sixteen 16-entry slices, one pshufb each. Adding 0x70 with unsigned
+// saturation sets bit 7 (pshufb -> 0) for indices outside the slice.
+// Returns the number of bytes mapped, a multiple of 32.
+LAB2_TARGET("avx2")
+int lookupRowAvx2(uint8_t* p, const uint8_t* table, int width) {
+    __m256i slices[16];
+    for (int k = 0; k < 16; ++k) {
+        slices[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * k)));
+    }
+    const __m256i bias = _mm256_set1_epi8(0x70);
+    const __m256i step = _mm256_set1_epi8(16);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + x));
+        __m256i result = _mm256_setzero_si256();
+        for (int k = 0; k < 16; ++k) {
+            result = _mm256_or_si256(result, _mm256_shuffle_epi8(slices[k], _mm256_adds_epu8(idx, bias)));
+            idx = _mm256_sub_epi8(idx, step);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + x), result);
+    }
+    return x;
+}
+#endif
+
+// In-place p[x] = table[p[x]] over one row.
+void lookupRow(uint8_t* p, const uint8_t* table, int width) {
+    int x = 0;
+#ifdef LAB2_X86_DISPATCH
+    const CpuFeatures& cpu = cpuFeatures();
+    if (cpu.avx512vbmi) {
+        x = lookupRowVbmi(p, table, width);
+    } else if (cpu.avx2) {
+        x = lookupRowAvx2(p, table, width);
+    }
+#endif
+    for (; x < width; ++x) {
+        p[x] = table[p[x]];
+    }
+}
+
+void applyStageToRow(const ToneStage& stage, uint8_t* const* p, int width) {
+    if (stage.kind == ToneStage::ChannelMap) {
+        for (int c = 0; c < 3; ++c) {
+            lookupRow(p[c], stage.map[c], width);
+        }
+        return;
+    }
+
+    // Gains live in a stack block the rows cannot alias, so the scaling loops vectorize.
+    const int kBlock = 256;
+    uint32_t gains[kBlock];
+    for (int x0 = 0; x0 < width; x0 += kBlock) {
+        int n = std::min(kBlock, width - x0);
+        const uint8_t* r = p[0] + x0;
+        const uint8_t* g = p[1] + x0;
+        const uint8_t* b = p[2] + x0;
+        for (int x = 0; x < n; ++x) {
+            gains[x] = stage.gain[lumaOf(r[x], g[x], b[x])];
+        }
+        for (int c = 0; c < 3; ++c) {
+            uint8_t* row = p[c] + x0;
+            for (int x = 0; x < n; ++x) {
+                uint32_t v = (row[x] * gains[x]) >> 16;
+                row[x] = static_cast<uint8_t>(v > 255 ? 255 : v);
+            }
+        }
+    }
+}
+
+uint32_t toQ16(float gain) {
+    gain = std::max(0.0f, std::min(255.0f, gain));
+    return static_cast<uint32_t>(gain * 65536.0f + 0.5f);
+}
+
+}
+
+void buildEqualizationMap(const std::vector<int>& histogram, uint8_t* map) {
+    int cdf[256];
+    cdf[0] = histogram[0];
+    for (int i = 1; i < 256; i++) {
+        cdf[i] = cdf[i-1] + histogram[i];
+    }
+    int total_pixels = cdf[255];
+
+    int cdf_min = total_pixels;
+    for (int i = 0; i < 256; i++) {
+        if (histogram[i] != 0) {
+            cdf_min = std::min(cdf_min, cdf[i]);
+        }
+    }
+
+    for (int i = 0; i < 256; i++) {
+        if (cdf[i] > cdf_min) {
+            float equalized = (cdf[i] - cdf_min) / static_cast<float>(total_pixels - cdf_min);
+            map[i] = static_cast<uint8_t>(equalized * 255);
+        } else {
+            map[i] = 0;
+        }
+    }
+}
+
+ToneStage ToneStage::identity() {
+    ToneStage stage;
+    stage.kind = ChannelMap;
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < 256; ++i) {
+            stage.map[c][i] = static_cast<uint8_t>(i);
+        }
+    }
+    for (int i = 0; i < 256; ++i) {
+        stage.gain[i] = 1u << 16;
+    }
+    return stage;
+}
+
+ToneStage ToneStage::channelMap(const uint8_t* r, const uint8_t* g, const uint8_t* b) {
+    ToneStage stage = identity();
+    std::memcpy(stage.map[0], r, 256);
+    std::memcpy(stage.map[1], g, 256);
+    std::memcpy(stage.map[2], b, 256);
+    return stage;
+}
+
+ToneStage ToneStage::lumaGain(const float* gain) {
+    ToneStage stage = identity();
+    stage.kind = LumaGain;
+    for (int i = 0; i < 256; ++i) {
+        stage.gain[i] = toQ16(gain[i]);
+    }
+    return stage;
+}
+
+void TonePipeline::add(const ToneStage& stage) {
+    if (stages.empty() || stages.back().kind != stage.kind) {
+        stages.push_back(stage);
+        return;
+    }
+
+    ToneStage& last = stages.back();
+    if (stage.kind == ToneStage::ChannelMap) {
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < 256; ++i) {
+                last.map[c][i] = stage.map[c][last.map[c][i]];
+            }
+        }
+    } else {
+        // Scaling RGB by g scales luma by g as well, so the second gain is
+        // looked up at the luma the first one produced (clipping aside).
+        for (int y = 0; y < 256; ++y) {
+            uint64_t first = last.gain[y];
+            int scaled = static_cast<int>(std::min<uint64_t>(255, (y * first) >> 16));
+            uint64_t combined = (first * stage.gain[scaled]) >> 16;
+            last.gain[y] = static_cast<uint32_t>(std::min<uint64_t>(combined, 255u << 16));
+        }
+    }
+}
+
+void TonePipeline::clear() {
+    stages.clear();
+}
+
+bool TonePipeline::empty() const {
+    return stages.empty();
+}
+
+size_t TonePipeline::stageCount() const {
+    return stages.size();
+}
+
+void TonePipeline::apply(PlanarImage& image) const {
+    apply(image, image);
+}
+
+void TonePipeline::apply(const PlanarImage& src, PlanarImage& dst) const {
+    if (src.empty()) return;
+    if (&src != &dst) {
+        dst.allocate(src.getWidth(), src.getHeight(), src.getChannels());
+    }
+
+    int width = src.getWidth();
+    int grain = std::max(1, (1 << 15) / width);
+
+    parallelFor(0, src.getHeight(), grain, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            if (&src != &dst) {
+                for (int c = 0; c < src.getChannels(); ++c) {
+                    std::memcpy(dst.row(c, y), src.row(c, y), width);
+                }
+            }
+            if (src.getChannels() < 3) continue;
+
+            uint8_t* rows[3] = {dst.row(0, y), dst.row(1, y), dst.row(2, y)};
+            for (const ToneStage& stage : stages) {
+                applyStageToRow(stage, rows, width);
+            }
+        }
+    });
+}
+
+ToneStage makeEqualizationStage(const ChannelHistograms& histogram) {
+    uint8_t maps[3][256];
+    for (int c = 0; c < 3; ++c) {
+        buildEqualizationMap(histogram[c], maps[c]);
+    }
+    return ToneStage::channelMap(maps[0], maps[1], maps[2]);
+}
+
+ToneStage makeLumaEqualizationStage(const std::vector<int>& lumaHistogram) {
+    uint8_t map[256];
+    buildEqualizationMap(lumaHistogram, map);
+
+    // Luma 0 only occurs for (near) black pixels; its equalized value is 0.
+    float gain[256];
+    gain[0] = 0.0f;
+    for (int y = 1; y < 256; ++y) {
+        gain[y] = static_cast<float>(map[y]) / y;
+    }
+    return ToneStage::lumaGain(gain);
+}
+
+ToneStage makeLinearContrastStage(const std::vector<int>& lumaHistogram, int min_out, int max_out) {
+    int min_brightness = 0;
+    while (min_brightness < 255 && lumaHistogram[min_brightness] == 0) ++min_brightness;
+    int max_brightness = 255;
+    while (max_brightness > 0 && lumaHistogram[max_brightness] == 0) --max_brightness;
+
+    // Если все пиксели одинаковой яркости, избегаем деления на ноль
+    if (max_brightness <= min_brightness) {
+        return ToneStage::identity();
+    }
+
+    float gain[256];
+    gain[0] = 1.0f;
+    for (int y = 1; y < 256; ++y) {
+        float normalized = static_cast<float>(y - min_brightness) / (max_brightness - min_brightness);
+        int new_brightness = static_cast<int>(min_out + normalized * (max_out - min_out));
+        new_brightness = std::max(0, std::min(255, new_brightness));
+        gain[y] = static_cast<float>(new_brightness) / y;
+    }
+    return ToneStage::lumaGain(gain);
+}
@@ -0,0 +1,55 @@
+#ifndef TONE_LUT_H
+#define TONE_LUT_H
+
+#include <cstdint>
+#include <vector>
+#include "histogram.h"
+#include "planar_image.h"
+
+// One compiled point operation. ChannelMap looks every channel up in its own
+// 256-entry table; LumaGain multiplies all channels of a pixel by a Q16 gain
+// indexed by the pixel's integer luma, which preserves the RGB ratios.
+struct ToneStage {
+    enum Kind { ChannelMap, LumaGain };
+
+    Kind kind;
+    uint8_t map[3][256];
+    uint32_t gain[256];
+
+    static ToneStage identity();
+    static ToneStage channelMap(const uint8_t* r, const uint8_t* g, const uint8_t* b);
+    static ToneStage lumaGain(const float* gain);
+};
+
+// A chain of point operations. Adjacent stages of the same kind are composed
+// into one table when added, and apply() runs whatever remains in a single
+// pass over the image, row by row, keeping intermediates in a row buffer.
+class TonePipeline {
+public:
+    void add(const ToneStage& stage);
+    void clear();
+    bool empty() const;
+    size_t stageCount() const;
+
+    // Applies to channels 0..2; other planes (alpha) are left alone.
+    void apply(PlanarImage& image) const;
+    // Same, reading from src: each row is copied and transformed while it is
+    // still in cache, so this is one pass instead of a copy plus a pass.
+    void apply(const PlanarImage& src, PlanarImage& dst) const;
+
+private:
+    std::vector<ToneStage> stages;
+};
+
+// Equalization curve of one histogram: the CDF rescaled so that the first
+// occupied bin maps to 0 and the last to 255.
+void buildEqualizationMap(const std::vector<int>& histogram, uint8_t* map);
+
+// Classic per-channel histogram equalization tables.
+ToneStage makeEqualizationStage(const ChannelHistograms& histogram);
+// Equalizes integer luma and rescales RGB by the luma ratio.
+ToneStage makeLumaEqualizationStage(const std::vector<int>& lumaHistogram);
+// Stretches the occupied luma range onto [min_out, max_out] by rescaling RGB.
+ToneStage makeLinearContrastStage(const std::vector<int>& lumaHistogram, int min_out, int max_out);
+
+#endif // TONE_LUT_H
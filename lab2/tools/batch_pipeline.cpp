@@ -0,0 +1,253 @@
+// Headless batch processing: runs one pipeline (see pipeline.h) over many
+// files and reports time and throughput per stage.
+//
+//   BatchPipeline [-o DIR] [-m MIB] "gaussian:k=7,s=2 | equalize:hsv | rle" FILE|DIR...
+//
+// -m runs out of core (stream_pipeline.h): files go one at a time in row
+// bands, within MIB megabytes of working memory each.
+//
+// With at least as many files as hardware threads, whole files run
+// concurrently, one per pool thread (the kernels then run inline); with fewer,
+// files go one at a time and every kernel uses the whole pool. Stage MB/s is
+// raw pixel bytes over the time spent in that stage, so with concurrent files
+// it is the rate of one thread.
+#include "image_io.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "stream_pipeline.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct StageStats {
+    int images;
+    double pixels, bytes;
+    double seconds;
+    StageStats() : images(0), pixels(0), bytes(0), seconds(0) {}
+
+    void add(const PlanarImage& image, double elapsed) {
+        double count = static_cast<double>(image.getWidth()) * image.getHeight();
+        ++images;
+        pixels += count;
+        bytes += count * image.getChannels();
+        seconds += elapsed;
+    }
+};
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool isDirectory(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+void addInputs(const std::string& path, std::vector<std::string>& inputs) {
+    if (!isDirectory(path)) {
+        inputs.push_back(path);
+        return;
+    }
+    std::vector<std::string> found;
+    if (DIR* dir = opendir(path.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string file = path + "/" + entry->d_name;
+            if (isImageFileSupported(file) && !isDirectory(file)) found.push_back(file);
+        }
+        closedir(dir);
+    }
+    std::sort(found.begin(), found.end());
+    inputs.insert(inputs.end(), found.begin(), found.end());
+}
+
+std::string outputPath(const std::string& directory, const std::string& input, const std::string& extension) {
+    size_t slash = input.find_last_of('/');
+    std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) name.erase(dot);
+    return directory + "/" + name + extension;
+}
+
+void printStage(const std::string& name, const StageStats& s) {
+    std::printf("%-36s %7d %9.2f %9.3f %9.1f\n", name.c_str(), s.images, s.pixels / 1e6, s.seconds,
+                s.seconds > 0 ? s.bytes / 1e6 / s.seconds : 0.0);
+}
+
+// Every file in row bands, one after another; each band uses the whole pool.
+int runStreaming(const Pipeline& pipeline, const std::vector<std::string>& inputs,
+                 const std::string& outputDirectory, const StreamOptions& options) {
+    const std::string& extension = pipeline.outputExtension();
+    std::vector<StageStats> stats(pipeline.size() + 2);
+    size_t peak = 0;
+    int failed = 0;
+
+    auto wallStart = Clock::now();
+    for (const std::string& input : inputs) {
+        std::string output = extension.empty() ? std::string() : outputPath(outputDirectory, input, extension);
+        StreamReport report;
+        std::string error;
+        if (!runPipelineStreaming(pipeline, input, output, options, error, &report)) {
+            ++failed;
+            std::fprintf(stderr, "%s: %s\n", input.c_str(), error.c_str());
+            continue;
+        }
+        double pixels = static_cast<double>(report.width) * report.height;
+        auto account = [&](StageStats& s, double seconds) {
+            ++s.images;
+            s.pixels += pixels;
+            s.bytes += pixels * report.channels;
+            s.seconds += seconds;
+        };
+        account(stats[0], report.readSeconds);
+        for (size_t i = 0; i < pipeline.size(); ++i) account(stats[i + 1], report.stageSeconds[i]);
+        account(stats.back(), report.writeSeconds);
+        peak = std::max(peak, report.peakBytes);
+        std::printf("%s: %dx%d in bands of %d rows, %d passes, ~%zu MiB peak\n", input.c_str(), report.width,
+                    report.height, report.bandRows, report.passes, (report.peakBytes >> 20) + 1);
+    }
+    double wall = secondsSince(wallStart);
+
+    std::printf("%-36s %7s %9s %9s %9s\n", "stage", "images", "MPix", "time s", "MB/s");
+    printStage("read", stats[0]);
+    for (size_t i = 0; i < pipeline.size(); ++i) printStage(pipeline.stageName(i), stats[i + 1]);
+    if (!extension.empty()) printStage("write " + extension, stats.back());
+    std::printf("%d files, %d failed, %.3f s wall, %.1f MB/s, out of core within %zu MiB\n",
+                static_cast<int>(inputs.size()), failed, wall, wall > 0 ? stats[0].bytes / 1e6 / wall : 0.0,
+                options.memoryLimit >> 20);
+    return failed == 0 ? 0 : 1;
+}
+
+void usage(const char* program) {
+    std::fprintf(stderr, "usage: %s [-o DIR] [-m MIB] PIPELINE FILE|DIR...\n\nstages:\n%s", program,
+                 Pipeline::stageHelp().c_str());
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string outputDirectory;
+    bool streaming = false;
+    StreamOptions streamOptions;
+    int arg = 1;
+    while (arg + 1 < argc && argv[arg][0] == '-') {
+        if (std::strcmp(argv[arg], "-o") == 0) {
+            outputDirectory = argv[arg + 1];
+        } else if (std::strcmp(argv[arg], "-m") == 0 && std::atoi(argv[arg + 1]) > 0) {
+            streaming = true;
+            streamOptions.memoryLimit = static_cast<size_t>(std::atoi(argv[arg + 1])) << 20;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        arg += 2;
+    }
+    if (argc - arg < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    Pipeline pipeline;
+    std::string error;
+    if (!pipeline.parse(argv[arg], error)) {
+        std::fprintf(stderr, "pipeline: %s\n", error.c_str());
+        return 2;
+    }
+    const std::string& extension = pipeline.outputExtension();
+    if (!extension.empty() && outputDirectory.empty()) {
+        std::fprintf(stderr, "an output stage needs -o DIR\n");
+        return 2;
+    }
+    if (!outputDirectory.empty() && mkdir(outputDirectory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::fprintf(stderr, "%s: %s\n", outputDirectory.c_str(), std::strerror(errno));
+        return 1;
+    }
+
+    std::vector<std::string> inputs;
+    for (int i = arg + 1; i < argc; ++i) {
+        addInputs(argv[i], inputs);
+    }
+    if (inputs.empty()) {
+        std::fprintf(stderr, "no input files\n");
+        return 2;
+    }
+
+    // Slot 0 is reading, then the pipeline stages, then writing.
+    size_t stageCount = pipeline.size();
+    std::vector<StageStats> stats(stageCount + 2);
+    std::mutex statsMutex;
+    int failed = 0;
+
+    auto processFile = [&](const std::string& input) {
+        std::vector<StageStats> local(stats.size());
+        PlanarImage image;
+
+        auto start = Clock::now();
+        bool ok = readImageFile(input, image);
+        local[0].add(image, secondsSince(start));
+
+        for (size_t i = 0; ok && i < stageCount; ++i) {
+            start = Clock::now();
+            pipeline.runStage(i, image);
+            local[i + 1].add(image, secondsSince(start));
+        }
+
+        std::string output;
+        if (ok && !extension.empty()) {
+            output = outputPath(outputDirectory, input, extension);
+            start = Clock::now();
+            ok = writeImageFile(output, image);
+            local[stageCount + 1].add(image, secondsSince(start));
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if (!ok) {
+            ++failed;
+            std::fprintf(stderr, "%s: %s failed\n", input.c_str(), image.empty() ? "reading" : "writing");
+            return;
+        }
+        for (size_t i = 0; i < stats.size(); ++i) {
+            stats[i].images += local[i].images;
+            stats[i].pixels += local[i].pixels;
+            stats[i].bytes += local[i].bytes;
+            stats[i].seconds += local[i].seconds;
+        }
+    };
+
+    if (streaming) {
+        return runStreaming(pipeline, inputs, outputDirectory, streamOptions);
+    }
+
+    int fileCount = static_cast<int>(inputs.size());
+    bool concurrentFiles = fileCount >= hardwareThreads();
+    auto wallStart = Clock::now();
+    if (concurrentFiles) {
+        parallelFor(0, fileCount, 1, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) processFile(inputs[i]);
+        });
+    } else {
+        for (const std::string& input : inputs) processFile(input);
+    }
+    double wall = secondsSince(wallStart);
+
+    std::printf("%-36s %7s %9s %9s %9s\n", "stage", "images", "MPix", "time s", "MB/s");
+    printStage("read", stats[0]);
+    for (size_t i = 0; i < stageCount; ++i) printStage(pipeline.stageName(i), stats[i + 1]);
+    if (!extension.empty()) printStage("write " + extension, stats.back());
+    double totalBytes = stats[0].bytes;
+    std::printf("%d files, %d failed, %.3f s wall, %.1f MB/s, %d threads, %s\n", fileCount, failed, wall,
+                wall > 0 ? totalBytes / 1e6 / wall : 0.0, hardwareThreads(),
+                concurrentFiles ? "files in parallel" : "one file at a time");
+    return failed == 0 ? 0 : 1;
+}
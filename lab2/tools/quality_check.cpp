@@ -0,0 +1,694 @@
+// Proof that optimized kernels have not drifted: every operation runs through
+// ImageProcessor, as the application runs it, on a corpus of the images in
+// lab2/image plus synthetic worst cases, and each result is compared
+//
+//  - with a straightforward reference loop (reference_kernels.h), where the
+//    case has one, against that case's limits: exact for kernels that promise
+//    identical output, looser for approximations such as the bilateral grid;
+//  - with the golden output stored for that input, against the golden limits
+//    of the case, kept with it in DIR/cases.txt: exact for integer kernels,
+//    one level for floating-point ones, whose rounding changes with whether
+//    the compiler fuses multiply-adds (as -march=native builds do). Limits
+//    given on the command line loosen these.
+//
+// Pipeline stages that promise the whole-image result when cut up (pipeline.h,
+// stream_pipeline.h) are also run in bands, on a rectangle and streamed, at
+// the smallest kernels the parser accepts, where a halo that falls short of
+// the kernel shows first as seams. Edit sequences with a known outcome, such
+// as loading an image of another size, are checked as well. Neither runs
+// with --cases.
+//
+//   QualityCheck [--images DIR] [--golden DIR] [--cases median,edges]
+//                [--max-error 0] [--min-psnr DB] [--min-ssim 1] [--update]
+//
+// Goldens are RLE files, one per input, holding the output of every case
+// stacked top to bottom in the order listed in DIR/cases.txt. For the corpus
+// images they keep only a centre window of each full-size output, since RLE
+// does little for photographs; the synthetic inputs fit whole. --update
+// rewrites them from the current outputs; do that only after checking that a
+// change in output is intended. The exit status is 1 if any comparison fails,
+// which includes a case or input with no golden to compare against.
+#include "bilateral.h"
+#include "color_kernels.h"
+#include "image_compare.h"
+#include "image_io.h"
+#include "image_processor.h"
+#include "morphology.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "reference_kernels.h"
+#include "stream_pipeline.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#ifndef LAB2_SOURCE_DIR
+#define LAB2_SOURCE_DIR "."
+#endif
+
+namespace {
+
+const double kInfinity = std::numeric_limits<double>::infinity();
+
+struct Limits {
+    int maxError;
+    double minPsnr;
+    double minSsim;
+
+    bool accept(const ImageDifference& d) const {
+        return d.maxError <= maxError && d.psnr >= minPsnr && d.ssim >= minSsim;
+    }
+};
+
+const Limits kExact = {0, kInfinity, 1.0};
+
+typedef std::function<void(const PlanarImage&, PlanarImage&)> Reference;
+
+// Within one level of the expected output; for floating-point kernels.
+const Limits kOneLevel = {1, 45.0, 0.99};
+
+// Each limit the looser of the two.
+Limits looser(const Limits& a, const Limits& b) {
+    return {std::max(a.maxError, b.maxError), std::min(a.minPsnr, b.minPsnr), std::min(a.minSsim, b.minSsim)};
+}
+
+struct Case {
+    std::string name;
+    std::function<void(ImageProcessor&)> run;
+    Reference reference; // empty: checked against the golden only
+    Limits limits;
+    Limits goldenLimits; // against goldens written by another build
+};
+
+struct Input {
+    std::string name;
+    PlanarImage image;
+    int goldenX, goldenY, goldenWidth, goldenHeight; // window of the output kept in the golden
+};
+
+const int kGoldenWindow = 64;
+
+void setGoldenWindow(Input& input) {
+    input.goldenWidth = std::min(kGoldenWindow, input.image.getWidth());
+    input.goldenHeight = std::min(kGoldenWindow, input.image.getHeight());
+    input.goldenX = (input.image.getWidth() - input.goldenWidth) / 2;
+    input.goldenY = (input.image.getHeight() - input.goldenHeight) / 2;
+}
+
+std::vector<Case> makeCases() {
+    std::vector<Case> cases;
+    struct Border {
+        BorderMode mode;
+        const char* name;
+    };
+    const Border skip = {BorderMode::Skip, "skip"};
+    const Border clamp = {BorderMode::Clamp, "clamp"};
+    const Border reflect = {BorderMode::Reflect, "reflect"};
+
+    for (auto box : {std::make_pair(3, skip), std::make_pair(5, clamp), std::make_pair(7, reflect)}) {
+        int k = box.first;
+        BorderMode mode = box.second.mode;
+        cases.push_back({"box-k" + std::to_string(k) + "-" + box.second.name,
+                         [k, mode](ImageProcessor& p) { p.applyLowPassFilter(k, mode); },
+                         [k, mode](const PlanarImage& s, PlanarImage& d) { referenceBoxFilter(s, d, k, mode); },
+                         kExact, kExact});
+    }
+    cases.push_back({"gaussian-k3-s0.8-skip",
+                     [](ImageProcessor& p) { p.applyGaussianFilter(3, 0.8, BorderMode::Skip); },
+                     [](const PlanarImage& s, PlanarImage& d) {
+                         referenceGaussianFilter(s, d, 3, 0.8, BorderMode::Skip);
+                     },
+                     kExact, kOneLevel});
+    cases.push_back({"gaussian-k7-s2-reflect",
+                     [](ImageProcessor& p) { p.applyGaussianFilter(7, 2.0, BorderMode::Reflect); },
+                     [](const PlanarImage& s, PlanarImage& d) {
+                         referenceGaussianFilter(s, d, 7, 2.0, BorderMode::Reflect);
+                     },
+                     kExact, kOneLevel});
+    for (auto median : {std::make_pair(1, skip), std::make_pair(3, clamp), std::make_pair(9, reflect)}) {
+        int r = median.first;
+        BorderMode mode = median.second.mode;
+        cases.push_back({"median-r" + std::to_string(r) + "-" + median.second.name,
+                         [r, mode](ImageProcessor& p) { p.applyMedianFilter(r, mode); },
+                         [r, mode](const PlanarImage& s, PlanarImage& d) { referenceMedianFilter(s, d, r, mode); },
+                         kExact, kExact});
+    }
+    // The grid approximates the brute-force filter; worst near hard edges.
+    cases.push_back({"bilateral-s4-r30", [](ImageProcessor& p) { p.applyBilateralFilter(4, 30); },
+                     [](const PlanarImage& s, PlanarImage& d) { bilateralFilterReference(s, d, 4, 30); },
+                     {255, 26.0, 0.90}, kOneLevel});
+
+    struct Morph {
+        const char* name;
+        MorphologyOp op;
+        int width, height;
+        bool binary;
+    };
+    for (const Morph& m : {Morph{"erode-5x3", MorphologyOp::Erode, 5, 3, false},
+                           Morph{"dilate-3x7", MorphologyOp::Dilate, 3, 7, false},
+                           Morph{"open-7x7", MorphologyOp::Open, 7, 7, false},
+                           Morph{"close-5x5", MorphologyOp::Close, 5, 5, false},
+                           Morph{"open-4x2", MorphologyOp::Open, 4, 2, false},
+                           Morph{"close-6x6", MorphologyOp::Close, 6, 6, false},
+                           Morph{"open-binary-5x5", MorphologyOp::Open, 5, 5, true}}) {
+        cases.push_back({m.name, [m](ImageProcessor& p) { p.applyMorphology(m.op, m.width, m.height, m.binary); },
+                         [m](const PlanarImage& s, PlanarImage& d) {
+                             referenceMorphology(s, d, m.op, m.width, m.height, m.binary);
+                         },
+                         kExact, kExact});
+    }
+
+    cases.push_back({"edges-50-150", [](ImageProcessor& p) { p.applyEdgeDetection(50, 150); },
+                     [](const PlanarImage& s, PlanarImage& d) { referenceCannyEdges(s, d, 50, 150); }, kExact,
+                     kExact});
+
+    // The luma gains go through Q16 tables in the fast path.
+    cases.push_back({"equalize-rgb", [](ImageProcessor& p) { p.applyHistogramEqualization(0); },
+                     referenceEqualizeRgb, kExact, kExact});
+    cases.push_back({"equalize-luma", [](ImageProcessor& p) { p.applyHistogramEqualization(1); },
+                     referenceEqualizeLuma, kOneLevel, kExact});
+    cases.push_back({"equalize-hsv", [](ImageProcessor& p) { p.applyHistogramEqualization(2); },
+                     [](const PlanarImage& s, PlanarImage& d) { equalizeValueReference(s, d); }, kOneLevel,
+                     kExact});
+    cases.push_back({"equalize-hls", [](ImageProcessor& p) { p.applyHistogramEqualization(3); }, nullptr, kExact,
+                     kOneLevel});
+    cases.push_back({"clahe-t8-c2", [](ImageProcessor& p) { p.applyCLAHE(8, 2.0, false); }, nullptr, kExact,
+                     kExact});
+    cases.push_back({"clahe-sliding-t4-c3", [](ImageProcessor& p) { p.applyCLAHE(4, 3.0, true); }, nullptr, kExact,
+                     kExact});
+    cases.push_back({"contrast-30-220", [](ImageProcessor& p) { p.applyLinearContrast(30, 220); },
+                     [](const PlanarImage& s, PlanarImage& d) { referenceLinearContrast(s, d, 30, 220); },
+                     kOneLevel, kExact});
+    return cases;
+}
+
+// Deterministic noise, the same on every machine.
+struct Noise {
+    unsigned state;
+    explicit Noise(unsigned seed) : state(seed) {}
+    int next() {
+        state = state * 1103515245u + 12345u;
+        return static_cast<int>((state >> 16) & 255);
+    }
+};
+
+// Images that stress the edges of the kernels: sizes that are not a multiple
+// of the row alignment or smaller than the windows, single rows and columns,
+// alternating extremes, isolated impulses, flat and saturated regions, and
+// an alpha plane that must pass through untouched.
+std::vector<Input> makeSyntheticInputs() {
+    std::vector<Input> inputs;
+    auto add = [&](const std::string& name, int width, int height, int channels,
+                   std::function<int(int c, int x, int y)> value) {
+        Input input;
+        input.name = "synthetic-" + name;
+        input.image.allocate(width, height, channels);
+        for (int c = 0; c < channels; ++c) {
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    input.image.row(c, y)[x] = static_cast<uint8_t>(std::max(0, std::min(255, value(c, x, y))));
+                }
+            }
+        }
+        input.goldenX = input.goldenY = 0;
+        input.goldenWidth = width;
+        input.goldenHeight = height;
+        inputs.push_back(std::move(input));
+    };
+
+    add("checker", 67, 45, 3, [](int, int x, int y) { return (x + y) % 2 ? 255 : 0; });
+    add("impulses", 64, 48, 3, [](int c, int x, int y) {
+        if ((x * 7 + y * 13) % 31 == 0) return 255;
+        if (y == 20 && c != 1) return 255;
+        return x == 40 ? 128 : 0;
+    });
+    add("ramp-alpha", 129, 33, 4, [](int c, int x, int y) {
+        return c == 3 ? (x * 2 + y) % 256 : c == 0 ? x * 2 : c == 1 ? y * 8 : 255 - x;
+    });
+    {
+        Noise noise(7);
+        add("noise", 96, 64, 3, [&noise](int, int, int) { return noise.next(); });
+    }
+    add("flat", 40, 30, 3, [](int, int, int) { return 128; });
+    add("saturated", 72, 40, 3, [](int c, int x, int y) {
+        int block = x / 12 + 6 * (y / 20);
+        static const int colors[12][3] = {{255, 0, 0}, {0, 255, 0}, {0, 0, 255}, {255, 255, 0}, {0, 255, 255},
+                                          {255, 0, 255}, {0, 0, 0}, {255, 255, 255}, {1, 0, 0}, {254, 255, 255},
+                                          {128, 128, 128}, {255, 128, 0}};
+        return colors[block % 12][c];
+    });
+    add("tiny", 3, 2, 3, [](int c, int x, int y) { return 40 * (x + 3 * y) + 10 * c; });
+    add("row", 50, 1, 3, [](int c, int x, int) { return (x * 5 + c * 60) % 256; });
+    add("column", 1, 50, 3, [](int c, int, int y) { return (y * 5 + c * 60) % 256; });
+    return inputs;
+}
+
+std::vector<Input> loadCorpus(const std::string& directory, std::string& error) {
+    std::vector<std::string> files;
+    if (DIR* dir = opendir(directory.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name[0] != '.' && isImageFileSupported(name)) files.push_back(name);
+        }
+        closedir(dir);
+    } else {
+        error = directory + ": cannot be listed";
+        return {};
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<Input> inputs;
+    for (const std::string& file : files) {
+        Input input;
+        input.name = file.substr(0, file.find_last_of('.'));
+        if (!readImageFile(directory + "/" + file, input.image) || input.image.getChannels() < 3) {
+            std::fprintf(stderr, "skipping %s: cannot be read as an RGB image\n", file.c_str());
+            continue;
+        }
+        setGoldenWindow(input);
+        inputs.push_back(std::move(input));
+    }
+    return inputs;
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+// A line of DIR/cases.txt: the case name and its golden limits. Cases are
+// listed in the order their outputs are stacked in the goldens.
+struct ManifestEntry {
+    std::string name;
+    Limits limits;
+};
+
+std::vector<ManifestEntry> readManifest(const std::string& path) {
+    std::vector<ManifestEntry> entries;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        ManifestEntry entry = {"", kExact};
+        std::string maxError, minPsnr, minSsim;
+        if (!(fields >> entry.name)) continue;
+        if (fields >> maxError >> minPsnr >> minSsim) {
+            // strtod, unlike a stream, reads "inf".
+            entry.limits = {std::atoi(maxError.c_str()), std::strtod(minPsnr.c_str(), nullptr),
+                            std::strtod(minSsim.c_str(), nullptr)};
+        }
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+bool writeManifest(const std::string& path, const std::vector<Case>& cases) {
+    std::ofstream file(path);
+    for (const Case& c : cases) {
+        file << c.name << " " << c.goldenLimits.maxError << " " << c.goldenLimits.minPsnr << " "
+             << c.goldenLimits.minSsim << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+// The width x height window at (x, y) of src, stored at row top of dst.
+void copyWindow(const PlanarImage& src, int x, int y, int width, int height, PlanarImage& dst, int top) {
+    for (int c = 0; c < src.getChannels(); ++c) {
+        for (int r = 0; r < height; ++r) std::memcpy(dst.row(c, top + r), src.row(c, y + r) + x, width);
+    }
+}
+
+std::string describe(const ImageDifference& d) {
+    char text[64];
+    if (std::isinf(d.psnr)) {
+        std::snprintf(text, sizeof(text), "%3d   inf dB %.4f", d.maxError, d.ssim);
+    } else {
+        std::snprintf(text, sizeof(text), "%3d %5.1f dB %.4f", d.maxError, d.psnr, d.ssim);
+    }
+    return text;
+}
+
+// Pipelines checked in pieces against a whole-image run, and stages the
+// parser must reject because their kernels would be wider than their halo.
+// Single stages run in bands, on a rectangle and streamed; chains streamed.
+const char* const kSplitPipelines[] = {"box:k=3,border=skip", "box:k=3,border=reflect",
+                                       "gaussian:k=3,s=0.8,border=skip", "gaussian:k=3,s=0.8,border=clamp",
+                                       "median:r=1,border=reflect",
+                                       "box:k=3|gaussian:k=3,s=0.8,border=clamp|equalize:luma|median:r=1"};
+const char* const kRejectedStages[] = {"box:k=1", "gaussian:k=1"};
+
+struct SplitOutcome {
+    bool ran;
+    bool hasPieces;
+    ImageDifference banded, region, stream;
+};
+
+// Runs a single stage in bands and on a rectangle reaching from the left
+// edge past the middle, against its whole-image result; false if a run fails.
+bool compareStagePieces(const PipelineStage& stage, const PlanarImage& image, const PlanarImage& whole,
+                        SplitOutcome& outcome) {
+    JobControl control;
+    PlanarImage pieces;
+    if (!runStageInBands(stage, image, pieces, control) || !compareImages(pieces, whole, outcome.banded)) {
+        return false;
+    }
+
+    ImageRegion rect(0, image.getHeight() / 5, image.getWidth() / 2 + 1, image.getHeight() / 2 + 3);
+    if (!clipRegion(rect, image.getWidth(), image.getHeight()) ||
+        !runStageInRegion(stage, image, rect, false, pieces, control)) {
+        return false;
+    }
+    PlanarImage expected(rect.width, rect.height, whole.getChannels());
+    copyWindow(whole, rect.x, rect.y, rect.width, rect.height, expected, 0);
+    return compareImages(pieces, expected, outcome.region);
+}
+
+// Streams the image file at input through pipeline with the smallest memory
+// limit that leaves room for a band, so that it runs in as many bands as it
+// can, and compares the result with whole.
+bool compareStreamed(const Pipeline& pipeline, const std::string& input, const std::string& output,
+                     const PlanarImage& whole, SplitOutcome& outcome) {
+    StreamOptions options;
+    std::string error;
+    for (options.memoryLimit = size_t(64) << 10; options.memoryLimit < (size_t(1) << 30);
+         options.memoryLimit += options.memoryLimit / 4) {
+        if (runPipelineStreaming(pipeline, input, output, options, error)) {
+            PlanarImage streamed;
+            return readImageFile(output, streamed) && compareImages(streamed, whole, outcome.stream);
+        }
+        if (error.find("memory limit too small") != 0) break;
+    }
+    std::fprintf(stderr, "%s\n", error.c_str());
+    return false;
+}
+
+// Edit sequences whose outcome is known exactly, beyond what one operation
+// shows. Prints each expectation that fails and returns how many did.
+int checkEditing() {
+    int failed = 0;
+    auto expect = [&failed](bool ok, const std::string& what) {
+        if (ok) return;
+        std::printf("editing: %s\n", what.c_str());
+        ++failed;
+    };
+    Noise noise(11);
+    auto noiseImage = [&noise](int width, int height) {
+        PlanarImage image(width, height, 3);
+        for (int c = 0; c < 3; ++c) {
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) image.row(c, y)[x] = static_cast<uint8_t>(noise.next());
+            }
+        }
+        return image;
+    };
+
+    // A loaded image, of the same size as the one before or another, made
+    // the original and then reset to.
+    for (auto size : {std::make_pair(100, 80), std::make_pair(300, 200)}) {
+        std::string name = std::to_string(size.first) + "x" + std::to_string(size.second);
+        ImageProcessor processor;
+        processor.setImage(noiseImage(100, 80));
+        processor.applyLowPassFilter(3);
+        PlanarImage loaded = noiseImage(size.first, size.second);
+        PlanarImage expected(loaded);
+        expect(processor.loadDecoded(loaded), name + " image not loaded");
+        processor.setOriginalFromFiltered();
+        ImageDifference d;
+        expect(compareImages(processor.getOriginal(), expected, d) && d.maxError == 0,
+               "loaded " + name + " image is not the original");
+        processor.applyLowPassFilter(3);
+        processor.resetToOriginal();
+        expect(compareImages(processor.getFiltered(), expected, d) && d.maxError == 0,
+               "reset does not return to the loaded " + name + " image");
+    }
+
+    // Opening never brightens a pixel and closing never darkens one, and
+    // neither changes its own result; even sizes are where the anchors of
+    // the two passes differ.
+    PlanarImage image = noiseImage(67, 45);
+    for (const MorphologyOp op : {MorphologyOp::Open, MorphologyOp::Close}) {
+        bool open = op == MorphologyOp::Open;
+        for (auto size : {std::make_pair(4, 2), std::make_pair(6, 6), std::make_pair(5, 3)}) {
+            std::string name = std::string(open ? "open-" : "close-") + std::to_string(size.first) + "x" +
+                               std::to_string(size.second);
+            PlanarImage once, twice;
+            morphology(image, once, op, size.first, size.second);
+            morphology(once, twice, op, size.first, size.second);
+            bool ordered = true;
+            for (int c = 0; c < 3; ++c) {
+                for (int y = 0; y < image.getHeight(); ++y) {
+                    for (int x = 0; x < image.getWidth(); ++x) {
+                        int before = image.row(c, y)[x], after = once.row(c, y)[x];
+                        ordered = ordered && (open ? after <= before : after >= before);
+                    }
+                }
+            }
+            ImageDifference d;
+            expect(ordered, name + (open ? " brightens" : " darkens") + " pixels");
+            expect(compareImages(twice, once, d) && d.maxError == 0, name + " is not idempotent");
+        }
+    }
+    return failed;
+}
+
+struct Outcome {
+    PlanarImage output;
+    bool hasReference, referenceOk;
+    ImageDifference reference;
+    bool hasGolden, goldenOk;
+    ImageDifference golden;
+};
+
+void usage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [--images DIR] [--golden DIR] [--cases NAME,...]\n"
+                 "          [--max-error N] [--min-psnr DB] [--min-ssim S] [--update]\n",
+                 program);
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string imageDir = std::string(LAB2_SOURCE_DIR) + "/image";
+    std::string goldenDir = std::string(LAB2_SOURCE_DIR) + "/golden";
+    std::vector<std::string> only;
+    Limits goldenLimits = kExact;
+    bool update = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--images" && hasValue) {
+            imageDir = argv[++i];
+        } else if (arg == "--golden" && hasValue) {
+            goldenDir = argv[++i];
+        } else if (arg == "--cases" && hasValue) {
+            only = split(argv[++i]);
+        } else if (arg == "--max-error" && hasValue) {
+            goldenLimits.maxError = std::atoi(argv[++i]);
+        } else if (arg == "--min-psnr" && hasValue) {
+            goldenLimits.minPsnr = std::atof(argv[++i]);
+        } else if (arg == "--min-ssim" && hasValue) {
+            goldenLimits.minSsim = std::atof(argv[++i]);
+        } else if (arg == "--update") {
+            update = true;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (update && !only.empty()) {
+        std::fprintf(stderr, "--update rewrites whole goldens and runs every case\n");
+        return 2;
+    }
+
+    std::vector<Case> cases;
+    for (Case& c : makeCases()) {
+        if (only.empty() || std::find(only.begin(), only.end(), c.name) != only.end()) cases.push_back(c);
+    }
+    if (cases.empty()) {
+        std::fprintf(stderr, "no such cases\n");
+        return 2;
+    }
+
+    std::string error;
+    std::vector<Input> inputs = loadCorpus(imageDir, error);
+    if (!error.empty()) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+    for (Input& input : makeSyntheticInputs()) inputs.push_back(std::move(input));
+
+    std::vector<ManifestEntry> manifest;
+    if (!update) manifest = readManifest(goldenDir + "/cases.txt");
+    std::vector<PlanarImage> goldens(inputs.size());
+    if (!update) {
+        for (size_t i = 0; i < inputs.size(); ++i) readImageFile(goldenDir + "/" + inputs[i].name + ".rle", goldens[i]);
+    }
+
+    // Every (input, case) pair is independent; the pool runs them side by
+    // side and the kernels inside run inline.
+    std::vector<Outcome> outcomes(inputs.size() * cases.size());
+    parallelFor(0, static_cast<int>(outcomes.size()), 1, [&](int t0, int t1) {
+        for (int t = t0; t < t1; ++t) {
+            const Input& input = inputs[t / cases.size()];
+            const Case& c = cases[t % cases.size()];
+            const PlanarImage& golden = goldens[t / cases.size()];
+            Outcome& outcome = outcomes[t];
+
+            ImageProcessor processor;
+            processor.setImage(PlanarImage(input.image));
+            c.run(processor);
+            outcome.output = processor.getFiltered();
+
+            outcome.hasReference = static_cast<bool>(c.reference);
+            outcome.referenceOk = true;
+            if (outcome.hasReference) {
+                PlanarImage expected;
+                c.reference(input.image, expected);
+                outcome.referenceOk = compareImages(outcome.output, expected, outcome.reference) &&
+                                      c.limits.accept(outcome.reference);
+            }
+
+            auto found = std::find_if(manifest.begin(), manifest.end(),
+                                      [&c](const ManifestEntry& entry) { return entry.name == c.name; });
+            int index = static_cast<int>(found - manifest.begin());
+            outcome.hasGolden = found != manifest.end() && golden.getWidth() == input.goldenWidth &&
+                                golden.getHeight() == input.goldenHeight * static_cast<int>(manifest.size()) &&
+                                golden.getChannels() == outcome.output.getChannels();
+            outcome.goldenOk = true;
+            if (outcome.hasGolden) {
+                PlanarImage actual(input.goldenWidth, input.goldenHeight, golden.getChannels());
+                PlanarImage expected(input.goldenWidth, input.goldenHeight, golden.getChannels());
+                copyWindow(outcome.output, input.goldenX, input.goldenY, input.goldenWidth, input.goldenHeight,
+                           actual, 0);
+                copyWindow(golden, 0, index * input.goldenHeight, input.goldenWidth, input.goldenHeight,
+                           expected, 0);
+                outcome.goldenOk = compareImages(actual, expected, outcome.golden) &&
+                                   looser(found->limits, goldenLimits).accept(outcome.golden);
+            }
+        }
+    });
+
+    std::printf("%-22s %-22s %-22s %-22s %s\n", "input", "case", "vs reference", "vs golden", "");
+    int failures = 0;
+    int missing = 0;
+    for (size_t t = 0; t < outcomes.size(); ++t) {
+        const Outcome& outcome = outcomes[t];
+        bool matched = outcome.referenceOk && outcome.goldenOk;
+        // Without its golden a case proves nothing; only --update may lack one.
+        bool unchecked = !outcome.hasGolden && !update;
+        bool ok = matched && !unchecked;
+        if (!ok) ++failures;
+        if (unchecked) ++missing;
+        std::printf("%-22s %-22s %-22s %-22s %s\n", inputs[t / cases.size()].name.c_str(),
+                    cases[t % cases.size()].name.c_str(),
+                    outcome.hasReference ? describe(outcome.reference).c_str() : "-",
+                    outcome.hasGolden ? describe(outcome.golden).c_str() : "-",
+                    ok ? "" : matched ? "NO GOLDEN" : "FAIL");
+    }
+
+    if (update && failures > 0) {
+        std::fprintf(stderr, "goldens not written: outputs differ from their references\n");
+    } else if (update) {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            const Input& input = inputs[i];
+            int height = input.goldenHeight;
+            PlanarImage stacked(input.goldenWidth, height * static_cast<int>(cases.size()),
+                                outcomes[i * cases.size()].output.getChannels());
+            for (size_t k = 0; k < cases.size(); ++k) {
+                copyWindow(outcomes[i * cases.size() + k].output, input.goldenX, input.goldenY, input.goldenWidth,
+                           height, stacked, static_cast<int>(k) * height);
+            }
+            std::string path = goldenDir + "/" + inputs[i].name + ".rle";
+            if (!writeImageFile(path, stacked)) {
+                std::fprintf(stderr, "cannot write %s\n", path.c_str());
+                return 2;
+            }
+        }
+        if (!writeManifest(goldenDir + "/cases.txt", cases)) {
+            std::fprintf(stderr, "cannot write %s/cases.txt\n", goldenDir.c_str());
+            return 2;
+        }
+        std::printf("wrote goldens for %zu inputs x %zu cases to %s\n", inputs.size(), cases.size(),
+                    goldenDir.c_str());
+    }
+
+    int splitFailures = 0;
+    size_t splitCount = 0;
+    if (only.empty()) {
+        for (const char* spec : kRejectedStages) {
+            Pipeline pipeline;
+            if (pipeline.parse(spec, error)) {
+                std::printf("%s: accepted by the parser\n", spec);
+                ++splitFailures;
+            }
+        }
+
+        std::vector<Pipeline> pipelines(sizeof(kSplitPipelines) / sizeof(kSplitPipelines[0]));
+        for (size_t k = 0; k < pipelines.size(); ++k) {
+            if (!pipelines[k].parse(kSplitPipelines[k], error)) {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return 2;
+            }
+        }
+        const char* tmp = std::getenv("TMPDIR");
+        std::string prefix = std::string(tmp && *tmp ? tmp : "/tmp") + "/lab2-quality-" + std::to_string(getpid());
+        std::string streamInput = prefix + "-in.rle";
+        std::string streamOutput = prefix + "-out.rle";
+
+        // One input at a time: streaming runs use the whole pool and set its limits.
+        std::vector<SplitOutcome> splits(inputs.size() * pipelines.size());
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            const PlanarImage& image = inputs[i].image;
+            bool written = writeImageFile(streamInput, image);
+            for (size_t k = 0; k < pipelines.size(); ++k) {
+                SplitOutcome& split = splits[i * pipelines.size() + k];
+                PlanarImage whole(image);
+                pipelines[k].run(whole);
+                split.hasPieces = pipelines[k].size() == 1;
+                split.ran = written && compareStreamed(pipelines[k], streamInput, streamOutput, whole, split) &&
+                            (!split.hasPieces || compareStagePieces(pipelines[k].stage(0), image, whole, split));
+            }
+        }
+        std::remove(streamInput.c_str());
+        std::remove(streamOutput.c_str());
+
+        std::printf("\n%-22s %-22s %-22s %-22s %s\n", "input", "banded vs whole", "region vs whole",
+                    "stream vs whole", "pipeline");
+        for (size_t t = 0; t < splits.size(); ++t) {
+            const SplitOutcome& split = splits[t];
+            bool pieces = split.ran && split.hasPieces;
+            bool ok = split.ran && split.stream.maxError == 0 &&
+                      (!split.hasPieces || (split.banded.maxError == 0 && split.region.maxError == 0));
+            if (!ok) ++splitFailures;
+            std::printf("%-22s %-22s %-22s %-22s %s%s\n", inputs[t / pipelines.size()].name.c_str(),
+                        pieces ? describe(split.banded).c_str() : "-", pieces ? describe(split.region).c_str() : "-",
+                        split.ran ? describe(split.stream).c_str() : "-", kSplitPipelines[t % pipelines.size()],
+                        ok ? "" : "  FAIL");
+        }
+        splitCount = splits.size();
+    }
+
+    int editFailures = only.empty() ? checkEditing() : 0;
+
+    std::printf("%zu comparisons, %d failed (%d without a golden)\n", outcomes.size(), failures, missing);
+    if (splitCount > 0) std::printf("%zu split runs, %d failed\n", splitCount, splitFailures);
+    if (only.empty()) std::printf("editing checks: %d failed\n", editFailures);
+    return failures + splitFailures + editFailures > 0 ? 1 : 0;
+}
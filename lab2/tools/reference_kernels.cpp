@@ -0,0 +1,346 @@
+#include "reference_kernels.h"
+#include "histogram.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+void copyExtraPlanes(const PlanarImage& src, PlanarImage& dst) {
+    for (int c = 3; c < src.getChannels(); ++c) {
+        std::memcpy(dst.plane(c), src.plane(c), static_cast<size_t>(src.getStride()) * src.getHeight());
+    }
+}
+
+// Skip mode leaves pixels whose window crosses the edge as they were.
+bool inFrame(int x, int y, int width, int height, int radius) {
+    return x < radius || x >= width - radius || y < radius || y >= height - radius;
+}
+
+// Runs value(channel, x, y) for every RGB sample that a square filter of the
+// given radius computes under the border mode; the rest are copied.
+template <typename Value>
+void squareFilter(const PlanarImage& src, PlanarImage& dst, int radius, BorderMode border, Value value) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    dst.allocate(width, height, src.getChannels());
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                bool skip = border == BorderMode::Skip && inFrame(x, y, width, height, radius);
+                dst.row(c, y)[x] = skip ? src.row(c, y)[x] : value(c, x, y);
+            }
+        }
+    }
+    copyExtraPlanes(src, dst);
+}
+
+// Pixel of a square window under the border mode; Skip reads as Clamp (its
+// frame is not computed at all).
+uint8_t windowPixel(const PlanarImage& src, int c, int x, int y, BorderMode border) {
+    BorderMode edge = border == BorderMode::Skip ? BorderMode::Clamp : border;
+    return src.row(c, borderIndex(y, src.getHeight(), edge))[borderIndex(x, src.getWidth(), edge)];
+}
+
+// Erosion or dilation with the rectangle anchored at (w / 2, h / 2), or with
+// reflected at (w - 1 - w / 2, h - 1 - h / 2).
+void morphPlane(const PlanarImage& src, int srcChannel, PlanarImage& dst, int dstChannel, bool erode,
+                int kernelWidth, int kernelHeight, bool reflected) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    int anchorX = reflected ? kernelWidth - 1 - kernelWidth / 2 : kernelWidth / 2;
+    int anchorY = reflected ? kernelHeight - 1 - kernelHeight / 2 : kernelHeight / 2;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int best = erode ? 255 : 0;
+            for (int wy = y - anchorY; wy < y - anchorY + kernelHeight; ++wy) {
+                for (int wx = x - anchorX; wx < x - anchorX + kernelWidth; ++wx) {
+                    // Pixels outside the image never win.
+                    if (wx < 0 || wx >= width || wy < 0 || wy >= height) continue;
+                    int v = src.row(srcChannel, wy)[wx];
+                    best = erode ? std::min(best, v) : std::max(best, v);
+                }
+            }
+            dst.row(dstChannel, y)[x] = static_cast<uint8_t>(best);
+        }
+    }
+}
+
+// Erosion or dilation, or both in order, of one plane into another.
+void morphOp(const PlanarImage& src, int srcChannel, PlanarImage& dst, int dstChannel, MorphologyOp op,
+             int kernelWidth, int kernelHeight) {
+    if (op == MorphologyOp::Erode || op == MorphologyOp::Dilate) {
+        morphPlane(src, srcChannel, dst, dstChannel, op == MorphologyOp::Erode, kernelWidth, kernelHeight, false);
+        return;
+    }
+    // The second pass uses the reflected rectangle.
+    PlanarImage first(src.getWidth(), src.getHeight(), 1);
+    morphPlane(src, srcChannel, first, 0, op == MorphologyOp::Open, kernelWidth, kernelHeight, false);
+    morphPlane(first, 0, dst, dstChannel, op != MorphologyOp::Open, kernelWidth, kernelHeight, true);
+}
+
+std::vector<int> channelHistogram(const PlanarImage& image, int c) {
+    std::vector<int> histogram(256, 0);
+    for (int y = 0; y < image.getHeight(); ++y) {
+        for (int x = 0; x < image.getWidth(); ++x) histogram[image.row(c, y)[x]]++;
+    }
+    return histogram;
+}
+
+std::vector<int> lumaHistogram(const PlanarImage& image) {
+    std::vector<int> histogram(256, 0);
+    for (int y = 0; y < image.getHeight(); ++y) {
+        for (int x = 0; x < image.getWidth(); ++x) {
+            histogram[lumaOf(image.row(0, y)[x], image.row(1, y)[x], image.row(2, y)[x])]++;
+        }
+    }
+    return histogram;
+}
+
+// CDF rescaled so the first occupied level maps to 0 and the last to 255.
+std::vector<int> equalizationCurve(const std::vector<int>& histogram) {
+    std::vector<int> cdf(256);
+    int total = 0;
+    for (int i = 0; i < 256; ++i) {
+        total += histogram[i];
+        cdf[i] = total;
+    }
+    int cdfMin = total;
+    for (int i = 0; i < 256; ++i) {
+        if (histogram[i] != 0) cdfMin = std::min(cdfMin, cdf[i]);
+    }
+    std::vector<int> curve(256, 0);
+    for (int i = 0; i < 256; ++i) {
+        if (cdf[i] > cdfMin) {
+            float equalized = (cdf[i] - cdfMin) / static_cast<float>(total - cdfMin);
+            curve[i] = static_cast<int>(equalized * 255);
+        }
+    }
+    return curve;
+}
+
+// Multiplies every RGB sample by the gain of its pixel's luma.
+void applyLumaGain(const PlanarImage& src, PlanarImage& dst, const std::vector<float>& gain) {
+    dst.copyFrom(src);
+    for (int y = 0; y < src.getHeight(); ++y) {
+        for (int x = 0; x < src.getWidth(); ++x) {
+            float g = gain[lumaOf(src.row(0, y)[x], src.row(1, y)[x], src.row(2, y)[x])];
+            for (int c = 0; c < 3; ++c) {
+                dst.row(c, y)[x] = static_cast<uint8_t>(std::min(255, static_cast<int>(src.row(c, y)[x] * g)));
+            }
+        }
+    }
+}
+
+}
+
+void referenceBoxFilter(const PlanarImage& src, PlanarImage& dst, int kernelSize, BorderMode border) {
+    if (kernelSize % 2 == 0 || kernelSize < 3) kernelSize = 3;
+    int radius = kernelSize / 2;
+    squareFilter(src, dst, radius, border, [&](int c, int x, int y) {
+        int sum = 0;
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) sum += windowPixel(src, c, x + dx, y + dy, border);
+        }
+        return static_cast<uint8_t>(sum / (kernelSize * kernelSize));
+    });
+}
+
+void referenceGaussianFilter(const PlanarImage& src, PlanarImage& dst, int kernelSize, double sigma,
+                             BorderMode border) {
+    if (kernelSize % 2 == 0 || kernelSize < 3) kernelSize = 3;
+    int radius = kernelSize / 2;
+
+    std::vector<double> kernel(kernelSize * kernelSize);
+    double total = 0;
+    for (int i = -radius; i <= radius; ++i) {
+        for (int j = -radius; j <= radius; ++j) {
+            double value = std::exp(-(i * i + j * j) / (2 * sigma * sigma));
+            kernel[(i + radius) * kernelSize + j + radius] = value;
+            total += value;
+        }
+    }
+    for (double& value : kernel) value /= total;
+
+    squareFilter(src, dst, radius, border, [&](int c, int x, int y) {
+        double sum = 0;
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) {
+                sum += windowPixel(src, c, x + dx, y + dy, border) * kernel[(dy + radius) * kernelSize + dx + radius];
+            }
+        }
+        return static_cast<uint8_t>(std::max(0.0, std::min(255.0, sum)));
+    });
+}
+
+void referenceMedianFilter(const PlanarImage& src, PlanarImage& dst, int radius, BorderMode border) {
+    radius = std::max(1, std::min(50, radius));
+    std::vector<uint8_t> window;
+    squareFilter(src, dst, radius, border, [&](int c, int x, int y) {
+        window.clear();
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) window.push_back(windowPixel(src, c, x + dx, y + dy, border));
+        }
+        std::nth_element(window.begin(), window.begin() + window.size() / 2, window.end());
+        return window[window.size() / 2];
+    });
+}
+
+void referenceMorphology(const PlanarImage& src, PlanarImage& dst, MorphologyOp op, int kernelWidth,
+                         int kernelHeight, bool binary) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    kernelWidth = std::max(1, kernelWidth);
+    kernelHeight = std::max(1, kernelHeight);
+    dst.allocate(width, height, src.getChannels());
+
+    if (binary) {
+        PlanarImage mask(width, height, 1);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int luma = lumaOf(src.row(0, y)[x], src.row(1, y)[x], src.row(2, y)[x]);
+                mask.row(0, y)[x] = luma >= 128 ? 255 : 0;
+            }
+        }
+        for (int c = 0; c < 3; ++c) morphOp(mask, 0, dst, c, op, kernelWidth, kernelHeight);
+    } else {
+        for (int c = 0; c < 3; ++c) morphOp(src, c, dst, c, op, kernelWidth, kernelHeight);
+    }
+    copyExtraPlanes(src, dst);
+}
+
+void referenceCannyEdges(const PlanarImage& src, PlanarImage& dst, int lowThreshold, int highThreshold) {
+    int width = src.getWidth();
+    int height = src.getHeight();
+    if (lowThreshold > highThreshold) std::swap(lowThreshold, highThreshold);
+
+    auto clampX = [&](int x) { return std::max(0, std::min(width - 1, x)); };
+    auto clampY = [&](int y) { return std::max(0, std::min(height - 1, y)); };
+    auto gray = [&](int x, int y) {
+        x = clampX(x);
+        y = clampY(y);
+        return lumaOf(src.row(0, y)[x], src.row(1, y)[x], src.row(2, y)[x]);
+    };
+
+    // 5x5 binomial blur of the edge-replicated gray image, rounded once at
+    // the end. Rows are evaluated wherever asked, columns only inside and
+    // replicated beyond the edge.
+    const int weights[5] = {1, 4, 6, 4, 1};
+    auto blurred = [&](int x, int y) {
+        x = clampX(x);
+        int sum = 0;
+        for (int i = 0; i < 5; ++i) {
+            int column = 0;
+            for (int j = 0; j < 5; ++j) column += weights[j] * gray(x + i - 2, y + j - 2);
+            sum += weights[i] * column;
+        }
+        return (sum + 128) >> 8;
+    };
+
+    // Sobel |gx| + |gy| and its direction on rows -1..height; columns outside
+    // have magnitude 0.
+    int rows = height + 2;
+    std::vector<int> magnitude(static_cast<size_t>(rows) * width);
+    std::vector<int> direction(magnitude.size());
+    for (int y = -1; y <= height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int gx = (blurred(x + 1, y - 1) - blurred(x - 1, y - 1)) + 2 * (blurred(x + 1, y) - blurred(x - 1, y)) +
+                     (blurred(x + 1, y + 1) - blurred(x - 1, y + 1));
+            int gy = (blurred(x - 1, y + 1) + 2 * blurred(x, y + 1) + blurred(x + 1, y + 1)) -
+                     (blurred(x - 1, y - 1) + 2 * blurred(x, y - 1) + blurred(x + 1, y - 1));
+            size_t i = static_cast<size_t>(y + 1) * width + x;
+            int ax = std::abs(gx);
+            int ay = std::abs(gy);
+            magnitude[i] = ax + ay;
+            // 0 = horizontal gradient, 2 = vertical, 1 and 3 the diagonals,
+            // split at tan(22.5) and tan(67.5) in the same integer form as
+            // the fast version so ties fall on the same side.
+            direction[i] = ay * 1024 < ax * 424 ? 0 : ay * 1024 > ax * 2472 ? 2 : (gx ^ gy) >= 0 ? 1 : 3;
+        }
+    }
+    auto mag = [&](int x, int y) {
+        return x < 0 || x >= width ? 0 : magnitude[static_cast<size_t>(y + 1) * width + x];
+    };
+
+    // Non-maximum suppression, then hysteresis by flooding from strong pixels
+    // through 8-connected candidates.
+    std::vector<uint8_t> state(static_cast<size_t>(width) * height, 0); // 0 none, 1 weak, 2 strong
+    std::vector<int> stack;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int m = mag(x, y);
+            int d = direction[static_cast<size_t>(y + 1) * width + x];
+            int n1 = d == 0 ? mag(x - 1, y) : d == 1 ? mag(x - 1, y - 1) : d == 2 ? mag(x, y - 1) : mag(x + 1, y - 1);
+            int n2 = d == 0 ? mag(x + 1, y) : d == 1 ? mag(x + 1, y + 1) : d == 2 ? mag(x, y + 1) : mag(x - 1, y + 1);
+            if (m > lowThreshold && m > n1 && m >= n2) {
+                state[y * width + x] = m > highThreshold ? 2 : 1;
+                if (m > highThreshold) stack.push_back(y * width + x);
+            }
+        }
+    }
+    std::vector<uint8_t> edge(state.size(), 0);
+    for (int p : stack) edge[p] = 255;
+    while (!stack.empty()) {
+        int p = stack.back();
+        stack.pop_back();
+        int x = p % width;
+        int y = p / width;
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                int nx = x + dx;
+                int ny = y + dy;
+                if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                int q = ny * width + nx;
+                if (state[q] != 0 && edge[q] == 0) {
+                    edge[q] = 255;
+                    stack.push_back(q);
+                }
+            }
+        }
+    }
+
+    dst.allocate(width, height, src.getChannels());
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < height; ++y) std::memcpy(dst.row(c, y), &edge[static_cast<size_t>(y) * width], width);
+    }
+    copyExtraPlanes(src, dst);
+}
+
+void referenceEqualizeRgb(const PlanarImage& src, PlanarImage& dst) {
+    dst.copyFrom(src);
+    for (int c = 0; c < 3; ++c) {
+        std::vector<int> curve = equalizationCurve(channelHistogram(src, c));
+        for (int y = 0; y < src.getHeight(); ++y) {
+            for (int x = 0; x < src.getWidth(); ++x) dst.row(c, y)[x] = static_cast<uint8_t>(curve[src.row(c, y)[x]]);
+        }
+    }
+}
+
+void referenceEqualizeLuma(const PlanarImage& src, PlanarImage& dst) {
+    std::vector<int> curve = equalizationCurve(lumaHistogram(src));
+    std::vector<float> gain(256, 0.0f);
+    for (int y = 1; y < 256; ++y) gain[y] = static_cast<float>(curve[y]) / y;
+    applyLumaGain(src, dst, gain);
+}
+
+void referenceLinearContrast(const PlanarImage& src, PlanarImage& dst, int minOut, int maxOut) {
+    std::vector<int> histogram = lumaHistogram(src);
+    int low = 0;
+    while (low < 255 && histogram[low] == 0) ++low;
+    int high = 255;
+    while (high > 0 && histogram[high] == 0) --high;
+    if (high <= low) {
+        dst.copyFrom(src);
+        return;
+    }
+
+    std::vector<float> gain(256, 1.0f);
+    for (int y = 1; y < 256; ++y) {
+        float normalized = static_cast<float>(y - low) / (high - low);
+        int level = std::max(0, std::min(255, static_cast<int>(minOut + normalized * (maxOut - minOut))));
+        gain[y] = static_cast<float>(level) / y;
+    }
+    applyLumaGain(src, dst, gain);
+}
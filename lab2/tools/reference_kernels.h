@@ -0,0 +1,28 @@
+#ifndef REFERENCE_KERNELS_H
+#define REFERENCE_KERNELS_H
+
+#include "filters.h"
+#include "morphology.h"
+#include "planar_image.h"
+
+// Straightforward per-pixel versions of the optimized kernels, written for
+// obviousness rather than speed: every output pixel reads its whole window
+// through borderIndex, with no padding, rings, histograms or SIMD. They
+// follow the documented behaviour of the fast versions (border modes,
+// rounding, which planes are touched), so exact kernels must match them
+// bit for bit. Channels beyond RGB are copied.
+void referenceBoxFilter(const PlanarImage& src, PlanarImage& dst, int kernelSize, BorderMode border);
+void referenceGaussianFilter(const PlanarImage& src, PlanarImage& dst, int kernelSize, double sigma,
+                             BorderMode border);
+void referenceMedianFilter(const PlanarImage& src, PlanarImage& dst, int radius, BorderMode border);
+void referenceMorphology(const PlanarImage& src, PlanarImage& dst, MorphologyOp op, int kernelWidth,
+                         int kernelHeight, bool binary);
+void referenceCannyEdges(const PlanarImage& src, PlanarImage& dst, int lowThreshold, int highThreshold);
+
+// Tone operations with float gains, as the original per-pixel loops did;
+// the LUT versions round through Q16 and may differ by one level.
+void referenceEqualizeRgb(const PlanarImage& src, PlanarImage& dst);
+void referenceEqualizeLuma(const PlanarImage& src, PlanarImage& dst);
+void referenceLinearContrast(const PlanarImage& src, PlanarImage& dst, int minOut, int maxOut);
+
+#endif // REFERENCE_KERNELS_H